@@ -0,0 +1,480 @@
+// Benchmark harness: generates a deterministic tree, runs the explorer's
+// engines on it non-interactively and compares the results with a stored
+// baseline. Each measured run happens in a forked child so its peak RSS and
+// CPU time are its own.
+
+#include "tree_gen.h"
+#include "tree_walker.h"
+#include "dir_listing.h"
+#include "sort_keys.h"
+#include "name_matcher.h"
+#include "content_search.h"
+#include "disk_usage.h"
+#include "copy_engine.h"
+#include "delete_engine.h"
+#include "output_buffer.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace {
+
+// A run slower than its baseline by less than this is noise, whatever the
+// percentage says.
+const double kNoiseFloor = 0.005;
+
+struct Sample {
+    double seconds = 0;
+    double cpu_seconds = 0;
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+    int64_t syscalls = -1;      // -1 when the kernel tracepoint is not available
+    uint64_t io_syscalls = 0;   // read- and write-type calls, from /proc/self/io
+    long peak_rss_kb = 0;
+};
+
+struct Bench {
+    const char* name;
+    std::function<void(const std::string& root)> setup;     // not measured
+    std::function<void(const std::string& root, Sample& sample)> run;
+};
+
+bool exists(const std::string& path) {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0;
+}
+
+void remove_tree(const std::string& path) {
+    if(exists(path)) {
+        DeleteEngine::Options options;
+        options.progress = false;
+        DeleteEngine(options).remove(path);
+    }
+}
+
+CopyEngine::Result copy_tree(const std::string& source, const std::string& target) {
+    CopyEngine::Options options;
+    options.recursive = true;
+    options.progress = false;
+    return CopyEngine(options).copy(source, target);
+}
+
+// Counts every syscall entry of this process and the threads it starts,
+// through the raw_syscalls:sys_enter tracepoint. Needs tracefs and a
+// perf_event_paranoid setting that allows it; returns -1 otherwise.
+int open_syscall_counter() {
+    const char* id_paths[] = {"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                              "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"};
+    for(const char* id_path : id_paths) {
+        std::ifstream in(id_path);
+        uint64_t id;
+        if(!(in >> id)) {
+            continue;
+        }
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.config = id;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+        if(fd >= 0) {
+            return fd;
+        }
+    }
+    return -1;
+}
+
+uint64_t io_syscalls() {
+    std::ifstream in("/proc/self/io");
+    std::string key;
+    uint64_t value;
+    uint64_t total = 0;
+    while(in >> key >> value) {
+        if(key == "syscr:" || key == "syscw:") {
+            total += value;
+        }
+    }
+    return total;
+}
+
+// Runs one measurement in a child process.
+bool measure(const Bench& bench, const std::string& root, Sample& sample) {
+    bench.setup(root);
+    int fds[2];
+    if(pipe(fds) != 0) {
+        return false;
+    }
+    pid_t pid = fork();
+    if(pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if(pid == 0) {
+        close(fds[0]);
+        Sample child;
+        int counter = open_syscall_counter();
+        // Reading /proc/self/io is itself counted; measure that and take it off.
+        uint64_t io_probe = io_syscalls();
+        uint64_t io_before = io_syscalls();
+        uint64_t io_overhead = io_before - io_probe;
+        if(counter >= 0) {
+            ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        auto start = std::chrono::steady_clock::now();
+        bench.run(root, child);
+        child.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(counter >= 0) {
+            ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t count = 0;
+            if(read(counter, &count, sizeof(count)) == sizeof(count)) {
+                child.syscalls = static_cast<int64_t>(count);
+            }
+        }
+        child.io_syscalls = io_syscalls() - io_before - io_overhead;
+        ssize_t n = write(fds[1], &child, sizeof(child));
+        _exit(n == sizeof(child) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t n = read(fds[0], &sample, sizeof(sample));
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage;
+    if(wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+       n != sizeof(sample)) {
+        return false;
+    }
+    sample.cpu_seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                         usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    sample.peak_rss_kb = usage.ru_maxrss;
+    return true;
+}
+
+std::vector<Bench> make_benches() {
+    auto nothing = [](const std::string&) {};
+    auto list_flat = [](const std::string& root, Sample& sample, bool with_meta) {
+        int dirfd = DirReader::open_dir((root + "/flat").c_str());
+        if(dirfd < 0) {
+            return;
+        }
+        DirReader reader(dirfd);
+        DirReader::Entry raw;
+        DirListing listing;
+        while(reader.next(raw)) {
+            listing.records.push_back(listing.make_record(dirfd, raw, with_meta));
+        }
+        sort_listing(listing, SortSpec());
+        sample.entries = listing.records.size();
+    };
+
+    std::vector<Bench> benches;
+    benches.push_back({"list_flat", nothing, [=](const std::string& root, Sample& sample) {
+        list_flat(root, sample, false);
+    }});
+    benches.push_back({"list_flat_detailed", nothing, [=](const std::string& root, Sample& sample) {
+        list_flat(root, sample, true);
+    }});
+    benches.push_back({"walk_tree", nothing, [](const std::string& root, Sample& sample) {
+        std::atomic<uint64_t> entries(0);
+        TreeWalker walker;
+        walker.on_entry([&](const WalkEntry&) {
+            ++entries;
+            return true;
+        });
+        walker.walk(root);
+        sample.entries = entries;
+    }});
+    benches.push_back({"name_search", nothing, [](const std::string& root, Sample& sample) {
+        NameMatcher matcher;
+        std::string error;
+        matcher.parse("*.cpp", error);
+        std::atomic<uint64_t> entries(0);
+        std::atomic<uint64_t> matched(0);
+        TreeWalker walker;
+        walker.on_entry([&](const WalkEntry& entry) {
+            ++entries;
+            if(matcher.matches(std::string_view(entry.name, entry.name_len))) {
+                ++matched;
+            }
+            return true;
+        });
+        walker.walk(root + "/tree");
+        sample.entries = entries;
+    }});
+    benches.push_back({"content_search", nothing, [](const std::string& root, Sample& sample) {
+        ContentSearch::Options options;
+        options.needle = kNeedle;
+        ContentSearch search(options);
+        ContentSearch::Result result = search.run(root + "/tree", [](const std::string&,
+                                                                     const std::vector<ContentSearch::LineMatch>&) {});
+        sample.entries = result.files_scanned;
+        sample.bytes = result.bytes_scanned;
+    }});
+    benches.push_back({"disk_usage", nothing, [](const std::string& root, Sample& sample) {
+        DiskUsage usage;
+        for(const auto& totals : usage.measure(root, {"tree", "flat"})) {
+            sample.entries += totals.files + totals.directories;
+            sample.bytes += totals.allocated;
+        }
+    }});
+    benches.push_back({"copy_tree", [](const std::string& root) {
+        remove_tree(root + "/copy");
+    }, [](const std::string& root, Sample& sample) {
+        CopyEngine::Result result = copy_tree(root + "/tree", root + "/copy");
+        sample.entries = result.files + result.directories;
+        sample.bytes = result.bytes;
+    }});
+    benches.push_back({"delete_tree", [](const std::string& root) {
+        if(!exists(root + "/copy")) {
+            copy_tree(root + "/tree", root + "/copy");
+        }
+    }, [](const std::string& root, Sample& sample) {
+        DeleteEngine::Options options;
+        options.progress = false;
+        DeleteEngine::Result result = DeleteEngine(options).remove(root + "/copy");
+        sample.entries = result.files + result.directories;
+    }});
+    return benches;
+}
+
+// Reads the "name" and "seconds" of each benchmark line written by
+// write_json; the baseline is always one this program wrote.
+std::map<std::string, double> read_baseline(const std::string& path, bool& found) {
+    std::map<std::string, double> baseline;
+    std::ifstream in(path);
+    found = static_cast<bool>(in);
+    std::string line;
+    while(std::getline(in, line)) {
+        size_t name_at = line.find("\"name\": \"");
+        size_t seconds_at = line.find("\"seconds\": ");
+        if(name_at == std::string::npos || seconds_at == std::string::npos) {
+            continue;
+        }
+        name_at += 9;
+        size_t name_end = line.find('"', name_at);
+        baseline[line.substr(name_at, name_end - name_at)] = std::strtod(line.c_str() + seconds_at + 11, nullptr);
+    }
+    return baseline;
+}
+
+bool write_json(const std::string& path, const std::string& tree, const std::vector<std::pair<std::string, Sample>>& results) {
+    std::ofstream out(path);
+    out << "{\n  \"tree\": \"" << tree << "\",\n  \"benchmarks\": [\n";
+    for(size_t i = 0; i < results.size(); ++i) {
+        const Sample& s = results[i].second;
+        char line[512];
+        snprintf(line, sizeof(line),
+                 "    {\"name\": \"%s\", \"seconds\": %.6f, \"cpu_seconds\": %.6f, \"entries\": %llu, "
+                 "\"entries_per_sec\": %.0f, \"bytes\": %llu, \"syscalls\": %s, \"io_syscalls\": %llu, "
+                 "\"peak_rss_kb\": %ld}%s\n",
+                 results[i].first.c_str(), s.seconds, s.cpu_seconds, (unsigned long long)s.entries,
+                 s.seconds > 0 ? s.entries / s.seconds : 0.0, (unsigned long long)s.bytes,
+                 s.syscalls < 0 ? "null" : std::to_string(s.syscalls).c_str(),
+                 (unsigned long long)s.io_syscalls, s.peak_rss_kb, i + 1 < results.size() ? "," : "");
+        out << line;
+    }
+    out << "  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " generate ROOT [--depth N] [--fanout N] [--files N] [--max-file SIZE]" << std::endl;
+    std::cerr << "                 [--flat N] [--seed N]" << std::endl;
+    std::cerr << "       " << program << " run ROOT [--runs N] [--only NAME] [--baseline FILE] [--threshold PCT]" << std::endl;
+    std::cerr << "                 [--output FILE]" << std::endl;
+    std::cerr << "  generate  build ROOT/tree and ROOT/flat (kept if already built with the same options)" << std::endl;
+    std::cerr << "  run       time each benchmark (median of --runs after a warm-up, default 5) and compare with the baseline;" << std::endl;
+    std::cerr << "            exits 1 if any is more than --threshold percent (default 20) slower" << std::endl;
+}
+
+int generate(const std::string& root, int argc, char* argv[]) {
+    TreeSpec spec;
+    for(int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return 2;
+        }
+        std::string value = argv[++i];
+        try {
+            if(arg == "--depth") {
+                spec.depth = std::stoul(value);
+            } else if(arg == "--fanout") {
+                spec.fanout = std::stoul(value);
+            } else if(arg == "--files") {
+                spec.files_per_dir = std::stoul(value);
+            } else if(arg == "--max-file") {
+                if(!parse_size(value, spec.max_file)) {
+                    throw std::invalid_argument(value);
+                }
+            } else if(arg == "--flat") {
+                spec.flat_entries = std::stoul(value);
+            } else if(arg == "--seed") {
+                spec.seed = std::stoull(value);
+            } else {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                return 2;
+            }
+        } catch(const std::exception& ex) {
+            std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+            return 2;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    TreeStats stats;
+    bool reused = false;
+    std::string error;
+    if(!generate_tree(root, spec, stats, reused, error)) {
+        std::cerr << "Generate error: " << error << std::endl;
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << (reused ? "Reusing " : "Generated ") << root << ": " << stats.files << " files, "
+              << stats.directories << " directories, " << stats.bytes << " bytes";
+    if(!reused) {
+        std::cout << " in " << std::fixed << std::setprecision(2) << seconds << "s";
+    }
+    std::cout << std::endl;
+    return 0;
+}
+
+int run(const std::string& root, int argc, char* argv[]) {
+    unsigned runs = 5;
+    std::string only;
+    std::string baseline_path;
+    std::string output_path;
+    double threshold = 20;
+    for(int i = 0; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return 2;
+        }
+        std::string value = argv[++i];
+        try {
+            if(arg == "--runs") {
+                runs = std::max(1ul, std::stoul(value));
+            } else if(arg == "--only") {
+                only = value;
+            } else if(arg == "--baseline") {
+                baseline_path = value;
+            } else if(arg == "--threshold") {
+                threshold = std::stod(value);
+            } else if(arg == "--output") {
+                output_path = value;
+            } else {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                return 2;
+            }
+        } catch(const std::exception& ex) {
+            std::cerr << "Invalid value for " << arg << ": " << value << std::endl;
+            return 2;
+        }
+    }
+
+    std::ifstream stamp(root + "/.bench_tree");
+    std::string tree;
+    if(!std::getline(stamp, tree)) {
+        std::cerr << "Run error: " << root << " has no generated tree; run generate first" << std::endl;
+        return 2;
+    }
+    bool have_baseline = false;
+    std::map<std::string, double> baseline;
+    if(!baseline_path.empty()) {
+        baseline = read_baseline(baseline_path, have_baseline);
+        if(!have_baseline) {
+            std::cout << "No baseline at " << baseline_path << "; nothing to compare with." << std::endl;
+        }
+    }
+
+    std::printf("%-20s %9s %9s %12s %10s %10s %9s %9s\n", "benchmark", "seconds", "cpu", "entries/s",
+                "peak RSS", "syscalls", "baseline", "change");
+    std::vector<std::pair<std::string, Sample>> results;
+    int regressions = 0;
+    for(const auto& bench : make_benches()) {
+        if(!only.empty() && only != bench.name) {
+            continue;
+        }
+        // One unrecorded run first, so every recorded one sees a warm page cache.
+        std::vector<Sample> samples;
+        for(unsigned i = 0; i <= runs; ++i) {
+            Sample sample;
+            if(!measure(bench, root, sample)) {
+                std::cerr << "Run error: " << bench.name << " failed" << std::endl;
+                return 1;
+            }
+            if(i > 0) {
+                samples.push_back(sample);
+            }
+        }
+        std::sort(samples.begin(), samples.end(), [](const Sample& a, const Sample& b) {
+            return a.seconds < b.seconds;
+        });
+        const Sample& s = samples[samples.size() / 2];
+        results.emplace_back(bench.name, s);
+
+        char rss_text[32];
+        std::string rss(rss_text, format_size(rss_text, uint64_t(s.peak_rss_kb) * 1024));
+        std::string syscalls = s.syscalls < 0 ? "-" : std::to_string(s.syscalls);
+        std::printf("%-20s %9.4f %9.4f %12.0f %10s %10s", bench.name, s.seconds, s.cpu_seconds,
+                    s.seconds > 0 ? s.entries / s.seconds : 0.0, rss.c_str(), syscalls.c_str());
+        auto base = baseline.find(bench.name);
+        if(base == baseline.end()) {
+            std::printf(" %9s %9s\n", "-", have_baseline ? "new" : "-");
+            continue;
+        }
+        double change = base->second > 0 ? (s.seconds / base->second - 1) * 100 : 0;
+        bool regressed = change > threshold && s.seconds - base->second > kNoiseFloor;
+        regressions += regressed;
+        std::printf(" %9.4f %+8.1f%%%s\n", base->second, change, regressed ? "  REGRESSED" : "");
+    }
+
+    if(!output_path.empty() && !write_json(output_path, tree, results)) {
+        std::cerr << "Run error: cannot write " << output_path << std::endl;
+        return 1;
+    }
+    if(regressions) {
+        std::cout << regressions << " benchmark(s) more than " << threshold << "% slower than the baseline." << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    if(argc < 3) {
+        print_usage(argv[0]);
+        return 2;
+    }
+    std::string command = argv[1];
+    if(command == "generate") {
+        return generate(argv[2], argc - 3, argv + 3);
+    }
+    if(command == "run") {
+        return run(argv[2], argc - 3, argv + 3);
+    }
+    print_usage(argv[0]);
+    return 2;
+}
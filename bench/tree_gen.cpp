@@ -0,0 +1,213 @@
+#include "tree_gen.h"
+#include "delete_engine.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+const char* const kNeedle = "BENCH_NEEDLE";
+
+namespace {
+
+const size_t kTextBlock = 64 * 1024;
+const char* const kExtensions[] = {".txt", ".cpp", ".h", ".md", ".json", ".dat", ".log", ".py"};
+const char* const kWords[] = {"alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+                              "india", "juliet", "kilo", "lima", "mike", "november", "oscar", "papa"};
+
+// xorshift64*: small, fast and the same on every platform.
+class Random {
+public:
+    explicit Random(uint64_t seed) : state(seed ? seed : 0x9e3779b97f4a7c15ULL) {}
+    uint64_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545f4914f6cdd1dULL;
+    }
+    double unit() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+    uint64_t log_uniform(uint64_t lo, uint64_t hi) {
+        double a = std::log(double(lo ? lo : 1));
+        double b = std::log(double(hi > lo ? hi : lo + 1));
+        return static_cast<uint64_t>(std::exp(a + (b - a) * unit()));
+    }
+
+private:
+    uint64_t state;
+};
+
+class Generator {
+public:
+    Generator(const TreeSpec& spec, TreeStats& stats) : spec(spec), stats(stats), random(spec.seed) {
+        // Lines of words, so content search sees realistic line lengths.
+        while(text.size() < kTextBlock) {
+            size_t words = 4 + random.next() % 10;
+            for(size_t i = 0; i < words; ++i) {
+                text += kWords[random.next() % (sizeof(kWords) / sizeof(kWords[0]))];
+                text += i + 1 < words ? ' ' : '\n';
+            }
+        }
+        text.resize(kTextBlock);
+    }
+
+    bool directory(const std::string& path, unsigned level, std::string& error) {
+        if(mkdir(path.c_str(), 0755) != 0) {
+            error = path + ": " + std::strerror(errno);
+            return false;
+        }
+        ++stats.directories;
+        for(unsigned i = 0; i < spec.files_per_dir; ++i) {
+            char name[32];
+            const char* ext = kExtensions[random.next() % (sizeof(kExtensions) / sizeof(kExtensions[0]))];
+            snprintf(name, sizeof(name), "file%04u%s", i, ext);
+            uint64_t size = random.next() % 1000 < spec.large_per_mille
+                ? random.log_uniform(spec.max_file, spec.large_file)
+                : random.log_uniform(spec.min_file, spec.max_file);
+            if(!file(path + "/" + name, size, error)) {
+                return false;
+            }
+        }
+        if(level < spec.depth) {
+            for(unsigned i = 0; i < spec.fanout; ++i) {
+                if(!directory(path + "/dir" + std::to_string(i), level + 1, error)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool flat(const std::string& path, std::string& error) {
+        if(mkdir(path.c_str(), 0755) != 0) {
+            error = path + ": " + std::strerror(errno);
+            return false;
+        }
+        ++stats.directories;
+        int dirfd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(dirfd < 0) {
+            error = path + ": " + std::strerror(errno);
+            return false;
+        }
+        for(unsigned i = 0; i < spec.flat_entries; ++i) {
+            char name[32];
+            snprintf(name, sizeof(name), "entry%07u.dat", i);
+            int fd = openat(dirfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if(fd < 0) {
+                error = path + "/" + name + ": " + std::strerror(errno);
+                close(dirfd);
+                return false;
+            }
+            close(fd);
+            ++stats.files;
+        }
+        close(dirfd);
+        return true;
+    }
+
+private:
+    const TreeSpec& spec;
+    TreeStats& stats;
+    Random random;
+    std::string text;
+
+    bool file(const std::string& path, uint64_t size, std::string& error) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd < 0) {
+            error = path + ": " + std::strerror(errno);
+            return false;
+        }
+        std::string head;
+        if(spec.needle_every && (stats.files % spec.needle_every) == 0) {
+            head = std::string("found ") + kNeedle + " here\n";
+        }
+        uint64_t written = 0;
+        size_t offset = random.next() % kTextBlock;
+        while(written < size) {
+            const char* data;
+            size_t len;
+            if(written < head.size()) {
+                data = head.data() + written;
+                len = head.size() - written;
+            } else {
+                data = text.data() + offset;
+                len = kTextBlock - offset;
+                offset = 0;
+            }
+            len = std::min<uint64_t>(len, size - written);
+            ssize_t n = write(fd, data, len);
+            if(n <= 0) {
+                error = path + ": " + std::strerror(n < 0 ? errno : EIO);
+                close(fd);
+                return false;
+            }
+            written += n;
+        }
+        close(fd);
+        ++stats.files;
+        stats.bytes += size;
+        return true;
+    }
+};
+
+}
+
+std::string describe(const TreeSpec& spec) {
+    std::ostringstream text;
+    text << "depth=" << spec.depth << " fanout=" << spec.fanout << " files_per_dir=" << spec.files_per_dir
+         << " min_file=" << spec.min_file << " max_file=" << spec.max_file
+         << " large_per_mille=" << spec.large_per_mille << " large_file=" << spec.large_file
+         << " needle_every=" << spec.needle_every << " flat_entries=" << spec.flat_entries
+         << " seed=" << spec.seed;
+    return text.str();
+}
+
+bool generate_tree(const std::string& root, const TreeSpec& spec, TreeStats& stats, bool& reused,
+                   std::string& error) {
+    const std::string stamp_path = root + "/.bench_tree";
+    const std::string wanted = describe(spec);
+    reused = false;
+    stats = TreeStats();
+
+    std::ifstream stamp(stamp_path);
+    std::string line;
+    if(stamp && std::getline(stamp, line) && line == wanted &&
+       stamp >> stats.files >> stats.directories >> stats.bytes) {
+        reused = true;
+        return true;
+    }
+    stats = TreeStats();
+
+    struct stat st;
+    if(lstat(root.c_str(), &st) == 0) {
+        DeleteEngine::Options options;
+        options.progress = false;
+        DeleteEngine::Result removed = DeleteEngine(options).remove(root);
+        if(removed.errors) {
+            error = "cannot remove old tree: " + removed.first_error;
+            return false;
+        }
+    }
+    if(mkdir(root.c_str(), 0755) != 0) {
+        error = root + ": " + std::strerror(errno);
+        return false;
+    }
+
+    Generator generator(spec, stats);
+    if(!generator.directory(root + "/tree", 0, error) || !generator.flat(root + "/flat", error)) {
+        return false;
+    }
+
+    std::ofstream out(stamp_path);
+    out << wanted << "\n" << stats.files << " " << stats.directories << " " << stats.bytes << "\n";
+    if(!out) {
+        error = stamp_path + ": cannot write stamp";
+        return false;
+    }
+    return true;
+}
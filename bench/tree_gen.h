@@ -0,0 +1,39 @@
+#ifndef TREE_GEN_H
+#define TREE_GEN_H
+
+#include <string>
+#include <cstdint>
+
+// Shape of the synthetic benchmark tree. The same spec and seed always give
+// the same names, sizes and contents.
+struct TreeSpec {
+    unsigned depth = 4;                 // directory levels below tree/
+    unsigned fanout = 4;                // subdirectories per directory
+    unsigned files_per_dir = 20;
+    uint64_t min_file = 64;             // sizes are log-uniform in [min, max]
+    uint64_t max_file = 64 * 1024;
+    unsigned large_per_mille = 5;       // files drawn up to large_file instead
+    uint64_t large_file = 4 * 1024 * 1024;
+    unsigned needle_every = 8;          // every Nth file contains kNeedle
+    unsigned flat_entries = 100000;     // empty files in one flat/ directory
+    uint64_t seed = 1;
+};
+
+struct TreeStats {
+    uint64_t files = 0;
+    uint64_t directories = 0;
+    uint64_t bytes = 0;
+};
+
+extern const char* const kNeedle;
+
+// One line naming every field, stored in root/.bench_tree.
+std::string describe(const TreeSpec& spec);
+
+// Builds root/tree and root/flat. A root whose stamp already matches the
+// spec is left alone; any other existing root is removed first. Returns
+// false with error set on failure.
+bool generate_tree(const std::string& root, const TreeSpec& spec, TreeStats& stats, bool& reused,
+                   std::string& error);
+
+#endif
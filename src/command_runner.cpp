@@ -0,0 +1,799 @@
+#include "command_runner.h"
+#include "explorer_daemon.h"
+
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+namespace {
+
+const char* const kCommands[] = {"ls", "find", "cp", "mv", "rm", "chmod", "snapshot", "diff", "top", "view", "stat", "du"};
+
+// Leading "-x" words; stops at "--" or the first operand.
+bool take_flags(const std::vector<std::string>& args, const std::string& allowed, std::string& flags,
+                std::vector<std::string>& operands) {
+    size_t i = 1;
+    for(; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if(arg == "--") {
+            ++i;
+            break;
+        }
+        if(arg.size() < 2 || arg[0] != '-') {
+            break;
+        }
+        for(size_t j = 1; j < arg.size(); ++j) {
+            if(allowed.find(arg[j]) == std::string::npos) {
+                return false;
+            }
+            flags += arg[j];
+        }
+    }
+    operands.assign(args.begin() + i, args.end());
+    return true;
+}
+
+// top's options that take a value.
+bool top_option_with_value(const std::string& arg) {
+    return arg == "--by" || arg == "-n" || arg == "--ext" || arg == "--older" || arg == "--newer";
+}
+
+// view's options that take a value.
+bool view_option_with_value(const std::string& arg) {
+    return arg == "-n" || arg == "--at";
+}
+
+bool has_flag(const std::string& flags, char flag) {
+    return flags.find(flag) != std::string::npos;
+}
+
+std::string normalise(const std::string& path) {
+    std::error_code ec;
+    std::string result = fs::absolute(path, ec).lexically_normal().string();
+    while(result.size() > 1 && result.back() == '/') {
+        result.pop_back();
+    }
+    return result;
+}
+
+// True if one path is the other or lies below it.
+bool overlaps(const std::string& a, const std::string& b) {
+    const std::string& shorter = a.size() <= b.size() ? a : b;
+    const std::string& longer = a.size() <= b.size() ? b : a;
+    if(longer.compare(0, shorter.size(), shorter) != 0) {
+        return false;
+    }
+    return longer.size() == shorter.size() || shorter == "/" || longer[shorter.size()] == '/';
+}
+
+bool is_reader(const std::vector<std::string>& args) {
+    return args[0] == "ls" || args[0] == "find" || args[0] == "diff" || args[0] == "top" ||
+           args[0] == "view" || args[0] == "stat" || args[0] == "du";
+}
+
+bool path_exists(const std::string& path, struct stat& st) {
+    return lstat(path.c_str(), &st) == 0;
+}
+
+// Index of the first operand that names a path; find's first operand is
+// its query.
+size_t first_path(const std::vector<std::string>& args) {
+    size_t first = 1;
+    if(args[0] == "chmod") {
+        // Its mode may itself start with '-'.
+        bool split = false;
+        for(; first < args.size(); ++first) {
+            if(args[first] == "--files" || args[first] == "--dirs") {
+                split = true;
+                ++first;
+            } else if(args[first] != "-R") {
+                break;
+            }
+        }
+        first += split ? 0 : 1;
+    } else if(args[0] == "top" || args[0] == "view") {
+        auto with_value = args[0] == "top" ? top_option_with_value : view_option_with_value;
+        while(first < args.size() && args[first].size() > 1 && args[first][0] == '-') {
+            first += with_value(args[first]) ? 2 : 1;
+        }
+    } else {
+        while(first < args.size() && args[first].size() > 1 && args[first][0] == '-' && args[first] != "--") {
+            ++first;
+        }
+        if(first < args.size() && args[first] == "--") {
+            ++first;
+        }
+        if(args[0] == "find") {
+            ++first;
+        }
+    }
+    return first;
+}
+
+std::string target_in(const std::string& dir, const std::string& source) {
+    return (fs::path(dir) / fs::path(normalise(source)).filename()).string();
+}
+
+// Copies all of fd to out_fd; a failed write to stdout leaves std::cout bad.
+void hand_over(int fd, int out_fd) {
+    std::cout.flush();
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        return;
+    }
+    off_t offset = 0;
+    while(offset < st.st_size) {
+        ssize_t n = sendfile(out_fd, fd, &offset, st.st_size - offset);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            if(out_fd == STDOUT_FILENO) {
+                std::cout.setstate(std::ios::badbit);
+            }
+            return;
+        }
+    }
+}
+
+}
+
+CommandRunner::CommandRunner(const Options& options) : options(options), engine_workers(0), own_explorers(false) {
+    reader_options = options.explorer;
+    reader_options.interactive = false;
+    reader_options.prefetch = false;
+    if(!reader_options.caches) {
+        reader_options.caches = std::make_shared<ExplorerCaches>();
+    }
+    explorer = std::make_unique<FileExplorer>(reader_options);
+}
+
+CommandRunner::~CommandRunner() = default;
+
+bool CommandRunner::is_command(const std::string& word) {
+    return std::find(std::begin(kCommands), std::end(kCommands), word) != std::end(kCommands);
+}
+
+void CommandRunner::error(const std::string& command, const std::string& message) {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    *options.errors << command << " error: " << message << std::endl;
+}
+
+bool CommandRunner::split_line(const std::string& line, std::vector<std::string>& words, std::string& error) {
+    words.clear();
+    std::string word;
+    bool in_word = false;
+    char quote = 0;
+    for(size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if(quote) {
+            if(c == quote) {
+                quote = 0;
+            } else if(c == '\\' && quote == '"' && i + 1 < line.size()) {
+                word += line[++i];
+            } else {
+                word += c;
+            }
+        } else if(c == '\'' || c == '"') {
+            quote = c;
+            in_word = true;
+        } else if(c == '\\' && i + 1 < line.size()) {
+            word += line[++i];
+            in_word = true;
+        } else if(c == ' ' || c == '\t' || c == '\r') {
+            if(in_word) {
+                words.push_back(word);
+                word.clear();
+                in_word = false;
+            }
+        } else if(c == '#' && !in_word) {
+            break;
+        } else {
+            word += c;
+            in_word = true;
+        }
+    }
+    if(quote) {
+        error = "unterminated quote";
+        return false;
+    }
+    if(in_word) {
+        words.push_back(word);
+    }
+    return true;
+}
+
+bool CommandRunner::prepare(size_t line, const std::vector<std::string>& args, Command& command) {
+    command.line = line;
+    command.args = args;
+    command.paths.clear();
+    if(args.empty() || !is_command(args[0])) {
+        return false;
+    }
+    size_t first = first_path(args);
+    for(size_t i = first; i < args.size(); ++i) {
+        command.paths.push_back(normalise(args[i]));
+    }
+    // Both read the working directory when given one operand.
+    bool implicit_dir = (args[0] == "snapshot" || args[0] == "diff") && command.paths.size() == 1;
+    if(implicit_dir || (command.paths.empty() && is_reader(args))) {
+        command.paths.push_back(normalise("."));
+    }
+    return true;
+}
+
+int CommandRunner::run(const std::vector<std::string>& args) {
+    Command command;
+    if(!prepare(0, args, command)) {
+        error(args.empty() ? "command" : args[0], "unknown command");
+        return Usage;
+    }
+    return execute(command);
+}
+
+int CommandRunner::run_batch(std::istream& in) {
+    unsigned jobs = options.jobs ? options.jobs : TreeWalker::default_threads();
+    engine_workers = jobs > 1 ? std::max(1u, TreeWalker::default_threads() / jobs) : 0;
+    own_explorers = jobs > 1 && options.explorer.output_frame == 0;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::shared_ptr<Command>> queue;
+    std::vector<std::shared_ptr<Command>> running;     // dispatched, not finished
+    bool reading = true;
+    int status = Success;
+    uint64_t total = 0;
+    uint64_t failed = 0;
+
+    auto worker = [&]() {
+        while(true) {
+            std::shared_ptr<Command> command;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return !queue.empty() || !reading; });
+                if(queue.empty()) {
+                    return;
+                }
+                command = queue.front();
+                queue.pop_front();
+            }
+            int code = execute(*command);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                running.erase(std::find(running.begin(), running.end(), command));
+                status = std::max(status, code);
+                failed += code != Success;
+            }
+            changed.notify_all();
+        }
+    };
+    std::vector<std::thread> pool;
+    for(unsigned i = 0; i < jobs; ++i) {
+        pool.emplace_back(worker);
+    }
+
+    std::string line;
+    size_t line_number = 0;
+    std::vector<std::string> words;
+    while(std::getline(in, line)) {
+        ++line_number;
+        std::string parse_error;
+        auto command = std::make_shared<Command>();
+        if(split_line(line, words, parse_error)) {
+            if(words.empty()) {
+                continue;
+            }
+            if(!prepare(line_number, words, *command)) {
+                parse_error = "unknown command " + words[0];
+            }
+        }
+        if(!parse_error.empty()) {
+            error("batch", "line " + std::to_string(line_number) + ": " + parse_error);
+            std::lock_guard<std::mutex> lock(mutex);
+            ++total;
+            ++failed;
+            status = Usage;
+            continue;
+        }
+
+        // Wait for a free worker and for every running command that shares
+        // a path with this one; readers may share with readers.
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() {
+            if(running.size() >= jobs) {
+                return false;
+            }
+            for(const auto& other : running) {
+                if(is_reader(other->args) && is_reader(command->args)) {
+                    continue;
+                }
+                for(const auto& a : other->paths) {
+                    for(const auto& b : command->paths) {
+                        if(overlaps(a, b)) {
+                            return false;
+                        }
+                    }
+                }
+            }
+            return true;
+        });
+        ++total;
+        running.push_back(command);
+        queue.push_back(command);
+        lock.unlock();
+        changed.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reading = false;
+    }
+    changed.notify_all();
+    for(auto& thread : pool) {
+        thread.join();
+    }
+    if(failed > 0) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cerr << failed << " of " << total << " commands failed" << std::endl;
+    }
+    return status;
+}
+
+bool CommandRunner::read_command(const std::function<bool(FileExplorer&)>& body) {
+    int fd = own_explorers ? memfd_create("file_explorer", MFD_CLOEXEC) : -1;
+    if(fd < 0) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        return body(*explorer);
+    }
+    bool ok;
+    {
+        ExplorerOptions own_options = reader_options;
+        own_options.output_fd = fd;
+        FileExplorer own(own_options);
+        ok = body(own);
+    }
+    std::lock_guard<std::mutex> lock(output_mutex);
+    hand_over(fd, reader_options.output_fd);
+    close(fd);
+    return ok;
+}
+
+int CommandRunner::execute(const Command& command) {
+    const std::string& name = command.args[0];
+    if(!options.connect.empty() && ExplorerDaemon::serves(name)) {
+        // The daemon has its own working directory.
+        ExplorerDaemon::Query query;
+        query.format = options.explorer.format;
+        query.listing = options.explorer.listing;
+        query.args = command.args;
+        size_t first = first_path(query.args);
+        for(size_t i = first; i < query.args.size(); ++i) {
+            query.args[i] = normalise(query.args[i]);
+        }
+        if(first == query.args.size()) {
+            query.args.push_back(normalise("."));
+        }
+        int status = -1;
+        int fd = own_explorers ? memfd_create("file_explorer", MFD_CLOEXEC) : -1;
+        if(fd >= 0) {
+            status = ExplorerDaemon::forward(options.connect, query, fd);
+            std::lock_guard<std::mutex> lock(output_mutex);
+            hand_over(fd, reader_options.output_fd);
+            close(fd);
+        } else {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            status = ExplorerDaemon::forward(options.connect, query);
+        }
+        if(status >= 0) {
+            return status;
+        }
+    }
+    if(name == "ls") {
+        return ls(command.args);
+    }
+    if(name == "find") {
+        return find(command.args);
+    }
+    if(name == "cp") {
+        return cp(command.args);
+    }
+    if(name == "mv") {
+        return mv(command.args);
+    }
+    if(name == "rm") {
+        return rm(command.args);
+    }
+    if(name == "snapshot") {
+        return snapshot(command.args);
+    }
+    if(name == "diff") {
+        return diff(command.args);
+    }
+    if(name == "top") {
+        return top(command.args);
+    }
+    if(name == "view") {
+        return view(command.args);
+    }
+    if(name == "stat") {
+        return stat_paths(command.args);
+    }
+    if(name == "du") {
+        return du(command.args);
+    }
+    return chmod(command.args);
+}
+
+int CommandRunner::ls(const std::vector<std::string>& args) {
+    std::string flags;
+    std::vector<std::string> paths;
+    if(!take_flags(args, "l", flags, paths)) {
+        error("ls", "usage: ls [-l] [PATH...]");
+        return Usage;
+    }
+    if(paths.empty()) {
+        paths.push_back(".");
+    }
+    return read_command([&](FileExplorer& explorer) {
+        bool ok = true;
+        for(const auto& path : paths) {
+            if(paths.size() > 1 && options.explorer.format == OutputFormat::Human) {
+                explorer.print_heading(path + ":");
+            }
+            ok = explorer.list_directory(normalise(path), has_flag(flags, 'l')) && ok;
+        }
+        return ok;
+    }) ? Success : Failure;
+}
+
+int CommandRunner::find(const std::vector<std::string>& args) {
+    std::string flags;
+    std::vector<std::string> operands;
+    if(!take_flags(args, "", flags, operands) || operands.empty()) {
+        error("find", "usage: find QUERY [PATH...]");
+        return Usage;
+    }
+    std::vector<std::string> roots(operands.begin() + 1, operands.end());
+    if(roots.empty()) {
+        roots.push_back(".");
+    }
+    return read_command([&](FileExplorer& explorer) {
+        bool ok = true;
+        for(const auto& root : roots) {
+            ok = explorer.find(normalise(root), operands[0]) && ok;
+        }
+        return ok;
+    }) ? Success : Failure;
+}
+
+int CommandRunner::cp(const std::vector<std::string>& args) {
+    std::string flags;
+    std::vector<std::string> operands;
+    if(!take_flags(args, "r", flags, operands) || operands.size() < 2) {
+        error("cp", "usage: cp [-r] SRC... DST");
+        return Usage;
+    }
+    const std::string& dst = operands.back();
+    struct stat st;
+    bool into = operands.size() > 2 || (stat(dst.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+
+    CopyEngine::Options copy_options;
+    copy_options.recursive = has_flag(flags, 'r');
+    copy_options.progress = false;
+    copy_options.workers = engine_workers;
+    int status = Success;
+    for(size_t i = 0; i + 1 < operands.size(); ++i) {
+        const std::string& source = operands[i];
+        std::string target = into ? target_in(dst, source) : dst;
+        if(stat(source.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && !copy_options.recursive) {
+            error("cp", source + ": is a directory (use -r)");
+            status = Failure;
+            continue;
+        }
+        if(!options.yes && path_exists(target, st)) {
+            error("cp", target + ": exists (use --yes to replace)");
+            status = Failure;
+            continue;
+        }
+        OpScope scope("copy");
+        CopyEngine::Result result = CopyEngine(copy_options).copy(source, target);
+        if(result.errors > 0) {
+            error("cp", result.first_error);
+            status = Failure;
+        }
+    }
+    return status;
+}
+
+int CommandRunner::mv(const std::vector<std::string>& args) {
+    std::string flags;
+    std::vector<std::string> operands;
+    if(!take_flags(args, "", flags, operands) || operands.size() < 2) {
+        error("mv", "usage: mv SRC... DST");
+        return Usage;
+    }
+    const std::string dst = operands.back();
+    operands.pop_back();
+    struct stat st;
+    bool dst_is_dir = stat(dst.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+    if(operands.size() > 1 && !dst_is_dir) {
+        error("mv", dst + ": not a directory");
+        return Failure;
+    }
+
+    int status = Success;
+    std::vector<std::string> sources;
+    for(const auto& source : operands) {
+        std::string target = dst_is_dir ? target_in(dst, source) : dst;
+        if(!options.yes && path_exists(target, st)) {
+            error("mv", target + ": exists (use --yes to replace)");
+            status = Failure;
+            continue;
+        }
+        sources.push_back(source);
+    }
+    if(sources.empty()) {
+        return status;
+    }
+
+    MoveEngine::Options move_options;
+    move_options.progress = false;
+    move_options.workers = engine_workers;
+    MoveEngine engine(move_options);
+    OpScope scope("move");
+    MoveEngine::Result result = dst_is_dir ? engine.move_into(sources, dst) : engine.move(sources[0], dst);
+    if(result.errors > 0) {
+        error("mv", result.first_error);
+        status = Failure;
+    }
+    return status;
+}
+
+int CommandRunner::rm(const std::vector<std::string>& args) {
+    std::string flags;
+    std::vector<std::string> paths;
+    if(!take_flags(args, "r", flags, paths) || paths.empty()) {
+        error("rm", "usage: rm [-r] PATH...");
+        return Usage;
+    }
+    DeleteEngine::Options delete_options;
+    delete_options.progress = false;
+    delete_options.workers = engine_workers;
+    int status = Success;
+    for(const auto& path : paths) {
+        struct stat st;
+        if(!path_exists(path, st)) {
+            error("rm", path + ": " + std::strerror(errno));
+            status = Failure;
+            continue;
+        }
+        if(S_ISDIR(st.st_mode)) {
+            if(!has_flag(flags, 'r')) {
+                error("rm", path + ": is a directory (use -r)");
+                status = Failure;
+                continue;
+            }
+            if(!options.yes) {
+                error("rm", path + ": refusing to remove a directory without --yes");
+                status = Failure;
+                continue;
+            }
+        }
+        OpScope scope("delete");
+        DeleteEngine::Result result = DeleteEngine(delete_options).remove(path);
+        if(result.errors > 0) {
+            error("rm", result.first_error);
+            status = Failure;
+        }
+    }
+    return status;
+}
+
+int CommandRunner::chmod(const std::vector<std::string>& args) {
+    const char* usage = "usage: chmod [-R] MODE PATH... or chmod [-R] [--files MODE] [--dirs MODE] PATH...";
+    PermissionEngine::Options chmod_options;
+    chmod_options.progress = false;
+    chmod_options.workers = engine_workers;
+    std::string error_text;
+    size_t i = 1;
+    bool split = false;
+    for(; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if(arg == "-R") {
+            chmod_options.recursive = true;
+        } else if((arg == "--files" || arg == "--dirs") && i + 1 < args.size()) {
+            ModeSpec& spec = arg == "--files" ? chmod_options.files : chmod_options.directories;
+            if(!spec.parse(args[++i], error_text)) {
+                error("chmod", error_text);
+                return Usage;
+            }
+            split = true;
+        } else {
+            break;
+        }
+    }
+    // "-w" is a mode, not a flag.
+    if(!split && i < args.size()) {
+        if(!chmod_options.files.parse(args[i++], error_text)) {
+            error("chmod", error_text);
+            return Usage;
+        }
+        chmod_options.directories = chmod_options.files;
+    }
+    if(i >= args.size() || (chmod_options.files.empty() && chmod_options.directories.empty())) {
+        error("chmod", usage);
+        return Usage;
+    }
+    int status = Success;
+    for(; i < args.size(); ++i) {
+        OpScope scope("chmod");
+        PermissionEngine::Result result = PermissionEngine(chmod_options).apply(args[i]);
+        if(result.errors > 0) {
+            error("chmod", result.first_error);
+            status = Failure;
+        }
+    }
+    return status;
+}
+
+int CommandRunner::snapshot(const std::vector<std::string>& args) {
+    std::string flags;
+    std::vector<std::string> operands;
+    if(!take_flags(args, "", flags, operands) || operands.empty() || operands.size() > 2) {
+        error("snapshot", "usage: snapshot [DIR] FILE");
+        return Usage;
+    }
+    std::string dir = operands.size() == 2 ? operands[0] : ".";
+    return read_command([&](FileExplorer& explorer) {
+        return explorer.save_snapshot(normalise(dir), operands.back());
+    }) ? Success : Failure;
+}
+
+int CommandRunner::diff(const std::vector<std::string>& args) {
+    std::string flags;
+    std::vector<std::string> operands;
+    if(!take_flags(args, "", flags, operands) || operands.empty() || operands.size() > 2) {
+        error("diff", "usage: diff SNAPSHOT [SNAPSHOT|DIR]");
+        return Usage;
+    }
+    std::string after = operands.size() == 2 ? operands[1] : ".";
+    return read_command([&](FileExplorer& explorer) {
+        return explorer.diff_snapshot(operands[0], after);
+    }) ? Success : Failure;
+}
+
+int CommandRunner::top(const std::vector<std::string>& args) {
+    const char* usage = "usage: top [--by size|blocks|mtime|atime] [-n N] [-r] [--ext LIST] [--older AGE] "
+                        "[--newer AGE] [PATH...]";
+    TopFiles::Options top_options;
+    top_options.threads = engine_workers;
+    size_t i = 1;
+    for(; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; ++i) {
+        const std::string& arg = args[i];
+        if(arg == "-r") {
+            top_options.reverse = true;
+            continue;
+        }
+        if(!top_option_with_value(arg) || i + 1 >= args.size()) {
+            error("top", usage);
+            return Usage;
+        }
+        const std::string& value = args[++i];
+        bool ok = true;
+        if(arg == "--by") {
+            ok = TopFiles::parse_key(value, top_options.key);
+        } else if(arg == "-n") {
+            char* end = nullptr;
+            top_options.count = std::strtoul(value.c_str(), &end, 10);
+            ok = !value.empty() && *end == '\0';
+        } else if(arg == "--ext") {
+            top_options.extensions = TopFiles::parse_extensions(value);
+        } else if(arg == "--older") {
+            ok = TopFiles::parse_age(value, top_options.older_than);
+        } else {
+            ok = TopFiles::parse_age(value, top_options.newer_than);
+        }
+        if(!ok) {
+            error("top", "invalid value for " + arg + ": " + value);
+            return Usage;
+        }
+    }
+    std::vector<std::string> roots(args.begin() + i, args.end());
+    if(roots.empty()) {
+        roots.push_back(".");
+    }
+    return read_command([&](FileExplorer& explorer) {
+        bool ok = true;
+        for(const auto& root : roots) {
+            ok = explorer.top_files(normalise(root), top_options) && ok;
+        }
+        return ok;
+    }) ? Success : Failure;
+}
+
+int CommandRunner::view(const std::vector<std::string>& args) {
+    const char* usage = "usage: view [-n LINES] [--at head|tail|N|N%|/TEXT] [-f] FILE";
+    uint64_t lines = 20;
+    std::string position = "head";
+    bool follow = false;
+    size_t i = 1;
+    for(; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; ++i) {
+        const std::string& arg = args[i];
+        if(arg == "-f") {
+            follow = true;
+            continue;
+        }
+        if(!view_option_with_value(arg) || i + 1 >= args.size()) {
+            error("view", usage);
+            return Usage;
+        }
+        const std::string& value = args[++i];
+        if(arg == "-n") {
+            char* end = nullptr;
+            lines = std::strtoull(value.c_str(), &end, 10);
+            if(value.empty() || *end != '\0') {
+                error("view", "invalid value for -n: " + value);
+                return Usage;
+            }
+        } else {
+            position = value;
+        }
+    }
+    if(i + 1 != args.size()) {
+        error("view", usage);
+        return Usage;
+    }
+    if(follow) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        return explorer->view_file(args[i], position, lines, follow) ? Success : Failure;
+    }
+    return read_command([&](FileExplorer& explorer) {
+        return explorer.view_file(args[i], position, lines, false);
+    }) ? Success : Failure;
+}
+
+int CommandRunner::stat_paths(const std::vector<std::string>& args) {
+    std::string flags;
+    std::vector<std::string> paths;
+    if(!take_flags(args, "", flags, paths)) {
+        error("stat", "usage: stat [PATH...]");
+        return Usage;
+    }
+    if(paths.empty()) {
+        paths.push_back(".");
+    }
+    return read_command([&](FileExplorer& explorer) {
+        bool ok = true;
+        for(const auto& path : paths) {
+            ok = explorer.stat_path(normalise(path)) && ok;
+        }
+        return ok;
+    }) ? Success : Failure;
+}
+
+int CommandRunner::du(const std::vector<std::string>& args) {
+    std::string flags;
+    std::vector<std::string> paths;
+    if(!take_flags(args, "", flags, paths)) {
+        error("du", "usage: du [PATH...]");
+        return Usage;
+    }
+    if(paths.empty()) {
+        paths.push_back(".");
+    }
+    return read_command([&](FileExplorer& explorer) {
+        bool ok = true;
+        for(const auto& path : paths) {
+            ok = explorer.disk_usage_of(normalise(path)) && ok;
+        }
+        return ok;
+    }) ? Success : Failure;
+}
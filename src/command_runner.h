@@ -0,0 +1,101 @@
+#ifndef COMMAND_RUNNER_H
+#define COMMAND_RUNNER_H
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <mutex>
+#include <memory>
+#include <functional>
+#include "file_explorer.h"
+
+// Non-interactive mode. `file_explorer CMD ARGS...` runs one command;
+// `--batch FILE` (or `-` for stdin) runs one command per line:
+//
+//   ls [-l] [PATH...]          find QUERY [PATH...]
+//   cp [-r] SRC... DST         mv SRC... DST
+//   rm [-r] PATH...            chmod [-R] MODE PATH...
+//   chmod [-R] [--files MODE] [--dirs MODE] PATH...
+//   snapshot [DIR] FILE        diff SNAPSHOT [SNAPSHOT|DIR]
+//   top [--by size|blocks|mtime|atime] [-n N] [-r] [--ext LIST]
+//       [--older AGE] [--newer AGE] [PATH...]
+//   view [-n LINES] [--at head|tail|N|N%|/TEXT] [-f] FILE
+//   stat [PATH...]             du [PATH...]
+//
+// Batch commands run on a bounded worker pool in input order, except that
+// a command waits while an earlier one that is still running touches the
+// same path, an ancestor or a descendant of it. Replacing existing targets
+// and removing directories need --yes; without it they fail rather than
+// prompt. Readers run side by side, each on an explorer of its own (the
+// caches are shared) whose output collects in a memory file and is copied
+// to stdout in one piece when it is done, so output is never interleaved;
+// view -f writes straight to stdout and holds it until it is stopped.
+//
+// With a daemon socket to connect to, ls, find, stat and du run on the
+// daemon (see ExplorerDaemon) with their paths made absolute here; they
+// run locally if no daemon answers.
+class CommandRunner {
+public:
+    enum ExitCode {
+        Success = 0,
+        Failure = 1,    // at least one command failed
+        Usage = 2       // at least one command could not be parsed
+    };
+
+    struct Options {
+        ExplorerOptions explorer;
+        bool yes = false;
+        unsigned jobs = 0;          // concurrent batch commands, 0 = one per core
+        std::string connect;        // daemon socket, empty to run everything here
+        std::ostream* errors = &std::cerr;
+    };
+
+    explicit CommandRunner(const Options& options);
+    ~CommandRunner();
+
+    static bool is_command(const std::string& word);
+
+    int run(const std::vector<std::string>& args);
+    int run_batch(std::istream& in);
+
+    // Splits a batch line into words: blanks separate, '...' and "..."
+    // quote, backslash escapes, and # starts a comment.
+    static bool split_line(const std::string& line, std::vector<std::string>& words, std::string& error);
+
+private:
+    struct Command {
+        size_t line = 0;
+        std::vector<std::string> args;
+        std::vector<std::string> paths;     // normalised absolute paths it touches
+    };
+
+    Options options;
+    unsigned engine_workers;    // per command, so the pool is not oversubscribed
+    bool own_explorers;         // batch with several jobs: readers run apart
+    std::mutex output_mutex;    // one writer to stdout at a time; also serialises errors
+    ExplorerOptions reader_options;
+    std::unique_ptr<FileExplorer> explorer;
+
+    int execute(const Command& command);
+    int ls(const std::vector<std::string>& args);
+    int find(const std::vector<std::string>& args);
+    int cp(const std::vector<std::string>& args);
+    int mv(const std::vector<std::string>& args);
+    int rm(const std::vector<std::string>& args);
+    int chmod(const std::vector<std::string>& args);
+    int snapshot(const std::vector<std::string>& args);
+    int diff(const std::vector<std::string>& args);
+    int top(const std::vector<std::string>& args);
+    int view(const std::vector<std::string>& args);
+    int stat_paths(const std::vector<std::string>& args);
+    int du(const std::vector<std::string>& args);
+
+    // Runs body on the shared explorer under output_mutex or, with
+    // own_explorers, on a new one writing to a memory file that is copied
+    // to stdout under output_mutex afterwards.
+    bool read_command(const std::function<bool(FileExplorer&)>& body);
+    bool prepare(size_t line, const std::vector<std::string>& args, Command& command);
+    void error(const std::string& command, const std::string& message);
+};
+
+#endif
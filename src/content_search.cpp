@@ -0,0 +1,224 @@
+#include "content_search.h"
+#include "tree_walker.h"
+#include "text_scan.h"
+#include "map_guard.h"
+#include "telemetry.h"
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+// Files up to this size are read with one pread; mapping them would cost
+// more in page-table setup and teardown than the copy.
+const uint64_t kSmallFile = 256 * 1024;
+const size_t kBinaryProbe = 8192;
+const size_t kMaxQueued = 4096;
+
+}
+
+ContentSearch::ContentSearch(const Options& options) : options(options), needle(options.needle) {
+    if(options.ignore_case) {
+        for(auto& c : needle) {
+            c = (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
+        }
+    }
+}
+
+void ContentSearch::scan_buffer(const char* data, size_t len, std::vector<LineMatch>& lines) const {
+    const char* end = data + len;
+    const char* p = data;
+    const char* counted = data;
+    uint64_t line = 1;
+    while(p < end) {
+        const char* hit = find_literal(p, end - p, needle, options.ignore_case);
+        if(!hit) {
+            break;
+        }
+        line += count_newlines(counted, hit - counted);
+        const char* line_start = static_cast<const char*>(memrchr(data, '\n', hit - data));
+        line_start = line_start ? line_start + 1 : data;
+        const char* line_end = static_cast<const char*>(memchr(hit, '\n', end - hit));
+        if(!line_end) {
+            line_end = end;
+        }
+
+        size_t length = line_end - line_start;
+        if(length > 0 && line_start[length - 1] == '\r') {
+            --length;
+        }
+        lines.push_back({line, std::string(line_start, std::min(length, options.max_line))});
+
+        // One row per line, like grep: continue after this line's newline.
+        counted = line_end;
+        p = line_end + 1;
+    }
+}
+
+bool ContentSearch::scan_file(const std::string& path, std::vector<char>& buffer, std::vector<LineMatch>& lines,
+                              Result& local) {
+    TraceSpan span("scan_file");
+    int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if(fd < 0) {
+        ++local.errors;
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    uint64_t size = st.st_size;
+    if(size < options.min_size || (options.max_size != 0 && size > options.max_size)) {
+        close(fd);
+        return false;
+    }
+    ++local.files_scanned;
+    if(size == 0) {
+        close(fd);
+        return true;
+    }
+
+    const char* data = nullptr;
+    void* mapped = MAP_FAILED;
+    if(size <= kSmallFile) {
+        if(buffer.size() < size) {
+            buffer.resize(kSmallFile);
+        }
+        size_t got = 0;
+        while(got < size) {
+            ssize_t n = pread(fd, buffer.data() + got, size - got, got);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                break;
+            }
+            got += n;
+        }
+        size = got;     // the file may have shrunk since fstat
+        data = buffer.data();
+    } else {
+        mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED) {
+            close(fd);
+            ++local.errors;
+            return false;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapped);
+    }
+    close(fd);
+    Telemetry::add(Counter::BytesRead, size);
+
+    {
+        // A file truncated mid-search reads as NULs past its new end.
+        MapGuard guard(mapped != MAP_FAILED ? data : nullptr, size);
+        if(!options.include_binary && memchr(data, 0, std::min<size_t>(size, kBinaryProbe))) {
+            ++local.binary_skipped;
+        } else {
+            local.bytes_scanned += size;
+            scan_buffer(data, size, lines);
+        }
+    }
+    if(mapped != MAP_FAILED) {
+        munmap(mapped, st.st_size);
+    }
+    return true;
+}
+
+ContentSearch::Result ContentSearch::run(const std::string& root, const MatchCallback& callback) {
+    auto start = std::chrono::steady_clock::now();
+    Result result;
+
+    std::mutex queue_mutex;
+    std::condition_variable has_work;
+    std::condition_variable has_room;
+    std::deque<std::string> queue;
+    bool walking = true;
+    std::mutex result_mutex;    // also serialises the callback
+
+    auto scanner = [&]() {
+        std::vector<char> buffer;
+        std::vector<LineMatch> lines;
+        Result local;
+        while(true) {
+            std::string path;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                has_work.wait(lock, [&]() { return !queue.empty() || !walking; });
+                if(queue.empty()) {
+                    break;
+                }
+                path = std::move(queue.front());
+                queue.pop_front();
+            }
+            has_room.notify_one();
+
+            lines.clear();
+            scan_file(path, buffer, lines, local);
+            if(!lines.empty()) {
+                ++local.files_matched;
+                local.lines_matched += lines.size();
+                std::lock_guard<std::mutex> lock(result_mutex);
+                callback(path, lines);
+            }
+        }
+        std::lock_guard<std::mutex> lock(result_mutex);
+        result.files_scanned += local.files_scanned;
+        result.files_matched += local.files_matched;
+        result.lines_matched += local.lines_matched;
+        result.bytes_scanned += local.bytes_scanned;
+        result.binary_skipped += local.binary_skipped;
+        result.errors += local.errors;
+    };
+
+    unsigned threads = options.threads ? options.threads : TreeWalker::default_threads();
+    std::vector<std::thread> pool;
+    for(unsigned i = 0; i < threads; ++i) {
+        pool.emplace_back(scanner);
+    }
+
+    // The walker only lists; reading happens on the scanner pool so one
+    // directory full of large files still spreads across every scanner.
+    TreeWalker walker;
+    const NameMatcher* names = options.names;
+    walker.on_entry([&](const WalkEntry& entry) {
+        std::string_view name(entry.name, entry.name_len);
+        if(entry.is_directory()) {
+            return !(names && names->excluded(name));
+        }
+        if(entry.type != DT_REG || (names && !names->matches(name))) {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        has_room.wait(lock, [&]() { return queue.size() < kMaxQueued; });
+        queue.push_back(entry.path());
+        lock.unlock();
+        has_work.notify_one();
+        return true;
+    });
+    walker.walk(root);
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        walking = false;
+    }
+    has_work.notify_all();
+    for(auto& thread : pool) {
+        thread.join();
+    }
+    result.errors += walker.errors();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
@@ -0,0 +1,64 @@
+#ifndef CONTENT_SEARCH_H
+#define CONTENT_SEARCH_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include "name_matcher.h"
+
+// Literal search inside the files of a tree, like grep -rnF. A TreeWalker
+// feeds regular files to a pool of scanner threads. Small files are read
+// with one pread into a per-thread buffer; large ones are mmap'd under a
+// MapGuard, so one truncated while it is scanned cannot end the search. Files
+// with a NUL byte in their first 8 KiB are treated as binary and skipped.
+class ContentSearch {
+public:
+    struct Options {
+        std::string needle;
+        bool ignore_case = false;
+        const NameMatcher* names = nullptr;   // file name filter; excludes prune dirs
+        uint64_t min_size = 0;
+        uint64_t max_size = 0;                  // 0 means no limit
+        bool include_binary = false;
+        unsigned threads = 0;
+        size_t max_line = 240;                  // longer lines are cut
+    };
+
+    struct LineMatch {
+        uint64_t line;      // 1-based
+        std::string text;
+    };
+
+    struct Result {
+        uint64_t files_scanned = 0;
+        uint64_t files_matched = 0;
+        uint64_t lines_matched = 0;
+        uint64_t bytes_scanned = 0;
+        uint64_t binary_skipped = 0;
+        uint64_t errors = 0;
+        double seconds = 0;
+    };
+
+    // Called once per matching file with all of its lines, serialised, as
+    // soon as that file is done.
+    using MatchCallback = std::function<void(const std::string& path, const std::vector<LineMatch>& lines)>;
+
+    explicit ContentSearch(const Options& options);
+
+    Result run(const std::string& root, const MatchCallback& callback);
+
+    // Scans one buffer; exposed for callers that already hold file data.
+    void scan_buffer(const char* data, size_t len, std::vector<LineMatch>& lines) const;
+
+private:
+    Options options;
+    std::string needle;     // folded when ignoring case
+
+    bool scan_file(const std::string& path, std::vector<char>& buffer, std::vector<LineMatch>& lines,
+                   Result& local);
+};
+
+#endif
@@ -0,0 +1,476 @@
+#include "copy_engine.h"
+#include "telemetry.h"
+#include "tree_walker.h"
+#include "output_buffer.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+namespace {
+
+const size_t kIoChunk = 1024 * 1024;
+const uint64_t kMaxSyscallBytes = uint64_t(1) << 30;
+
+// True when path, or the directory it would be created in, is dir or lies
+// below it. Ancestors are compared by device and inode, so spellings such
+// as "./a" or "a/." and symlinked paths are caught too.
+bool is_within(const std::string& path, const struct stat& dir) {
+    std::string probe = path;
+    struct stat st;
+    if(stat(probe.c_str(), &st) != 0) {
+        while(probe.size() > 1 && probe.back() == '/') {
+            probe.pop_back();
+        }
+        size_t slash = probe.rfind('/');
+        probe = slash == std::string::npos ? "." : slash == 0 ? "/" : probe.substr(0, slash);
+        if(stat(probe.c_str(), &st) != 0) {
+            return false;
+        }
+    }
+    while(true) {
+        if(st.st_dev == dir.st_dev && st.st_ino == dir.st_ino) {
+            return true;
+        }
+        probe += "/..";
+        struct stat up;
+        if(stat(probe.c_str(), &up) != 0 || (up.st_dev == st.st_dev && up.st_ino == st.st_ino)) {
+            return false;       // reached the root
+        }
+        st = up;
+    }
+}
+
+bool is_unsupported(int err) {
+    return err == EXDEV || err == ENOSYS || err == EINVAL || err == EOPNOTSUPP || err == ENOTSUP;
+}
+
+// Copies [pos, pos + len) to the same offset in out_fd, stepping method down
+// whenever the current one is not supported between these two files.
+bool copy_range(int in_fd, int out_fd, uint64_t pos, uint64_t len, CopyEngine::Method& method,
+                std::atomic<uint64_t>* progress) {
+    while(len > 0) {
+        ssize_t n = -1;
+        if(method <= CopyEngine::CopyFileRange) {
+            loff_t in_off = pos;
+            loff_t out_off = pos;
+            n = copy_file_range(in_fd, &in_off, out_fd, &out_off, std::min(len, kMaxSyscallBytes), 0);
+            if(n < 0 && is_unsupported(errno)) {
+                method = CopyEngine::Sendfile;
+                continue;
+            }
+        } else if(method == CopyEngine::Sendfile) {
+            off_t in_off = pos;
+            if(lseek(out_fd, pos, SEEK_SET) < 0) {
+                return false;
+            }
+            n = sendfile(out_fd, in_fd, &in_off, std::min(len, kMaxSyscallBytes));
+            if(n < 0 && is_unsupported(errno)) {
+                method = CopyEngine::ReadWrite;
+                continue;
+            }
+        } else {
+            thread_local std::vector<char> buffer(kIoChunk);
+            n = pread(in_fd, buffer.data(), std::min<uint64_t>(len, buffer.size()), pos);
+            for(ssize_t written = 0; n > 0 && written < n; ) {
+                ssize_t w = pwrite(out_fd, buffer.data() + written, n - written, pos + written);
+                if(w < 0) {
+                    if(errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                written += w;
+            }
+        }
+
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if(n == 0) {
+            errno = ENODATA;    // the source shrank while being copied
+            return false;
+        }
+        pos += n;
+        len -= n;
+        if(progress) {
+            *progress += n;
+        }
+    }
+    return true;
+}
+
+void print_duration(std::ostream& os, double seconds) {
+    long total = static_cast<long>(seconds + 0.5);
+    char text[32];
+    if(total >= 3600) {
+        snprintf(text, sizeof(text), "%ld:%02ld:%02ld", total / 3600, (total / 60) % 60, total % 60);
+    } else {
+        snprintf(text, sizeof(text), "%02ld:%02ld", total / 60, total % 60);
+    }
+    os << text;
+}
+
+std::string human_size(uint64_t bytes) {
+    char text[32];
+    return std::string(text, format_size(text, bytes));
+}
+
+}
+
+CopyEngine::CopyEngine(const Options& options)
+    : options(options), bytes_done(0), bytes_total(0), files_done(0), error_count(0) {
+    for(auto& count : method_counts) {
+        count = 0;
+    }
+}
+
+const char* CopyEngine::method_name(Method method) {
+    switch(method) {
+        case Reflink: return "reflink";
+        case CopyFileRange: return "copy_file_range";
+        case Sendfile: return "sendfile";
+        case ReadWrite: return "read/write";
+        default: return "unknown";
+    }
+}
+
+bool CopyEngine::copy_data(int in_fd, int out_fd, uint64_t size, Method& used, std::atomic<uint64_t>* progress) {
+    if(size > 0 && ioctl(out_fd, FICLONE, in_fd) == 0) {
+        used = Reflink;
+        if(progress) {
+            *progress += size;
+        }
+        return true;
+    }
+
+    used = CopyFileRange;
+    uint64_t offset = 0;
+    while(offset < size) {
+        off_t data = lseek(in_fd, offset, SEEK_DATA);
+        off_t hole;
+        if(data < 0) {
+            if(errno == ENXIO) {
+                break;      // only a hole remains
+            }
+            data = offset;  // no SEEK_DATA support: treat as dense
+            hole = size;
+        } else {
+            hole = lseek(in_fd, data, SEEK_HOLE);
+            if(hole < 0) {
+                hole = size;
+            }
+        }
+        if(uint64_t(data) >= size) {
+            break;
+        }
+        hole = std::min<uint64_t>(hole, size);
+        if(!copy_range(in_fd, out_fd, data, hole - data, used, progress)) {
+            return false;
+        }
+        offset = hole;
+    }
+    // A trailing hole looks the same as a source that shrank; only the
+    // size tells them apart.
+    struct stat st;
+    if(fstat(in_fd, &st) != 0) {
+        return false;
+    }
+    if(uint64_t(st.st_size) < size) {
+        errno = ENODATA;
+        return false;
+    }
+    return ftruncate(out_fd, size) == 0;
+}
+
+void CopyEngine::note_error(const std::string& path, int err) {
+    note_error(path + ": " + std::strerror(err));
+}
+
+void CopyEngine::note_error(const std::string& message) {
+    ++error_count;
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if(first_error.empty()) {
+        first_error = message;
+    }
+}
+
+void CopyEngine::record_source(const struct stat& st) {
+    if(!options.record_sources) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(sources_mutex);
+    sources.push_back({uint64_t(st.st_dev), uint64_t(st.st_ino), uint64_t(st.st_size), st.st_mtim, st.st_mode});
+}
+
+bool CopyEngine::copy_one(const std::string& source, const std::string& target) {
+    TraceSpan span("copy_file");
+    int in_fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if(in_fd < 0) {
+        note_error(source, errno);
+        return false;
+    }
+    struct stat st;
+    int err = 0;
+    if(fstat(in_fd, &st) != 0) {
+        err = errno;
+    } else if(!S_ISREG(st.st_mode)) {
+        err = EINVAL;
+    } else {
+        // Truncating the target must never truncate the source itself.
+        struct stat target_st;
+        if(stat(target.c_str(), &target_st) == 0 && target_st.st_dev == st.st_dev && target_st.st_ino == st.st_ino) {
+            err = EINVAL;
+        }
+    }
+    if(err != 0) {
+        close(in_fd);
+        note_error(source, err);
+        return false;
+    }
+    posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int out_fd = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if(out_fd < 0) {
+        err = errno;
+        close(in_fd);
+        note_error(target, err);
+        return false;
+    }
+
+    Method used;
+    bool ok = copy_data(in_fd, out_fd, st.st_size, used, &bytes_done);
+    err = errno;
+    if(ok && fchmod(out_fd, st.st_mode & 07777) != 0) {
+        ok = false;
+        err = errno;
+    }
+    if(ok && options.preserve_times) {
+        timespec times[2] = {st.st_atim, st.st_mtim};
+        if(futimens(out_fd, times) != 0) {
+            ok = false;
+            err = errno;
+        }
+    }
+    if(close(out_fd) != 0 && ok) {
+        ok = false;
+        err = errno;
+    }
+    close(in_fd);
+
+    if(!ok) {
+        if(err == ENODATA) {
+            note_error(source + ": shrank while being copied");
+        } else {
+            note_error(target, err);
+        }
+        return false;
+    }
+    record_source(st);
+    ++files_done;
+    ++method_counts[used];
+    Telemetry::add(Counter::BytesCopied, st.st_size);
+    return true;
+}
+
+void CopyEngine::report_progress(bool final, double seconds) {
+    uint64_t done = bytes_done;
+    uint64_t total = std::max<uint64_t>(bytes_total, done);
+    double rate = seconds > 0 ? done / seconds : 0;
+
+    std::cerr << "\r  " << human_size(done) << " / " << human_size(total);
+    if(total > 0) {
+        std::cerr << "  " << (done * 100 / total) << "%";
+    }
+    std::cerr << "  " << human_size(static_cast<uint64_t>(rate)) << "/s";
+    if(!final && rate > 0 && total > done) {
+        std::cerr << "  ETA ";
+        print_duration(std::cerr, (total - done) / rate);
+    } else {
+        std::cerr << "  in ";
+        print_duration(std::cerr, seconds);
+    }
+    std::cerr << "    " << (final ? "\n" : "") << std::flush;
+}
+
+CopyEngine::Result CopyEngine::copy(const std::string& source, const std::string& target) {
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    Result result;
+    std::vector<FileJob> jobs;
+    std::vector<DirFixup> dir_modes;
+
+    struct stat st;
+    if(stat(source.c_str(), &st) != 0) {
+        note_error(source, errno);
+    } else if(S_ISDIR(st.st_mode)) {
+        if(!options.recursive) {
+            note_error(source, EISDIR);
+        } else if(is_within(target, st)) {
+            note_error(target, EINVAL);     // would copy into itself forever
+        } else if(mkdir(target.c_str(), S_IRWXU) != 0 && errno != EEXIST) {
+            note_error(target, errno);
+        } else {
+            dir_modes.push_back({target, mode_t(st.st_mode & 07777), {st.st_atim, st.st_mtim}});
+            record_source(st);
+            ++result.directories;
+
+            // Pass 1, in parallel: recreate directories and symlinks and
+            // collect regular files with their sizes so progress has a total.
+            size_t strip = source.size() + (source.back() == '/' ? 0 : 1);
+            std::string base = target.back() == '/' ? target : target + "/";
+            TreeWalker walker;
+            std::vector<std::vector<FileJob>> found(walker.thread_count());
+            std::vector<std::vector<DirFixup>> found_dirs(walker.thread_count());
+            std::atomic<uint64_t> symlinks(0);
+
+            walker.on_entry([&](const WalkEntry& entry) {
+                std::string from = entry.path();
+                std::string to = base + from.substr(strip);
+                struct stat entry_st;
+                Telemetry::add(Counter::MetadataCalls);
+                if(fstatat(entry.dirfd, entry.name, &entry_st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    note_error(from, errno);
+                    return false;
+                }
+                if(S_ISDIR(entry_st.st_mode)) {
+                    if(mkdir(to.c_str(), S_IRWXU) != 0 && errno != EEXIST) {
+                        note_error(to, errno);
+                        return false;
+                    }
+                    found_dirs[entry.worker].push_back({to, mode_t(entry_st.st_mode & 07777),
+                                                        {entry_st.st_atim, entry_st.st_mtim}});
+                    record_source(entry_st);
+                } else if(S_ISREG(entry_st.st_mode)) {
+                    found[entry.worker].push_back({from, to, uint64_t(entry_st.st_size)});
+                    bytes_total += entry_st.st_size;
+                } else if(S_ISLNK(entry_st.st_mode)) {
+                    std::vector<char> link(entry_st.st_size + 1);
+                    ssize_t n = readlinkat(entry.dirfd, entry.name, link.data(), link.size());
+                    if(n < 0) {
+                        note_error(from, errno);
+                        return false;
+                    }
+                    unlink(to.c_str());
+                    if(symlink(std::string(link.data(), n).c_str(), to.c_str()) != 0) {
+                        note_error(to, errno);
+                    } else {
+                        ++symlinks;
+                        record_source(entry_st);
+                        if(options.preserve_times) {
+                            timespec times[2] = {entry_st.st_atim, entry_st.st_mtim};
+                            utimensat(AT_FDCWD, to.c_str(), times, AT_SYMLINK_NOFOLLOW);
+                        }
+                    }
+                } else {
+                    note_error(from, ENOTSUP);
+                }
+                return true;
+            });
+            walker.on_error([&](const std::string& path, int err) {
+                note_error(path, err);
+            });
+            walker.walk(source);
+
+            for(auto& list : found) {
+                std::move(list.begin(), list.end(), std::back_inserter(jobs));
+            }
+            for(auto& list : found_dirs) {
+                result.directories += list.size();
+                std::move(list.begin(), list.end(), std::back_inserter(dir_modes));
+            }
+            result.symlinks = symlinks;
+            // Largest first keeps the pool busy until the end.
+            std::sort(jobs.begin(), jobs.end(), [](const FileJob& a, const FileJob& b) {
+                return a.size > b.size;
+            });
+        }
+    } else {
+        jobs.push_back({source, target, uint64_t(st.st_size)});
+        bytes_total = st.st_size;
+    }
+
+    // Pass 2: a bounded pool of file workers, so many small files do not
+    // wait on each other's latency.
+    std::mutex progress_mutex;
+    std::condition_variable progress_cv;
+    bool copying = true;
+    std::thread progress_thread;
+    bool show_progress = options.progress && isatty(STDERR_FILENO) && !jobs.empty();
+    if(show_progress) {
+        progress_thread = std::thread([&]() {
+            std::unique_lock<std::mutex> lock(progress_mutex);
+            while(!progress_cv.wait_for(lock, std::chrono::milliseconds(250), [&]() { return !copying; })) {
+                report_progress(false, elapsed());
+            }
+        });
+    }
+
+    unsigned workers = options.workers ? options.workers : std::max(4u, TreeWalker::default_threads());
+    workers = static_cast<unsigned>(std::min<size_t>(workers, std::max<size_t>(jobs.size(), 1)));
+    std::atomic<size_t> next_job(0);
+    auto worker = [&]() {
+        for(size_t i = next_job++; i < jobs.size(); i = next_job++) {
+            copy_one(jobs[i].source, jobs[i].target);
+        }
+    };
+    std::vector<std::thread> pool;
+    for(unsigned i = 1; i < workers; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for(auto& thread : pool) {
+        thread.join();
+    }
+
+    // Directory modes and times go on last so read-only directories could
+    // be filled and filling them did not bump their times.
+    for(auto it = dir_modes.rbegin(); it != dir_modes.rend(); ++it) {
+        if(chmod(it->path.c_str(), it->mode) != 0) {
+            note_error(it->path, errno);
+        } else if(options.preserve_times && utimensat(AT_FDCWD, it->path.c_str(), it->times, 0) != 0) {
+            note_error(it->path, errno);
+        }
+    }
+
+    if(show_progress) {
+        {
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            copying = false;
+        }
+        progress_cv.notify_all();
+        progress_thread.join();
+        report_progress(true, elapsed());
+    }
+
+    result.files = files_done;
+    result.expected_bytes = bytes_total;
+    result.bytes = bytes_done;
+    result.errors = error_count;
+    result.sources = std::move(sources);
+    for(int m = 0; m < MethodCount; ++m) {
+        result.by_method[m] = method_counts[m];
+    }
+    result.seconds = elapsed();
+    result.first_error = first_error;
+    return result;
+}
@@ -0,0 +1,100 @@
+#ifndef COPY_ENGINE_H
+#define COPY_ENGINE_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <sys/stat.h>
+
+// File and tree copier. Data moves by the cheapest mechanism the
+// filesystems allow, tried in order: FICLONE reflink, copy_file_range,
+// sendfile, and a 1 MiB read/write loop. Holes are preserved by copying only
+// the SEEK_DATA/SEEK_HOLE extents and sizing the target with ftruncate.
+class CopyEngine {
+public:
+    enum Method {
+        Reflink,
+        CopyFileRange,
+        Sendfile,
+        ReadWrite,
+        MethodCount
+    };
+
+    struct Options {
+        bool recursive = false;
+        bool progress = true;       // live throughput/ETA line on stderr
+        unsigned workers = 0;       // parallel file copies, 0 = default
+        bool preserve_times = false; // keep access and modification times
+        bool record_sources = false; // list what was copied in Result::sources
+    };
+
+    // A source entry as it was when copied.
+    struct Source {
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t size;
+        timespec mtime;
+        mode_t mode;
+    };
+
+    struct Result {
+        uint64_t files = 0;
+        uint64_t expected_bytes = 0;    // source sizes when they were scanned
+        uint64_t directories = 0;
+        uint64_t symlinks = 0;
+        uint64_t bytes = 0;
+        uint64_t errors = 0;
+        uint64_t by_method[MethodCount] = {};
+        double seconds = 0;
+        std::string first_error;
+        std::vector<Source> sources;    // with record_sources
+    };
+
+    explicit CopyEngine(const Options& options);
+
+    // Copies a file (following a symlinked source) or, with recursive set,
+    // a directory tree. Existing target files are replaced.
+    Result copy(const std::string& source, const std::string& target);
+
+    static const char* method_name(Method method);
+
+    // Copies size bytes from in_fd to the empty out_fd, adding to progress
+    // as data lands. Returns false with errno set on failure, ENODATA when
+    // in_fd ends before size.
+    static bool copy_data(int in_fd, int out_fd, uint64_t size, Method& used,
+                          std::atomic<uint64_t>* progress);
+
+private:
+    struct FileJob {
+        std::string source;
+        std::string target;
+        uint64_t size;
+    };
+
+    struct DirFixup {
+        std::string path;
+        mode_t mode;
+        timespec times[2];
+    };
+
+    Options options;
+    std::atomic<uint64_t> bytes_done;
+    std::atomic<uint64_t> bytes_total;
+    std::atomic<uint64_t> files_done;
+    std::atomic<uint64_t> error_count;
+    std::atomic<uint64_t> method_counts[MethodCount];
+    std::mutex error_mutex;
+    std::string first_error;
+    std::mutex sources_mutex;
+    std::vector<Source> sources;
+
+    bool copy_one(const std::string& source, const std::string& target);
+    void note_error(const std::string& path, int err);
+    void note_error(const std::string& message);
+    void record_source(const struct stat& st);
+    void report_progress(bool final, double seconds);
+};
+
+#endif
@@ -0,0 +1,116 @@
+#include "delete_engine.h"
+#include "tree_walker.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+DeleteEngine::DeleteEngine(const Options& options)
+    : options(options), files(0), directories(0), error_count(0), kept(0) {
+}
+
+void DeleteEngine::note_error(const std::string& path, int err) {
+    ++error_count;
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if(first_error.empty()) {
+        first_error = path + ": " + std::strerror(err);
+    }
+}
+
+DeleteEngine::Result DeleteEngine::remove(const std::string& path) {
+    auto start = std::chrono::steady_clock::now();
+    Result result;
+
+    struct stat st;
+    if(lstat(path.c_str(), &st) != 0) {
+        note_error(path, errno);
+    } else if(options.removable && !options.removable(st)) {
+        ++kept;
+    } else if(!S_ISDIR(st.st_mode)) {
+        // A symlink to a directory is a single entry here.
+        if(options.dry_run || unlink(path.c_str()) == 0) {
+            ++files;
+        } else {
+            note_error(path, errno);
+        }
+    } else {
+        std::mutex progress_mutex;
+        std::condition_variable progress_cv;
+        bool running = true;
+        std::thread progress_thread;
+        if(options.progress && isatty(STDERR_FILENO)) {
+            progress_thread = std::thread([&]() {
+                std::unique_lock<std::mutex> lock(progress_mutex);
+                while(!progress_cv.wait_for(lock, std::chrono::milliseconds(250), [&]() { return !running; })) {
+                    std::cerr << "\r  " << (options.dry_run ? "Counted " : "Deleted ") << files << " files, "
+                              << directories << " directories    " << std::flush;
+                }
+            });
+        }
+
+        TreeWalker walker(options.workers);
+        walker.set_strict(true);
+        walker.on_entry([&](const WalkEntry& entry) {
+            if(options.removable) {
+                struct stat entry_st;
+                if(fstatat(entry.dirfd, entry.name, &entry_st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    note_error(entry.path(), errno);
+                    return false;
+                }
+                if(!options.removable(entry_st)) {
+                    ++kept;
+                    return false;
+                }
+            }
+            if(entry.is_directory()) {
+                return true;
+            }
+            if(options.dry_run || unlinkat(entry.dirfd, entry.name, 0) == 0) {
+                ++files;
+            } else {
+                note_error(entry.path(), errno);
+            }
+            return true;
+        });
+        // Children are gone by the time a directory is left. The parent's fd
+        // is closed by then, so the empty directory is removed by path; rmdir
+        // cannot remove anything but an empty directory.
+        walker.on_leave([&](const std::string& dir_path, unsigned) {
+            if(options.dry_run || unlinkat(AT_FDCWD, dir_path.c_str(), AT_REMOVEDIR) == 0) {
+                ++directories;
+            } else if(options.removable && (errno == ENOTEMPTY || errno == EEXIST)) {
+                ++kept;
+            } else {
+                note_error(dir_path, errno);
+            }
+        });
+        walker.on_error([&](const std::string& dir_path, int err) {
+            note_error(dir_path, err);
+        });
+        walker.walk(path);
+
+        if(progress_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                running = false;
+            }
+            progress_cv.notify_all();
+            progress_thread.join();
+            std::cerr << "\r" << std::string(60, ' ') << "\r" << std::flush;
+        }
+    }
+
+    result.files = files;
+    result.directories = directories;
+    result.errors = error_count;
+    result.kept = kept;
+    result.first_error = first_error;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
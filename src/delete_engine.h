@@ -0,0 +1,54 @@
+#ifndef DELETE_ENGINE_H
+#define DELETE_ENGINE_H
+
+#include <string>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <sys/stat.h>
+
+// Parallel recursive delete. Each directory is opened once; its entries are
+// removed with unlinkat relative to that fd while subdirectories fan out to
+// the TreeWalker pool, and a directory is removed once all of its children
+// are gone. Symlinks are unlinked, never followed, and the walk is strict:
+// a directory swapped for a symlink or a mount point is left alone.
+class DeleteEngine {
+public:
+    struct Options {
+        bool dry_run = false;       // count what would be removed
+        bool progress = true;       // live counts on stderr
+        unsigned workers = 0;
+        // When set, only entries it accepts (by their lstat) are removed or,
+        // for directories, entered; the rest are kept, and so is every
+        // directory left not empty.
+        std::function<bool(const struct stat&)> removable;
+    };
+
+    struct Result {
+        uint64_t files = 0;
+        uint64_t directories = 0;
+        uint64_t errors = 0;
+        uint64_t kept = 0;          // refused by removable
+        double seconds = 0;
+        std::string first_error;
+    };
+
+    explicit DeleteEngine(const Options& options);
+
+    // Removes path; a directory is removed with everything below it.
+    Result remove(const std::string& path);
+
+private:
+    Options options;
+    std::atomic<uint64_t> files;
+    std::atomic<uint64_t> directories;
+    std::atomic<uint64_t> error_count;
+    std::atomic<uint64_t> kept;
+    std::mutex error_mutex;
+    std::string first_error;
+
+    void note_error(const std::string& path, int err);
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "dir_cache.h"
+#include "telemetry.h"
+
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+namespace {
+
+// Anything that can change a listed name, type, size, mode, owner or time.
+const uint32_t kWatchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB |
+                            IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+}
+
+DirCache::DirCache(size_t budget_bytes)
+    : budget(budget_bytes), bytes(0), next_token(1) {
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+DirCache::~DirCache() {
+    if(inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+}
+
+std::shared_ptr<DirCache::Snapshot> DirCache::read_snapshot(const std::string& path, bool with_meta, size_t max_bytes) {
+    int dirfd = DirReader::open_dir(path.c_str(), true);
+    if(dirfd < 0) {
+        return nullptr;
+    }
+    auto snapshot = std::make_shared<Snapshot>();
+    snapshot->with_meta = with_meta;
+    DirListing& listing = snapshot->listing;
+    DirReader reader(dirfd);
+    DirReader::Entry raw;
+    while(reader.next(raw)) {
+        listing.records.push_back(listing.make_record(dirfd, raw, with_meta));
+        if(listing.records.size() * sizeof(ListRecord) + listing.arena.size() > max_bytes) {
+            errno = EFBIG;
+            return nullptr;
+        }
+    }
+    snapshot->error = reader.error();
+    snapshot->listing.records.shrink_to_fit();
+    snapshot->listing.arena.shrink_to_fit();
+    snapshot->bytes = snapshot->listing.memory_bytes() + sizeof(Snapshot) + path.size();
+    return snapshot;
+}
+
+void DirCache::poll_events() {
+    if(inotify_fd < 0) {
+        return;
+    }
+    alignas(struct inotify_event) char buffer[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+    while(true) {
+        ssize_t n = read(inotify_fd, buffer, sizeof(buffer));
+        if(n <= 0) {
+            return;
+        }
+        for(char* p = buffer; p < buffer + n; ) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+            if(event->mask & IN_Q_OVERFLOW) {
+                // Events were lost; nothing cached can be trusted.
+                while(!entries.empty()) {
+                    drop(entries.begin());
+                }
+                continue;
+            }
+            auto watch = watches.find(event->wd);
+            if(watch == watches.end()) {
+                continue;
+            }
+            if(event->mask & IN_IGNORED) {
+                // The kernel removed the watch (directory deleted).
+                auto it = entries.find(watch->second);
+                watches.erase(watch);
+                if(it != entries.end()) {
+                    it->second.wd = -1;
+                    drop(it);
+                }
+                continue;
+            }
+            auto it = entries.find(watch->second);
+            if(it != entries.end()) {
+                ++counters.invalidations;
+                drop(it);
+            }
+        }
+    }
+}
+
+void DirCache::drop(std::unordered_map<std::string, Entry>::iterator it) {
+    Entry& entry = it->second;
+    if(entry.snapshot) {
+        bytes -= entry.snapshot->bytes;
+    }
+    if(entry.wd >= 0) {
+        watches.erase(entry.wd);
+        inotify_rm_watch(inotify_fd, entry.wd);
+    }
+    lru.erase(entry.lru);
+    entries.erase(it);
+}
+
+void DirCache::evict_to_budget() {
+    auto victim = lru.end();
+    while(bytes > budget && victim != lru.begin()) {
+        --victim;
+        auto it = entries.find(*victim);
+        if(it == entries.end() || !it->second.snapshot) {
+            continue;   // still being read
+        }
+        auto next = victim;
+        ++next;
+        ++counters.evictions;
+        drop(it);
+        victim = next;
+    }
+}
+
+std::shared_ptr<const DirCache::Snapshot> DirCache::get(const std::string& path, bool with_meta) {
+    uint64_t token = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        poll_events();
+        auto big = oversized.find(path);
+        if(big != oversized.end()) {
+            struct stat st;
+            if(stat(path.c_str(), &st) == 0 && st.st_mtim.tv_sec == big->second.tv_sec &&
+               st.st_mtim.tv_nsec == big->second.tv_nsec) {
+                errno = EFBIG;
+                return nullptr;
+            }
+            oversized.erase(big);
+        }
+        auto it = entries.find(path);
+        if(it != entries.end() && it->second.snapshot && (it->second.snapshot->with_meta || !with_meta)) {
+            ++counters.hits;
+            Telemetry::add(Counter::CacheHits);
+            lru.splice(lru.begin(), lru, it->second.lru);
+            return it->second.snapshot;
+        }
+        ++counters.misses;
+        Telemetry::add(Counter::CacheMisses);
+
+        if(it != entries.end() && it->second.snapshot) {
+            // Cached without metadata: read again with it, under the same watch.
+            bytes -= it->second.snapshot->bytes;
+            it->second.snapshot = nullptr;
+            it->second.token = token = next_token++;
+        }
+
+        // The watch goes on before the directory is read, so a change made
+        // while reading is seen and the result is not kept.
+        if(it == entries.end() && inotify_fd >= 0) {
+            int wd = inotify_add_watch(inotify_fd, path.c_str(), kWatchMask);
+            auto existing = wd >= 0 ? watches.find(wd) : watches.end();
+            if(wd >= 0 && existing == watches.end()) {
+                token = next_token++;
+                lru.push_front(path);
+                entries.emplace(path, Entry{nullptr, wd, token, lru.begin()});
+                watches.emplace(wd, path);
+            }
+            // A watch already owned by another path (the same directory by
+            // another name) is left alone; this path is just not cached.
+        }
+    }
+
+    // The mtime is taken first, so a change while reading is not missed.
+    struct stat before;
+    bool dated = stat(path.c_str(), &before) == 0;
+    std::shared_ptr<Snapshot> snapshot = read_snapshot(path, with_meta, budget / 2);
+    int err = errno;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    poll_events();
+    if(!snapshot && err == EFBIG && dated) {
+        oversized[path] = before.st_mtim;
+    }
+    auto it = entries.find(path);
+    if(it != entries.end() && it->second.token == token && !it->second.snapshot) {
+        if(!snapshot || snapshot->bytes > budget / 2) {
+            drop(it);
+        } else {
+            it->second.snapshot = snapshot;
+            bytes += snapshot->bytes;
+            evict_to_budget();
+        }
+    }
+    errno = err;
+    return snapshot;
+}
+
+bool DirCache::contains(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    poll_events();
+    auto it = entries.find(path);
+    return it != entries.end() && it->second.snapshot;
+}
+
+void DirCache::invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(path);
+    if(it != entries.end() && it->second.snapshot) {
+        ++counters.invalidations;
+        drop(it);
+    }
+}
+
+void DirCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    oversized.clear();
+    for(auto it = entries.begin(); it != entries.end(); ) {
+        auto next = std::next(it);
+        if(it->second.snapshot) {
+            drop(it);
+        }
+        it = next;
+    }
+}
+
+DirCache::Stats DirCache::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    poll_events();
+    Stats result = counters;
+    result.entries = entries.size();
+    result.bytes = bytes;
+    result.budget = budget;
+    return result;
+}
@@ -0,0 +1,89 @@
+#ifndef DIR_CACHE_H
+#define DIR_CACHE_H
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include <ctime>
+#include "dir_listing.h"
+
+// Snapshots of recently visited directories: every entry as a compact
+// ListRecord in directory order, with metadata when a caller asked for it. Each cached directory
+// has an inotify watch; pending events are drained whenever the cache is
+// used and any change to a directory or its entries drops its snapshot, so
+// a hit is never older than the last event the kernel delivered. Snapshots
+// are evicted least recently used first once the memory budget is reached.
+// A directory whose snapshot would take more than half the budget is not
+// read at all; callers list it directly.
+//
+// Safe to use from several threads; directories are read outside the lock.
+class DirCache {
+public:
+    struct Snapshot {
+        DirListing listing;     // with_meta: records carry metadata where statx succeeded
+        bool with_meta = false;
+        int error = 0;          // errno if reading stopped early
+        size_t bytes = 0;
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t invalidations = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+        size_t budget = 0;
+    };
+
+    static const size_t kDefaultBudget = 64 * 1024 * 1024;
+
+    explicit DirCache(size_t budget_bytes = kDefaultBudget);
+    ~DirCache();
+    DirCache(const DirCache&) = delete;
+    DirCache& operator=(const DirCache&) = delete;
+
+    // The snapshot of path, read now if it is not cached, has changed, or
+    // lacks metadata that with_meta asks for. Returns null with errno set if
+    // the directory cannot be opened, or with EFBIG if it is too large to
+    // cache.
+    std::shared_ptr<const Snapshot> get(const std::string& path, bool with_meta = true);
+    // True if path has a snapshot that is still current.
+    bool contains(const std::string& path);
+
+    void invalidate(const std::string& path);
+    void clear();
+    Stats stats();
+
+private:
+    struct Entry {
+        std::shared_ptr<const Snapshot> snapshot;   // null while being read
+        int wd;
+        uint64_t token;
+        std::list<std::string>::iterator lru;
+    };
+
+    size_t budget;
+    int inotify_fd;
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_map<int, std::string> watches;
+    std::list<std::string> lru;     // most recently used at the front
+    // Directories found too large, with their mtime then; a stat is enough
+    // to refuse them again until they change.
+    std::unordered_map<std::string, struct timespec> oversized;
+    size_t bytes;
+    uint64_t next_token;
+    Stats counters;
+
+    void poll_events();
+    void drop(std::unordered_map<std::string, Entry>::iterator it);
+    void evict_to_budget();
+    static std::shared_ptr<Snapshot> read_snapshot(const std::string& path, bool with_meta, size_t max_bytes);
+};
+
+#endif
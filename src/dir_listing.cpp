@@ -0,0 +1,51 @@
+#include "dir_listing.h"
+#include "file_metadata.h"
+
+#include <cerrno>
+
+void DirListing::clear() {
+    records.clear();
+    arena.clear();
+    live_name_bytes = 0;
+}
+
+ListRecord DirListing::make_record(int dirfd, const DirReader::Entry& entry, bool with_meta) {
+    ListRecord record{};
+    record.name_offset = static_cast<uint32_t>(arena.size());
+    record.name_len = static_cast<uint8_t>(std::min<size_t>(entry.name_len, 255));
+    record.type = entry.type;
+    arena.insert(arena.end(), entry.name, entry.name + record.name_len);
+
+    if(entry.type == DT_DIR) {
+        record.flags |= ListRecord::kIsDir;
+    }
+    if(with_meta || entry.type == DT_LNK) {
+        FileMeta meta;
+        if(fetch_metadata(dirfd, entry.name, meta)) {
+            record.flags |= ListRecord::kHaveMeta;
+            record.flags = meta.is_directory() ? (record.flags | ListRecord::kIsDir)
+                                               : (record.flags & ~ListRecord::kIsDir);
+            record.mode = meta.mode;
+            record.nlink = meta.nlink;
+            record.uid = meta.uid;
+            record.gid = meta.gid;
+            record.size = meta.size;
+            record.mtime = meta.mtime;
+        } else {
+            record.error = static_cast<uint8_t>(errno);
+        }
+    }
+    return record;
+}
+
+void DirListing::compact() {
+    std::vector<char> packed;
+    packed.reserve(live_name_bytes);
+    for(ListRecord& record : records) {
+        uint32_t offset = static_cast<uint32_t>(packed.size());
+        packed.insert(packed.end(), arena.begin() + record.name_offset,
+                      arena.begin() + record.name_offset + record.name_len);
+        record.name_offset = offset;
+    }
+    arena.swap(packed);
+}
@@ -0,0 +1,130 @@
+#ifndef DIR_LISTING_H
+#define DIR_LISTING_H
+
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include "tree_walker.h"
+
+enum class ListMode {
+    Sorted,     // compact records, sorted before printing
+    Streaming   // rows printed in directory order as batches arrive
+};
+
+enum class SortField {
+    Name,
+    Natural,    // digit runs compare by value: v2 < v10
+    Size,
+    Mtime,
+    Extension
+};
+
+struct SortSpec {
+    SortField field = SortField::Name;
+    bool descending = false;
+};
+
+struct ListSettings {
+    ListMode mode = ListMode::Sorted;
+    size_t limit = 0;   // 0 means no limit
+    SortSpec sort;
+    bool dir_sizes = false; // sorted mode: directories carry their du total
+};
+
+// Compact per-entry record. The name lives in the owning DirListing's
+// arena, so a record is a fixed 40 bytes however long the name is.
+struct ListRecord {
+    enum Flags : uint8_t {
+        kIsDir = 1,      // directory, or symlink to one
+        kHaveMeta = 2,
+        kHaveUsage = 4   // size is the recursive allocated total
+    };
+
+    uint32_t name_offset;
+    uint8_t name_len;
+    uint8_t type;        // DT_* from getdents
+    uint8_t flags;
+    uint8_t error;       // errno of a failed metadata fetch
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t size;
+    int64_t mtime;
+
+    bool is_dir() const { return flags & kIsDir; }
+    bool have_meta() const { return flags & kHaveMeta; }
+    bool have_usage() const { return flags & kHaveUsage; }
+};
+
+class DirListing {
+public:
+    std::vector<ListRecord> records;
+    std::vector<char> arena;
+
+    void clear();
+    std::string_view name(const ListRecord& record) const {
+        return std::string_view(arena.data() + record.name_offset, record.name_len);
+    }
+
+    // Copies the name into the arena and fills the record. Metadata is fetched
+    // (one statx relative to dirfd) when with_meta is set or the entry is a
+    // symlink whose target type decides the directories-first order.
+    ListRecord make_record(int dirfd, const DirReader::Entry& entry, bool with_meta);
+
+    // Adds a record made by make_record. With a limit, only the `limit`
+    // smallest records by `less` are kept (a bounded max-heap); call
+    // finish_bounded before reading them in order.
+    template<class Less>
+    void push(const ListRecord& record, size_t limit, Less less);
+    template<class Less>
+    void finish_bounded(size_t limit, Less less);
+
+    size_t memory_bytes() const {
+        return records.capacity() * sizeof(ListRecord) + arena.capacity();
+    }
+
+private:
+    size_t live_name_bytes = 0;
+
+    void compact();
+};
+
+template<class Less>
+void DirListing::push(const ListRecord& record, size_t limit, Less less) {
+    if(limit == 0 || records.size() < limit) {
+        records.push_back(record);
+        live_name_bytes += record.name_len;
+        if(limit != 0) {
+            std::push_heap(records.begin(), records.end(), less);
+        }
+        return;
+    }
+
+    if(!less(record, records.front())) {
+        // Rejected: its name was the last thing appended, so take it back.
+        arena.resize(record.name_offset);
+        return;
+    }
+    std::pop_heap(records.begin(), records.end(), less);
+    live_name_bytes -= records.back().name_len;
+    records.back() = record;
+    live_name_bytes += record.name_len;
+    std::push_heap(records.begin(), records.end(), less);
+
+    // Evicted names stay in the arena until they outweigh the live ones.
+    if(arena.size() > 2 * live_name_bytes + 64 * 1024) {
+        compact();
+    }
+}
+
+template<class Less>
+void DirListing::finish_bounded(size_t limit, Less less) {
+    if(limit != 0) {
+        std::sort_heap(records.begin(), records.end(), less);
+    }
+}
+
+#endif
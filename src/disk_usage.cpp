@@ -0,0 +1,211 @@
+#include "disk_usage.h"
+#include "telemetry.h"
+#include "tree_walker.h"
+#include "file_metadata.h"
+
+#include <deque>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+
+DiskUsage::DiskUsage(unsigned threads)
+    : threads(threads ? threads : TreeWalker::default_threads()), generation(0), dirs_scanned(0), dirs_reused(0) {
+}
+
+void DiskUsage::clear() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    cache.clear();
+}
+
+std::shared_ptr<const DiskUsage::Node> DiskUsage::visit(const std::string& path, uint64_t dev, Key& key,
+                                                        std::vector<char>& buffer) {
+    TraceSpan span("du_dir");
+    FileMeta meta;
+    if(!fetch_metadata(AT_FDCWD, path.c_str(), meta, false) || !meta.is_directory()) {
+        return nullptr;
+    }
+    if(dev != 0 && meta.dev != dev) {
+        return nullptr;     // a mount point
+    }
+    key = Key{meta.dev, meta.ino};
+
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto it = cache.find(key);
+        if(it != cache.end() && it->second->mtime == meta.mtime && it->second->mtime_nsec == meta.mtime_nsec) {
+            it->second->generation = generation;
+            ++dirs_reused;
+            return it->second;
+        }
+    }
+
+    // The mtime was taken before reading, so a change made while the
+    // directory is read makes the next measure read it again.
+    auto node = std::make_shared<Node>();
+    node->mtime = meta.mtime;
+    node->mtime_nsec = meta.mtime_nsec;
+    node->generation = generation;
+    node->own.allocated = meta.blocks * 512;
+    node->own.apparent = meta.size;
+    node->own.directories = 1;
+
+    int fd = DirReader::open_dir(path.c_str());
+    if(fd < 0) {
+        node->own.errors = 1;
+    } else {
+        DirReader reader(fd, &buffer);
+        DirReader::Entry entry;
+        FileMeta child;
+        while(reader.next(entry)) {
+            if(!fetch_metadata(fd, entry.name, child, false)) {
+                continue;
+            }
+            if(child.is_directory()) {
+                node->children.emplace_back(std::string(entry.name, entry.name_len), Key{child.dev, child.ino});
+            } else if(child.nlink > 1) {
+                node->linked.push_back({child.ino, child.blocks * 512, child.size});
+            } else {
+                node->own.allocated += child.blocks * 512;
+                node->own.apparent += child.size;
+                ++node->own.files;
+            }
+        }
+        if(reader.error()) {
+            node->own.errors = 1;
+        }
+    }
+    ++dirs_scanned;
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    cache[key] = node;
+    return node;
+}
+
+DiskUsage::Totals DiskUsage::total(const Key& root) {
+    Totals sum;
+    std::vector<std::pair<uint64_t, Linked>> links;
+    std::vector<Key> stack{root};
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    while(!stack.empty()) {
+        Key key = stack.back();
+        stack.pop_back();
+        auto it = cache.find(key);
+        // Nodes not visited this round were skipped: another device, or the
+        // directory vanished.
+        if(it == cache.end() || it->second->generation != generation) {
+            continue;
+        }
+        const Node& node = *it->second;
+        sum.allocated += node.own.allocated;
+        sum.apparent += node.own.apparent;
+        sum.files += node.own.files;
+        sum.directories += node.own.directories;
+        sum.errors += node.own.errors;
+        for(const auto& link : node.linked) {
+            links.emplace_back(key.dev, link);
+        }
+        for(const auto& child : node.children) {
+            stack.push_back(child.second);
+        }
+    }
+
+    std::sort(links.begin(), links.end(), [](const auto& a, const auto& b) {
+        return a.first != b.first ? a.first < b.first : a.second.ino < b.second.ino;
+    });
+    for(size_t i = 0; i < links.size(); ++i) {
+        if(i > 0 && links[i].first == links[i - 1].first && links[i].second.ino == links[i - 1].second.ino) {
+            continue;
+        }
+        sum.allocated += links[i].second.allocated;
+        sum.apparent += links[i].second.apparent;
+        ++sum.files;
+    }
+    return sum;
+}
+
+std::vector<DiskUsage::Totals> DiskUsage::measure(const std::string& parent, const std::vector<std::string>& names) {
+    std::lock_guard<std::mutex> measuring(measure_mutex);
+    ++generation;
+    dirs_scanned = 0;
+    dirs_reused = 0;
+
+    std::string base = parent.empty() || parent.back() == '/' ? parent : parent + "/";
+    std::vector<Key> roots(names.size(), Key{0, 0});
+
+    // One shared queue: a directory job costs at least a stat, so a single
+    // lock is not the bottleneck, and one huge subtree still spreads across
+    // every worker.
+    std::mutex queue_mutex;
+    std::condition_variable queue_cv;
+    std::deque<std::pair<Job, size_t>> queue;
+    size_t active = 0;
+    const size_t kNoRoot = size_t(-1);
+    for(size_t i = 0; i < names.size(); ++i) {
+        queue.push_back({Job{base + names[i], 0}, i});
+    }
+
+    auto worker = [&]() {
+        std::vector<char> buffer(DirReader::kBatchBytes);
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        while(true) {
+            queue_cv.wait(lock, [&]() { return !queue.empty() || active == 0; });
+            if(queue.empty()) {
+                return;
+            }
+            auto job = std::move(queue.back());
+            queue.pop_back();
+            ++active;
+            lock.unlock();
+
+            Key key{0, 0};
+            auto node = visit(job.first.path, job.first.dev, key, buffer);
+            std::vector<std::pair<Job, size_t>> children;
+            if(node) {
+                if(job.second != kNoRoot) {
+                    roots[job.second] = key;
+                }
+                std::string dir = job.first.path + "/";
+                for(const auto& child : node->children) {
+                    children.push_back({Job{dir + child.first, key.dev}, kNoRoot});
+                }
+            }
+
+            lock.lock();
+            --active;
+            for(auto& child : children) {
+                queue.push_back(std::move(child));
+            }
+            if(!children.empty() || (queue.empty() && active == 0)) {
+                queue_cv.notify_all();
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned i = 1; i < threads && !names.empty(); ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for(auto& thread : pool) {
+        thread.join();
+    }
+
+    std::vector<Totals> totals(names.size());
+    for(size_t i = 0; i < names.size(); ++i) {
+        if(roots[i].ino != 0 || roots[i].dev != 0) {
+            totals[i] = total(roots[i]);
+        }
+    }
+
+    // Directories that were not seen this round are gone or unreachable.
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if(cache.size() > kMaxCachedDirs) {
+        for(auto it = cache.begin(); it != cache.end(); ) {
+            it = it->second->generation != generation ? cache.erase(it) : std::next(it);
+        }
+    }
+    return totals;
+}
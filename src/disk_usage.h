@@ -0,0 +1,85 @@
+#ifndef DISK_USAGE_H
+#define DISK_USAGE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Recursive directory sizes, like du -sx. Allocated blocks are counted, a
+// file with several links is counted once per total, and mount points below
+// the measured directory are not entered.
+//
+// Every directory's own totals and its list of subdirectories are cached,
+// keyed by (dev, ino) and valid while its mtime is unchanged. Measuring
+// again costs one stat per directory; only directories whose entries
+// changed are read again. A file that grows in place does not touch its
+// directory's mtime, so clear() forces a full rescan.
+class DiskUsage {
+public:
+    struct Totals {
+        uint64_t allocated = 0;     // bytes of allocated blocks
+        uint64_t apparent = 0;      // sum of file sizes
+        uint64_t files = 0;         // non-directories
+        uint64_t directories = 0;   // including the measured one
+        uint64_t errors = 0;        // directories that could not be read
+    };
+
+    explicit DiskUsage(unsigned threads = 0);
+
+    // Measures parent/name for every name, all on one worker pool. Calls
+    // from several threads take turns, so explorers can share one cache.
+    std::vector<Totals> measure(const std::string& parent, const std::vector<std::string>& names);
+
+    // Directories read and reused from the cache by the last measure().
+    uint64_t scanned() const { return dirs_scanned; }
+    uint64_t reused() const { return dirs_reused; }
+
+    void clear();
+
+private:
+    struct Key {
+        uint64_t dev;
+        uint64_t ino;
+        bool operator==(const Key& other) const { return dev == other.dev && ino == other.ino; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const { return key.ino * 0x9e3779b97f4a7c15ull ^ key.dev; }
+    };
+    // A file with more than one link, resolved across the whole total.
+    struct Linked {
+        uint64_t ino;
+        uint64_t allocated;
+        uint64_t apparent;
+    };
+    struct Node {
+        int64_t mtime;
+        uint32_t mtime_nsec;
+        Totals own;     // the directory itself and its single-link files
+        std::vector<std::pair<std::string, Key>> children;
+        std::vector<Linked> linked;
+        mutable std::atomic<uint64_t> generation;
+    };
+    struct Job {
+        std::string path;
+        uint64_t dev;
+    };
+
+    static const size_t kMaxCachedDirs = 1 << 21;
+
+    unsigned threads;
+    std::mutex measure_mutex;
+    std::mutex cache_mutex;
+    std::unordered_map<Key, std::shared_ptr<const Node>, KeyHash> cache;
+    uint64_t generation;
+    std::atomic<uint64_t> dirs_scanned;
+    std::atomic<uint64_t> dirs_reused;
+
+    std::shared_ptr<const Node> visit(const std::string& path, uint64_t dev, Key& key, std::vector<char>& buffer);
+    Totals total(const Key& root);
+};
+
+#endif
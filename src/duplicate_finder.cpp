@@ -0,0 +1,428 @@
+#include "duplicate_finder.h"
+#include "tree_walker.h"
+#include "hash64.h"
+#include "telemetry.h"
+
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+namespace {
+
+// Bytes hashed at each end of a file in the partial stage. Files up to
+// twice this are read whole by the partial read, so they go straight to
+// the full stage.
+const size_t kSampleBytes = 64 * 1024;
+const size_t kReadBytes = 1024 * 1024;
+// FIDEDUPERANGE may do less than asked in one call; ask in pieces this big.
+const uint64_t kDedupeChunk = 16 * 1024 * 1024;
+
+bool read_at(int fd, char* buffer, size_t len, uint64_t offset) {
+    size_t got = 0;
+    while(got < len) {
+        ssize_t n = pread(fd, buffer + got, len - got, offset + got);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            return false;
+        }
+        got += n;
+    }
+    return true;
+}
+
+// 1 if the two open files hold the same bytes, 0 if not, -1 on a read error.
+int same_contents(int a, int b, uint64_t size, std::vector<char>& buffer) {
+    buffer.resize(2 * kReadBytes);
+    char* left = buffer.data();
+    char* right = left + kReadBytes;
+    for(uint64_t offset = 0; offset < size; offset += kReadBytes) {
+        size_t len = std::min<uint64_t>(kReadBytes, size - offset);
+        if(!read_at(a, left, len, offset) || !read_at(b, right, len, offset)) {
+            return -1;
+        }
+        if(std::memcmp(left, right, len) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+std::string dedup_temp_name(const std::string& path) {
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    return dir + "." + name + ".dedup" + std::to_string(getpid());
+}
+
+void note_error(DuplicateFinder::DedupResult& result, const std::string& path, int err) {
+    ++result.errors;
+    if(result.first_error.empty()) {
+        result.first_error = path + ": " + std::strerror(err);
+    }
+}
+
+// Shares the extents of src with dst; 1 done, 0 contents differ, -errno.
+int dedupe_range(int src, int dst, uint64_t size) {
+    std::vector<char> storage(sizeof(file_dedupe_range) + sizeof(file_dedupe_range_info));
+    file_dedupe_range* range = reinterpret_cast<file_dedupe_range*>(storage.data());
+    uint64_t offset = 0;
+    while(offset < size) {
+        std::memset(storage.data(), 0, storage.size());
+        range->src_offset = offset;
+        range->src_length = std::min(kDedupeChunk, size - offset);
+        range->dest_count = 1;
+        range->info[0].dest_fd = dst;
+        range->info[0].dest_offset = offset;
+        if(ioctl(src, FIDEDUPERANGE, range) != 0) {
+            return -errno;
+        }
+        if(range->info[0].status == FILE_DEDUPE_RANGE_DIFFERS) {
+            return 0;
+        }
+        if(range->info[0].status < 0) {
+            return range->info[0].status;
+        }
+        if(range->info[0].bytes_deduped == 0) {
+            return -EIO;
+        }
+        offset += range->info[0].bytes_deduped;
+    }
+    return 1;
+}
+
+}
+
+DuplicateFinder::DuplicateFinder(const Options& options)
+    : options(options), open_buckets(0), result(nullptr) {
+}
+
+void DuplicateFinder::hash(Bucket& bucket, Candidate& file, std::vector<char>& buffer, uint64_t& bytes_read) {
+    TraceSpan span(bucket.full_stage ? "hash_full" : "hash_partial");
+    int fd = open(file.path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st;
+    // A file that changed size since it was listed no longer belongs here.
+    if(fd < 0 || fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) != bucket.size) {
+        file.failed = true;
+        if(fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    Hash64 hash;
+    uint64_t read = 0;
+    bool ok = true;
+    if(!bucket.full_stage) {
+        buffer.resize(kReadBytes);
+        ok = read_at(fd, buffer.data(), kSampleBytes, 0) &&
+             read_at(fd, buffer.data() + kSampleBytes, kSampleBytes, bucket.size - kSampleBytes);
+        read = 2 * kSampleBytes;
+        hash.update(buffer.data(), read);
+    } else {
+        buffer.resize(kReadBytes);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        for(uint64_t offset = 0; ok && offset < bucket.size; offset += kReadBytes) {
+            size_t len = std::min<uint64_t>(kReadBytes, bucket.size - offset);
+            ok = read_at(fd, buffer.data(), len, offset);
+            hash.update(buffer.data(), len);
+            read += len;
+        }
+        // The page cache is no use for files read once end to end.
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    close(fd);
+    bytes_read += read;
+    Telemetry::add(Counter::BytesRead, read);
+    file.failed = !ok;
+    (bucket.full_stage ? file.full : file.partial) = hash.digest();
+}
+
+void DuplicateFinder::start_stage(Bucket& bucket, const std::vector<size_t>& members, bool full) {
+    bucket.stage = members;
+    bucket.full_stage = full;
+    bucket.pending = members.size();
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        for(size_t index : members) {
+            queue.push_back({&bucket, index});
+        }
+    }
+    has_work.notify_all();
+}
+
+void DuplicateFinder::stage_done(Bucket& bucket) {
+    auto key = [&](size_t index) {
+        return bucket.full_stage ? bucket.files[index].full : bucket.files[index].partial;
+    };
+    std::vector<size_t> members;
+    for(size_t index : bucket.stage) {
+        if(!bucket.files[index].failed) {
+            members.push_back(index);
+        }
+    }
+    std::sort(members.begin(), members.end(), [&](size_t a, size_t b) { return key(a) < key(b); });
+
+    std::vector<size_t> next;
+    std::vector<Group> found;
+    for(size_t i = 0; i < members.size();) {
+        size_t j = i + 1;
+        while(j < members.size() && key(members[j]) == key(members[i])) {
+            ++j;
+        }
+        if(j - i >= 2) {
+            if(bucket.full_stage) {
+                Group group;
+                group.size = bucket.size;
+                for(size_t k = i; k < j; ++k) {
+                    group.paths.push_back(bucket.files[members[k]].path);
+                }
+                std::sort(group.paths.begin(), group.paths.end());
+                found.push_back(std::move(group));
+            } else {
+                next.insert(next.end(), members.begin() + i, members.begin() + j);
+            }
+        }
+        i = j;
+    }
+
+    if(!found.empty()) {
+        std::lock_guard<std::mutex> lock(result_mutex);
+        for(auto& group : found) {
+            result->duplicates += group.paths.size() - 1;
+            result->reclaimable += group.size * (group.paths.size() - 1);
+            result->groups.push_back(std::move(group));
+        }
+    }
+    if(!next.empty()) {
+        start_stage(bucket, next, true);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        --open_buckets;
+    }
+    has_work.notify_all();
+}
+
+void DuplicateFinder::worker(std::vector<char>& buffer) {
+    uint64_t bytes_read = 0;
+    uint64_t partial = 0;
+    uint64_t full = 0;
+    while(true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            has_work.wait(lock, [&]() { return !queue.empty() || open_buckets == 0; });
+            if(queue.empty()) {
+                break;
+            }
+            job = queue.front();
+            queue.pop_front();
+        }
+        Bucket& bucket = *job.bucket;
+        ++(bucket.full_stage ? full : partial);
+        hash(bucket, bucket.files[job.index], buffer, bytes_read);
+        if(--bucket.pending == 0) {
+            stage_done(bucket);
+        }
+    }
+    std::lock_guard<std::mutex> lock(result_mutex);
+    result->bytes_read += bytes_read;
+    result->partial_hashed += partial;
+    result->full_hashed += full;
+}
+
+DuplicateFinder::Result DuplicateFinder::find(const std::string& root) {
+    auto start = std::chrono::steady_clock::now();
+    Result found;
+    result = &found;
+
+    // Listing: one fstatat per regular file, collected per walker thread.
+    TreeWalker walker;
+    std::vector<std::vector<Candidate>> listed(walker.thread_count());
+    std::atomic<uint64_t> stat_errors(0);
+    walker.on_entry([&](const WalkEntry& entry) {
+        if(entry.type != DT_REG) {
+            return true;
+        }
+        struct stat st;
+        Telemetry::add(Counter::MetadataCalls);
+        if(fstatat(entry.dirfd, entry.name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            ++stat_errors;
+            return true;
+        }
+        if(S_ISREG(st.st_mode) && static_cast<uint64_t>(st.st_size) >= options.min_size) {
+            listed[entry.worker].push_back({entry.path(), static_cast<uint64_t>(st.st_size), st.st_dev, st.st_ino,
+                                            0, 0, false});
+        }
+        return true;
+    });
+    walker.walk(root);
+
+    std::vector<Candidate> files;
+    for(auto& part : listed) {
+        std::move(part.begin(), part.end(), std::back_inserter(files));
+        std::vector<Candidate>().swap(part);
+    }
+    found.files = files.size();
+    std::sort(files.begin(), files.end(), [](const Candidate& a, const Candidate& b) {
+        if(a.size != b.size) {
+            return a.size < b.size;
+        }
+        if(a.dev != b.dev || a.ino != b.ino) {
+            return a.dev != b.dev ? a.dev < b.dev : a.ino < b.ino;
+        }
+        return a.path < b.path;
+    });
+
+    // Size buckets with at least two distinct inodes.
+    std::deque<Bucket> buckets;
+    for(size_t i = 0; i < files.size();) {
+        size_t j = i + 1;
+        while(j < files.size() && files[j].size == files[i].size) {
+            ++j;
+        }
+        if(j - i >= 2) {
+            std::vector<Candidate> members;
+            for(size_t k = i; k < j; ++k) {
+                if(!members.empty() && members.back().dev == files[k].dev && members.back().ino == files[k].ino) {
+                    ++found.links_skipped;
+                } else {
+                    members.push_back(std::move(files[k]));
+                }
+            }
+            if(members.size() >= 2) {
+                buckets.emplace_back();
+                buckets.back().size = files[i].size;
+                buckets.back().files = std::move(members);
+            }
+        }
+        i = j;
+    }
+    std::vector<Candidate>().swap(files);
+
+    open_buckets = buckets.size();
+    for(auto& bucket : buckets) {
+        std::vector<size_t> all(bucket.files.size());
+        for(size_t k = 0; k < all.size(); ++k) {
+            all[k] = k;
+        }
+        start_stage(bucket, all, bucket.size <= 2 * kSampleBytes);
+    }
+
+    unsigned threads = options.threads ? options.threads : 2 * TreeWalker::default_threads();
+    std::vector<std::thread> pool;
+    std::vector<std::vector<char>> buffers(threads);
+    for(unsigned i = 0; i < threads; ++i) {
+        pool.emplace_back([this, &buffers, i]() { worker(buffers[i]); });
+    }
+    for(auto& thread : pool) {
+        thread.join();
+    }
+
+    for(const auto& bucket : buckets) {
+        for(const auto& file : bucket.files) {
+            found.errors += file.failed;
+        }
+    }
+    std::sort(found.groups.begin(), found.groups.end(), [](const Group& a, const Group& b) {
+        uint64_t left = a.size * (a.paths.size() - 1);
+        uint64_t right = b.size * (b.paths.size() - 1);
+        return left != right ? left > right : a.paths[0] < b.paths[0];
+    });
+    found.errors += walker.errors() + stat_errors;
+    found.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result = nullptr;
+    return found;
+}
+
+DuplicateFinder::DedupResult DuplicateFinder::dedup(const std::vector<Group>& groups, Dedup mode) {
+    DedupResult result;
+    std::vector<char> buffer;
+    for(const auto& group : groups) {
+        const std::string& keeper = group.paths[0];
+        int keep_fd = open(keeper.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        struct stat keep_st;
+        if(keep_fd < 0 || fstat(keep_fd, &keep_st) != 0) {
+            note_error(result, keeper, errno);
+            if(keep_fd >= 0) {
+                close(keep_fd);
+            }
+            continue;
+        }
+        for(size_t i = 1; i < group.paths.size(); ++i) {
+            const std::string& path = group.paths[i];
+            int fd = open(path.c_str(), (mode == Dedup::Reflink ? O_RDWR : O_RDONLY) | O_NOFOLLOW | O_CLOEXEC);
+            struct stat st;
+            if(fd < 0 || fstat(fd, &st) != 0) {
+                note_error(result, path, errno);
+                if(fd >= 0) {
+                    close(fd);
+                }
+                continue;
+            }
+            if(st.st_dev == keep_st.st_dev && st.st_ino == keep_st.st_ino) {
+                close(fd);
+                continue;
+            }
+            if(st.st_size != keep_st.st_size) {
+                ++result.differed;
+                close(fd);
+                continue;
+            }
+
+            if(mode == Dedup::Reflink) {
+                int status = dedupe_range(keep_fd, fd, st.st_size);
+                if(status == 1) {
+                    ++result.replaced;
+                    result.bytes += st.st_size;
+                } else if(status == 0) {
+                    ++result.differed;
+                } else {
+                    note_error(result, path, -status);
+                }
+                close(fd);
+                continue;
+            }
+
+            if(st.st_dev != keep_st.st_dev) {
+                note_error(result, path, EXDEV);
+                close(fd);
+                continue;
+            }
+            int same = same_contents(keep_fd, fd, st.st_size, buffer);
+            close(fd);
+            if(same < 0) {
+                note_error(result, path, EIO);
+                continue;
+            }
+            if(same == 0) {
+                ++result.differed;
+                continue;
+            }
+            // Link beside the copy, then rename over it: the path is never
+            // missing, and a failure leaves the copy as it was.
+            std::string temp = dedup_temp_name(path);
+            if(link(keeper.c_str(), temp.c_str()) != 0) {
+                note_error(result, path, errno);
+            } else if(rename(temp.c_str(), path.c_str()) != 0) {
+                note_error(result, path, errno);
+                unlink(temp.c_str());
+            } else {
+                ++result.replaced;
+                result.bytes += st.st_size;
+            }
+        }
+        close(keep_fd);
+    }
+    return result;
+}
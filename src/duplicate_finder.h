@@ -0,0 +1,105 @@
+#ifndef DUPLICATE_FINDER_H
+#define DUPLICATE_FINDER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+
+// Finds regular files with identical contents below a root. A TreeWalker
+// lists every file with one fstatat; files are bucketed by size and extra
+// links to an inode already in the bucket are dropped. Buckets then go
+// through two hashing stages on a pool of reader threads: XXH64 of the
+// first and last 64 KiB, then a streaming XXH64 of the whole file for what
+// still matches. There is no barrier between stages: a bucket whose partial
+// hashes are all in queues its full hashes at once, so large files from
+// one bucket are read while other buckets are still being sampled.
+//
+// Groups are decided by hash; dedup() compares bytes before it acts.
+class DuplicateFinder {
+public:
+    enum class Dedup {
+        Hardlink,   // replace each copy with a link to the first
+        Reflink     // share extents with FIDEDUPERANGE; the kernel compares
+    };
+
+    struct Options {
+        uint64_t min_size = 1;      // smaller files are not considered
+        unsigned threads = 0;       // readers; 0 = twice the cores, for I/O overlap
+    };
+
+    // Paths sorted; the first is the one dedup() keeps.
+    struct Group {
+        uint64_t size = 0;
+        std::vector<std::string> paths;
+    };
+
+    struct Result {
+        uint64_t files = 0;             // regular files seen
+        uint64_t links_skipped = 0;     // extra links to an inode in the same bucket
+        uint64_t partial_hashed = 0;
+        uint64_t full_hashed = 0;
+        uint64_t bytes_read = 0;
+        uint64_t duplicates = 0;        // files beyond the first in each group
+        uint64_t reclaimable = 0;       // bytes those files hold
+        uint64_t errors = 0;
+        double seconds = 0;
+        std::vector<Group> groups;      // most reclaimable first
+    };
+
+    struct DedupResult {
+        uint64_t replaced = 0;
+        uint64_t bytes = 0;
+        uint64_t differed = 0;      // changed since the scan; left alone
+        uint64_t errors = 0;
+        std::string first_error;
+    };
+
+    explicit DuplicateFinder(const Options& options);
+
+    Result find(const std::string& root);
+
+    static DedupResult dedup(const std::vector<Group>& groups, Dedup mode);
+
+private:
+    struct Candidate {
+        std::string path;
+        uint64_t size;
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t partial;
+        uint64_t full;
+        bool failed;
+    };
+
+    struct Bucket {
+        uint64_t size;
+        std::vector<Candidate> files;
+        std::vector<size_t> stage;      // indexes being hashed in the current stage
+        std::atomic<size_t> pending;
+        bool full_stage;
+    };
+
+    struct Job {
+        Bucket* bucket;
+        size_t index;
+    };
+
+    Options options;
+    std::mutex queue_mutex;
+    std::condition_variable has_work;
+    std::deque<Job> queue;
+    size_t open_buckets;
+    std::mutex result_mutex;
+    Result* result;
+
+    void worker(std::vector<char>& buffer);
+    void hash(Bucket& bucket, Candidate& file, std::vector<char>& buffer, uint64_t& bytes_read);
+    void stage_done(Bucket& bucket);
+    void start_stage(Bucket& bucket, const std::vector<size_t>& members, bool full);
+};
+
+#endif
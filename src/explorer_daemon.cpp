@@ -0,0 +1,527 @@
+#include "explorer_daemon.h"
+#include "command_runner.h"
+
+#include <thread>
+#include <sstream>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace {
+
+const size_t kHeaderBytes = 5;
+const char* const kServed[] = {"ls", "find", "stat", "du"};
+
+void put_u32(std::string& out, uint32_t value) {
+    for(int i = 0; i < 4; ++i) {
+        out += static_cast<char>(value >> (8 * i));
+    }
+}
+
+void put_u64(std::string& out, uint64_t value) {
+    put_u32(out, static_cast<uint32_t>(value));
+    put_u32(out, static_cast<uint32_t>(value >> 32));
+}
+
+uint32_t get_u32(const char* in) {
+    uint32_t value = 0;
+    for(int i = 0; i < 4; ++i) {
+        value |= uint32_t(static_cast<unsigned char>(in[i])) << (8 * i);
+    }
+    return value;
+}
+
+// Reads fixed-width fields off the front of a payload.
+struct Reader {
+    std::string_view data;
+    bool ok = true;
+
+    const char* take(size_t bytes) {
+        if(!ok || data.size() < bytes) {
+            ok = false;
+            return nullptr;
+        }
+        const char* field = data.data();
+        data.remove_prefix(bytes);
+        return field;
+    }
+    uint8_t u8() {
+        const char* field = take(1);
+        return field ? static_cast<uint8_t>(*field) : 0;
+    }
+    uint32_t u32() {
+        const char* field = take(4);
+        return field ? get_u32(field) : 0;
+    }
+    uint64_t u64() {
+        uint64_t low = u32();
+        return low | uint64_t(u32()) << 32;
+    }
+};
+
+bool send_all(int fd, const char* data, size_t len) {
+    while(len > 0) {
+        ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+        if(sent < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+bool send_frame(int fd, uint8_t type, std::string_view payload) {
+    std::string frame;
+    frame.reserve(kHeaderBytes + payload.size());
+    put_u32(frame, static_cast<uint32_t>(payload.size()));
+    frame += static_cast<char>(type);
+    frame.append(payload);
+    return send_all(fd, frame.data(), frame.size());
+}
+
+bool write_all(int fd, const char* data, size_t len) {
+    while(len > 0) {
+        ssize_t written = write(fd, data, len);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+// The daemon and its clients only deal with a peer running as the same
+// user, or as root.
+bool trusted_peer(int fd) {
+    ucred cred{};
+    socklen_t len = sizeof(cred);
+    if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+        return false;
+    }
+    return cred.uid == geteuid() || cred.uid == 0;
+}
+
+bool frame_ready(const std::string& buffer) {
+    return buffer.size() >= kHeaderBytes && buffer.size() - kHeaderBytes >= get_u32(buffer.data());
+}
+
+}
+
+ExplorerDaemon::ExplorerDaemon(const Options& options)
+    : options(options), caches(std::make_shared<ExplorerCaches>()), listen_fd(-1), epoll_fd(-1), signal_fd(-1),
+      stopping(false), served(0) {
+}
+
+ExplorerDaemon::~ExplorerDaemon() {
+    for(int fd : {listen_fd, epoll_fd, signal_fd}) {
+        if(fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+std::string ExplorerDaemon::default_socket() {
+    const char* runtime = std::getenv("XDG_RUNTIME_DIR");
+    if(runtime && *runtime) {
+        return std::string(runtime) + "/file_explorer.sock";
+    }
+    return "/tmp/file_explorer-" + std::to_string(getuid()) + ".sock";
+}
+
+bool ExplorerDaemon::serves(const std::string& command) {
+    return std::find(std::begin(kServed), std::end(kServed), command) != std::end(kServed);
+}
+
+std::string ExplorerDaemon::encode(const Query& query) {
+    std::string payload;
+    payload += static_cast<char>(query.format);
+    payload += static_cast<char>(query.listing.mode);
+    payload += static_cast<char>(query.listing.sort.field);
+    payload += static_cast<char>(query.listing.sort.descending);
+    payload += static_cast<char>(query.listing.dir_sizes);
+    put_u64(payload, query.listing.limit);
+    put_u32(payload, static_cast<uint32_t>(query.args.size()));
+    for(const auto& arg : query.args) {
+        put_u32(payload, static_cast<uint32_t>(arg.size()));
+        payload += arg;
+    }
+    return payload;
+}
+
+bool ExplorerDaemon::decode(std::string_view payload, Query& query) {
+    Reader in{payload};
+    uint8_t format = in.u8();
+    uint8_t mode = in.u8();
+    uint8_t field = in.u8();
+    query.listing.sort.descending = in.u8() != 0;
+    query.listing.dir_sizes = in.u8() != 0;
+    query.listing.limit = in.u64();
+    if(format > uint8_t(OutputFormat::JsonLines) || mode > uint8_t(ListMode::Streaming) ||
+       field > uint8_t(SortField::Extension)) {
+        return false;
+    }
+    query.format = static_cast<OutputFormat>(format);
+    query.listing.mode = static_cast<ListMode>(mode);
+    query.listing.sort.field = static_cast<SortField>(field);
+    uint32_t count = in.u32();
+    query.args.clear();
+    for(uint32_t i = 0; i < count && in.ok; ++i) {
+        uint32_t len = in.u32();
+        const char* arg = in.take(len);
+        if(arg) {
+            query.args.emplace_back(arg, len);
+        }
+    }
+    return in.ok && in.data.empty();
+}
+
+bool ExplorerDaemon::take_frame(std::string& buffer, uint8_t& type, std::string& payload) {
+    if(!frame_ready(buffer)) {
+        return false;
+    }
+    uint32_t len = get_u32(buffer.data());
+    type = static_cast<uint8_t>(buffer[4]);
+    payload.assign(buffer, kHeaderBytes, len);
+    buffer.erase(0, kHeaderBytes + len);
+    return true;
+}
+
+int ExplorerDaemon::forward(const std::string& socket_path, const Query& query, int out_fd) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if(socket_path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    // A socket someone else put in the way is not our daemon.
+    if(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || !trusted_peer(fd) ||
+       !send_frame(fd, Request, encode(query))) {
+        close(fd);
+        return -1;
+    }
+
+    int status = -1;
+    std::string buffer;
+    std::string payload;
+    std::vector<char> chunk(256 * 1024);
+    uint8_t type = 0;
+    while(status < 0) {
+        while(status < 0 && take_frame(buffer, type, payload)) {
+            if(type == Output) {
+                std::cout.flush();
+                write_all(out_fd, payload.data(), payload.size());
+            } else if(type == Error) {
+                std::cerr << payload << std::flush;
+            } else if(type == Done && !payload.empty()) {
+                status = static_cast<uint8_t>(payload[0]);
+            }
+        }
+        if(status >= 0) {
+            break;
+        }
+        ssize_t n = recv(fd, chunk.data(), chunk.size(), 0);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            std::cerr << "Daemon error: connection closed before the command finished" << std::endl;
+            status = CommandRunner::Failure;
+            break;
+        }
+        buffer.append(chunk.data(), n);
+    }
+    close(fd);
+    return status;
+}
+
+bool ExplorerDaemon::listen_on(std::string& error) {
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if(socket_path.size() >= sizeof(addr.sun_path)) {
+        error = "socket path too long: " + socket_path;
+        return false;
+    }
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+    // A socket file that nobody answers on was left by a daemon that died.
+    struct stat st;
+    if(lstat(socket_path.c_str(), &st) == 0) {
+        if(!S_ISSOCK(st.st_mode)) {
+            error = socket_path + " exists and is not a socket";
+            return false;
+        }
+        if(st.st_uid != geteuid()) {
+            error = socket_path + " belongs to another user";
+            return false;
+        }
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool answered = probe >= 0 && connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+        if(probe >= 0) {
+            close(probe);
+        }
+        if(answered) {
+            error = "a daemon is already listening on " + socket_path;
+            return false;
+        }
+        unlink(socket_path.c_str());
+    }
+
+    // Owner-only from the moment it exists, whatever the umask.
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    mode_t previous_umask = umask(0177);
+    bool bound = listen_fd >= 0 && bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+    int err = errno;
+    umask(previous_umask);
+    if(!bound || chmod(socket_path.c_str(), S_IRUSR | S_IWUSR) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+        error = "cannot listen on " + socket_path + ": " + std::strerror(bound ? errno : err);
+        return false;
+    }
+    return true;
+}
+
+bool ExplorerDaemon::serve(std::string& error) {
+    socket_path = options.socket.empty() ? default_socket() : options.socket;
+    if(!listen_on(error)) {
+        return false;
+    }
+
+    // Stop signals arrive through the event loop; no thread is interrupted.
+    sigset_t signals;
+    sigset_t previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+    std::signal(SIGPIPE, SIG_IGN);
+    signal_fd = signalfd(-1, &signals, SFD_CLOEXEC | SFD_NONBLOCK);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    for(int fd : {listen_fd, signal_fd}) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if(fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            error = std::string("cannot set up the event loop: ") + std::strerror(errno);
+            unlink(socket_path.c_str());
+            pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+            return false;
+        }
+    }
+
+    // An index built for the directory the daemon starts in serves searches.
+    std::string index_file = NameIndex::default_file(fs::current_path().string());
+    std::string index_error;
+    if(access(index_file.c_str(), R_OK) == 0) {
+        if(caches->name_index.load(index_file, index_error) && caches->name_index.start_watch(index_error)) {
+            std::cerr << "Daemon: serving searches under " << caches->name_index.status().root
+                      << " from the filename index" << std::endl;
+        } else {
+            std::cerr << "Daemon: filename index not used: " << index_error << std::endl;
+        }
+    }
+
+    unsigned workers = options.workers ? options.workers : TreeWalker::default_threads();
+    std::vector<std::thread> pool;
+    for(unsigned i = 0; i < workers; ++i) {
+        pool.emplace_back(&ExplorerDaemon::worker_loop, this);
+    }
+    std::cerr << "Daemon: listening on " << socket_path << " with " << workers << " workers" << std::endl;
+
+    bool running = true;
+    epoll_event events[64];
+    while(running) {
+        int ready = epoll_wait(epoll_fd, events, 64, -1);
+        if(ready < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for(int i = 0; i < ready; ++i) {
+            int fd = events[i].data.fd;
+            if(fd == listen_fd) {
+                accept_clients();
+            } else if(fd == signal_fd) {
+                // Consumed here, or it would fire once the mask is restored.
+                signalfd_siginfo info;
+                while(read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                }
+                running = false;
+            } else {
+                auto it = connections.find(fd);
+                if(it != connections.end()) {
+                    receive(*it->second);
+                }
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_ready.notify_all();
+    for(auto& thread : pool) {
+        thread.join();
+    }
+    for(auto& entry : connections) {
+        close(entry.first);
+    }
+    connections.clear();
+    unlink(socket_path.c_str());
+    pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    std::cerr << "Daemon: stopped after " << served << " requests" << std::endl;
+    return true;
+}
+
+void ExplorerDaemon::accept_clients() {
+    while(true) {
+        // Blocking, so a worker streaming rows waits for a slow reader.
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            return;
+        }
+        if(!trusted_peer(fd)) {
+            send_frame(fd, Error, "Daemon error: serves only its own user\n");
+            send_frame(fd, Done, std::string(1, static_cast<char>(CommandRunner::Failure)));
+            close(fd);
+            continue;
+        }
+        auto connection = std::make_unique<Connection>();
+        connection->fd = fd;
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.fd = fd;
+        if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            continue;
+        }
+        connections.emplace(fd, std::move(connection));
+    }
+}
+
+void ExplorerDaemon::receive(Connection& connection) {
+    char chunk[16 * 1024];
+    bool closed = false;
+    while(true) {
+        ssize_t n = recv(connection.fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+        if(n > 0) {
+            connection.buffer.append(chunk, n);
+            if(connection.buffer.size() > kHeaderBytes + kMaxRequestBytes && !frame_ready(connection.buffer)) {
+                closed = true;      // not a client of ours
+                break;
+            }
+            continue;
+        }
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        closed = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        break;
+    }
+    if(frame_ready(connection.buffer) && connection.buffer.size() <= kHeaderBytes + kMaxRequestBytes) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            queue.push_back(&connection);
+        }
+        queue_ready.notify_one();
+        return;
+    }
+    if(closed) {
+        close_connection(connection);
+        return;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    event.data.fd = connection.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+}
+
+void ExplorerDaemon::close_connection(Connection& connection) {
+    int fd = connection.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(fd);
+}
+
+void ExplorerDaemon::worker_loop() {
+    while(true) {
+        Connection* connection;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_ready.wait(lock, [&]() { return !queue.empty() || stopping; });
+            if(queue.empty()) {
+                return;
+            }
+            connection = queue.front();
+            queue.pop_front();
+        }
+        uint8_t type = 0;
+        std::string payload;
+        while(take_frame(connection->buffer, type, payload)) {
+            handle(*connection, type == Request ? std::string_view(payload) : std::string_view());
+        }
+        // Back to the event loop, which sees the next request or the hangup.
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        event.data.fd = connection->fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+    }
+}
+
+void ExplorerDaemon::handle(Connection& connection, std::string_view payload) {
+    Query query;
+    std::ostringstream errors;
+    int status;
+    if(!decode(payload, query) || query.args.empty()) {
+        errors << "Daemon error: malformed request" << std::endl;
+        status = CommandRunner::Usage;
+    } else if(!serves(query.args[0])) {
+        errors << query.args[0] << " error: not served by the daemon" << std::endl;
+        status = CommandRunner::Usage;
+    } else {
+        // Output frames go out as the explorer flushes; it is gone, and its
+        // last rows sent, before the Done frame.
+        CommandRunner::Options runner_options;
+        runner_options.explorer = options.explorer;
+        runner_options.explorer.format = query.format;
+        runner_options.explorer.listing = query.listing;
+        runner_options.explorer.use_cache = true;
+        runner_options.explorer.caches = caches;
+        runner_options.explorer.output_fd = connection.fd;
+        runner_options.explorer.output_frame = Output;
+        runner_options.errors = &errors;
+        CommandRunner runner(runner_options);
+        status = runner.run(query.args);
+        if(status != CommandRunner::Success && errors.tellp() == 0) {
+            // The explorer's own messages went to the daemon's stderr.
+            errors << query.args[0] << " error: failed; details are in the daemon's log" << std::endl;
+        }
+    }
+    std::string text = errors.str();
+    if(!text.empty()) {
+        send_frame(connection.fd, Error, text);
+    }
+    send_frame(connection.fd, Done, std::string(1, static_cast<char>(status)));
+    ++served;
+}
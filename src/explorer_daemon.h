@@ -0,0 +1,111 @@
+#ifndef EXPLORER_DAEMON_H
+#define EXPLORER_DAEMON_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include "file_explorer.h"
+
+// Long-running server for the read-only commands ls, find, stat and du.
+// One process owns the directory cache, the disk usage cache and the
+// filename index, so a client starts warm and a scan one command paid for is
+// reused by the next, instead of every process starting cold.
+//
+// Clients talk over a Unix domain socket in frames: a little-endian u32
+// payload length, a u8 type, then the payload. A client sends one Request
+// (its output format, listing settings and the command words) and gets back
+// Output frames as the rows are produced, at most an Error frame with the
+// command's error messages, and a Done frame holding the exit status.
+//
+// One epoll thread accepts connections and reads requests; complete
+// requests are handed to a pool of workers, which run them with the same
+// code as command mode and write their frames straight to the socket.
+// Requests run with the daemon's own permissions, so the socket is made
+// owner-only and a client is served only if it runs as the daemon's user
+// or as root; clients likewise only talk to a daemon of their own user or
+// root.
+class ExplorerDaemon {
+public:
+    enum FrameType : uint8_t {
+        Request = 1,
+        Output = 2,
+        Error = 3,
+        Done = 4
+    };
+
+    static const uint32_t kMaxRequestBytes = 64 * 1024;
+
+    struct Options {
+        std::string socket;         // default_socket() if empty
+        unsigned workers = 0;       // requests served at once, 0 = one per core
+        ExplorerOptions explorer;
+    };
+
+    struct Query {
+        OutputFormat format = OutputFormat::Human;
+        ListSettings listing;
+        std::vector<std::string> args;      // command and its words, paths absolute
+    };
+
+    explicit ExplorerDaemon(const Options& options);
+    ~ExplorerDaemon();
+    ExplorerDaemon(const ExplorerDaemon&) = delete;
+    ExplorerDaemon& operator=(const ExplorerDaemon&) = delete;
+
+    // Serves until SIGINT or SIGTERM. False if the socket cannot be set up
+    // or another daemon is already listening on it.
+    bool serve(std::string& error);
+
+    // $XDG_RUNTIME_DIR/file_explorer.sock, or /tmp/file_explorer-UID.sock.
+    // An existing socket there that another user owns is refused.
+    static std::string default_socket();
+    static bool serves(const std::string& command);
+
+    // Client side: runs query on the daemon at socket, copying its rows to
+    // out_fd and its errors to stderr. Returns the exit status, or -1 with
+    // nothing printed if no daemon answers.
+    static int forward(const std::string& socket, const Query& query, int out_fd = STDOUT_FILENO);
+
+    static std::string encode(const Query& query);
+    static bool decode(std::string_view payload, Query& query);
+
+private:
+    struct Connection {
+        int fd;
+        std::string buffer;     // bytes received and not yet handled
+    };
+
+    Options options;
+    std::string socket_path;
+    std::shared_ptr<ExplorerCaches> caches;
+    int listen_fd;
+    int epoll_fd;
+    int signal_fd;
+
+    // Connections with a complete request, waiting for a worker. Only the
+    // epoll thread creates and closes connections; while one is queued or
+    // being served its epoll registration is disarmed.
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    std::deque<Connection*> queue;
+    bool stopping;
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    std::atomic<uint64_t> served;
+
+    bool listen_on(std::string& error);
+    void accept_clients();
+    void receive(Connection& connection);
+    void close_connection(Connection& connection);
+    void worker_loop();
+    void handle(Connection& connection, std::string_view payload);
+    static bool take_frame(std::string& buffer, uint8_t& type, std::string& payload);
+};
+
+#endif
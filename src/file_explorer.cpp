@@ -1,7 +1,20 @@
 #include "file_explorer.h"
 
-FileExplorer::FileExplorer() {
+FileExplorer::FileExplorer(const ExplorerOptions& options)
+    : caches(options.caches ? options.caches : std::make_shared<ExplorerCaches>()),
+      name_index(caches->name_index),
+      disk_usage(caches->disk_usage),
+      dir_cache(caches->dir_cache),
+      out(options.output_fd, options.output_frame) {
     current_path = fs::current_path();
+    list_settings = options.listing;
+    output_format = options.format;
+    use_cache = options.use_cache;
+    interactive = options.interactive;
+    if(options.prefetch) {
+        prefetcher = std::make_unique<Prefetcher>(dir_cache);
+        prefetcher->retarget(current_path.string(), {});
+    }
 }
 
 // Fixed time conversion function
@@ -14,6 +27,7 @@ std::time_t FileExplorer::to_time_t(const fs::file_time_type& ftime) {
 void FileExplorer::run() {
     std::cout << "=== File Explorer Application ===" << std::endl;
     std::cout << "Current directory: " << current_path << std::endl;
+    history.load();
     
     while(true) {
         show_menu();
@@ -44,77 +58,357 @@ void FileExplorer::show_menu() {
     std::cout << "8. Create directory" << std::endl;
     std::cout << "9. Search files" << std::endl;
     std::cout << "10. Manage permissions" << std::endl;
+    std::cout << "11. Filename index" << std::endl;
+    std::cout << "12. Listing settings" << std::endl;
+    std::cout << "13. Search file contents" << std::endl;
+    std::cout << "14. Operation statistics" << std::endl;
+    std::cout << "15. Find duplicate files" << std::endl;
+    std::cout << "16. Tree snapshots" << std::endl;
+    std::cout << "17. Largest / oldest files report" << std::endl;
+    std::cout << "18. View file" << std::endl;
     std::cout << "0. Exit" << std::endl;
 }
 
-void FileExplorer::list_files(bool detailed) {
-    std::cout << "\nContents of " << current_path << ":" << std::endl;
-    std::cout << std::string(80, '-') << std::endl;
+bool FileExplorer::list_files(bool detailed) {
+    OpScope scope(detailed ? "list_detailed" : "list");
+    const bool human = output_format == OutputFormat::Human && interactive;
+    if(human) {
+        std::cout << "\nContents of " << current_path << ":" << std::endl;
+        std::cout << std::string(80, '-') << std::endl;
+    }
     
-    try {
-        std::vector<fs::directory_entry> entries;
-        for(const auto& entry : fs::directory_iterator(current_path)) {
-            entries.push_back(entry);
+    DiskUsage::Totals usage_sum;
+    dir_usage.clear();
+    const size_t limit = list_settings.limit;
+    size_t total = 0;
+    size_t shown = 0;
+    int read_error = 0;
+    
+    const bool with_meta = detailed || list_settings.sort.field == SortField::Size ||
+                           list_settings.sort.field == SortField::Mtime;
+    std::shared_ptr<const DirCache::Snapshot> snapshot;
+    if(list_settings.mode == ListMode::Sorted && use_cache) {
+        // A directory too large to cache is read directly below instead.
+        snapshot = dir_cache.get(current_path.string(), with_meta);
+        if(!snapshot && errno != EFBIG) {
+            std::cerr << "Error accessing directory: " << current_path << " - " << std::strerror(errno) << std::endl;
+            return false;
         }
-        
-        std::sort(entries.begin(), entries.end(), [](const fs::directory_entry& a, const fs::directory_entry& b) {
-            bool a_is_dir = a.is_directory();
-            bool b_is_dir = b.is_directory();
-            if(a_is_dir != b_is_dir) {
-                return a_is_dir > b_is_dir;
+    }
+
+    if(list_settings.mode == ListMode::Streaming) {
+        int dirfd = DirReader::open_dir(current_path.c_str(), true);
+        if(dirfd < 0) {
+            std::cerr << "Error accessing directory: " << current_path << " - " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        // Nothing is kept: each row is printed as its getdents batch is read.
+        DirReader reader(dirfd);
+        DirReader::Entry raw;
+        DirListing scratch;
+        while(reader.next(raw)) {
+            ++total;
+            if(limit != 0 && shown >= limit) {
+                continue;
             }
-            return a.path().filename() < b.path().filename();
-        });
-        
-        for(const auto& entry : entries) {
-            if(detailed) {
-                display_file_info(entry);
-            } else {
-                std::string marker = entry.is_directory() ? "[DIR] " : "[FILE]";
-                std::cout << marker << " " << entry.path().filename() << std::endl;
+            scratch.clear();
+            ListRecord record = scratch.make_record(dirfd, raw, detailed);
+            print_list_row(scratch.name(record), record, detailed);
+            ++shown;
+            if(reader.batch_done()) {
+                out.flush();
             }
         }
-        
+        read_error = reader.error();
+    } else {
+        // Compact records only; with a limit, a bounded heap keeps the first
+        // `limit` entries in sort order so memory follows the output size.
+        // Snapshot records go through the same heap, so a cached listing
+        // costs no more than a fresh one.
+        DirListing listing;
+        RecordOrder less(listing, list_settings.sort);
+        // With directory sizes on, subdirectories wait until their totals
+        // are known so size order and the bounded heap both see them.
+        DirListing subdirs;
+        if(snapshot) {
+            for(const auto& cached : snapshot->listing.records) {
+                ++total;
+                const bool held = list_settings.dir_sizes && cached.type == DT_DIR;
+                DirListing& into = held ? subdirs : listing;
+                std::string_view name = snapshot->listing.name(cached);
+                ListRecord record = cached;
+                record.name_offset = static_cast<uint32_t>(into.arena.size());
+                into.arena.insert(into.arena.end(), name.begin(), name.end());
+                if(held) {
+                    subdirs.records.push_back(record);
+                } else {
+                    listing.push(record, limit, less);
+                }
+            }
+            read_error = snapshot->error;
+        } else {
+            int dirfd = DirReader::open_dir(current_path.c_str(), true);
+            if(dirfd < 0) {
+                std::cerr << "Error accessing directory: " << current_path << " - " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            DirReader reader(dirfd);
+            DirReader::Entry raw;
+            while(reader.next(raw)) {
+                ++total;
+                if(list_settings.dir_sizes && raw.type == DT_DIR) {
+                    subdirs.records.push_back(subdirs.make_record(dirfd, raw, with_meta));
+                    continue;
+                }
+                listing.push(listing.make_record(dirfd, raw, with_meta), limit, less);
+            }
+            read_error = reader.error();
+        }
+        if(!subdirs.records.empty()) {
+            add_dir_sizes(subdirs, usage_sum);
+            for(const auto& dir : subdirs.records) {
+                // Re-homed into listing's arena, last, as push expects.
+                std::string_view name = subdirs.name(dir);
+                ListRecord record = dir;
+                record.name_offset = static_cast<uint32_t>(listing.arena.size());
+                listing.arena.insert(listing.arena.end(), name.begin(), name.end());
+                listing.push(record, limit, less);
+            }
+        }
+        if(limit != 0) {
+            listing.finish_bounded(limit, less);
+        } else {
+            sort_listing(listing, list_settings.sort);
+        }
+        for(const auto& record : listing.records) {
+            print_list_row(listing.name(record), record, detailed);
+        }
+        shown = listing.records.size();
+    }
+    out.flush();
+    if(read_error) {
+        std::cerr << "Error reading directory: " << current_path << " - " << std::strerror(read_error) << std::endl;
+    }
+    
+    if(human) {
         std::cout << std::string(80, '-') << std::endl;
-        std::cout << "Total: " << entries.size() << " items" << std::endl;
-        
-    } catch(const fs::filesystem_error& ex) {
-        std::cerr << "Error accessing directory: " << ex.what() << std::endl;
+        std::cout << "Total: " << total << " items";
+        if(shown < total) {
+            std::cout << " (showing " << shown << ")";
+        }
+        if(!dir_usage.empty()) {
+            std::cout << ", " << format_file_size(usage_sum.allocated) << " in " << usage_sum.files
+                      << " files below subdirectories";
+        }
+        std::cout << std::endl;
     }
+    return read_error == 0;
 }
 
-void FileExplorer::display_file_info(const fs::directory_entry& entry) {
-    try {
-        fs::file_status status = entry.status();
-        fs::perms permissions = status.permissions();
-        
-        std::cout << get_permissions_string(permissions) << " ";
-        std::cout << std::setw(3) << entry.hard_link_count() << " ";
-        
-        struct stat file_stat;
-        if(stat(entry.path().c_str(), &file_stat) == 0) {
-            struct passwd* pw = getpwuid(file_stat.st_uid);
-            struct group* gr = getgrgid(file_stat.st_gid);
-            std::cout << std::setw(8) << (pw ? pw->pw_name : "unknown") << " ";
-            std::cout << std::setw(8) << (gr ? gr->gr_name : "unknown") << " ";
-            
-            if(entry.is_directory()) {
-                std::cout << std::setw(8) << "<DIR>" << " ";
-            } else {
-                std::cout << std::setw(8) << format_file_size(entry.file_size()) << " ";
+void FileExplorer::add_dir_sizes(DirListing& listing, DiskUsage::Totals& usage_sum) {
+    std::vector<std::string> names;
+    std::vector<ListRecord*> dirs;
+    for(auto& record : listing.records) {
+        if(record.type == DT_DIR) {
+            names.emplace_back(listing.name(record));
+            dirs.push_back(&record);
+        }
+    }
+    if(names.empty()) {
+        return;
+    }
+    std::vector<DiskUsage::Totals> totals = disk_usage.measure(current_path.string(), names);
+    for(size_t i = 0; i < dirs.size(); ++i) {
+        if(totals[i].directories > 0) {
+            dirs[i]->size = totals[i].allocated;
+            dirs[i]->flags |= ListRecord::kHaveUsage;
+            dir_usage[names[i]] = totals[i];
+            usage_sum.allocated += totals[i].allocated;
+            usage_sum.files += totals[i].files;
+        }
+    }
+}
+
+void FileExplorer::print_list_row(std::string_view name, const ListRecord& record, bool detailed) {
+    if(detailed && !record.have_meta()) {
+        out.flush();
+        std::cerr << "Error getting info for: " << (current_path / name) << " - " << std::strerror(record.error) << std::endl;
+        return;
+    }
+    
+    switch(output_format) {
+        case OutputFormat::Human:
+            if(detailed) {
+                display_file_info(name, record);
+                return;
+            }
+            out.append(record.is_dir() ? "[DIR]  " : "[FILE] ");
+            out.append_quoted(name);
+            break;
+        case OutputFormat::Tsv:
+            out.append(entry_type_name(record));
+            out.append('\t');
+            out.append_tsv_field(name);
+            if(detailed) {
+                IdNameCache& ids = IdNameCache::instance();
+                out.append('\t');
+                out.append_uint(record.size);
+                out.append('\t');
+                out.append_int(record.mtime);
+                out.append('\t');
+                out.append_octal(record.mode & 07777, 4);
+                out.append('\t');
+                out.append_uint(record.nlink);
+                out.append('\t');
+                out.append_tsv_field(ids.user_name(record.uid));
+                out.append('\t');
+                out.append_tsv_field(ids.group_name(record.gid));
+            }
+            break;
+        case OutputFormat::JsonLines:
+            out.append("{\"type\":\"");
+            out.append(entry_type_name(record));
+            out.append("\",\"name\":");
+            out.append_json_string(name);
+            if(detailed) {
+                IdNameCache& ids = IdNameCache::instance();
+                out.append(",\"size\":");
+                out.append_uint(record.size);
+                out.append(",\"mtime\":");
+                out.append_int(record.mtime);
+                out.append(",\"mode\":\"");
+                out.append_octal(record.mode & 07777, 4);
+                out.append("\",\"nlink\":");
+                out.append_uint(record.nlink);
+                out.append(",\"user\":");
+                out.append_json_string(ids.user_name(record.uid));
+                out.append(",\"group\":");
+                out.append_json_string(ids.group_name(record.gid));
+            }
+            if(record.have_usage()) {
+                auto usage = dir_usage.find(std::string(name));
+                if(usage != dir_usage.end()) {
+                    out.append(",\"du\":");
+                    out.append_uint(usage->second.allocated);
+                    out.append(",\"files\":");
+                    out.append_uint(usage->second.files);
+                }
+            }
+            out.append('}');
+            break;
+    }
+    out.end_row();
+}
+
+void FileExplorer::display_file_info(std::string_view name, const ListRecord& record) {
+    IdNameCache& ids = IdNameCache::instance();
+    
+    out.append_permissions(record.mode);
+    out.append(' ');
+    out.append_uint_padded(record.nlink, 3);
+    out.append(' ');
+    out.append_padded(ids.user_name(record.uid), 8);
+    out.append(' ');
+    out.append_padded(ids.group_name(record.gid), 8);
+    out.append(' ');
+    
+    if(S_ISDIR(record.mode) && !record.have_usage()) {
+        out.append_padded("<DIR>", 8);
+    } else {
+        char size_text[32];
+        out.append_padded(std::string_view(size_text, format_size(size_text, record.size)), 8);
+    }
+    out.append(' ');
+    
+    out.append_time(record.mtime);
+    out.append(' ');
+    out.append_quoted(name);
+    out.end_row();
+}
+
+const char* FileExplorer::entry_type_name(const ListRecord& record) {
+    switch(record.type) {
+        case DT_DIR: return "dir";
+        case DT_REG: return "file";
+        case DT_LNK: return "symlink";
+        case DT_FIFO: return "fifo";
+        case DT_SOCK: return "socket";
+        case DT_CHR: return "char";
+        case DT_BLK: return "block";
+        default: return record.is_dir() ? "dir" : "unknown";
+    }
+}
+
+void FileExplorer::list_settings_menu() {
+    std::cout << "\n=== Listing Settings ===" << std::endl;
+    std::cout << "Mode: " << (list_settings.mode == ListMode::Streaming ? "streaming" : "sorted")
+              << ", order: " << sort_field_name(list_settings.sort.field)
+              << (list_settings.sort.descending ? " (descending)" : "")
+              << ", limit: " << (list_settings.limit ? std::to_string(list_settings.limit) : "none")
+              << ", directory sizes: " << (list_settings.dir_sizes ? "on" : "off")
+              << ", format: " << output_format_name(output_format) << std::endl;
+    std::cout << "1. Sorted (compact records, directories first)" << std::endl;
+    std::cout << "2. Streaming (directory order, rows appear as they are read)" << std::endl;
+    std::cout << "Choose mode: ";
+    
+    int option;
+    std::cin >> option;
+    std::cin.ignore();
+    if(option == 1) {
+        list_settings.mode = ListMode::Sorted;
+    } else if(option == 2) {
+        list_settings.mode = ListMode::Streaming;
+    } else {
+        std::cout << "Invalid option!" << std::endl;
+        return;
+    }
+    
+    if(list_settings.mode == ListMode::Sorted) {
+        std::cout << "Sort by (name, natural, size, mtime, ext): ";
+        std::string field_str;
+        std::getline(std::cin, field_str);
+        SortField field;
+        if(!field_str.empty()) {
+            if(!parse_sort_field(field_str, field)) {
+                std::cout << "Invalid sort order!" << std::endl;
+                return;
             }
-            
-            // FIXED: Using the new time conversion function
-            auto ftime = fs::last_write_time(entry.path());
-            std::time_t mod_time = to_time_t(ftime);
-            std::cout << std::put_time(std::localtime(&mod_time), "%Y-%m-%d %H:%M") << " ";
+            list_settings.sort.field = field;
         }
         
-        std::cout << entry.path().filename() << std::endl;
+        std::cout << "Descending? (y/n): ";
+        char response;
+        std::cin >> response;
+        std::cin.ignore();
+        list_settings.sort.descending = (response == 'y' || response == 'Y');
         
-    } catch(const fs::filesystem_error& ex) {
-        std::cerr << "Error getting info for: " << entry.path() << " - " << ex.what() << std::endl;
+        std::cout << "Show recursive directory sizes? (y/n, r to rescan): ";
+        std::cin >> response;
+        std::cin.ignore();
+        list_settings.dir_sizes = (response == 'y' || response == 'Y' || response == 'r' || response == 'R');
+        if(response == 'r' || response == 'R') {
+            disk_usage.clear();
+        }
+    }
+    
+    std::cout << "Output format (human, tsv, json): ";
+    std::string format_str;
+    std::getline(std::cin, format_str);
+    if(!format_str.empty() && !parse_output_format(format_str, output_format)) {
+        std::cout << "Invalid output format!" << std::endl;
+        return;
+    }
+    
+    std::cout << "Row limit (0 for none): ";
+    std::string limit_str;
+    std::getline(std::cin, limit_str);
+    try {
+        list_settings.limit = limit_str.empty() ? 0 : std::stoul(limit_str);
+    } catch(const std::exception& ex) {
+        std::cerr << "Invalid limit!" << std::endl;
+        return;
     }
+    std::cout << "Listing settings updated." << std::endl;
 }
 
 std::string FileExplorer::get_permissions_string(fs::perms p) {
@@ -134,20 +428,19 @@ std::string FileExplorer::get_permissions_string(fs::perms p) {
 }
 
 std::string FileExplorer::format_file_size(uintmax_t size) {
-    std::ostringstream oss;
-    if(size < 1024) {
-        oss << size << "B";
-    } else if(size < 1024 * 1024) {
-        oss << std::fixed << std::setprecision(1) << (size / 1024.0) << "K";
-    } else if(size < 1024 * 1024 * 1024) {
-        oss << std::fixed << std::setprecision(1) << (size / (1024.0 * 1024.0)) << "M";
-    } else {
-        oss << std::fixed << std::setprecision(1) << (size / (1024.0 * 1024.0 * 1024.0)) << "G";
-    }
-    return oss.str();
+    char text[32];
+    return std::string(text, format_size(text, size));
 }
 
 void FileExplorer::handle_choice(int choice) {
+    // Copies, moves, deletes and tree-wide searches compete with the
+    // prefetcher for the disk, and what it still had queued is stale by the
+    // time they finish; the next directory change queues fresh work.
+    bool heavy = choice == 4 || choice == 5 || choice == 6 || choice == 9 || choice == 13 ||
+                 choice == 15 || choice == 16 || choice == 17;
+    if(heavy && prefetcher) {
+        prefetcher->cancel();
+    }
     switch(choice) {
         case 1:
             list_files(false);
@@ -179,6 +472,30 @@ void FileExplorer::handle_choice(int choice) {
         case 10:
             manage_permissions();
             break;
+        case 11:
+            manage_index();
+            break;
+        case 12:
+            list_settings_menu();
+            break;
+        case 13:
+            search_contents();
+            break;
+        case 14:
+            show_stats();
+            break;
+        case 15:
+            find_duplicates();
+            break;
+        case 16:
+            snapshot_menu();
+            break;
+        case 17:
+            top_files_menu();
+            break;
+        case 18:
+            view_menu();
+            break;
         default:
             std::cout << "Invalid choice!" << std::endl;
     }
@@ -191,12 +508,15 @@ void FileExplorer::navigate() {
     std::cout << "2. Go to subdirectory" << std::endl;
     std::cout << "3. Go to home directory" << std::endl;
     std::cout << "4. Go to specific path" << std::endl;
+    std::cout << "5. Fuzzy jump (everything under a directory)" << std::endl;
+    std::cout << "6. Fuzzy jump (recently visited)" << std::endl;
     std::cout << "Choose option: ";
     
     int option;
     std::cin >> option;
     std::cin.ignore();
     
+    const fs::path previous = current_path;
     try {
         switch(option) {
             case 1: {
@@ -211,10 +531,23 @@ void FileExplorer::navigate() {
             case 2: {
                 std::cout << "Available directories:" << std::endl;
                 std::vector<std::string> directories;
-                for(const auto& entry : fs::directory_iterator(current_path)) {
-                    if(entry.is_directory()) {
-                        directories.push_back(entry.path().filename());
-                        std::cout << "- " << entry.path().filename() << std::endl;
+                std::shared_ptr<const DirCache::Snapshot> snapshot;
+                if(use_cache) {
+                    snapshot = dir_cache.get(current_path.string(), false);
+                }
+                if(snapshot) {
+                    for(const auto& record : snapshot->listing.records) {
+                        if(record.is_dir()) {
+                            directories.emplace_back(snapshot->listing.name(record));
+                            std::cout << "- " << fs::path(directories.back()) << std::endl;
+                        }
+                    }
+                } else {
+                    for(const auto& entry : fs::directory_iterator(current_path)) {
+                        if(entry.is_directory()) {
+                            directories.push_back(entry.path().filename());
+                            std::cout << "- " << entry.path().filename() << std::endl;
+                        }
                     }
                 }
                 
@@ -260,12 +593,234 @@ void FileExplorer::navigate() {
                 }
                 break;
             }
+            case 5:
+            case 6: {
+                FuzzyFinder finder;
+                if(option == 5) {
+                    std::cout << "Search under (Enter for current directory): ";
+                    std::string root_str;
+                    std::getline(std::cin, root_str);
+                    fs::path root = root_str.empty() ? current_path : fs::path(root_str);
+                    if(!fs::is_directory(root)) {
+                        std::cout << "Path does not exist or is not a directory!" << std::endl;
+                        break;
+                    }
+                    OpScope scope("fuzzy_load");
+                    auto start = std::chrono::steady_clock::now();
+                    finder.load_tree(fs::canonical(root).string(), frecency_bonuses());
+                    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+                    std::cout << "Loaded " << finder.size() << " paths in " << elapsed.count() << " ms";
+                    if(finder.walk_errors() > 0) {
+                        std::cout << " (" << finder.walk_errors() << " unreadable)";
+                    }
+                    std::cout << std::endl;
+                } else {
+                    FuzzyFinder::Bonuses bonuses = frecency_bonuses();
+                    for(const auto& path : history.ranked(std::time(nullptr))) {
+                        finder.add(path, bonuses[path]);
+                    }
+                }
+                if(finder.size() == 0) {
+                    std::cout << (option == 5 ? "Nothing to search." : "No directories visited yet.") << std::endl;
+                    break;
+                }
+                std::string chosen = fuzzy_pick(finder);
+                if(chosen.empty()) {
+                    std::cout << "Cancelled." << std::endl;
+                    break;
+                }
+                // A file takes us to the directory holding it.
+                fs::path new_path(chosen);
+                if(!fs::is_directory(new_path)) {
+                    new_path = new_path.parent_path();
+                }
+                if(fs::is_directory(new_path)) {
+                    current_path = new_path;
+                    std::cout << "Moved to: " << current_path << std::endl;
+                } else {
+                    std::cout << "Directory not found!" << std::endl;
+                }
+                break;
+            }
             default:
                 std::cout << "Invalid option!" << std::endl;
         }
     } catch(const fs::filesystem_error& ex) {
         std::cerr << "Navigation error: " << ex.what() << std::endl;
     }
+    if(current_path != previous) {
+        entered_directory(previous);
+    }
+}
+
+void FileExplorer::entered_directory(const fs::path& previous) {
+    const size_t kRecentDirs = 8;
+    auto seen = std::find(recent_dirs.begin(), recent_dirs.end(), previous.string());
+    if(seen != recent_dirs.end()) {
+        recent_dirs.erase(seen);
+    }
+    recent_dirs.push_front(previous.string());
+    if(recent_dirs.size() > kRecentDirs) {
+        recent_dirs.pop_back();
+    }
+    if(prefetcher) {
+        prefetcher->retarget(current_path.string(), std::vector<std::string>(recent_dirs.begin(), recent_dirs.end()));
+    }
+    // Best effort: a read-only cache directory just means no ranking.
+    history.record(current_path.string(), std::time(nullptr));
+}
+
+FuzzyFinder::Bonuses FileExplorer::frecency_bonuses() {
+    // Logarithmic, so a handful of visits lifts a path above plain matches
+    // without a favourite drowning out a much better match.
+    FuzzyFinder::Bonuses bonuses;
+    const int64_t now = std::time(nullptr);
+    for(const auto& entry : history.visits()) {
+        double frecency = VisitHistory::frecency(entry.second, now);
+        bonuses[entry.first] = static_cast<int32_t>(std::min(64.0, 8 * std::log2(1 + frecency)));
+    }
+    return bonuses;
+}
+
+std::string FileExplorer::fuzzy_pick(FuzzyFinder& finder) {
+    OpScope scope("fuzzy_pick");
+    if(isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)) {
+        return fuzzy_pick_keys(finder);
+    }
+    return fuzzy_pick_lines(finder);
+}
+
+// Raw terminal mode: the list is redrawn under the prompt on every key.
+std::string FileExplorer::fuzzy_pick_keys(FuzzyFinder& finder) {
+    termios saved;
+    if(tcgetattr(STDIN_FILENO, &saved) != 0) {
+        return fuzzy_pick_lines(finder);
+    }
+    termios raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    winsize window{};
+    const bool sized = ioctl(STDOUT_FILENO, TIOCGWINSZ, &window) == 0;
+    const size_t width = sized && window.ws_col > 4 ? window.ws_col : 80;
+    // The list has to fit below the prompt for the cursor to find its way back.
+    const size_t rows = sized && window.ws_row > 4 ? std::min<size_t>(FuzzyFinder::kTopResults, window.ws_row - 3)
+                                                   : FuzzyFinder::kTopResults;
+
+    std::cout << "Type to filter; Up/Down or Ctrl-P/Ctrl-N select, Enter jumps, Esc cancels." << std::endl;
+    std::string query;
+    std::string chosen;
+    size_t selected = 0;
+    double ms = 0;
+    std::vector<FuzzyFinder::Match> matches = finder.top(rows);
+    while(true) {
+        std::string screen = "\r\x1b[J> " + query;
+        char status[96];
+        std::snprintf(status, sizeof(status), "\r\n  %zu/%zu  (%.2f ms)", finder.candidates(), finder.size(), ms);
+        screen += status;
+        for(size_t i = 0; i < matches.size(); ++i) {
+            std::string_view path = finder.path(matches[i].id);
+            if(path.size() > width - 3) {
+                path = path.substr(path.size() - (width - 3));
+            }
+            screen += i == selected ? "\r\n\x1b[7m> " : "\r\n  ";
+            screen.append(path.data(), path.size());
+            if(i == selected) {
+                screen += "\x1b[0m";
+            }
+        }
+        screen += "\x1b[" + std::to_string(matches.size() + 1) + "A\r\x1b[" + std::to_string(query.size() + 2) + "C";
+        std::cout << screen << std::flush;
+
+        char c;
+        if(read(STDIN_FILENO, &c, 1) != 1) {
+            break;
+        }
+        std::string next = query;
+        if(c == '\r' || c == '\n') {
+            if(!matches.empty()) {
+                chosen = finder.full_path(matches[selected].id);
+            }
+            break;
+        } else if(c == 3) {         // Ctrl-C
+            break;
+        } else if(c == 27) {        // Esc alone, or an arrow key
+            pollfd fd{STDIN_FILENO, POLLIN, 0};
+            char seq[2];
+            if(poll(&fd, 1, 30) <= 0 || read(STDIN_FILENO, seq, 2) != 2 || seq[0] != '[') {
+                break;
+            }
+            c = seq[1] == 'A' ? 16 : seq[1] == 'B' ? 14 : 0;
+        }
+        if(c == 16) {               // Ctrl-P
+            selected = selected > 0 ? selected - 1 : 0;
+            continue;
+        } else if(c == 14) {        // Ctrl-N
+            selected = selected + 1 < matches.size() ? selected + 1 : selected;
+            continue;
+        } else if(c == 127 || c == 8) {
+            if(!next.empty()) {
+                next.pop_back();
+            }
+        } else if(c == 21) {        // Ctrl-U
+            next.clear();
+        } else if(static_cast<unsigned char>(c) >= 32) {
+            next += c;
+        }
+        if(next == query) {
+            continue;
+        }
+        query = next;
+        auto start = std::chrono::steady_clock::now();
+        finder.set_query(query);
+        matches = finder.top(rows);
+        ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        selected = 0;
+    }
+    std::cout << "\r\x1b[J" << std::flush;
+    tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    return chosen;
+}
+
+// Line at a time, for pipes and dumb terminals: a query, then a number.
+std::string FileExplorer::fuzzy_pick_lines(FuzzyFinder& finder) {
+    std::cout << "Fuzzy query (empty to cancel): ";
+    std::string query;
+    if(!std::getline(std::cin, query)) {
+        return "";
+    }
+    while(!query.empty()) {
+        auto start = std::chrono::steady_clock::now();
+        finder.set_query(query);
+        std::vector<FuzzyFinder::Match> matches = finder.top();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << finder.candidates() << " of " << finder.size() << " paths match (" << std::fixed
+                  << std::setprecision(2) << ms << " ms)" << std::defaultfloat << std::endl;
+        for(size_t i = 0; i < matches.size(); ++i) {
+            std::cout << std::setw(3) << i + 1 << ". " << finder.path(matches[i].id) << std::endl;
+        }
+        std::cout << (matches.empty() ? "New query (empty to cancel): "
+                                      : "Choose number (Enter for 1, 0 to cancel, text to search again): ");
+        std::string answer;
+        if(!std::getline(std::cin, answer)) {
+            return "";
+        }
+        if(!matches.empty()) {
+            if(answer.empty()) {
+                return finder.full_path(matches[0].id);
+            }
+            if(answer.find_first_not_of("0123456789") == std::string::npos) {
+                size_t number = std::strtoul(answer.c_str(), nullptr, 10);
+                if(number == 0 || number > matches.size()) {
+                    return "";
+                }
+                return finder.full_path(matches[number - 1].id);
+            }
+        }
+        query = answer;
+    }
+    return "";
 }
 
 void FileExplorer::copy_file() {
@@ -297,19 +852,67 @@ void FileExplorer::copy_file() {
             }
         }
         
-        fs::copy(source_path, dest_path, fs::copy_options::overwrite_existing);
-        std::cout << "File copied successfully!" << std::endl;
+        CopyEngine::Options options;
+        if(fs::is_directory(source_path)) {
+            std::cout << "Source is a directory. Copy recursively? (y/n): ";
+            char response;
+            std::cin >> response;
+            std::cin.ignore();
+            if(response != 'y' && response != 'Y') {
+                std::cout << "Copy cancelled." << std::endl;
+                return;
+            }
+            options.recursive = true;
+        }
+        
+        OpScope scope("copy");
+        CopyEngine engine(options);
+        CopyEngine::Result result = engine.copy(source_path.string(), dest_path.string());
+        print_copy_result(result);
+        if(result.errors == 0) {
+            std::cout << (options.recursive ? "Directory copied successfully!" : "File copied successfully!") << std::endl;
+        }
         
     } catch(const fs::filesystem_error& ex) {
         std::cerr << "Copy error: " << ex.what() << std::endl;
     }
 }
 
+void FileExplorer::print_copy_result(const CopyEngine::Result& result) {
+    std::cout << "Copied " << result.files << " files";
+    if(result.directories > 0) {
+        std::cout << ", " << result.directories << " directories";
+    }
+    if(result.symlinks > 0) {
+        std::cout << ", " << result.symlinks << " symlinks";
+    }
+    std::cout << " (" << format_file_size(result.bytes) << ") in " << std::fixed << std::setprecision(2)
+              << result.seconds << "s";
+    if(result.seconds > 0) {
+        std::cout << ", " << format_file_size(static_cast<uint64_t>(result.bytes / result.seconds)) << "/s";
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    
+    const char* separator = " via ";
+    for(int m = 0; m < CopyEngine::MethodCount; ++m) {
+        if(result.by_method[m] > 0) {
+            std::cout << separator << CopyEngine::method_name(static_cast<CopyEngine::Method>(m))
+                      << " (" << result.by_method[m] << ")";
+            separator = ", ";
+        }
+    }
+    std::cout << std::endl;
+    
+    if(result.errors > 0) {
+        std::cerr << "Copy error: " << result.errors << " failures, first: " << result.first_error << std::endl;
+    }
+}
+
 void FileExplorer::move_file() {
     std::cout << "\n=== Move File ===" << std::endl;
     
     std::string source_name, dest_name;
-    std::cout << "Enter source filename: ";
+    std::cout << "Enter source filename (wildcards or @listfile to move several): ";
     std::getline(std::cin, source_name);
     std::cout << "Enter destination filename: ";
     std::getline(std::cin, dest_name);
@@ -318,7 +921,12 @@ void FileExplorer::move_file() {
     fs::path dest_path = current_path / dest_name;
     
     try {
-        if(!fs::exists(source_path)) {
+        if(source_name.find_first_of("*?[") != std::string::npos || (!source_name.empty() && source_name[0] == '@')) {
+            move_batch(source_name, dest_path);
+            return;
+        }
+        
+        if(!fs::exists(fs::symlink_status(source_path))) {
             std::cout << "Source file does not exist!" << std::endl;
             return;
         }
@@ -334,14 +942,87 @@ void FileExplorer::move_file() {
             }
         }
         
-        fs::rename(source_path, dest_path);
-        std::cout << "File moved successfully!" << std::endl;
+        OpScope scope("move");
+        MoveEngine::Result result = MoveEngine(MoveEngine::Options()).move(source_path.string(), dest_path.string());
+        print_move_result(result);
+        if(result.errors == 0) {
+            std::cout << "File moved successfully!" << std::endl;
+        }
         
     } catch(const fs::filesystem_error& ex) {
         std::cerr << "Move error: " << ex.what() << std::endl;
     }
 }
 
+void FileExplorer::move_batch(const std::string& pattern, const fs::path& dest_dir) {
+    std::vector<std::string> sources;
+    if(pattern[0] == '@') {
+        fs::path list_path = current_path / pattern.substr(1);
+        std::ifstream list(list_path);
+        if(!list) {
+            std::cout << "Cannot read list file " << list_path << std::endl;
+            return;
+        }
+        std::string line;
+        while(std::getline(list, line)) {
+            if(!line.empty()) {
+                sources.push_back(fs::path(line).is_absolute() ? line : (current_path / line).string());
+            }
+        }
+    } else {
+        glob_t matches;
+        if(glob((current_path / pattern).c_str(), 0, nullptr, &matches) == 0) {
+            sources.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+        }
+        globfree(&matches);
+    }
+    
+    if(sources.empty()) {
+        std::cout << "No files match." << std::endl;
+        return;
+    }
+    if(!fs::is_directory(dest_dir)) {
+        std::cout << "Destination must be an existing directory when moving several files." << std::endl;
+        return;
+    }
+    
+    size_t replacing = 0;
+    for(const auto& source : sources) {
+        if(fs::exists(fs::symlink_status(dest_dir / fs::path(source).filename()))) {
+            ++replacing;
+        }
+    }
+    std::cout << "Move " << sources.size() << " items into " << dest_dir;
+    if(replacing > 0) {
+        std::cout << ", replacing " << replacing << " existing";
+    }
+    std::cout << "? (y/n): ";
+    char response;
+    std::cin >> response;
+    std::cin.ignore();
+    if(response != 'y' && response != 'Y') {
+        std::cout << "Move cancelled." << std::endl;
+        return;
+    }
+    
+    OpScope scope("move_batch");
+    MoveEngine::Result result = MoveEngine(MoveEngine::Options()).move_into(sources, dest_dir.string());
+    print_move_result(result);
+}
+
+void FileExplorer::print_move_result(const MoveEngine::Result& result) {
+    std::cout << "Moved " << (result.renamed + result.copied) << " items";
+    if(result.copied > 0) {
+        std::cout << " (" << result.copied << " copied across filesystems, " << format_file_size(result.bytes) << ")";
+    }
+    std::cout << " in " << std::fixed << std::setprecision(2) << result.seconds << "s" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+    
+    if(result.errors > 0) {
+        std::cerr << "Move error: " << result.errors << " failures, first: " << result.first_error << std::endl;
+    }
+}
+
 void FileExplorer::delete_file() {
     std::cout << "\n=== Delete File ===" << std::endl;
     
@@ -352,19 +1033,37 @@ void FileExplorer::delete_file() {
     fs::path file_path = current_path / filename;
     
     try {
-        if(!fs::exists(file_path)) {
+        if(!fs::exists(fs::symlink_status(file_path))) {
             std::cout << "File does not exist!" << std::endl;
             return;
         }
         
-        if(fs::is_directory(file_path)) {
-            std::cout << "Warning: This is a directory. Delete recursively? (y/n): ";
+        if(fs::is_directory(fs::symlink_status(file_path))) {
             char response;
-            std::cin >> response;
-            std::cin.ignore();
+            while(true) {
+                std::cout << "Warning: This is a directory. Delete recursively? (y/n, c to count first): ";
+                std::cin >> response;
+                std::cin.ignore();
+                if(response != 'c' && response != 'C') {
+                    break;
+                }
+                OpScope scope("delete_count");
+                DeleteEngine::Options options;
+                options.dry_run = true;
+                DeleteEngine::Result count = DeleteEngine(options).remove(file_path.string());
+                std::cout << "Would delete " << count.files << " files, " << count.directories << " directories" << std::endl;
+            }
             if(response == 'y' || response == 'Y') {
-                fs::remove_all(file_path);
-                std::cout << "Directory deleted successfully!" << std::endl;
+                OpScope scope("delete");
+                DeleteEngine::Result result = DeleteEngine(DeleteEngine::Options()).remove(file_path.string());
+                std::cout << "Deleted " << result.files << " files, " << result.directories << " directories in "
+                          << std::fixed << std::setprecision(2) << result.seconds << "s" << std::endl;
+                std::cout.unsetf(std::ios::floatfield);
+                if(result.errors > 0) {
+                    std::cerr << "Delete error: " << result.errors << " failures, first: " << result.first_error << std::endl;
+                } else {
+                    std::cout << "Directory deleted successfully!" << std::endl;
+                }
             } else {
                 std::cout << "Delete cancelled." << std::endl;
             }
@@ -444,113 +1143,1140 @@ void FileExplorer::search_files() {
     std::cout << "\n=== Search Files ===" << std::endl;
     
     std::string search_term;
-    std::cout << "Enter search term (filename or pattern): ";
+    std::cout << "Enter search term (text, ^prefix, suffix$, glob like *.cpp, /regex/; !pattern excludes, -i ignores case): ";
     std::getline(std::cin, search_term);
-    
-    std::cout << "Searching for: " << search_term << std::endl;
-    std::cout << "In directory: " << current_path << std::endl;
-    
-    try {
-        bool found = false;
-        for(const auto& entry : fs::recursive_directory_iterator(current_path)) {
-            std::string filename = entry.path().filename().string();
-            
-            if(filename.find(search_term) != std::string::npos) {
-                std::string type = entry.is_directory() ? "[DIR] " : "[FILE]";
-                std::cout << type << " " << entry.path() << std::endl;
-                found = true;
-            }
-        }
-        
-        if(!found) {
-            std::cout << "No files or directories found matching: " << search_term << std::endl;
-        }
-        
-    } catch(const fs::filesystem_error& ex) {
-        std::cerr << "Search error: " << ex.what() << std::endl;
-    }
+    run_search(search_term);
 }
 
-void FileExplorer::manage_permissions() {
-    std::cout << "\n=== Manage Permissions ===" << std::endl;
+bool FileExplorer::run_search(const std::string& search_term) {
+    NameMatcher matcher;
+    std::string pattern_error;
+    if(!matcher.parse(search_term, pattern_error)) {
+        std::cerr << "Search error: " << pattern_error << std::endl;
+        return false;
+    }
     
-    std::string filename;
-    std::cout << "Enter filename: ";
-    std::getline(std::cin, filename);
+    const bool human = output_format == OutputFormat::Human && interactive;
+    if(human) {
+        std::cout << "Searching for: " << search_term << std::endl;
+        std::cout << "In directory: " << current_path << std::endl;
+    }
     
-    fs::path file_path = current_path / filename;
+    OpScope scope("search");
+    std::vector<std::pair<std::string, bool>> results;
+    uint64_t walk_errors = 0;
     
-    try {
-        if(!fs::exists(file_path)) {
-            std::cout << "File does not exist!" << std::endl;
-            return;
+    if(name_index.covers(current_path.string())) {
+        name_index.query(matcher, current_path.string(), results);
+        if(human) {
+            std::cout << "(answered from filename index" << (name_index.stale() ? ", may be stale" : "") << ")" << std::endl;
         }
+    } else {
+        // Each worker collects its own matches; they are merged and sorted once
+        // the walk is done so the output order does not depend on scheduling.
+        TreeWalker walker;
+        std::vector<std::vector<std::pair<std::string, bool>>> matches(walker.thread_count());
         
-        fs::perms current_perms = fs::status(file_path).permissions();
-        std::cout << "Current permissions: " << get_permissions_string(current_perms) << std::endl;
+        walker.on_entry([&](const WalkEntry& entry) {
+            std::string_view filename(entry.name, entry.name_len);
+            if(entry.is_directory() && matcher.excluded(filename)) {
+                return false;   // excluded directories are pruned, not just hidden
+            }
+            if(matcher.matches(filename)) {
+                matches[entry.worker].emplace_back(entry.path(), entry.is_directory());
+            }
+            return true;
+        });
+        walker.walk(current_path.string());
+        walk_errors = walker.errors();
         
-        std::cout << "\nPermission options:" << std::endl;
-        std::cout << "1. Add read permission for all" << std::endl;
-        std::cout << "2. Add write permission for all" << std::endl;
-        std::cout << "3. Add execute permission for all" << std::endl;
-        std::cout << "4. Remove read permission for all" << std::endl;
-        std::cout << "5. Remove write permission for all" << std::endl;
-        std::cout << "6. Remove execute permission for all" << std::endl;
-        std::cout << "7. Set to read-only for all" << std::endl;
-        std::cout << "8. Set custom permissions (octal)" << std::endl;
+        for(auto& worker_matches : matches) {
+            std::move(worker_matches.begin(), worker_matches.end(), std::back_inserter(results));
+        }
+    }
+    std::sort(results.begin(), results.end());
+    
+    for(const auto& result : results) {
+        print_search_row(result.first, result.second);
+    }
+    out.flush();
+    
+    if(results.empty() && human) {
+        std::cout << "No files or directories found matching: " << search_term << std::endl;
+    }
+    if(walk_errors > 0) {
+        std::cerr << "Search skipped " << walk_errors << " unreadable directories" << std::endl;
+    }
+    return walk_errors == 0;
+}
+
+bool FileExplorer::list_directory(const fs::path& dir, bool detailed) {
+    current_path = dir;
+    return list_files(detailed);
+}
+
+void FileExplorer::print_heading(const std::string& text) {
+    out.append(text);
+    out.end_row();
+    out.flush();
+}
+
+bool FileExplorer::find(const fs::path& root, const std::string& query) {
+    current_path = root;
+    return run_search(query);
+}
+
+bool FileExplorer::stat_path(const fs::path& path) {
+    OpScope scope("stat");
+    FileMeta meta;
+    if(!fetch_metadata(AT_FDCWD, path.c_str(), meta, false)) {
+        std::cerr << "Stat error: " << path << " - " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    ListRecord record{};
+    record.type = IFTODT(meta.mode);
+    record.flags = ListRecord::kHaveMeta | (meta.is_directory() ? ListRecord::kIsDir : 0);
+    record.mode = meta.mode;
+    record.nlink = meta.nlink;
+    record.uid = meta.uid;
+    record.gid = meta.gid;
+    record.size = meta.size;
+    record.mtime = meta.mtime;
+    print_list_row(path.string(), record, true);
+    out.flush();
+    return true;
+}
+
+bool FileExplorer::disk_usage_of(const fs::path& path) {
+    OpScope scope("du");
+    FileMeta meta;
+    if(!fetch_metadata(AT_FDCWD, path.c_str(), meta, false)) {
+        std::cerr << "Disk usage error: " << path << " - " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    DiskUsage::Totals totals;
+    if(meta.is_directory()) {
+        totals = disk_usage.measure(path.string(), {"."})[0];
+    } else {
+        totals.allocated = meta.blocks * 512;
+        totals.apparent = meta.size;
+        totals.files = 1;
+    }
+    print_usage_row(path.string(), totals);
+    out.flush();
+    if(totals.errors > 0) {
+        std::cerr << "Disk usage error: " << totals.errors << " unreadable directories under " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool FileExplorer::top_files(const fs::path& root, const TopFiles::Options& options) {
+    TopFiles::Result result;
+    {
+        OpScope scope("top_files");
+        result = TopFiles(options).run(root.string());
+    }
+    const bool human = output_format == OutputFormat::Human && interactive;
+    if(human) {
+        std::cout << "\nTop " << options.count << " files by " << TopFiles::key_name(options.key)
+                  << (options.reverse ? " (reversed)" : "") << " under " << root << ":" << std::endl;
+        std::cout << std::string(80, '-') << std::endl;
+        std::cout << "    Size  Allocated  Modified          Accessed          Path" << std::endl;
+    }
+    for(const auto& item : result.items) {
+        print_top_row(item);
+    }
+    out.flush();
+    if(human) {
+        std::cout << std::string(80, '-') << std::endl;
+        std::cout << result.matched << " of " << result.files << " files matched, checked in " << std::fixed
+                  << std::setprecision(2) << result.seconds << "s" << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+    }
+    if(result.errors > 0) {
+        std::cerr << "Report skipped " << result.errors << " unreadable files or directories" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void FileExplorer::top_files_menu() {
+    std::cout << "\n=== Largest / Oldest Files ===" << std::endl;
+    std::cout << "Rank by:" << std::endl;
+    std::cout << "1. Size" << std::endl;
+    std::cout << "2. Allocated blocks" << std::endl;
+    std::cout << "3. Oldest modification" << std::endl;
+    std::cout << "4. Oldest access" << std::endl;
+    std::cout << "Choose option: ";
+    int option;
+    std::cin >> option;
+    std::cin.ignore();
+    static const TopFiles::Key kKeys[] = {TopFiles::Key::Size, TopFiles::Key::Blocks, TopFiles::Key::Mtime,
+                                          TopFiles::Key::Atime};
+    if(option < 1 || option > 4) {
+        std::cout << "Invalid option!" << std::endl;
+        return;
+    }
+    TopFiles::Options options;
+    options.key = kKeys[option - 1];
+    
+    std::string text;
+    std::cout << "How many files (default 20): ";
+    std::getline(std::cin, text);
+    if(!text.empty()) {
+        try {
+            options.count = std::stoul(text);
+        } catch(const std::exception& ex) {
+            std::cout << "Invalid number!" << std::endl;
+            return;
+        }
+    }
+    std::cout << "Extensions (e.g. log tmp, empty for all): ";
+    std::getline(std::cin, text);
+    options.extensions = TopFiles::parse_extensions(text);
+    std::cout << "Only files modified more than ... ago (e.g. 30d, 12h, empty for any): ";
+    std::getline(std::cin, text);
+    if(!text.empty() && !TopFiles::parse_age(text, options.older_than)) {
+        std::cout << "Invalid age!" << std::endl;
+        return;
+    }
+    std::cout << "Only files modified less than ... ago (empty for any): ";
+    std::getline(std::cin, text);
+    if(!text.empty() && !TopFiles::parse_age(text, options.newer_than)) {
+        std::cout << "Invalid age!" << std::endl;
+        return;
+    }
+    top_files(current_path, options);
+}
+
+void FileExplorer::print_top_row(const TopFiles::Item& item) {
+    switch(output_format) {
+        case OutputFormat::Human: {
+            char text[32];
+            out.append_padded(std::string_view(text, format_size(text, item.size)), 8);
+            out.append("  ");
+            out.append_padded(std::string_view(text, format_size(text, item.allocated)), 8);
+            out.append("  ");
+            out.append_time(item.mtime);
+            out.append("  ");
+            out.append_time(item.atime);
+            out.append("  ");
+            out.append_quoted(item.path);
+            break;
+        }
+        case OutputFormat::Tsv:
+            out.append_uint(item.size);
+            out.append('\t');
+            out.append_uint(item.allocated);
+            out.append('\t');
+            out.append_int(item.mtime);
+            out.append('\t');
+            out.append_int(item.atime);
+            out.append('\t');
+            out.append_tsv_field(item.path);
+            break;
+        case OutputFormat::JsonLines:
+            out.append("{\"path\":");
+            out.append_json_string(item.path);
+            out.append(",\"size\":");
+            out.append_uint(item.size);
+            out.append(",\"allocated\":");
+            out.append_uint(item.allocated);
+            out.append(",\"mtime\":");
+            out.append_int(item.mtime);
+            out.append(",\"atime\":");
+            out.append_int(item.atime);
+            out.append('}');
+            break;
+    }
+    out.end_row();
+}
+
+bool FileExplorer::view_file(const fs::path& file, const std::string& position, uint64_t lines, bool follow) {
+    OpScope scope("view");
+    FileViewer viewer;
+    std::string error;
+    if(!viewer.open(file.string(), error)) {
+        std::cerr << "View error: " << error << std::endl;
+        return false;
+    }
+    uint64_t offset = 0;
+    if(!viewer.locate(position, 0, lines, offset)) {
+        std::cerr << "View error: " << position << ": no such line or match in " << file << std::endl;
+        return false;
+    }
+    uint64_t shown = print_view_lines(viewer, offset, lines, viewer.size());
+    out.flush();
+    if(follow) {
+        return follow_file(viewer, std::max(shown, viewer.line_start(viewer.size())));
+    }
+    return true;
+}
+
+void FileExplorer::view_menu() {
+    std::cout << "\n=== View File ===" << std::endl;
+    std::string filename;
+    std::cout << "Enter filename to view: ";
+    std::getline(std::cin, filename);
+
+    OpScope scope("view");
+    FileViewer viewer;
+    std::string error;
+    if(!viewer.open((current_path / filename).string(), error)) {
+        std::cerr << "View error: " << error << std::endl;
+        return;
+    }
+    const uint64_t kPage = 20;
+    uint64_t top = 0;
+    uint64_t bottom = 0;
+    bool show = true;
+    std::string last_search;
+    while(true) {
+        if(show) {
+            bottom = print_view_lines(viewer, top, kPage, viewer.size());
+            out.flush();
+            uint64_t line = viewer.line_number(top, false);
+            std::cout << "-- " << (viewer.size() ? bottom * 100 / viewer.size() : 100) << "% of "
+                      << format_file_size(viewer.size());
+            if(line > 0) {
+                std::cout << ", line " << line;
+            }
+            std::cout << " --" << std::endl;
+        }
+        show = true;
+        std::cout << "[Enter] next, b back, h/t head/tail, N line, N% percent, /text search, f follow, q quit: ";
+        std::string command;
+        if(!std::getline(std::cin, command) || command == "q") {
+            break;
+        }
+        uint64_t offset = top;
+        if(command.empty() || command == "n") {
+            if(bottom >= viewer.size()) {
+                std::cout << "(end of file)" << std::endl;
+                show = false;
+                continue;
+            }
+            offset = bottom;
+        } else if(command == "b") {
+            offset = viewer.lines_back(top, kPage);
+        } else if(command == "h") {
+            offset = 0;
+        } else if(command == "t") {
+            viewer.locate("tail", 0, kPage, offset);
+        } else if(command == "f") {
+            viewer.locate("tail", 0, kPage, offset);
+            print_view_lines(viewer, offset, kPage, viewer.size());
+            out.flush();
+            follow_file(viewer, viewer.line_start(viewer.size()));
+            viewer.locate("tail", 0, kPage, offset);
+        } else {
+            if(command == "/") {
+                command = last_search;
+            } else if(command[0] == '/') {
+                last_search = command;
+            }
+            // Searches start below the top line so that repeating one moves on.
+            if(command.empty() || !viewer.locate(command, viewer.next_line(top), kPage, offset)) {
+                std::cout << (command.empty() || command[0] == '/' ? "Not found." : "No such line.") << std::endl;
+                show = false;
+                continue;
+            }
+        }
+        top = offset;
+    }
+}
+
+bool FileExplorer::follow_file(FileViewer& viewer, uint64_t shown) {
+    std::string error;
+    if(!viewer.start_follow(error)) {
+        std::cerr << "View error: " << error << std::endl;
+        return false;
+    }
+    // Enter on a terminal, or the next menu input, stops; in command mode
+    // without a terminal (cron, nohup, a service) only a signal does, and
+    // stdin is not read at all.
+    bool watch_stdin = interactive || isatty(STDIN_FILENO);
+    if(output_format == OutputFormat::Human) {
+        std::cout << "Following " << viewer.path() << (watch_stdin ? "; press Enter to stop." : "") << std::endl;
+    }
+    while(true) {
+        pollfd fds[2] = {{viewer.follow_fd(), POLLIN, 0}, {watch_stdin ? STDIN_FILENO : -1, POLLIN, 0}};
+        // Rotation leaves the old file alone, so the name is rechecked each second.
+        if(poll(fds, 2, 1000) < 0 && errno != EINTR) {
+            break;
+        }
+        if(fds[1].revents) {
+            std::string line;
+            if(std::getline(std::cin, line)) {
+                break;
+            }
+            watch_stdin = false;    // end of input is no answer
+            std::cin.clear();
+        }
+        viewer.drain_events();
+        if(viewer.refresh() == FileViewer::Change::Reset) {
+            if(output_format == OutputFormat::Human) {
+                std::cout << "--- " << viewer.path() << " was truncated or replaced ---" << std::endl;
+            }
+            shown = 0;
+        }
+        // Only whole lines; a partial one is printed once it is finished.
+        uint64_t end = viewer.line_start(viewer.size());
+        if(end > shown) {
+            shown = print_view_lines(viewer, shown, UINT64_MAX, end);
+            out.flush();
+        }
+    }
+    viewer.stop_follow();
+    return true;
+}
+
+uint64_t FileExplorer::print_view_lines(FileViewer& viewer, uint64_t offset, uint64_t count, uint64_t end) {
+    uint64_t line = viewer.line_number(offset, false);
+    for(uint64_t i = 0; i < count && offset < end; ++i) {
+        uint64_t next = viewer.next_line(offset);
+        std::string_view text(viewer.data() + offset, next - offset);
+        if(!text.empty() && text.back() == '\n') {
+            text.remove_suffix(1);
+        }
+        if(!text.empty() && text.back() == '\r') {
+            text.remove_suffix(1);
+        }
+        print_view_row(line, text);
+        line = line > 0 ? line + 1 : 0;
+        offset = next;
+    }
+    return offset;
+}
+
+void FileExplorer::print_view_row(uint64_t line, std::string_view text) {
+    const size_t kMaxColumns = 240;
+    switch(output_format) {
+        case OutputFormat::Human:
+            if(line > 0) {
+                out.append_uint_padded(line, 7);
+            } else {
+                out.append_padded("~", 7);
+            }
+            out.append("  ");
+            out.append(text.substr(0, kMaxColumns));
+            if(text.size() > kMaxColumns) {
+                out.append("...");
+            }
+            break;
+        case OutputFormat::Tsv:
+            if(line > 0) {
+                out.append_uint(line);
+            }
+            out.append('\t');
+            out.append_tsv_field(text);
+            break;
+        case OutputFormat::JsonLines:
+            out.append("{\"line\":");
+            if(line > 0) {
+                out.append_uint(line);
+            } else {
+                out.append("null");
+            }
+            out.append(",\"text\":");
+            out.append_json_string(text);
+            out.append('}');
+            break;
+    }
+    out.end_row();
+}
+
+void FileExplorer::print_usage_row(std::string_view path, const DiskUsage::Totals& totals) {
+    switch(output_format) {
+        case OutputFormat::Human: {
+            char text[32];
+            out.append_padded(std::string_view(text, format_size(text, totals.allocated)), 8);
+            out.append("  ");
+            out.append_uint_padded(totals.files, 9);
+            out.append(" files  ");
+            out.append_quoted(path);
+            break;
+        }
+        case OutputFormat::Tsv:
+            out.append_uint(totals.allocated);
+            out.append('\t');
+            out.append_uint(totals.apparent);
+            out.append('\t');
+            out.append_uint(totals.files);
+            out.append('\t');
+            out.append_uint(totals.directories);
+            out.append('\t');
+            out.append_tsv_field(path);
+            break;
+        case OutputFormat::JsonLines:
+            out.append("{\"path\":");
+            out.append_json_string(path);
+            out.append(",\"allocated\":");
+            out.append_uint(totals.allocated);
+            out.append(",\"apparent\":");
+            out.append_uint(totals.apparent);
+            out.append(",\"files\":");
+            out.append_uint(totals.files);
+            out.append(",\"directories\":");
+            out.append_uint(totals.directories);
+            out.append('}');
+            break;
+    }
+    out.end_row();
+}
+
+bool FileExplorer::save_snapshot(const fs::path& dir, const std::string& file) {
+    OpScope scope("snapshot");
+    TreeSnapshot snapshot;
+    std::string error;
+    uint64_t errors = 0;
+    if(!snapshot.capture(dir.string(), error, &errors) || !snapshot.save(file, error)) {
+        std::cerr << "Snapshot error: " << error << std::endl;
+        return false;
+    }
+    if(output_format == OutputFormat::Human && interactive) {
+        std::cout << "Saved " << snapshot.size() << " entries under " << dir << " to " << file << " ("
+                  << format_file_size(snapshot.bytes()) << ")" << std::endl;
+    }
+    if(errors > 0) {
+        std::cerr << "Snapshot skipped " << errors << " unreadable files or directories" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool FileExplorer::diff_snapshot(const std::string& before_file, const std::string& after) {
+    OpScope scope("snapshot_diff");
+    auto start = std::chrono::steady_clock::now();
+    TreeSnapshot before;
+    TreeSnapshot current;
+    std::string error;
+    uint64_t errors = 0;
+    std::error_code ec;
+    // A directory is compared as it is now; anything else is a snapshot file.
+    bool live = fs::is_directory(after, ec);
+    if(!before.load(before_file, error) ||
+       !(live ? current.capture(after, error, &errors) : current.load(after, error))) {
+        std::cerr << "Snapshot error: " << error << std::endl;
+        return false;
+    }
+    
+    std::vector<TreeSnapshot::Change> changes;
+    TreeSnapshot::diff(before, current, changes);
+    uint64_t counts[4] = {0, 0, 0, 0};
+    for(const auto& change : changes) {
+        ++counts[change.kind];
+        print_change_row(change);
+    }
+    out.flush();
+    
+    if(output_format == OutputFormat::Human && interactive) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << counts[TreeSnapshot::Change::Added] << " added, " << counts[TreeSnapshot::Change::Removed]
+                  << " removed, " << counts[TreeSnapshot::Change::Modified] << " modified, "
+                  << counts[TreeSnapshot::Change::Moved] << " moved (" << before.size() << " entries before, "
+                  << current.size() << " after, " << std::fixed << std::setprecision(2) << seconds << "s)" << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+    }
+    if(errors > 0) {
+        std::cerr << "Snapshot skipped " << errors << " unreadable files or directories" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void FileExplorer::snapshot_menu() {
+    std::cout << "\n=== Tree Snapshots ===" << std::endl;
+    std::cout << "1. Save snapshot of current directory" << std::endl;
+    std::cout << "2. Compare current directory with a snapshot" << std::endl;
+    std::cout << "3. Compare two snapshots" << std::endl;
+    std::cout << "0. Back" << std::endl;
+    std::cout << "Choose option: ";
+    int option;
+    std::cin >> option;
+    std::cin.ignore();
+    
+    std::string first;
+    std::string second;
+    switch(option) {
+        case 1:
+            std::cout << "Snapshot file: ";
+            std::getline(std::cin, first);
+            if(!first.empty()) {
+                save_snapshot(current_path, (current_path / first).string());
+            }
+            break;
+        case 2:
+            std::cout << "Snapshot file: ";
+            std::getline(std::cin, first);
+            if(!first.empty()) {
+                diff_snapshot((current_path / first).string(), current_path.string());
+            }
+            break;
+        case 3:
+            std::cout << "Older snapshot file: ";
+            std::getline(std::cin, first);
+            std::cout << "Newer snapshot file: ";
+            std::getline(std::cin, second);
+            if(!first.empty() && !second.empty()) {
+                diff_snapshot((current_path / first).string(), (current_path / second).string());
+            }
+            break;
+        case 0:
+            break;
+        default:
+            std::cout << "Invalid option!" << std::endl;
+    }
+}
+
+void FileExplorer::print_change_row(const TreeSnapshot::Change& change) {
+    static const char* const kKinds[] = {"added", "removed", "modified", "moved"};
+    static const char* const kWhat[] = {"type", "size", "mtime", "mode", "replaced"};
+    std::string what;
+    for(size_t bit = 0; bit < 5; ++bit) {
+        if(change.what & (1u << bit)) {
+            what += what.empty() ? "" : ",";
+            what += kWhat[bit];
+        }
+    }
+    switch(output_format) {
+        case OutputFormat::Human:
+            out.append("+-~>"[change.kind]);
+            out.append(' ');
+            if(change.kind == TreeSnapshot::Change::Moved) {
+                out.append_quoted(change.from);
+                out.append(" -> ");
+            }
+            out.append_quoted(change.path);
+            if(!what.empty()) {
+                out.append(" (");
+                out.append(what);
+                out.append(')');
+            }
+            break;
+        case OutputFormat::Tsv:
+            out.append(kKinds[change.kind]);
+            out.append('\t');
+            out.append_tsv_field(change.path);
+            out.append('\t');
+            out.append_tsv_field(change.from);
+            out.append('\t');
+            out.append(what);
+            break;
+        case OutputFormat::JsonLines:
+            out.append("{\"change\":\"");
+            out.append(kKinds[change.kind]);
+            out.append("\",\"path\":");
+            out.append_json_string(change.path);
+            if(change.kind == TreeSnapshot::Change::Moved) {
+                out.append(",\"from\":");
+                out.append_json_string(change.from);
+            }
+            if(!what.empty()) {
+                out.append(",\"what\":\"");
+                out.append(what);
+                out.append('"');
+            }
+            out.append('}');
+            break;
+    }
+    out.end_row();
+}
+
+void FileExplorer::search_contents() {
+    std::cout << "\n=== Search File Contents ===" << std::endl;
+    
+    ContentSearch::Options options;
+    std::cout << "Enter text to find: ";
+    std::getline(std::cin, options.needle);
+    if(options.needle.empty()) {
+        std::cout << "Nothing to search for." << std::endl;
+        return;
+    }
+    
+    std::cout << "Ignore case? (y/n): ";
+    char response;
+    std::cin >> response;
+    std::cin.ignore();
+    options.ignore_case = (response == 'y' || response == 'Y');
+    
+    std::string filter;
+    std::cout << "File name filter (e.g. *.cpp *.h !build, empty for all): ";
+    std::getline(std::cin, filter);
+    NameMatcher names;
+    std::string pattern_error;
+    if(!names.parse(filter, pattern_error)) {
+        std::cerr << "Search error: " << pattern_error << std::endl;
+        return;
+    }
+    if(!names.empty()) {
+        options.names = &names;
+    }
+    
+    std::string range;
+    std::cout << "File size range (e.g. 1K-10M, -1M, empty for any): ";
+    std::getline(std::cin, range);
+    if(!range.empty()) {
+        size_t dash = range.find('-');
+        std::string low = range.substr(0, dash);
+        std::string high = dash == std::string::npos ? std::string() : range.substr(dash + 1);
+        if((!low.empty() && !parse_size(low, options.min_size)) || (!high.empty() && !parse_size(high, options.max_size))) {
+            std::cout << "Invalid size range!" << std::endl;
+            return;
+        }
+    }
+    
+    const bool human = output_format == OutputFormat::Human && interactive;
+    if(human) {
+        std::cout << "Searching for: " << options.needle << std::endl;
+        std::cout << "In directory: " << current_path << std::endl;
+    }
+    
+    // Rows go out as each file finishes; files come in completion order.
+    OpScope scope("content_search");
+    ContentSearch search(options);
+    ContentSearch::Result result = search.run(current_path.string(),
+        [&](const std::string& path, const std::vector<ContentSearch::LineMatch>& lines) {
+            for(const auto& line : lines) {
+                print_content_row(path, line.line, line.text);
+            }
+            out.flush();
+        });
+    out.flush();
+    
+    if(human) {
+        std::cout << "Found " << result.lines_matched << " lines in " << result.files_matched << " files (scanned "
+                  << result.files_scanned << " files, " << format_file_size(result.bytes_scanned) << " in "
+                  << std::fixed << std::setprecision(2) << result.seconds << "s";
+        std::cout.unsetf(std::ios::floatfield);
+        if(result.binary_skipped > 0) {
+            std::cout << ", " << result.binary_skipped << " binary skipped";
+        }
+        std::cout << ")" << std::endl;
+    }
+    if(result.errors > 0) {
+        std::cerr << "Search skipped " << result.errors << " unreadable files or directories" << std::endl;
+    }
+}
+
+void FileExplorer::print_content_row(std::string_view path, uint64_t line, std::string_view text) {
+    switch(output_format) {
+        case OutputFormat::Human:
+            out.append(path);
+            out.append(':');
+            out.append_uint(line);
+            out.append(':');
+            out.append(text);
+            break;
+        case OutputFormat::Tsv:
+            out.append_tsv_field(path);
+            out.append('\t');
+            out.append_uint(line);
+            out.append('\t');
+            out.append_tsv_field(text);
+            break;
+        case OutputFormat::JsonLines:
+            out.append("{\"path\":");
+            out.append_json_string(path);
+            out.append(",\"line\":");
+            out.append_uint(line);
+            out.append(",\"text\":");
+            out.append_json_string(text);
+            out.append('}');
+            break;
+    }
+    out.end_row();
+}
+
+void FileExplorer::print_search_row(std::string_view path, bool is_dir) {
+    switch(output_format) {
+        case OutputFormat::Human:
+            out.append(is_dir ? "[DIR]  " : "[FILE] ");
+            out.append_quoted(path);
+            break;
+        case OutputFormat::Tsv:
+            out.append(is_dir ? "dir\t" : "file\t");
+            out.append_tsv_field(path);
+            break;
+        case OutputFormat::JsonLines:
+            out.append(is_dir ? "{\"type\":\"dir\",\"path\":" : "{\"type\":\"file\",\"path\":");
+            out.append_json_string(path);
+            out.append('}');
+            break;
+    }
+    out.end_row();
+}
+
+void FileExplorer::find_duplicates() {
+    std::cout << "\n=== Find Duplicate Files ===" << std::endl;
+    
+    DuplicateFinder::Options options;
+    std::string size_text;
+    std::cout << "Minimum file size (e.g. 4K, empty for any non-empty file): ";
+    std::getline(std::cin, size_text);
+    if(!size_text.empty() && !parse_size(size_text, options.min_size)) {
+        std::cout << "Invalid size!" << std::endl;
+        return;
+    }
+    options.min_size = std::max<uint64_t>(options.min_size, 1);
+    
+    const bool human = output_format == OutputFormat::Human && interactive;
+    if(human) {
+        std::cout << "Looking for duplicates in: " << current_path << std::endl;
+    }
+    
+    DuplicateFinder::Result result;
+    {
+        OpScope scope("duplicates");
+        result = DuplicateFinder(options).find(current_path.string());
+    }
+    for(size_t i = 0; i < result.groups.size(); ++i) {
+        const DuplicateFinder::Group& group = result.groups[i];
+        if(output_format == OutputFormat::Human) {
+            out.append(std::to_string(group.paths.size()) + " copies of " + format_file_size(group.size) +
+                       ", " + format_file_size(group.size * (group.paths.size() - 1)) + " reclaimable:");
+            out.end_row();
+        }
+        for(const auto& path : group.paths) {
+            print_duplicate_row(i + 1, group.size, path);
+        }
+    }
+    out.flush();
+    
+    if(human) {
+        std::cout << "Found " << result.groups.size() << " groups, " << result.duplicates << " duplicate files, "
+                  << format_file_size(result.reclaimable) << " reclaimable (" << result.files << " files, "
+                  << result.partial_hashed << " sampled, " << result.full_hashed << " hashed in full, "
+                  << format_file_size(result.bytes_read) << " read in " << std::fixed << std::setprecision(2)
+                  << result.seconds << "s";
+        std::cout.unsetf(std::ios::floatfield);
+        if(result.links_skipped > 0) {
+            std::cout << ", " << result.links_skipped << " hard links skipped";
+        }
+        std::cout << ")" << std::endl;
+    }
+    if(result.errors > 0) {
+        std::cerr << "Duplicate search skipped " << result.errors << " unreadable files or directories" << std::endl;
+    }
+    if(result.groups.empty() || !interactive) {
+        return;
+    }
+    
+    std::cout << "\nDeduplicate? Every copy is compared byte for byte first and the first path of each group is kept." << std::endl;
+    std::cout << "1. Replace copies with hard links" << std::endl;
+    std::cout << "2. Share extents with reflinks (btrfs, XFS)" << std::endl;
+    std::cout << "0. Leave them" << std::endl;
+    std::cout << "Choose option: ";
+    int option;
+    std::cin >> option;
+    std::cin.ignore();
+    if(option != 1 && option != 2) {
+        return;
+    }
+    
+    OpScope scope("dedup");
+    DuplicateFinder::DedupResult dedup = DuplicateFinder::dedup(result.groups,
+        option == 1 ? DuplicateFinder::Dedup::Hardlink : DuplicateFinder::Dedup::Reflink);
+    std::cout << "Replaced " << dedup.replaced << " copies, " << format_file_size(dedup.bytes) << " reclaimed";
+    if(dedup.differed > 0) {
+        std::cout << "; " << dedup.differed << " changed since the scan were left alone";
+    }
+    std::cout << std::endl;
+    if(dedup.errors > 0) {
+        std::cerr << "Dedup error: " << dedup.errors << " failures, first: " << dedup.first_error << std::endl;
+    }
+}
+
+void FileExplorer::print_duplicate_row(uint64_t group, uint64_t size, std::string_view path) {
+    switch(output_format) {
+        case OutputFormat::Human:
+            out.append("  ");
+            out.append_quoted(path);
+            break;
+        case OutputFormat::Tsv:
+            out.append_uint(group);
+            out.append('\t');
+            out.append_uint(size);
+            out.append('\t');
+            out.append_tsv_field(path);
+            break;
+        case OutputFormat::JsonLines:
+            out.append("{\"group\":");
+            out.append_uint(group);
+            out.append(",\"size\":");
+            out.append_uint(size);
+            out.append(",\"path\":");
+            out.append_json_string(path);
+            out.append('}');
+            break;
+    }
+    out.end_row();
+}
+
+void FileExplorer::manage_index() {
+    std::cout << "\n=== Filename Index ===" << std::endl;
+    if(name_index.loaded()) {
+        std::cout << "Indexed root: " << name_index.status().root << std::endl;
+    } else {
+        std::cout << "No index loaded." << std::endl;
+    }
+    std::cout << "1. Build/rebuild index for current directory" << std::endl;
+    std::cout << "2. Load saved index covering current directory" << std::endl;
+    std::cout << "3. Show index status" << std::endl;
+    std::cout << "4. Start watching for changes" << std::endl;
+    std::cout << "5. Stop watching" << std::endl;
+    std::cout << "6. Unload index" << std::endl;
+    std::cout << "Choose option: ";
+    
+    int option;
+    std::cin >> option;
+    std::cin.ignore();
+    
+    std::string error;
+    switch(option) {
+        case 1: {
+            std::string root = current_path.string();
+            std::cout << "Indexing " << current_path << "..." << std::endl;
+            auto start = std::chrono::steady_clock::now();
+            OpScope scope("index_build");
+            if(!name_index.build(root, NameIndex::default_file(root), error)) {
+                std::cerr << "Index build failed: " << error << std::endl;
+                return;
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            std::cout << "Indexed " << name_index.status().nodes << " entries in " << elapsed.count() << " ms" << std::endl;
+            if(!name_index.start_watch(error)) {
+                std::cerr << "Watcher not started: " << error << std::endl;
+            }
+            break;
+        }
+        case 2: {
+            for(fs::path dir = current_path; ; dir = dir.parent_path()) {
+                std::string file = NameIndex::default_file(dir.string());
+                if(fs::exists(file)) {
+                    if(!name_index.load(file, error)) {
+                        std::cerr << "Index load failed: " << error << std::endl;
+                        return;
+                    }
+                    std::cout << "Loaded index for " << dir << std::endl;
+                    if(!name_index.start_watch(error)) {
+                        std::cerr << "Watcher not started: " << error << std::endl;
+                    }
+                    return;
+                }
+                if(!dir.has_parent_path() || dir == dir.parent_path()) {
+                    break;
+                }
+            }
+            std::cout << "No saved index covers this directory." << std::endl;
+            break;
+        }
+        case 3: {
+            if(!name_index.loaded()) {
+                std::cout << "No index loaded." << std::endl;
+                return;
+            }
+            NameIndex::Status status = name_index.status();
+            std::cout << "Root:        " << status.root << std::endl;
+            std::cout << "File:        " << status.file << std::endl;
+            std::cout << "Built:       " << std::put_time(std::localtime(&status.built_at), "%Y-%m-%d %H:%M:%S") << std::endl;
+            std::cout << "Entries:     " << status.nodes << " (" << status.names << " unique names, "
+                      << status.trigrams << " trigrams)" << std::endl;
+            std::cout << "Deltas:      +" << status.added << " -" << status.removed << " since build" << std::endl;
+            std::cout << "Watching:    " << (status.watching ? "yes" : "no") << std::endl;
+            if(status.unwatched_dirs > 0) {
+                std::cout << "Unwatched:   " << status.unwatched_dirs << " directories (inotify watch limit?)" << std::endl;
+            }
+            if(status.overflowed) {
+                std::cout << "Event queue overflowed; changes were lost." << std::endl;
+            }
+            std::cout << "Stale:       " << (name_index.stale() ? "yes, rebuild to be sure" : "no") << std::endl;
+            break;
+        }
+        case 4:
+            if(name_index.start_watch(error)) {
+                std::cout << "Watching for changes." << std::endl;
+            } else {
+                std::cerr << "Watcher not started: " << error << std::endl;
+            }
+            break;
+        case 5:
+            name_index.stop_watch();
+            std::cout << "Stopped watching." << std::endl;
+            break;
+        case 6:
+            name_index.unload();
+            std::cout << "Index unloaded; searches walk the tree." << std::endl;
+            break;
+        default:
+            std::cout << "Invalid option!" << std::endl;
+    }
+}
+
+void FileExplorer::manage_permissions() {
+    std::cout << "\n=== Manage Permissions ===" << std::endl;
+    
+    std::string filename;
+    std::cout << "Enter filename: ";
+    std::getline(std::cin, filename);
+    
+    fs::path file_path = current_path / filename;
+    
+    try {
+        if(!fs::exists(file_path)) {
+            std::cout << "File does not exist!" << std::endl;
+            return;
+        }
+        
+        fs::perms current_perms = fs::status(file_path).permissions();
+        std::cout << "Current permissions: " << get_permissions_string(current_perms) << std::endl;
+        
+        std::cout << "\nPermission options:" << std::endl;
+        std::cout << "1. Add read permission for all" << std::endl;
+        std::cout << "2. Add write permission for all" << std::endl;
+        std::cout << "3. Add execute permission for all" << std::endl;
+        std::cout << "4. Remove read permission for all" << std::endl;
+        std::cout << "5. Remove write permission for all" << std::endl;
+        std::cout << "6. Remove execute permission for all" << std::endl;
+        std::cout << "7. Set to read-only for all" << std::endl;
+        std::cout << "8. Set custom permissions (octal or symbolic, e.g. 755 or u+rw,g-w,o=)" << std::endl;
+        std::cout << "9. Change recursively (separate rules for files and directories)" << std::endl;
         std::cout << "Choose option: ";
         
         int option;
         std::cin >> option;
         std::cin.ignore();
         
-        fs::perms new_perms = current_perms;
-        
-        switch(option) {
-            case 1:
-                new_perms |= (fs::perms::owner_read | fs::perms::group_read | fs::perms::others_read);
-                break;
-            case 2:
-                new_perms |= (fs::perms::owner_write | fs::perms::group_write | fs::perms::others_write);
-                break;
-            case 3:
-                new_perms |= (fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec);
-                break;
-            case 4:
-                new_perms &= ~(fs::perms::owner_read | fs::perms::group_read | fs::perms::others_read);
-                break;
-            case 5:
-                new_perms &= ~(fs::perms::owner_write | fs::perms::group_write | fs::perms::others_write);
-                break;
-            case 6:
-                new_perms &= ~(fs::perms::owner_exec | fs::perms::group_exec | fs::perms::others_exec);
-                break;
-            case 7:
-                new_perms = fs::perms::owner_read | fs::perms::group_read | fs::perms::others_read;
-                break;
-            case 8: {
-                std::cout << "Enter octal permissions (e.g., 755): ";
-                std::string octal_str;
-                std::getline(std::cin, octal_str);
-                try {
-                    int octal_val = std::stoi(octal_str, nullptr, 8);
-                    new_perms = static_cast<fs::perms>(octal_val);
-                } catch(const std::exception& ex) {
-                    std::cerr << "Invalid octal value!" << std::endl;
-                    return;
-                }
-                break;
+        static const char* const kPresets[] = {"a+r", "a+w", "a+x", "a-r", "a-w", "a-x", "a=r"};
+        PermissionEngine::Options options;
+        std::string error;
+        if(option >= 1 && option <= 7) {
+            options.files.parse(kPresets[option - 1], error);
+            options.directories = options.files;
+        } else if(option == 8) {
+            std::cout << "Enter mode: ";
+            std::string mode;
+            std::getline(std::cin, mode);
+            if(!options.files.parse(mode, error)) {
+                std::cerr << "Permission management error: " << error << std::endl;
+                return;
             }
-            default:
-                std::cout << "Invalid option!" << std::endl;
+            options.directories = options.files;
+        } else if(option == 9) {
+            std::string mode;
+            std::cout << "Mode for files (blank leaves files alone): ";
+            std::getline(std::cin, mode);
+            if(!mode.empty() && !options.files.parse(mode, error)) {
+                std::cerr << "Permission management error: " << error << std::endl;
                 return;
+            }
+            std::cout << "Mode for directories (blank leaves directories alone): ";
+            std::getline(std::cin, mode);
+            if(!mode.empty() && !options.directories.parse(mode, error)) {
+                std::cerr << "Permission management error: " << error << std::endl;
+                return;
+            }
+            options.recursive = true;
+        } else {
+            std::cout << "Invalid option!" << std::endl;
+            return;
         }
         
-        fs::permissions(file_path, new_perms);
-        std::cout << "Permissions updated successfully!" << std::endl;
-        std::cout << "New permissions: " << get_permissions_string(new_perms) << std::endl;
+        OpScope scope("chmod");
+        PermissionEngine::Result result = PermissionEngine(options).apply(file_path.string());
+        if(options.recursive) {
+            std::cout << "Checked " << result.scanned << " entries: " << result.changed << " changed, "
+                      << result.unchanged << " already right, " << result.skipped << " skipped in "
+                      << std::fixed << std::setprecision(2) << result.seconds << "s" << std::endl;
+            std::cout.unsetf(std::ios::floatfield);
+        }
+        if(result.errors > 0) {
+            std::cerr << "Permission management error: " << result.errors << " failures, first: "
+                      << result.first_error << std::endl;
+        } else if(!options.recursive) {
+            fs::perms new_perms = fs::status(file_path).permissions();
+            std::cout << (result.changed ? "Permissions updated successfully!" : "Permissions already set; nothing changed.")
+                      << std::endl;
+            std::cout << "New permissions: " << get_permissions_string(new_perms) << std::endl;
+        }
         
     } catch(const fs::filesystem_error& ex) {
         std::cerr << "Permission management error: " << ex.what() << std::endl;
     }
-}
\ No newline at end of file
+}
+
+void FileExplorer::show_stats() {
+    std::cout << "\n=== Operation Statistics ===" << std::endl;
+    if(!Telemetry::enabled()) {
+        std::cout << "Telemetry is off. Turn it on? (y/n): ";
+        char response;
+        std::cin >> response;
+        std::cin.ignore();
+        if(response == 'y' || response == 'Y') {
+            Telemetry::enable(true);
+            std::cout << "Telemetry on; operations from now on are recorded." << std::endl;
+        }
+        return;
+    }
+    
+    Telemetry::print_summary(std::cout);
+    DirCache::Stats cache = dir_cache.stats();
+    std::cout << "Directory cache: " << cache.entries << " directories, " << format_file_size(cache.bytes) << " of "
+              << format_file_size(cache.budget) << ", " << cache.hits << " hits, " << cache.misses << " misses, "
+              << cache.invalidations << " invalidated, " << cache.evictions << " evicted" << std::endl;
+    std::cout << "1. Reset counters" << std::endl;
+    std::cout << "2. Write JSON to file" << std::endl;
+    std::cout << (Telemetry::tracing() ? "3. Write trace to file and stop tracing" : "3. Start trace") << std::endl;
+    std::cout << "4. Turn telemetry off" << std::endl;
+    std::cout << "0. Back" << std::endl;
+    std::cout << "Choose option: ";
+    
+    int option;
+    std::cin >> option;
+    std::cin.ignore();
+    switch(option) {
+        case 0:
+            break;
+        case 1:
+            Telemetry::reset();
+            std::cout << "Counters reset." << std::endl;
+            break;
+        case 2: {
+            std::cout << "Enter file path: ";
+            std::string path;
+            std::getline(std::cin, path);
+            std::ofstream file(path);
+            Telemetry::write_json(file);
+            if(!file) {
+                std::cerr << "Stats error: cannot write " << path << std::endl;
+            } else {
+                std::cout << "Statistics written to " << path << std::endl;
+            }
+            break;
+        }
+        case 3: {
+            if(!Telemetry::tracing()) {
+                Telemetry::start_trace();
+                std::cout << "Tracing; parallel engines now record spans." << std::endl;
+                break;
+            }
+            std::cout << "Enter trace file path: ";
+            std::string path;
+            std::getline(std::cin, path);
+            std::string error;
+            if(!Telemetry::write_trace(path, error)) {
+                std::cerr << "Trace error: " << error << std::endl;
+            } else {
+                std::cout << "Chrome trace written to " << path << std::endl;
+            }
+            break;
+        }
+        case 4:
+            Telemetry::enable(false);
+            std::cout << "Telemetry off." << std::endl;
+            break;
+        default:
+            std::cout << "Invalid option!" << std::endl;
+    }
+}
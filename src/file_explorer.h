@@ -15,32 +15,144 @@
 #include <sstream>
 #include <unistd.h>
 #include <chrono>
+#include <cstring>
+#include <cmath>
+#include <string_view>
+#include <unordered_map>
+#include <glob.h>
+#include <deque>
+#include <memory>
+#include <poll.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include "tree_walker.h"
+#include "name_index.h"
+#include "file_metadata.h"
+#include "dir_listing.h"
+#include "sort_keys.h"
+#include "output_buffer.h"
+#include "copy_engine.h"
+#include "delete_engine.h"
+#include "move_engine.h"
+#include "permission_engine.h"
+#include "duplicate_finder.h"
+#include "tree_snapshot.h"
+#include "top_files.h"
+#include "file_viewer.h"
+#include "fuzzy_finder.h"
+#include "visit_history.h"
+#include "disk_usage.h"
+#include "content_search.h"
+#include "dir_cache.h"
+#include "prefetcher.h"
+#include "telemetry.h"
 
 namespace fs = std::filesystem;
 
+// Caches that outlive a single explorer; the daemon shares one set among
+// all of its clients.
+struct ExplorerCaches {
+    NameIndex name_index;
+    DiskUsage disk_usage;
+    DirCache dir_cache;
+};
+
+// Settings given on the command line.
+struct ExplorerOptions {
+    ListSettings listing;
+    OutputFormat format = OutputFormat::Human;
+    bool use_cache = true;
+    bool prefetch = false;
+    bool interactive = true;    // banners and totals around human output
+    std::shared_ptr<ExplorerCaches> caches;     // a private set if null
+    int output_fd = STDOUT_FILENO;
+    uint8_t output_frame = 0;   // see OutputBuffer
+};
+
 class FileExplorer {
 private:
     fs::path current_path;
+    std::shared_ptr<ExplorerCaches> caches;
+    NameIndex& name_index;
+    DiskUsage& disk_usage;
+    DirCache& dir_cache;
+    ListSettings list_settings;
+    OutputFormat output_format;
+    OutputBuffer out;
+    bool use_cache;
+    bool interactive;
+    std::deque<std::string> recent_dirs;        // most recent first
+    std::unique_ptr<Prefetcher> prefetcher;     // null unless --prefetch
+    std::unordered_map<std::string, DiskUsage::Totals> dir_usage;
+    VisitHistory history;                       // loaded by run()
     
 public:
-    FileExplorer();
+    explicit FileExplorer(const ExplorerOptions& options = ExplorerOptions());
     void run();
     
+    // Non-interactive entry points; return false if anything failed.
+    bool list_directory(const fs::path& dir, bool detailed);
+    // A line above one of several listings, in the listing's own output.
+    void print_heading(const std::string& text);
+    bool find(const fs::path& root, const std::string& query);
+    // One detailed listing row per path, for the path itself.
+    bool stat_path(const fs::path& path);
+    bool disk_usage_of(const fs::path& path);
+    bool top_files(const fs::path& root, const TopFiles::Options& options);
+    bool save_snapshot(const fs::path& dir, const std::string& file);
+    // after is a snapshot file, or a directory to compare as it is now.
+    bool diff_snapshot(const std::string& before_file, const std::string& after);
+    // Prints lines lines from position (see FileViewer::locate), then with
+    // follow keeps printing appended lines until Enter is pressed on a
+    // terminal stdin, or until a signal when stdin is not a terminal.
+    bool view_file(const fs::path& file, const std::string& position, uint64_t lines, bool follow);
+    
 private:
-    void list_files(bool detailed = false);
+    bool list_files(bool detailed = false);
     void navigate();
+    void entered_directory(const fs::path& previous);
+    FuzzyFinder::Bonuses frecency_bonuses();
+    // Lets the user pick one of finder's paths; empty if cancelled.
+    std::string fuzzy_pick(FuzzyFinder& finder);
+    std::string fuzzy_pick_keys(FuzzyFinder& finder);
+    std::string fuzzy_pick_lines(FuzzyFinder& finder);
     void show_menu();
     void handle_choice(int choice);
     void copy_file();
+    void print_copy_result(const CopyEngine::Result& result);
     void move_file();
+    void move_batch(const std::string& pattern, const fs::path& dest_dir);
+    void print_move_result(const MoveEngine::Result& result);
     void delete_file();
     void create_file();
     void create_directory();
     void search_files();
+    bool run_search(const std::string& search_term);
+    void search_contents();
+    void find_duplicates();
+    void snapshot_menu();
+    void top_files_menu();
+    void view_menu();
+    bool follow_file(FileViewer& viewer, uint64_t shown);
+    uint64_t print_view_lines(FileViewer& viewer, uint64_t offset, uint64_t count, uint64_t end);
     void manage_permissions();
+    void manage_index();
+    void list_settings_menu();
+    void show_stats();
     std::string get_permissions_string(fs::perms p);
     std::string format_file_size(uintmax_t size);
-    void display_file_info(const fs::directory_entry& entry);
+    void add_dir_sizes(DirListing& listing, DiskUsage::Totals& usage_sum);
+    void print_list_row(std::string_view name, const ListRecord& record, bool detailed);
+    void display_file_info(std::string_view name, const ListRecord& record);
+    void print_search_row(std::string_view path, bool is_dir);
+    void print_content_row(std::string_view path, uint64_t line, std::string_view text);
+    void print_duplicate_row(uint64_t group, uint64_t size, std::string_view path);
+    void print_change_row(const TreeSnapshot::Change& change);
+    void print_top_row(const TopFiles::Item& item);
+    void print_view_row(uint64_t line, std::string_view text);
+    void print_usage_row(std::string_view path, const DiskUsage::Totals& totals);
+    static const char* entry_type_name(const ListRecord& record);
     std::time_t to_time_t(const fs::file_time_type& ftime);
 };
 
@@ -0,0 +1,124 @@
+#include "file_metadata.h"
+#include "telemetry.h"
+
+#include <cerrno>
+#include <vector>
+#include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
+#include <unistd.h>
+#include <sys/sysmacros.h>
+
+namespace {
+
+void from_stat(const struct stat& st, FileMeta& meta) {
+    meta.mode = st.st_mode;
+    meta.nlink = st.st_nlink;
+    meta.uid = st.st_uid;
+    meta.gid = st.st_gid;
+    meta.size = st.st_size;
+    meta.blocks = st.st_blocks;
+    meta.ino = st.st_ino;
+    meta.dev = st.st_dev;
+    meta.mtime = st.st_mtim.tv_sec;
+    meta.mtime_nsec = st.st_mtim.tv_nsec;
+    meta.atime = st.st_atim.tv_sec;
+}
+
+bool fetch_once(int dirfd, const char* name, FileMeta& meta, int flags) {
+    Telemetry::add(Counter::MetadataCalls);
+#ifdef STATX_BASIC_STATS
+    static bool have_statx = true;
+    if(have_statx) {
+        struct statx stx;
+        if(statx(dirfd, name, flags, STATX_BASIC_STATS, &stx) == 0) {
+            meta.mode = stx.stx_mode;
+            meta.nlink = stx.stx_nlink;
+            meta.uid = stx.stx_uid;
+            meta.gid = stx.stx_gid;
+            meta.size = stx.stx_size;
+            meta.blocks = stx.stx_blocks;
+            meta.ino = stx.stx_ino;
+            meta.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+            meta.mtime = stx.stx_mtime.tv_sec;
+            meta.mtime_nsec = stx.stx_mtime.tv_nsec;
+            meta.atime = stx.stx_atime.tv_sec;
+            return true;
+        }
+        if(errno != ENOSYS) {
+            return false;
+        }
+        have_statx = false;
+    }
+#endif
+    struct stat st;
+    if(fstatat(dirfd, name, &st, flags) != 0) {
+        return false;
+    }
+    from_stat(st, meta);
+    return true;
+}
+
+std::string lookup_user(uint32_t uid) {
+    Telemetry::add(Counter::NameLookups);
+    struct passwd pw;
+    struct passwd* result = nullptr;
+    std::vector<char> buffer(4096);
+    while(getpwuid_r(uid, &pw, buffer.data(), buffer.size(), &result) == ERANGE) {
+        buffer.resize(buffer.size() * 2);
+    }
+    return result ? result->pw_name : "unknown";
+}
+
+std::string lookup_group(uint32_t gid) {
+    Telemetry::add(Counter::NameLookups);
+    struct group gr;
+    struct group* result = nullptr;
+    std::vector<char> buffer(4096);
+    while(getgrgid_r(gid, &gr, buffer.data(), buffer.size(), &result) == ERANGE) {
+        buffer.resize(buffer.size() * 2);
+    }
+    return result ? result->gr_name : "unknown";
+}
+
+}
+
+bool fetch_metadata(int dirfd, const char* name, FileMeta& meta, bool follow) {
+    if(!follow) {
+        return fetch_once(dirfd, name, meta, AT_SYMLINK_NOFOLLOW);
+    }
+    if(fetch_once(dirfd, name, meta, 0)) {
+        return true;
+    }
+    int err = errno;
+    if(err == ENOENT || err == ELOOP) {
+        if(fetch_once(dirfd, name, meta, AT_SYMLINK_NOFOLLOW)) {
+            return true;
+        }
+    }
+    errno = err;
+    return false;
+}
+
+IdNameCache& IdNameCache::instance() {
+    static IdNameCache cache;
+    return cache;
+}
+
+const std::string& IdNameCache::user_name(uint32_t uid) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = users.find(uid);
+    if(it == users.end()) {
+        it = users.emplace(uid, lookup_user(uid)).first;
+    }
+    return it->second;
+}
+
+const std::string& IdNameCache::group_name(uint32_t gid) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = groups.find(gid);
+    if(it == groups.end()) {
+        it = groups.emplace(gid, lookup_group(gid)).first;
+    }
+    return it->second;
+}
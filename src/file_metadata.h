@@ -0,0 +1,52 @@
+#ifndef FILE_METADATA_H
+#define FILE_METADATA_H
+
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Everything a detailed listing needs, filled by one statx (or fstatat on
+// kernels without it) relative to an open directory fd.
+struct FileMeta {
+    uint32_t mode;
+    uint32_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t size;
+    uint64_t blocks;
+    uint64_t ino;
+    uint64_t dev;
+    int64_t mtime;
+    uint32_t mtime_nsec;
+    int64_t atime;
+
+    bool is_directory() const { return S_ISDIR(mode); }
+    bool is_regular() const { return S_ISREG(mode); }
+    bool is_symlink() const { return S_ISLNK(mode); }
+};
+
+// Returns false and sets errno on failure. With follow set, a dangling
+// symlink falls back to the link itself, like ls -l.
+bool fetch_metadata(int dirfd, const char* name, FileMeta& meta, bool follow = true);
+
+// Process-wide uid/gid to name cache so NSS (and LDAP behind it) is asked
+// once per id rather than once per row.
+class IdNameCache {
+public:
+    static IdNameCache& instance();
+
+    const std::string& user_name(uint32_t uid);
+    const std::string& group_name(uint32_t gid);
+
+private:
+    IdNameCache() = default;
+
+    std::mutex mutex;
+    std::unordered_map<uint32_t, std::string> users;
+    std::unordered_map<uint32_t, std::string> groups;
+};
+
+#endif
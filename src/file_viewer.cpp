@@ -0,0 +1,301 @@
+#include "file_viewer.h"
+#include "text_scan.h"
+#include "prefetcher.h"
+#include "telemetry.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+namespace {
+
+const uint32_t kFollowMask = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF;
+
+}
+
+FileViewer::FileViewer() : fd(-1), map(nullptr), map_size(0), checkpoints(1, 0), inotify_fd(-1), watch_id(-1) {
+}
+
+FileViewer::~FileViewer() {
+    close();
+}
+
+bool FileViewer::open(const std::string& path, std::string& error) {
+    close();
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        error = "cannot open " + path + ": " + strerror(errno);
+        return false;
+    }
+    file_path = path;
+    if(!map_file(error)) {
+        close();
+        return false;
+    }
+    // Small files come in whole in the background; large ones are paged.
+    Prefetcher::advise_file(path);
+    return true;
+}
+
+void FileViewer::close() {
+    stop_follow();
+    guard.reset();
+    if(map) {
+        munmap(const_cast<char*>(map), map_size);
+    }
+    map = nullptr;
+    map_size = 0;
+    if(fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+    checkpoints.assign(1, 0);
+}
+
+bool FileViewer::map_file(std::string& error) {
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        error = "cannot stat " + file_path + ": " + strerror(errno);
+        return false;
+    }
+    if(!S_ISREG(st.st_mode)) {
+        error = file_path + " is not a regular file";
+        return false;
+    }
+    guard.reset();
+    if(map) {
+        munmap(const_cast<char*>(map), map_size);
+        map = nullptr;
+        map_size = 0;
+    }
+    if(st.st_size == 0) {
+        return true;
+    }
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED) {
+        error = "cannot map " + file_path + ": " + strerror(errno);
+        return false;
+    }
+    map = static_cast<const char*>(base);
+    map_size = st.st_size;
+    guard = std::make_unique<MapGuard>(map, map_size);
+    return true;
+}
+
+void FileViewer::index_through(uint64_t chunk) {
+    // Only whole chunks are indexed, so appends never invalidate a count.
+    while(checkpoints.size() <= chunk && checkpoints.size() * kChunkBytes <= map_size) {
+        uint64_t start = (checkpoints.size() - 1) * kChunkBytes;
+        checkpoints.push_back(checkpoints.back() + count_newlines(map + start, kChunkBytes));
+        Telemetry::add(Counter::BytesRead, kChunkBytes);
+    }
+}
+
+uint64_t FileViewer::line_start(uint64_t offset) const {
+    offset = std::min(offset, map_size);
+    if(offset == 0) {
+        return 0;
+    }
+    const void* newline = memrchr(map, '\n', offset);
+    return newline ? static_cast<const char*>(newline) - map + 1 : 0;
+}
+
+uint64_t FileViewer::next_line(uint64_t offset) const {
+    if(offset >= map_size) {
+        return map_size;
+    }
+    const void* newline = memchr(map + offset, '\n', map_size - offset);
+    return newline ? static_cast<const char*>(newline) - map + 1 : map_size;
+}
+
+uint64_t FileViewer::lines_back(uint64_t offset, uint64_t count) const {
+    uint64_t start = line_start(offset);
+    for(uint64_t i = 0; i < count && start > 0; ++i) {
+        start = line_start(start - 1);
+    }
+    return start;
+}
+
+uint64_t FileViewer::percent_offset(double percent) const {
+    if(map_size == 0) {
+        return 0;
+    }
+    percent = std::max(0.0, std::min(100.0, percent));
+    uint64_t offset = static_cast<uint64_t>(map_size * (percent / 100.0));
+    return line_start(std::min(offset, map_size - 1));
+}
+
+bool FileViewer::line_offset(uint64_t line, uint64_t& offset) {
+    if(line == 0 || map_size == 0) {
+        return false;
+    }
+    const uint64_t target = line - 1;   // newlines before the line
+    while(checkpoints.back() <= target && checkpoints.size() * kChunkBytes <= map_size) {
+        index_through(checkpoints.size());
+    }
+    // Last chunk with fewer than target newlines before its start: the
+    // newline ending the previous line is in it or after it. Chunks with no
+    // newline (a line over kChunkBytes) share a checkpoint and must not be
+    // picked past that newline. Line 1 starts in chunk 0.
+    size_t below = std::lower_bound(checkpoints.begin(), checkpoints.end(), target) - checkpoints.begin();
+    size_t chunk = below > 0 ? below - 1 : 0;
+    const char* p = map + chunk * kChunkBytes;
+    const char* end = map + map_size;
+    for(uint64_t remaining = target - checkpoints[chunk]; remaining > 0; --remaining) {
+        p = static_cast<const char*>(memchr(p, '\n', end - p));
+        if(!p) {
+            return false;
+        }
+        ++p;
+    }
+    if(p >= end) {
+        return false;
+    }
+    offset = p - map;
+    return true;
+}
+
+uint64_t FileViewer::line_number(uint64_t offset, bool scan) {
+    offset = std::min(offset, map_size);
+    uint64_t chunk = offset / kChunkBytes;
+    if(chunk >= checkpoints.size()) {
+        if(!scan && chunk > checkpoints.size()) {
+            return 0;
+        }
+        index_through(chunk);
+    }
+    uint64_t start = chunk * kChunkBytes;
+    return checkpoints[chunk] + count_newlines(map + start, offset - start) + 1;
+}
+
+uint64_t FileViewer::find(uint64_t from, std::string_view needle, bool ignore_case) const {
+    if(from >= map_size || needle.empty()) {
+        return map_size;
+    }
+    std::string folded(needle);
+    if(ignore_case) {
+        for(auto& c : folded) {
+            c = (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
+        }
+    }
+    const char* hit = find_literal(map + from, map_size - from, folded, ignore_case);
+    return hit ? hit - map : map_size;
+}
+
+bool FileViewer::locate(const std::string& position, uint64_t from, uint64_t lines, uint64_t& offset) {
+    if(position.empty() || position == "head") {
+        offset = 0;
+        return true;
+    }
+    if(position == "tail") {
+        // The first lines - 1 starts before the partial or empty last line.
+        uint64_t end = map_size > 0 && map[map_size - 1] == '\n' ? map_size - 1 : map_size;
+        offset = lines_back(end, lines > 0 ? lines - 1 : 0);
+        return true;
+    }
+    if(position[0] == '/') {
+        uint64_t hit = find(from, std::string_view(position).substr(1), true);
+        if(hit >= map_size) {
+            return false;
+        }
+        offset = line_start(hit);
+        return true;
+    }
+    char* end = nullptr;
+    if(position.back() == '%') {
+        double percent = std::strtod(position.c_str(), &end);
+        if(end != position.c_str() + position.size() - 1) {
+            return false;
+        }
+        offset = percent_offset(percent);
+        return true;
+    }
+    uint64_t line = std::strtoull(position.c_str(), &end, 10);
+    return *end == '\0' && line_offset(line, offset);
+}
+
+bool FileViewer::start_follow(std::string& error) {
+    stop_follow();
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotify_fd < 0) {
+        error = std::string("inotify unavailable: ") + strerror(errno);
+        return false;
+    }
+    watch_id = inotify_add_watch(inotify_fd, file_path.c_str(), kFollowMask);
+    if(watch_id < 0) {
+        error = "cannot watch " + file_path + ": " + strerror(errno);
+        stop_follow();
+        return false;
+    }
+    return true;
+}
+
+void FileViewer::stop_follow() {
+    if(inotify_fd >= 0) {
+        ::close(inotify_fd);
+    }
+    inotify_fd = -1;
+    watch_id = -1;
+}
+
+bool FileViewer::drain_events() {
+    if(inotify_fd < 0) {
+        return false;
+    }
+    alignas(inotify_event) char buffer[4096];
+    bool any = false;
+    while(true) {
+        ssize_t n = read(inotify_fd, buffer, sizeof(buffer));
+        if(n <= 0) {
+            break;
+        }
+        any = true;
+    }
+    return any;
+}
+
+FileViewer::Change FileViewer::refresh() {
+    struct stat st;
+    struct stat named;
+    if(fd < 0 || fstat(fd, &st) != 0) {
+        return Change::None;
+    }
+    // Rotated: the name now points at another file. Follow the name, like tail -F.
+    if(stat(file_path.c_str(), &named) == 0 && (named.st_ino != st.st_ino || named.st_dev != st.st_dev)) {
+        int fresh = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fresh < 0) {
+            return Change::None;
+        }
+        ::close(fd);
+        fd = fresh;
+        std::string error;
+        map_file(error);
+        checkpoints.assign(1, 0);
+        if(inotify_fd >= 0) {
+            inotify_rm_watch(inotify_fd, watch_id);
+            watch_id = inotify_add_watch(inotify_fd, file_path.c_str(), kFollowMask);
+        }
+        return Change::Reset;
+    }
+    uint64_t size = st.st_size;
+    if(size == map_size) {
+        return Change::None;
+    }
+    // Remapping costs page-table setup only; cached pages are not reread.
+    std::string error;
+    bool grew = size > map_size;
+    if(!map_file(error)) {
+        return Change::None;
+    }
+    if(!grew) {
+        checkpoints.assign(1, 0);
+        return Change::Reset;
+    }
+    return Change::Grew;
+}
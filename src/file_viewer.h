@@ -0,0 +1,85 @@
+#ifndef FILE_VIEWER_H
+#define FILE_VIEWER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "map_guard.h"
+
+// Read-only view of one file through mmap, for paging through logs of any
+// size. Line numbers come from a lazy index: the newline count at the start
+// of every 1 MiB chunk, filled with the SSE2 newline counter only as far as
+// a request needs. Moving by byte offset (head, tail, percentage, search)
+// never touches the index, so opening a huge file and jumping to its end
+// costs the same as for a small one. A file truncated while mapped reads
+// as NULs past its new end (see MapGuard) until refresh() notices.
+class FileViewer {
+public:
+    static const uint64_t kChunkBytes = 1024 * 1024;
+
+    enum class Change {
+        None,
+        Grew,       // appended to; everything seen so far is still valid
+        Reset       // truncated or replaced; start over
+    };
+
+    FileViewer();
+    ~FileViewer();
+    FileViewer(const FileViewer&) = delete;
+    FileViewer& operator=(const FileViewer&) = delete;
+
+    bool open(const std::string& path, std::string& error);
+    void close();
+
+    const std::string& path() const { return file_path; }
+    uint64_t size() const { return map_size; }
+    const char* data() const { return map; }
+
+    // Line boundaries by byte offset; these only look at nearby bytes.
+    uint64_t line_start(uint64_t offset) const;
+    uint64_t next_line(uint64_t offset) const;          // size() after the last line
+    uint64_t lines_back(uint64_t offset, uint64_t count) const;
+    uint64_t percent_offset(double percent) const;
+
+    // Offset of 1-based line; false if the file has fewer lines.
+    bool line_offset(uint64_t line, uint64_t& offset);
+    // 1-based line holding offset. Unless scan is set, returns 0 when that
+    // would mean indexing more than one chunk beyond what is indexed.
+    uint64_t line_number(uint64_t offset, bool scan = true);
+    uint64_t indexed_bytes() const { return (checkpoints.size() - 1) * kChunkBytes; }
+
+    // First match at or after from, or size() if there is none.
+    uint64_t find(uint64_t from, std::string_view needle, bool ignore_case) const;
+
+    // Start of the line a position names: "head", "tail" (the last lines
+    // lines), a line number "N", "N%", or "/text" for the next line at or
+    // after from containing text, ignoring case. False if there is none.
+    bool locate(const std::string& position, uint64_t from, uint64_t lines, uint64_t& offset);
+
+    // Follow mode. refresh() picks up a new size by remapping; the pages
+    // already read stay cached, so nothing is read twice.
+    bool start_follow(std::string& error);
+    void stop_follow();
+    int follow_fd() const { return inotify_fd; }
+    // Drains pending inotify events; true if any concerned the file.
+    bool drain_events();
+    Change refresh();
+
+private:
+    std::string file_path;
+    int fd;
+    const char* map;
+    uint64_t map_size;
+    std::unique_ptr<MapGuard> guard;
+    // checkpoints[i]: newlines in the first i chunks.
+    std::vector<uint64_t> checkpoints;
+    int inotify_fd;
+    int watch_id;
+
+    bool map_file(std::string& error);
+    void index_through(uint64_t chunk);
+};
+
+#endif
@@ -0,0 +1,315 @@
+#include "fuzzy_finder.h"
+#include "tree_walker.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+char fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
+}
+
+// First byte in [p, end) that folds to c (already lower case). The vector
+// loads may read on up to limit, past end, which saves a scalar tail on
+// most paths; hits beyond end are ignored.
+const char* find_folded(const char* p, const char* end, const char* limit, char c) {
+#ifdef __SSE2__
+    // Setting the 0x20 bit folds exactly the upper-case letters onto the
+    // lower-case ones, so it is only applied when c is a letter.
+    const __m128i needle = _mm_set1_epi8(c);
+    const __m128i fold_bit = _mm_set1_epi8((c >= 'a' && c <= 'z') ? 0x20 : 0);
+    for(; p < end && p + 16 <= limit; p += 16) {
+        __m128i chunk = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), fold_bit);
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+        if(mask != 0) {
+            const char* hit = p + __builtin_ctz(mask);
+            return hit < end ? hit : nullptr;
+        }
+    }
+#endif
+    for(; p < end; ++p) {
+        if(fold(*p) == c) {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+// Letters and digits get a bit each; everything else shares the rest.
+uint64_t char_bit(char c) {
+    c = fold(c);
+    if(c >= 'a' && c <= 'z') {
+        return uint64_t(1) << (c - 'a');
+    }
+    if(c >= '0' && c <= '9') {
+        return uint64_t(1) << (26 + c - '0');
+    }
+    return uint64_t(1) << (36 + static_cast<unsigned char>(c) % 28);
+}
+
+// Score for matching a query character at pos, the previous one having
+// ended at end: starts of components and words, and runs, count most.
+int32_t char_score(const char* path, size_t pos, size_t end, bool first) {
+    int32_t score = 16;
+    if(!first) {
+        score += pos == end ? 24 : -static_cast<int32_t>(std::min<size_t>(pos - end, 12));
+    }
+    char before = pos > 0 ? path[pos - 1] : '/';
+    if(before == '/') {
+        score += 32;
+    } else if(before == '_' || before == '-' || before == '.' || before == ' ') {
+        score += 20;
+    } else if(before >= 'a' && before <= 'z' && path[pos] >= 'A' && path[pos] <= 'Z') {
+        score += 16;
+    }
+    return score;
+}
+
+// Orders a heap so that its front is the worst match kept.
+bool better(const FuzzyFinder::Match& a, const FuzzyFinder::Match& b) {
+    return a.score != b.score ? a.score > b.score : a.id < b.id;
+}
+
+// Below this many candidates per slice starting a thread costs more than
+// it saves.
+const size_t kMinSlice = 65536;
+
+size_t slice_count(size_t count, unsigned threads) {
+    return std::max<size_t>(1, std::min<size_t>(threads, count / kMinSlice));
+}
+
+// Runs work(slice, begin, end) over [0, count) cut into slices, in parallel.
+template<typename Work>
+void for_slices(size_t count, size_t slices, Work work) {
+    std::vector<std::thread> pool;
+    for(size_t i = 1; i < slices; ++i) {
+        pool.emplace_back(work, i, count * i / slices, count * (i + 1) / slices);
+    }
+    work(0, 0, count / slices);
+    for(auto& thread : pool) {
+        thread.join();
+    }
+}
+
+}
+
+void FuzzyFinder::clear() {
+    root.clear();
+    arena.clear();
+    starts.clear();
+    masks.clear();
+    basenames.clear();
+    bonuses.clear();
+    errors = 0;
+    current.clear();
+    stages.clear();
+    spare.clear();
+}
+
+void FuzzyFinder::add(std::string_view text, int32_t bonus) {
+    if(text.empty() || text.size() > UINT16_MAX || arena.size() + text.size() > UINT32_MAX) {
+        return;
+    }
+    if(starts.empty()) {
+        starts.push_back(0);
+    }
+    uint64_t mask = 0;
+    for(char c : text) {
+        mask |= char_bit(c);
+    }
+    size_t slash = text.rfind('/');
+    arena.insert(arena.end(), text.begin(), text.end());
+    starts.push_back(static_cast<uint32_t>(arena.size()));
+    masks.push_back(mask);
+    basenames.push_back(static_cast<uint16_t>(slash == std::string_view::npos ? 0 : slash + 1));
+    bonuses.push_back(bonus);
+}
+
+void FuzzyFinder::load_tree(const std::string& root_path, const Bonuses& path_bonuses, unsigned threads) {
+    clear();
+    workers = threads ? threads : TreeWalker::default_threads();
+    root = root_path;
+    while(root.size() > 1 && root.back() == '/') {
+        root.pop_back();
+    }
+    const size_t strip = root == "/" ? 1 : root.size() + 1;
+
+    // Paths relative to root, so matches land in the part that differs.
+    struct Local {
+        std::vector<char> arena;
+        std::vector<size_t> ends;
+    };
+    TreeWalker walker(threads);
+    std::vector<Local> locals(walker.thread_count());
+    walker.on_entry([&](const WalkEntry& entry) {
+        Local& local = locals[entry.worker];
+        const std::string& dir = *entry.dir_path;
+        if(dir.size() > root.size()) {
+            local.arena.insert(local.arena.end(), dir.begin() + strip, dir.end());
+            local.arena.push_back('/');
+        }
+        local.arena.insert(local.arena.end(), entry.name, entry.name + entry.name_len);
+        local.ends.push_back(local.arena.size());
+        return true;
+    });
+    walker.walk(root);
+    errors = walker.errors();
+
+    size_t total = 0;
+    for(const auto& local : locals) {
+        total += local.arena.size();
+    }
+    arena.reserve(total);
+    for(auto& local : locals) {
+        size_t start = 0;
+        for(size_t end : local.ends) {
+            add(std::string_view(local.arena.data() + start, end - start));
+            start = end;
+        }
+        local = Local();
+    }
+
+    if(!path_bonuses.empty()) {
+        std::string full;
+        for(uint32_t id = 0; id < size(); ++id) {
+            full = full_path(id);
+            auto it = path_bonuses.find(full);
+            if(it != path_bonuses.end()) {
+                bonuses[id] = it->second;
+            }
+        }
+    }
+}
+
+std::string FuzzyFinder::full_path(uint32_t id) const {
+    if(root.empty()) {
+        return std::string(path(id));
+    }
+    return (root == "/" ? root : root + "/") + std::string(path(id));
+}
+
+size_t FuzzyFinder::candidates() const {
+    return stages.empty() ? size() : stages.back().size();
+}
+
+void FuzzyFinder::set_query(std::string_view text) {
+    std::string folded(text.substr(0, kMaxQuery));
+    for(auto& c : folded) {
+        c = fold(c);
+    }
+    size_t common = 0;
+    while(common < folded.size() && common < current.size() && folded[common] == current[common]) {
+        ++common;
+    }
+    // Backspace pops stages, keeping their memory for the next characters;
+    // only new characters are matched.
+    while(stages.size() > common) {
+        spare.push_back(std::move(stages.back()));
+        spare.back().clear();
+        stages.pop_back();
+    }
+    current.resize(common);
+    for(size_t i = common; i < folded.size(); ++i) {
+        current += folded[i];
+        narrow(folded[i]);
+    }
+}
+
+void FuzzyFinder::narrow(char c) {
+    const uint64_t bit = char_bit(c);
+    const bool first = stages.empty();
+    const Candidate* previous = first ? nullptr : stages.back().data();
+    const size_t count = first ? size() : stages.back().size();
+    std::vector<Candidate> next;
+    if(!spare.empty()) {
+        next = std::move(spare.back());
+        spare.pop_back();
+    }
+    next.resize(count);
+
+    // Every slice writes its survivors from its own start; the gaps between
+    // slices are closed afterwards, which keeps the candidates in id order.
+    const char* limit = arena.data() + arena.size();
+    const size_t slices = slice_count(count, workers);
+    std::vector<size_t> kept(slices);
+    for_slices(count, slices, [&](size_t slice, size_t begin, size_t end) {
+        Candidate* out = next.data() + begin;
+        for(size_t i = begin; i < end; ++i) {
+            const Candidate from = first ? Candidate(static_cast<uint32_t>(i), 0, 0) : previous[i];
+            const uint32_t id = from.id;
+            if(!(masks[id] & bit)) {
+                continue;
+            }
+            const char* text = arena.data() + starts[id];
+            const char* hit = find_folded(text + from.end, arena.data() + starts[id + 1], limit, c);
+            if(hit) {
+                size_t pos = hit - text;
+                *out++ = Candidate(id, static_cast<uint16_t>(pos + 1),
+                                   static_cast<int16_t>(from.score + char_score(text, pos, from.end, first)));
+            }
+        }
+        kept[slice] = out - (next.data() + begin);
+    });
+    size_t total = kept[0];
+    for(size_t slice = 1; slice < slices; ++slice) {
+        std::memmove(next.data() + total, next.data() + count * slice / slices, kept[slice] * sizeof(Candidate));
+        total += kept[slice];
+    }
+    next.resize(total);
+    stages.push_back(std::move(next));
+}
+
+int32_t FuzzyFinder::rank(const Candidate& candidate) const {
+    uint32_t id = candidate.id;
+    int32_t score = candidate.score + bonuses[id];
+    // A match that reaches into the last component names that entry;
+    // otherwise shallower, shorter paths come first.
+    if(candidate.end > basenames[id]) {
+        score += 40;
+    }
+    return score - static_cast<int32_t>((starts[id + 1] - starts[id]) / 8);
+}
+
+std::vector<FuzzyFinder::Match> FuzzyFinder::top(size_t count) const {
+    std::vector<Match> heap;
+    if(count == 0) {
+        return heap;
+    }
+    auto keep = [count](std::vector<Match>& kept, const Match& match) {
+        if(kept.size() >= count && !better(match, kept.front())) {
+            return;
+        }
+        kept.push_back(match);
+        std::push_heap(kept.begin(), kept.end(), better);
+        if(kept.size() > count) {
+            std::pop_heap(kept.begin(), kept.end(), better);
+            kept.pop_back();
+        }
+    };
+    // Best count per slice, then the best of those.
+    const bool all = stages.empty();
+    const size_t total = candidates();
+    const size_t slices = slice_count(total, workers);
+    std::vector<std::vector<Match>> heaps(slices);
+    for_slices(total, slices, [&](size_t slice, size_t begin, size_t end) {
+        std::vector<Match>& kept = heaps[slice];
+        kept.reserve(count + 1);
+        for(size_t i = begin; i < end; ++i) {
+            const Candidate candidate = all ? Candidate(static_cast<uint32_t>(i), 0, 0) : stages.back()[i];
+            keep(kept, Match{candidate.id, rank(candidate)});
+        }
+    });
+    heap = std::move(heaps[0]);
+    for(size_t slice = 1; slice < slices; ++slice) {
+        for(const auto& match : heaps[slice]) {
+            keep(heap, match);
+        }
+    }
+    std::sort_heap(heap.begin(), heap.end(), better);
+    return heap;
+}
@@ -0,0 +1,85 @@
+#ifndef FUZZY_FINDER_H
+#define FUZZY_FINDER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// Fuzzy "jump to" over a fixed set of paths: a query matches a path whose
+// characters contain it as a subsequence, ignoring case.
+//
+// Paths live back to back in one arena, each with a 64-bit mask of the
+// characters it contains, so most non-matches cost one AND. Queries narrow
+// incrementally: every stage holds the candidates for one more query
+// character together with where their match ended and its score so far, so
+// typing a character only searches onward from there (16 bytes at a time,
+// folding case as it goes), and deleting one just drops the last stage.
+class FuzzyFinder {
+public:
+    static const size_t kTopResults = 20;
+    static const size_t kMaxQuery = 255;    // longer queries are cut
+
+    struct Match {
+        uint32_t id;
+        int32_t score;
+    };
+
+    // Extra score per path, e.g. from visit frecency.
+    using Bonuses = std::unordered_map<std::string, int32_t>;
+
+    // Every entry below root, walked in parallel. Paths are kept relative to
+    // root so that queries match the part that differs. The same threads
+    // later narrow and rank large candidate sets.
+    void load_tree(const std::string& root, const Bonuses& bonuses, unsigned threads = 0);
+    void add(std::string_view path, int32_t bonus = 0);
+    void clear();
+
+    size_t size() const { return starts.empty() ? 0 : starts.size() - 1; }
+    std::string_view path(uint32_t id) const {
+        return std::string_view(arena.data() + starts[id], starts[id + 1] - starts[id]);
+    }
+    std::string full_path(uint32_t id) const;
+    uint64_t walk_errors() const { return errors; }
+
+    // Replaces the query. Only the part after the prefix it shares with the
+    // previous query is matched again.
+    void set_query(std::string_view text);
+    const std::string& query() const { return current; }
+    // Paths still matching the query.
+    size_t candidates() const;
+
+    // Best matches, best first.
+    std::vector<Match> top(size_t count = kTopResults) const;
+
+private:
+    // Eight bytes, as whole stages are streamed on every keystroke. Left
+    // uninitialised by default so reused stage buffers are not cleared.
+    struct Candidate {
+        uint32_t id;
+        uint16_t end;       // one past the last matched character
+        int16_t score;
+
+        Candidate() {}
+        Candidate(uint32_t id, uint16_t end, int16_t score) : id(id), end(end), score(score) {}
+    };
+
+    std::string root;                   // empty when paths were added directly
+    std::vector<char> arena;
+    std::vector<uint32_t> starts;       // path i is [starts[i], starts[i + 1])
+    std::vector<uint64_t> masks;
+    std::vector<uint16_t> basenames;    // offset of the last component
+    std::vector<int32_t> bonuses;
+    uint64_t errors = 0;
+
+    std::string current;                // lower case
+    std::vector<std::vector<Candidate>> stages;    // stages[i]: first i + 1 characters
+    std::vector<std::vector<Candidate>> spare;     // popped stages, reused
+    unsigned workers = 1;
+
+    void narrow(char c);
+    int32_t rank(const Candidate& candidate) const;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "hash64.h"
+
+#include <cstring>
+
+namespace {
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+const uint64_t kPrime3 = 0x165667B19E3779F9ull;
+const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+const uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) {
+    acc += input * kPrime2;
+    acc = rotl(acc, 31);
+    return acc * kPrime1;
+}
+
+inline uint64_t merge(uint64_t h, uint64_t acc) {
+    h ^= round(0, acc);
+    return h * kPrime1 + kPrime4;
+}
+
+}
+
+Hash64::Hash64(uint64_t seed) : seed(seed), total(0), pending_len(0) {
+    acc[0] = seed + kPrime1 + kPrime2;
+    acc[1] = seed + kPrime2;
+    acc[2] = seed;
+    acc[3] = seed - kPrime1;
+}
+
+void Hash64::update(const void* data, size_t len) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + len;
+    total += len;
+
+    if(pending_len + len < sizeof(pending)) {
+        std::memcpy(pending + pending_len, p, len);
+        pending_len += len;
+        return;
+    }
+    if(pending_len > 0) {
+        size_t fill = sizeof(pending) - pending_len;
+        std::memcpy(pending + pending_len, p, fill);
+        for(int i = 0; i < 4; ++i) {
+            acc[i] = round(acc[i], read64(pending + 8 * i));
+        }
+        p += fill;
+        pending_len = 0;
+    }
+    // Four independent lanes keep the multipliers busy.
+    uint64_t v0 = acc[0], v1 = acc[1], v2 = acc[2], v3 = acc[3];
+    for(; p + 32 <= end; p += 32) {
+        v0 = round(v0, read64(p));
+        v1 = round(v1, read64(p + 8));
+        v2 = round(v2, read64(p + 16));
+        v3 = round(v3, read64(p + 24));
+    }
+    acc[0] = v0;
+    acc[1] = v1;
+    acc[2] = v2;
+    acc[3] = v3;
+    pending_len = end - p;
+    std::memcpy(pending, p, pending_len);
+}
+
+uint64_t Hash64::digest() const {
+    uint64_t h;
+    if(total >= 32) {
+        h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+        for(int i = 0; i < 4; ++i) {
+            h = merge(h, acc[i]);
+        }
+    } else {
+        h = seed + kPrime5;
+    }
+    h += total;
+
+    const unsigned char* p = pending;
+    const unsigned char* end = pending + pending_len;
+    for(; p + 8 <= end; p += 8) {
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * kPrime1 + kPrime4;
+    }
+    if(p + 4 <= end) {
+        h ^= read32(p) * kPrime1;
+        h = rotl(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for(; p < end; ++p) {
+        h ^= *p * kPrime5;
+        h = rotl(h, 11) * kPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t Hash64::of(const void* data, size_t len, uint64_t seed) {
+    Hash64 hash(seed);
+    hash.update(data, len);
+    return hash.digest();
+}
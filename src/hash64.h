@@ -0,0 +1,26 @@
+#ifndef HASH64_H
+#define HASH64_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Streaming XXH64: a fast non-cryptographic 64-bit hash, for telling file
+// contents apart. Feed any number of update() calls, then digest().
+class Hash64 {
+public:
+    explicit Hash64(uint64_t seed = 0);
+
+    void update(const void* data, size_t len);
+    uint64_t digest() const;
+
+    static uint64_t of(const void* data, size_t len, uint64_t seed = 0);
+
+private:
+    uint64_t acc[4];
+    uint64_t seed;
+    uint64_t total;
+    unsigned char pending[32];
+    size_t pending_len;
+};
+
+#endif
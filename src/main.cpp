@@ -1,7 +1,172 @@
 #include "file_explorer.h"
+#include "command_runner.h"
+#include "explorer_daemon.h"
 
-int main() {
-    FileExplorer explorer;
-    explorer.run();
-    return 0;
-}
\ No newline at end of file
+static void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [OPTIONS]" << std::endl;
+    std::cerr << "       " << program << " [OPTIONS] [--yes] COMMAND ARGS..." << std::endl;
+    std::cerr << "       " << program << " [OPTIONS] [--yes] [--jobs N] --batch FILE|-" << std::endl;
+    std::cerr << "       " << program << " [OPTIONS] [--jobs N] [--socket PATH] --daemon" << std::endl;
+    std::cerr << "Commands: ls [-l] [PATH...], find QUERY [PATH...], cp [-r] SRC... DST, mv SRC... DST," << std::endl;
+    std::cerr << "          rm [-r] PATH...," << std::endl;
+    std::cerr << "          chmod [-R] MODE PATH..., chmod [-R] [--files MODE] [--dirs MODE] PATH..." << std::endl;
+    std::cerr << "          (MODE is octal or symbolic, e.g. u+rw,g-w,o=)," << std::endl;
+    std::cerr << "          snapshot [DIR] FILE, diff SNAPSHOT [SNAPSHOT|DIR]," << std::endl;
+    std::cerr << "          top [--by size|blocks|mtime|atime] [-n N] [-r] [--ext LIST] [--older AGE] [--newer AGE] [PATH...],"
+              << std::endl;
+    std::cerr << "          view [-n LINES] [--at head|tail|N|N%|/TEXT] [-f] FILE, stat [PATH...], du [PATH...]"
+              << std::endl;
+    std::cerr << "          exit status 0 ok, 1 failed, 2 usage" << std::endl;
+    std::cerr << "Options:" << std::endl;
+    std::cerr << "  --stream   list directories in directory order as entries are read" << std::endl;
+    std::cerr << "  --limit N  show at most N entries per listing" << std::endl;
+    std::cerr << "  --sort F   order listings by name, natural, size, mtime or ext" << std::endl;
+    std::cerr << "  --reverse  sort in descending order" << std::endl;
+    std::cerr << "  --format   row format for listings and search results" << std::endl;
+    std::cerr << "  --du       show recursive disk usage for directories in sorted listings" << std::endl;
+    std::cerr << "  --no-cache read directories afresh every time instead of from snapshots" << std::endl;
+    std::cerr << "  --prefetch warm neighbouring and recent directories in the background" << std::endl;
+    std::cerr << "  --stats    print each operation's time and counters, and a summary on exit" << std::endl;
+    std::cerr << "  --stats-json FILE  record operations and write them as JSON on exit" << std::endl;
+    std::cerr << "  --trace FILE       write a Chrome trace of the parallel engines on exit" << std::endl;
+    std::cerr << "  --yes      allow commands to replace existing targets and remove directories" << std::endl;
+    std::cerr << "  --jobs N   run up to N batch commands at once (default: one per core)," << std::endl;
+    std::cerr << "             or with --daemon, requests served at once" << std::endl;
+    std::cerr << "  --batch F  run one command per line of F, or of stdin for -" << std::endl;
+    std::cerr << "  --daemon   serve ls, find, stat and du to clients from shared caches" << std::endl;
+    std::cerr << "  --connect  run ls, find, stat and du on the daemon when one is listening" << std::endl;
+    std::cerr << "  --socket PATH      daemon socket (default " << ExplorerDaemon::default_socket() << ")" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    ExplorerOptions options;
+    bool stats = false;
+    std::string stats_json;
+    std::string trace_file;
+    CommandRunner::Options command_options;
+    std::string batch_file;
+    std::vector<std::string> command;
+    bool daemon = false;
+    bool connect = false;
+    std::string socket_path;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(CommandRunner::is_command(arg)) {
+            command.assign(argv + i, argv + argc);
+            break;
+        } else if(arg == "--yes") {
+            command_options.yes = true;
+        } else if(arg == "--jobs" && i + 1 < argc) {
+            try {
+                command_options.jobs = std::stoul(argv[++i]);
+            } catch(const std::exception& ex) {
+                std::cerr << "Invalid job count: " << argv[i] << std::endl;
+                return 2;
+            }
+        } else if(arg == "--batch" && i + 1 < argc) {
+            batch_file = argv[++i];
+        } else if(arg == "--daemon") {
+            daemon = true;
+        } else if(arg == "--connect") {
+            connect = true;
+        } else if(arg == "--socket" && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if(arg == "--stream") {
+            options.listing.mode = ListMode::Streaming;
+        } else if(arg == "--limit" && i + 1 < argc) {
+            try {
+                options.listing.limit = std::stoul(argv[++i]);
+            } catch(const std::exception& ex) {
+                std::cerr << "Invalid limit: " << argv[i] << std::endl;
+                return 2;
+            }
+        } else if(arg == "--sort" && i + 1 < argc) {
+            if(!parse_sort_field(argv[++i], options.listing.sort.field)) {
+                std::cerr << "Invalid sort order: " << argv[i] << std::endl;
+                return 2;
+            }
+        } else if(arg == "--format" && i + 1 < argc) {
+            if(!parse_output_format(argv[++i], options.format)) {
+                std::cerr << "Invalid output format: " << argv[i] << std::endl;
+                return 2;
+            }
+        } else if(arg == "--stats") {
+            stats = true;
+        } else if(arg == "--stats-json" && i + 1 < argc) {
+            stats_json = argv[++i];
+        } else if(arg == "--trace" && i + 1 < argc) {
+            trace_file = argv[++i];
+        } else if(arg == "--prefetch") {
+            options.prefetch = true;
+        } else if(arg == "--no-cache") {
+            options.use_cache = false;
+        } else if(arg == "--du") {
+            options.listing.dir_sizes = true;
+        } else if(arg == "--reverse") {
+            options.listing.sort.descending = true;
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+    
+    Telemetry::enable(stats || !stats_json.empty());
+    Telemetry::set_echo(stats);
+    if(!trace_file.empty()) {
+        Telemetry::start_trace();
+    }
+    
+    int status = 0;
+    if(daemon) {
+        ExplorerDaemon::Options daemon_options;
+        daemon_options.socket = socket_path;
+        daemon_options.workers = command_options.jobs;
+        daemon_options.explorer = options;
+        ExplorerDaemon server(daemon_options);
+        std::string error;
+        if(!server.serve(error)) {
+            std::cerr << "Daemon error: " << error << std::endl;
+            status = 1;
+        }
+    } else if(!command.empty() || !batch_file.empty()) {
+        command_options.explorer = options;
+        if(connect) {
+            command_options.connect = socket_path.empty() ? ExplorerDaemon::default_socket() : socket_path;
+        }
+        CommandRunner runner(command_options);
+        if(!command.empty()) {
+            status = runner.run(command);
+        } else if(batch_file == "-") {
+            status = runner.run_batch(std::cin);
+        } else {
+            std::ifstream batch(batch_file);
+            if(!batch) {
+                std::cerr << "Batch error: cannot open " << batch_file << std::endl;
+                return 2;
+            }
+            status = runner.run_batch(batch);
+        }
+    } else {
+        FileExplorer explorer(options);
+        explorer.run();
+    }
+    
+    if(stats) {
+        std::cerr << "\n=== Operation Statistics ===" << std::endl;
+        Telemetry::print_summary(std::cerr);
+    }
+    if(!stats_json.empty()) {
+        std::ofstream file(stats_json);
+        Telemetry::write_json(file);
+        if(!file) {
+            std::cerr << "Stats error: cannot write " << stats_json << std::endl;
+        }
+    }
+    if(!trace_file.empty()) {
+        std::string error;
+        if(!Telemetry::write_trace(trace_file, error)) {
+            std::cerr << "Trace error: " << error << std::endl;
+        }
+    }
+    return status;
+}
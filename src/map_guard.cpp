@@ -0,0 +1,73 @@
+#include "map_guard.h"
+
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <csignal>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace {
+
+// Lock-free, so the handler can read it. A slot is live while begin is a
+// real address; it is set only after end.
+const int kSlots = 128;
+std::atomic<uintptr_t> range_begin[kSlots];
+std::atomic<uintptr_t> range_end[kSlots];
+uintptr_t page_size = 4096;
+std::once_flag installed;
+
+void on_sigbus(int sig, siginfo_t* info, void*) {
+    uintptr_t address = reinterpret_cast<uintptr_t>(info->si_addr);
+    for(int i = 0; i < kSlots; ++i) {
+        uintptr_t begin = range_begin[i].load(std::memory_order_acquire);
+        if(begin == 0 || address < begin || address >= range_end[i].load(std::memory_order_acquire)) {
+            continue;
+        }
+        void* page = reinterpret_cast<void*>(address & ~(page_size - 1));
+        if(mmap(page, page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) {
+            return;
+        }
+        break;
+    }
+    // Not ours: the access faults again and the default action applies.
+    signal(sig, SIG_DFL);
+}
+
+void install() {
+    page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    struct sigaction action{};
+    action.sa_sigaction = on_sigbus;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, nullptr);
+}
+
+}
+
+MapGuard::MapGuard(const void* base, size_t size) : slot(-1) {
+    std::call_once(installed, install);
+    uintptr_t begin = reinterpret_cast<uintptr_t>(base);
+    if(begin == 0 || size == 0) {
+        return;
+    }
+    for(int i = 0; i < kSlots; ++i) {
+        uintptr_t expected = 0;
+        if(range_begin[i].load(std::memory_order_relaxed) != 0) {
+            continue;
+        }
+        // Claim with a placeholder so no fault matches before end is set.
+        if(range_begin[i].compare_exchange_strong(expected, UINTPTR_MAX, std::memory_order_acq_rel)) {
+            range_end[i].store(begin + size, std::memory_order_release);
+            range_begin[i].store(begin, std::memory_order_release);
+            slot = i;
+            return;
+        }
+    }
+}
+
+MapGuard::~MapGuard() {
+    if(slot >= 0) {
+        range_begin[slot].store(0, std::memory_order_release);
+    }
+}
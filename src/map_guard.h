@@ -0,0 +1,23 @@
+#ifndef MAP_GUARD_H
+#define MAP_GUARD_H
+
+#include <cstddef>
+
+// Keeps a read-only file mapping readable while the guard lives, even if
+// the file shrinks under it. Touching a page past the new end of file
+// raises SIGBUS; inside a guarded range the handler maps a zero page over
+// the faulting one and the read carries on, seeing NUL bytes, so a log
+// truncated by logrotate's copytruncate cannot kill a viewer or a search.
+// SIGBUS anywhere else still terminates the process.
+class MapGuard {
+public:
+    MapGuard(const void* base, size_t size);
+    ~MapGuard();
+    MapGuard(const MapGuard&) = delete;
+    MapGuard& operator=(const MapGuard&) = delete;
+
+private:
+    int slot;   // -1 if every slot was taken; the range is then unguarded
+};
+
+#endif
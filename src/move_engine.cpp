@@ -0,0 +1,248 @@
+#include "move_engine.h"
+#include "copy_engine.h"
+#include "delete_engine.h"
+#include "tree_walker.h"
+
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+
+std::string base_name(std::string path) {
+    while(path.size() > 1 && path.back() == '/') {
+        path.pop_back();
+    }
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+struct FileId {
+    uint64_t dev;
+    uint64_t ino;
+    bool operator==(const FileId& other) const { return dev == other.dev && ino == other.ino; }
+};
+
+struct FileIdHash {
+    size_t operator()(const FileId& id) const { return id.ino * 0x9e3779b97f4a7c15ull ^ id.dev; }
+};
+
+}
+
+MoveEngine::MoveEngine(const Options& options)
+    : options(options), renamed(0), copied(0), bytes(0), error_count(0) {
+}
+
+void MoveEngine::note_error(const std::string& path, int err) {
+    note_error(path + ": " + std::strerror(err));
+}
+
+void MoveEngine::note_error(const std::string& message) {
+    ++error_count;
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if(first_error.empty()) {
+        first_error = message;
+    }
+}
+
+MoveEngine::Result MoveEngine::finish(double seconds) {
+    Result result;
+    result.renamed = renamed;
+    result.copied = copied;
+    result.bytes = bytes;
+    result.errors = error_count;
+    result.seconds = seconds;
+    result.first_error = first_error;
+    return result;
+}
+
+bool MoveEngine::move_across(const std::string& source, const std::string& target, bool progress, unsigned workers) {
+    struct stat st;
+    if(lstat(source.c_str(), &st) != 0) {
+        note_error(source, errno);
+        return false;
+    }
+
+    if(S_ISLNK(st.st_mode)) {
+        std::vector<char> link(st.st_size + 1);
+        ssize_t n = readlink(source.c_str(), link.data(), link.size());
+        if(n < 0) {
+            note_error(source, errno);
+            return false;
+        }
+        struct stat target_st;
+        if(lstat(target.c_str(), &target_st) == 0 && !S_ISDIR(target_st.st_mode)) {
+            unlink(target.c_str());
+        }
+        if(symlink(std::string(link.data(), n).c_str(), target.c_str()) != 0) {
+            note_error(target, errno);
+            return false;
+        }
+        timespec times[2] = {st.st_atim, st.st_mtim};
+        utimensat(AT_FDCWD, target.c_str(), times, AT_SYMLINK_NOFOLLOW);
+        if(unlink(source.c_str()) != 0) {
+            note_error(source, errno);
+            return false;
+        }
+        ++copied;
+        return true;
+    }
+    if(!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+        note_error(source, ENOTSUP);
+        return false;
+    }
+
+    struct stat target_st;
+    bool target_existed = lstat(target.c_str(), &target_st) == 0;
+
+    CopyEngine::Options copy_options;
+    copy_options.recursive = S_ISDIR(st.st_mode);
+    copy_options.progress = progress;
+    copy_options.workers = workers;
+    copy_options.preserve_times = true;
+    copy_options.record_sources = true;
+    CopyEngine::Result copy = CopyEngine(copy_options).copy(source, target);
+    bytes += copy.bytes;
+
+    // Nothing is removed unless the copy had no errors and a regular file
+    // arrived at its full size. Bytes transferred are no measure, since
+    // holes in sparse files are skipped rather than copied.
+    bool verified = copy.errors == 0;
+    if(verified && S_ISREG(st.st_mode)) {
+        int fd = open(target.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat copy_st;
+        verified = fd >= 0 && fstat(fd, &copy_st) == 0 && copy_st.st_size == st.st_size;
+        if(fd >= 0) {
+            close(fd);
+        }
+    }
+    if(!verified) {
+        std::string message = copy.errors > 0 ? copy.first_error : target + ": copy is incomplete";
+        if(target_existed) {
+            message += "; source kept, partial copy left merged into " + target;
+        } else {
+            message += "; source kept";
+            DeleteEngine::Options cleanup;
+            cleanup.progress = false;
+            DeleteEngine(cleanup).remove(target);
+        }
+        note_error(message);
+        return false;
+    }
+
+    // The source then goes entry by entry, and only where it is still what
+    // was copied: anything created, modified or replaced meanwhile stays.
+    std::unordered_map<FileId, CopyEngine::Source, FileIdHash> copied_entries;
+    copied_entries.reserve(copy.sources.size());
+    for(const auto& entry : copy.sources) {
+        copied_entries.emplace(FileId{entry.dev, entry.ino}, entry);
+    }
+    DeleteEngine::Options delete_options;
+    delete_options.progress = progress;
+    delete_options.workers = workers;
+    delete_options.removable = [&copied_entries](const struct stat& now) {
+        auto found = copied_entries.find(FileId{uint64_t(now.st_dev), uint64_t(now.st_ino)});
+        if(found == copied_entries.end()) {
+            return false;
+        }
+        const CopyEngine::Source& then = found->second;
+        if((then.mode & S_IFMT) != (now.st_mode & S_IFMT)) {
+            return false;
+        }
+        return S_ISDIR(now.st_mode) ||
+               (then.size == uint64_t(now.st_size) && then.mtime.tv_sec == now.st_mtim.tv_sec &&
+                then.mtime.tv_nsec == now.st_mtim.tv_nsec);
+    };
+    DeleteEngine::Result removed = DeleteEngine(delete_options).remove(source);
+    if(removed.errors > 0) {
+        note_error("copied, but removing the source failed: " + removed.first_error);
+        return false;
+    }
+    if(removed.kept > 0) {
+        note_error(source + ": changed while being moved; copied, but " + std::to_string(removed.kept) +
+                   " entries kept at the source");
+        return false;
+    }
+    ++copied;
+    return true;
+}
+
+MoveEngine::Result MoveEngine::move(const std::string& source, const std::string& target) {
+    auto start = std::chrono::steady_clock::now();
+    if(rename(source.c_str(), target.c_str()) == 0) {
+        ++renamed;
+    } else if(errno == EXDEV) {
+        move_across(source, target, options.progress, options.workers);
+    } else {
+        note_error(source, errno);
+    }
+    return finish(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+}
+
+MoveEngine::Result MoveEngine::move_into(const std::vector<std::string>& sources, const std::string& target_dir) {
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&start]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    int dirfd = open(target_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dirfd < 0) {
+        note_error(target_dir, errno);
+        return finish(elapsed());
+    }
+    std::string base = target_dir.back() == '/' ? target_dir : target_dir + "/";
+
+    // Same-filesystem sources: one renameat each, no per-file path walk of
+    // the target directory.
+    std::vector<size_t> across_files;
+    std::vector<size_t> across_dirs;
+    for(size_t i = 0; i < sources.size(); ++i) {
+        std::string name = base_name(sources[i]);
+        if(renameat(AT_FDCWD, sources[i].c_str(), dirfd, name.c_str()) == 0) {
+            ++renamed;
+            continue;
+        }
+        if(errno != EXDEV) {
+            note_error(sources[i], errno);
+            continue;
+        }
+        struct stat st;
+        if(lstat(sources[i].c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            across_dirs.push_back(i);
+        } else {
+            across_files.push_back(i);
+        }
+    }
+    close(dirfd);
+
+    // Each tree already copies on its own pool; files share one.
+    for(size_t i : across_dirs) {
+        move_across(sources[i], base + base_name(sources[i]), options.progress, options.workers);
+    }
+
+    unsigned workers = options.workers ? options.workers : std::max(4u, TreeWalker::default_threads());
+    workers = static_cast<unsigned>(std::min<size_t>(workers, std::max<size_t>(across_files.size(), 1)));
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for(size_t i = next++; i < across_files.size(); i = next++) {
+            const std::string& source = sources[across_files[i]];
+            move_across(source, base + base_name(source), false, 1);
+        }
+    };
+    std::vector<std::thread> pool;
+    for(unsigned i = 1; i < workers; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for(auto& thread : pool) {
+        thread.join();
+    }
+
+    return finish(elapsed());
+}
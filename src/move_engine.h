@@ -0,0 +1,56 @@
+#ifndef MOVE_ENGINE_H
+#define MOVE_ENGINE_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+// Moves files and trees. A move is a rename(2) whenever source and target
+// share a filesystem; on EXDEV it falls back to CopyEngine (times and modes
+// kept, directories copied in parallel) and, once the copy is complete,
+// removes with DeleteEngine only the source entries still as they were
+// copied.
+class MoveEngine {
+public:
+    struct Options {
+        bool progress = true;       // live progress for cross-device copies
+        unsigned workers = 0;       // parallel cross-device file moves
+    };
+
+    struct Result {
+        uint64_t renamed = 0;       // moved by rename(2)
+        uint64_t copied = 0;        // moved by copy, verify and delete
+        uint64_t bytes = 0;         // bytes copied across devices
+        uint64_t errors = 0;
+        double seconds = 0;
+        std::string first_error;
+    };
+
+    explicit MoveEngine(const Options& options);
+
+    // Moves source to target, replacing a target file like rename(2) does.
+    Result move(const std::string& source, const std::string& target);
+
+    // Moves each source into target_dir under its own name. Renames run as
+    // one loop against an open handle of target_dir; sources that live on
+    // another filesystem are then copied across on a worker pool.
+    Result move_into(const std::vector<std::string>& sources, const std::string& target_dir);
+
+private:
+    Options options;
+    std::atomic<uint64_t> renamed;
+    std::atomic<uint64_t> copied;
+    std::atomic<uint64_t> bytes;
+    std::atomic<uint64_t> error_count;
+    std::mutex error_mutex;
+    std::string first_error;
+
+    bool move_across(const std::string& source, const std::string& target, bool progress, unsigned workers);
+    Result finish(double seconds);
+    void note_error(const std::string& path, int err);
+    void note_error(const std::string& message);
+};
+
+#endif
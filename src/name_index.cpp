@@ -0,0 +1,743 @@
+#include "name_index.h"
+#include "tree_walker.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+namespace {
+
+const char kMagic[8] = {'F', 'E', 'X', 'I', 'D', 'X', '1', '\0'};
+const uint32_t kVersion = 1;
+const uint32_t kRootNode = UINT32_MAX;
+
+uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+uint32_t trigram_key(const char* p) {
+    return (uint32_t(uint8_t(p[0])) << 16) | (uint32_t(uint8_t(p[1])) << 8) | uint8_t(p[2]);
+}
+
+std::string_view base_name(std::string_view relative) {
+    size_t slash = relative.rfind('/');
+    return slash == std::string_view::npos ? relative : relative.substr(slash + 1);
+}
+
+bool is_under(const std::string& relative, const std::string& under) {
+    if(under.empty()) {
+        return true;
+    }
+    return relative.size() > under.size() && relative.compare(0, under.size(), under) == 0 &&
+           relative[under.size()] == '/';
+}
+
+}
+
+struct NameIndex::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t built_at;
+    uint64_t root_len;
+    uint64_t node_count;
+    uint64_t name_count;
+    uint64_t name_bytes;
+    uint64_t trigram_count;
+    uint64_t posting_count;
+    uint64_t off_root;
+    uint64_t off_nodes;
+    uint64_t off_names;
+    uint64_t off_name_nodes;
+    uint64_t off_blob;
+    uint64_t off_trigrams;
+    uint64_t off_postings;
+    uint64_t file_size;
+};
+
+struct NameIndex::Node {
+    uint32_t parent;
+    uint32_t name_id;
+    uint8_t type;
+    uint8_t pad[3];
+};
+
+// names[i] .. names[i + 1] delimit both the bytes of name i in the blob and
+// the ids of the nodes carrying that name in name_nodes.
+struct NameIndex::NameRec {
+    uint64_t offset;
+    uint32_t first_node;
+    uint32_t pad;
+};
+
+struct NameIndex::TrigramRec {
+    uint32_t key;
+    uint32_t pad;
+    uint64_t first_posting;
+};
+
+NameIndex::NameIndex()
+    : map_base(nullptr), map_size(0), header(nullptr), nodes(nullptr), names(nullptr),
+      name_nodes(nullptr), name_blob(nullptr), trigrams(nullptr), postings(nullptr),
+      inotify_fd(-1), wake_fd(-1), watching(false), overflowed(false), unwatched_dirs(0) {
+}
+
+NameIndex::~NameIndex() {
+    unload();
+}
+
+std::string NameIndex::cache_dir() {
+    const char* cache_home = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+    if(cache_home && *cache_home) {
+        return std::string(cache_home) + "/file_explorer";
+    }
+    if(home && *home) {
+        return std::string(home) + "/.cache/file_explorer";
+    }
+    return "/tmp/file_explorer";
+}
+
+std::string NameIndex::default_file(const std::string& root) {
+    std::string dir = cache_dir();
+
+    // FNV-1a of the root keeps one index file per indexed directory.
+    uint64_t hash = 1469598103934665603ULL;
+    for(char c : root) {
+        hash = (hash ^ uint8_t(c)) * 1099511628211ULL;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/index-%016llx.idx", static_cast<unsigned long long>(hash));
+    return dir + name;
+}
+
+bool NameIndex::build(const std::string& root_path, const std::string& file, std::string& error) {
+    std::string base = root_path;
+    while(base.size() > 1 && base.back() == '/') {
+        base.pop_back();
+    }
+    size_t strip = base == "/" ? 1 : base.size() + 1;
+
+    struct RawEntry {
+        std::string relative;
+        uint8_t type;
+    };
+
+    TreeWalker walker;
+    std::vector<std::vector<RawEntry>> collected(walker.thread_count());
+    walker.on_entry([&](const WalkEntry& entry) {
+        collected[entry.worker].push_back({entry.path().substr(strip), entry.type});
+        return true;
+    });
+    walker.walk(base);
+
+    std::vector<RawEntry> entries;
+    for(auto& worker_entries : collected) {
+        std::move(worker_entries.begin(), worker_entries.end(), std::back_inserter(entries));
+        worker_entries.clear();
+        worker_entries.shrink_to_fit();
+    }
+    if(entries.size() >= kRootNode) {
+        error = "too many entries to index";
+        return false;
+    }
+    std::sort(entries.begin(), entries.end(), [](const RawEntry& a, const RawEntry& b) {
+        return a.relative < b.relative;
+    });
+
+    // Sorted order guarantees a directory gets its id before its children.
+    std::vector<Node> out_nodes(entries.size());
+    std::unordered_map<std::string_view, uint32_t> dir_ids;
+    std::unordered_map<std::string_view, uint32_t> name_ids;
+    std::vector<std::string_view> unique_names;
+    for(uint32_t i = 0; i < entries.size(); ++i) {
+        std::string_view relative(entries[i].relative);
+        size_t slash = relative.rfind('/');
+        uint32_t parent = kRootNode;
+        if(slash != std::string_view::npos) {
+            auto it = dir_ids.find(relative.substr(0, slash));
+            if(it != dir_ids.end()) {
+                parent = it->second;
+            }
+        }
+        std::string_view name = base_name(relative);
+        auto inserted = name_ids.emplace(name, uint32_t(unique_names.size()));
+        if(inserted.second) {
+            unique_names.push_back(name);
+        }
+        out_nodes[i] = Node{parent, inserted.first->second, entries[i].type, {0, 0, 0}};
+        if(entries[i].type == DT_DIR) {
+            dir_ids.emplace(relative, i);
+        }
+    }
+
+    std::vector<NameRec> out_names(unique_names.size() + 1);
+    std::string blob;
+    std::vector<uint32_t> counts(unique_names.size() + 1, 0);
+    for(const Node& node : out_nodes) {
+        ++counts[node.name_id + 1];
+    }
+    for(size_t i = 0; i < unique_names.size(); ++i) {
+        out_names[i].offset = blob.size();
+        out_names[i].first_node = counts[i];
+        counts[i + 1] += counts[i];
+        blob.append(unique_names[i]);
+    }
+    out_names.back().offset = blob.size();
+    out_names.back().first_node = uint32_t(out_nodes.size());
+
+    std::vector<uint32_t> out_name_nodes(out_nodes.size());
+    std::vector<uint32_t> fill(counts.begin(), counts.end() - 1);
+    for(uint32_t i = 0; i < out_nodes.size(); ++i) {
+        out_name_nodes[fill[out_nodes[i].name_id]++] = i;
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> grams;
+    for(uint32_t id = 0; id < unique_names.size(); ++id) {
+        std::string_view name = unique_names[id];
+        size_t first = grams.size();
+        for(size_t i = 0; i + 3 <= name.size(); ++i) {
+            grams.emplace_back(trigram_key(name.data() + i), id);
+        }
+        std::sort(grams.begin() + first, grams.end());
+        grams.erase(std::unique(grams.begin() + first, grams.end()), grams.end());
+    }
+    std::sort(grams.begin(), grams.end());
+
+    std::vector<TrigramRec> out_trigrams;
+    std::vector<uint32_t> out_postings;
+    out_postings.reserve(grams.size());
+    for(size_t i = 0; i < grams.size(); ++i) {
+        if(i == 0 || grams[i].first != grams[i - 1].first) {
+            out_trigrams.push_back(TrigramRec{grams[i].first, 0, out_postings.size()});
+        }
+        out_postings.push_back(grams[i].second);
+    }
+    out_trigrams.push_back(TrigramRec{UINT32_MAX, 0, out_postings.size()});
+
+    Header out{};
+    memcpy(out.magic, kMagic, sizeof(kMagic));
+    out.version = kVersion;
+    out.built_at = std::time(nullptr);
+    out.root_len = base.size();
+    out.node_count = out_nodes.size();
+    out.name_count = unique_names.size();
+    out.name_bytes = blob.size();
+    out.trigram_count = out_trigrams.size() - 1;
+    out.posting_count = out_postings.size();
+    out.off_root = sizeof(Header);
+    out.off_nodes = align8(out.off_root + out.root_len);
+    out.off_names = align8(out.off_nodes + out_nodes.size() * sizeof(Node));
+    out.off_name_nodes = out.off_names + out_names.size() * sizeof(NameRec);
+    out.off_blob = align8(out.off_name_nodes + out_name_nodes.size() * sizeof(uint32_t));
+    out.off_trigrams = align8(out.off_blob + blob.size());
+    out.off_postings = out.off_trigrams + out_trigrams.size() * sizeof(TrigramRec);
+    out.file_size = out.off_postings + out_postings.size() * sizeof(uint32_t);
+
+    size_t slash = file.rfind('/');
+    if(slash != std::string::npos && slash > 0) {
+        std::string dir = file.substr(0, slash);
+        for(size_t p = 1; p <= dir.size(); ++p) {
+            if(p == dir.size() || dir[p] == '/') {
+                mkdir(dir.substr(0, p).c_str(), 0755);
+            }
+        }
+    }
+
+    std::string temp = file + ".tmp";
+    {
+        std::ofstream stream(temp, std::ios::binary | std::ios::trunc);
+        if(!stream) {
+            error = "cannot write " + temp + ": " + strerror(errno);
+            return false;
+        }
+        auto put = [&](uint64_t offset, const void* data, size_t size) {
+            static const char zeros[8] = {0};
+            while(uint64_t(stream.tellp()) < offset) {
+                stream.write(zeros, std::min<uint64_t>(8, offset - uint64_t(stream.tellp())));
+            }
+            stream.write(static_cast<const char*>(data), size);
+        };
+        put(0, &out, sizeof(out));
+        put(out.off_root, base.data(), base.size());
+        put(out.off_nodes, out_nodes.data(), out_nodes.size() * sizeof(Node));
+        put(out.off_names, out_names.data(), out_names.size() * sizeof(NameRec));
+        put(out.off_name_nodes, out_name_nodes.data(), out_name_nodes.size() * sizeof(uint32_t));
+        put(out.off_blob, blob.data(), blob.size());
+        put(out.off_trigrams, out_trigrams.data(), out_trigrams.size() * sizeof(TrigramRec));
+        put(out.off_postings, out_postings.data(), out_postings.size() * sizeof(uint32_t));
+        if(!stream.flush()) {
+            error = "failed writing " + temp;
+            return false;
+        }
+    }
+    if(rename(temp.c_str(), file.c_str()) != 0) {
+        error = "cannot replace " + file + ": " + strerror(errno);
+        unlink(temp.c_str());
+        return false;
+    }
+
+    return load(file, error);
+}
+
+bool NameIndex::load(const std::string& file, std::string& error) {
+    unload();
+
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        error = "cannot open " + file + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+        close(fd);
+        error = file + " is not a filename index";
+        return false;
+    }
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        error = "cannot map " + file + ": " + strerror(errno);
+        return false;
+    }
+
+    const Header* h = static_cast<const Header*>(base);
+    const uint64_t size = uint64_t(st.st_size);
+    bool valid = memcmp(h->magic, kMagic, sizeof(kMagic)) == 0 && h->version == kVersion &&
+        h->file_size == size &&
+        h->off_root + h->root_len <= size &&
+        h->off_nodes + h->node_count * sizeof(Node) <= size &&
+        h->off_names + (h->name_count + 1) * sizeof(NameRec) <= size &&
+        h->off_name_nodes + h->node_count * sizeof(uint32_t) <= size &&
+        h->off_blob + h->name_bytes <= size &&
+        h->off_trigrams + (h->trigram_count + 1) * sizeof(TrigramRec) <= size &&
+        h->off_postings + h->posting_count * sizeof(uint32_t) <= size;
+    if(!valid) {
+        munmap(base, st.st_size);
+        error = file + " is corrupt or from another version";
+        return false;
+    }
+
+    const char* bytes = static_cast<const char*>(base);
+    map_base = base;
+    map_size = st.st_size;
+    header = h;
+    root.assign(bytes + h->off_root, h->root_len);
+    nodes = reinterpret_cast<const Node*>(bytes + h->off_nodes);
+    names = reinterpret_cast<const NameRec*>(bytes + h->off_names);
+    name_nodes = reinterpret_cast<const uint32_t*>(bytes + h->off_name_nodes);
+    name_blob = bytes + h->off_blob;
+    trigrams = reinterpret_cast<const TrigramRec*>(bytes + h->off_trigrams);
+    postings = reinterpret_cast<const uint32_t*>(bytes + h->off_postings);
+    index_file = file;
+    return true;
+}
+
+void NameIndex::unload() {
+    stop_watch();
+    if(map_base) {
+        munmap(map_base, map_size);
+    }
+    map_base = nullptr;
+    map_size = 0;
+    header = nullptr;
+    nodes = nullptr;
+    names = nullptr;
+    name_nodes = nullptr;
+    name_blob = nullptr;
+    trigrams = nullptr;
+    postings = nullptr;
+    root.clear();
+    index_file.clear();
+
+    std::lock_guard<std::mutex> lock(delta_mutex);
+    added.clear();
+    removed.clear();
+    overflowed = false;
+    unwatched_dirs = 0;
+}
+
+std::string NameIndex::relative_to_root(const std::string& path) const {
+    if(path == root) {
+        return "";
+    }
+    return path.substr(root == "/" ? 1 : root.size() + 1);
+}
+
+bool NameIndex::covers(const std::string& path) const {
+    if(!loaded()) {
+        return false;
+    }
+    if(path != root) {
+        if(root != "/" && (path.size() <= root.size() || path.compare(0, root.size(), root) != 0 ||
+                           path[root.size()] != '/')) {
+            return false;
+        }
+        if(root == "/" && path.empty()) {
+            return false;
+        }
+    }
+
+    std::string relative = relative_to_root(path);
+    uint32_t node;
+    if(resolve(relative, node) && !is_removed(relative)) {
+        return true;
+    }
+    // Removed from the base, or never in it: covered only if recreated since,
+    // as after rm -rf build && mkdir build.
+    std::lock_guard<std::mutex> lock(delta_mutex);
+    auto it = added.find(relative);
+    return it != added.end() && it->second;
+}
+
+bool NameIndex::stale() const {
+    return !watching || overflowed || unwatched_dirs > 0;
+}
+
+NameIndex::Status NameIndex::status() const {
+    Status s{};
+    s.root = root;
+    s.file = index_file;
+    if(header) {
+        s.built_at = static_cast<std::time_t>(header->built_at);
+        s.nodes = header->node_count;
+        s.names = header->name_count;
+        s.trigrams = header->trigram_count;
+    }
+    std::lock_guard<std::mutex> lock(delta_mutex);
+    s.added = added.size();
+    s.removed = removed.size();
+    s.watching = watching;
+    s.overflowed = overflowed;
+    s.unwatched_dirs = unwatched_dirs;
+    return s;
+}
+
+std::string NameIndex::node_path(uint32_t node) const {
+    std::vector<uint32_t> chain;
+    while(node != kRootNode) {
+        chain.push_back(node);
+        node = nodes[node].parent;
+    }
+    std::string path;
+    for(auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        const NameRec& name = names[nodes[*it].name_id];
+        if(!path.empty()) {
+            path += '/';
+        }
+        path.append(name_blob + name.offset, (&name + 1)->offset - name.offset);
+    }
+    return path;
+}
+
+bool NameIndex::resolve(const std::string& relative, uint32_t& node) const {
+    if(relative.empty()) {
+        node = kRootNode;
+        return true;
+    }
+    // Node ids follow the sorted order of relative paths.
+    uint64_t lo = 0;
+    uint64_t hi = header->node_count;
+    while(lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        int cmp = node_path(uint32_t(mid)).compare(relative);
+        if(cmp == 0) {
+            node = uint32_t(mid);
+            return true;
+        }
+        if(cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+bool NameIndex::is_removed(const std::string& relative) const {
+    std::lock_guard<std::mutex> lock(delta_mutex);
+    if(removed.empty()) {
+        return false;
+    }
+    for(size_t end = relative.find('/'); ; end = relative.find('/', end + 1)) {
+        if(removed.count(relative.substr(0, end))) {
+            return true;
+        }
+        if(end == std::string::npos) {
+            return false;
+        }
+    }
+}
+
+void NameIndex::query(const NameMatcher& matcher, const std::string& under, std::vector<Result>& results) const {
+    if(!loaded()) {
+        return;
+    }
+    std::string under_relative = relative_to_root(under);
+    uint32_t under_node;
+    bool in_base = resolve(under_relative, under_node);
+    const std::string literal = matcher.required_literal();
+    std::string_view term(literal);
+
+    // Directories between `under` and the match, checked against excludes.
+    auto pruned = [&](std::string_view relative) {
+        if(!matcher.has_excludes()) {
+            return false;
+        }
+        size_t start = under_relative.empty() ? 0 : under_relative.size() + 1;
+        size_t end = relative.rfind('/');
+        while(end != std::string_view::npos && start < end) {
+            size_t slash = relative.find('/', start);
+            if(matcher.excluded(relative.substr(start, slash - start))) {
+                return true;
+            }
+            start = slash + 1;
+        }
+        return false;
+    };
+
+    auto emit_name = [&](uint32_t name_id) {
+        const NameRec& rec = names[name_id];
+        std::string_view name(name_blob + rec.offset, (&rec + 1)->offset - rec.offset);
+        if(!matcher.matches(name)) {
+            return;
+        }
+        for(uint32_t slot = rec.first_node; slot < (&rec + 1)->first_node; ++slot) {
+            uint32_t node = name_nodes[slot];
+            if(under_node != kRootNode) {
+                uint32_t ancestor = nodes[node].parent;
+                while(ancestor != kRootNode && ancestor != under_node) {
+                    ancestor = nodes[ancestor].parent;
+                }
+                if(ancestor != under_node) {
+                    continue;
+                }
+            }
+            std::string relative = node_path(node);
+            if(is_removed(relative) || pruned(relative)) {
+                continue;
+            }
+            results.emplace_back(root == "/" ? "/" + relative : root + "/" + relative, nodes[node].type == DT_DIR);
+        }
+    };
+
+    if(in_base) {
+        if(term.size() >= 3) {
+            // Verify candidates from the shortest posting list of the literal.
+            const TrigramRec* table_end = trigrams + header->trigram_count;
+            const TrigramRec* best = nullptr;
+            uint64_t best_size = UINT64_MAX;
+            for(size_t i = 0; i + 3 <= term.size(); ++i) {
+                uint32_t key = trigram_key(term.data() + i);
+                const TrigramRec* rec = std::lower_bound(trigrams, table_end, key,
+                    [](const TrigramRec& r, uint32_t k) { return r.key < k; });
+                if(rec == table_end || rec->key != key) {
+                    best = nullptr;
+                    best_size = 0;
+                    break;
+                }
+                uint64_t size = (rec + 1)->first_posting - rec->first_posting;
+                if(size < best_size) {
+                    best = rec;
+                    best_size = size;
+                }
+            }
+            if(best) {
+                for(uint64_t p = best->first_posting; p < (best + 1)->first_posting; ++p) {
+                    emit_name(postings[p]);
+                }
+            }
+        } else {
+            for(uint32_t id = 0; id < header->name_count; ++id) {
+                emit_name(id);
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(delta_mutex);
+    for(const auto& entry : added) {
+        if(is_under(entry.first, under_relative) && matcher.matches(base_name(entry.first)) &&
+           !pruned(entry.first)) {
+            results.emplace_back(root == "/" ? "/" + entry.first : root + "/" + entry.first, entry.second);
+        }
+    }
+}
+
+bool NameIndex::start_watch(std::string& error) {
+    if(!loaded()) {
+        error = "no index loaded";
+        return false;
+    }
+    if(watching) {
+        return true;
+    }
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(inotify_fd < 0 || wake_fd < 0) {
+        error = std::string("inotify unavailable: ") + strerror(errno);
+        stop_watch();
+        return false;
+    }
+
+    unwatched_dirs = 0;
+    add_watch("");
+    for(uint32_t node = 0; node < header->node_count; ++node) {
+        if(nodes[node].type == DT_DIR) {
+            add_watch(node_path(node));
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(delta_mutex);
+        for(const auto& entry : added) {
+            if(entry.second) {
+                add_watch(entry.first);
+            }
+        }
+    }
+
+    watching = true;
+    watch_thread = std::thread(&NameIndex::watch_loop, this);
+    return true;
+}
+
+void NameIndex::stop_watch() {
+    if(watch_thread.joinable()) {
+        uint64_t one = 1;
+        if(write(wake_fd, &one, sizeof(one)) < 0) {
+            // The loop also polls a short timeout, so a failed wake-up only delays exit.
+        }
+        watch_thread.join();
+    }
+    watching = false;
+    if(inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+    if(wake_fd >= 0) {
+        close(wake_fd);
+    }
+    inotify_fd = -1;
+    wake_fd = -1;
+    watch_dirs.clear();
+}
+
+void NameIndex::add_watch(const std::string& relative) {
+    std::string full = relative.empty() ? root : (root == "/" ? "/" + relative : root + "/" + relative);
+    int wd = inotify_add_watch(inotify_fd, full.c_str(),
+        IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK);
+    if(wd < 0) {
+        ++unwatched_dirs;
+        return;
+    }
+    watch_dirs[wd] = relative;
+}
+
+void NameIndex::add_subtree(const std::string& relative) {
+    // A directory moved into the tree arrives with its contents already present.
+    std::string full = root == "/" ? "/" + relative : root + "/" + relative;
+    size_t strip = root == "/" ? 1 : root.size() + 1;
+    std::vector<std::pair<std::string, bool>> found;
+    TreeWalker walker(1);
+    walker.on_entry([&](const WalkEntry& entry) {
+        found.emplace_back(entry.path().substr(strip), entry.is_directory());
+        return true;
+    });
+    walker.walk(full);
+
+    std::lock_guard<std::mutex> lock(delta_mutex);
+    for(const auto& item : found) {
+        added[item.first] = item.second;
+        if(item.second) {
+            add_watch(item.first);
+        }
+    }
+}
+
+void NameIndex::drop_subtree(const std::string& relative) {
+    std::lock_guard<std::mutex> lock(delta_mutex);
+    removed.insert(relative);
+    added.erase(relative);
+    std::string prefix = relative + "/";
+    for(auto it = added.lower_bound(prefix); it != added.end() && it->first.compare(0, prefix.size(), prefix) == 0; ) {
+        it = added.erase(it);
+    }
+    // Watches on a directory moved elsewhere would report under the old path.
+    for(auto it = watch_dirs.begin(); it != watch_dirs.end(); ) {
+        if(it->second == relative || it->second.compare(0, prefix.size(), prefix) == 0) {
+            inotify_rm_watch(inotify_fd, it->first);
+            it = watch_dirs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void NameIndex::watch_loop() {
+    std::vector<char> buffer(64 * 1024);
+    pollfd fds[2] = {{inotify_fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+
+    while(true) {
+        if(poll(fds, 2, 1000) < 0 && errno != EINTR) {
+            break;
+        }
+        if(fds[1].revents & POLLIN) {
+            break;
+        }
+        if(!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        ssize_t n = read(inotify_fd, buffer.data(), buffer.size());
+        for(ssize_t pos = 0; pos < n; ) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer.data() + pos);
+            pos += sizeof(inotify_event) + event->len;
+
+            if(event->mask & IN_Q_OVERFLOW) {
+                overflowed = true;
+                continue;
+            }
+
+            std::string relative;
+            {
+                std::lock_guard<std::mutex> lock(delta_mutex);
+                auto it = watch_dirs.find(event->wd);
+                if(it == watch_dirs.end()) {
+                    continue;
+                }
+                if(event->mask & IN_IGNORED) {
+                    watch_dirs.erase(it);
+                    continue;
+                }
+                if(event->len == 0) {
+                    continue;
+                }
+                relative = it->second.empty() ? std::string(event->name)
+                                              : it->second + "/" + event->name;
+            }
+
+            bool is_dir = (event->mask & IN_ISDIR) != 0;
+            if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                drop_subtree(relative);
+            }
+            if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                {
+                    std::lock_guard<std::mutex> lock(delta_mutex);
+                    added[relative] = is_dir;
+                    if(is_dir) {
+                        add_watch(relative);
+                    }
+                }
+                if(is_dir) {
+                    add_subtree(relative);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include "name_matcher.h"
+
+// Persistent filename index for name search. The file holds the tree
+// under one root as interned path components (each node is a parent id plus
+// a name id into a deduplicated name table) and a trigram posting list over
+// the unique names. It is read through mmap, so loading costs no parsing.
+//
+// An optional inotify watcher applies changes as in-memory deltas on top of
+// the mapped base until the next rebuild.
+class NameIndex {
+public:
+    struct Status {
+        std::string root;
+        std::string file;
+        std::time_t built_at;
+        uint64_t nodes;
+        uint64_t names;
+        uint64_t trigrams;
+        size_t added;
+        size_t removed;
+        bool watching;
+        bool overflowed;
+        uint64_t unwatched_dirs;
+    };
+
+    using Result = std::pair<std::string, bool>;
+
+    NameIndex();
+    ~NameIndex();
+    NameIndex(const NameIndex&) = delete;
+    NameIndex& operator=(const NameIndex&) = delete;
+
+    // Index file used for a root when no explicit path is given.
+    static std::string default_file(const std::string& root);
+    // Per-user directory for index files and other state kept between runs.
+    static std::string cache_dir();
+
+    // Walks root, writes a fresh index file and maps it.
+    bool build(const std::string& root, const std::string& file, std::string& error);
+    bool load(const std::string& file, std::string& error);
+    void unload();
+
+    bool loaded() const { return map_base != nullptr; }
+    bool covers(const std::string& path) const;
+    // True when the index may not reflect the tree: no watcher is running,
+    // the inotify queue overflowed, or some directories could not be watched.
+    bool stale() const;
+    Status status() const;
+
+    // File names below `under` (which must be covered) accepted by matcher.
+    // Entries below an excluded directory are left out, as a walk would.
+    void query(const NameMatcher& matcher, const std::string& under, std::vector<Result>& results) const;
+
+    bool start_watch(std::string& error);
+    void stop_watch();
+
+private:
+    struct Header;
+    struct Node;
+    struct NameRec;
+    struct TrigramRec;
+
+    std::string index_file;
+    std::string root;
+    void* map_base;
+    size_t map_size;
+    const Header* header;
+    const Node* nodes;
+    const NameRec* names;
+    const uint32_t* name_nodes;
+    const char* name_blob;
+    const TrigramRec* trigrams;
+    const uint32_t* postings;
+
+    // Watcher state. Deltas are keyed by path relative to root.
+    mutable std::mutex delta_mutex;
+    std::map<std::string, bool> added;
+    std::set<std::string> removed;
+    std::unordered_map<int, std::string> watch_dirs;
+    std::thread watch_thread;
+    int inotify_fd;
+    int wake_fd;
+    std::atomic<bool> watching;
+    std::atomic<bool> overflowed;
+    std::atomic<uint64_t> unwatched_dirs;
+
+    std::string node_path(uint32_t node) const;
+    bool resolve(const std::string& relative, uint32_t& node) const;
+    bool is_removed(const std::string& relative) const;
+    std::string relative_to_root(const std::string& path) const;
+    void add_watch(const std::string& relative);
+    void add_subtree(const std::string& relative);
+    void drop_subtree(const std::string& relative);
+    void watch_loop();
+};
+
+#endif
@@ -0,0 +1,411 @@
+#include "name_matcher.h"
+#include "text_scan.h"
+
+#include <algorithm>
+#include <cstring>
+#include <climits>
+
+namespace {
+
+// File names are at most NAME_MAX bytes; anything longer takes a heap copy.
+const size_t kInlineName = 512;
+const size_t kPad = 16;
+
+char fold_char(char c) {
+    return (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
+}
+
+void fold_copy(char* out, const char* in, size_t len) {
+    for(size_t i = 0; i < len; ++i) {
+        out[i] = fold_char(in[i]);
+    }
+}
+
+// Copies name (folded if asked) and zero-pads it so the SSE2 scan can
+// read past its end.
+const char* padded_copy(std::string_view name, bool fold, char* inline_buffer, std::vector<char>& heap_buffer) {
+    char* buffer = inline_buffer;
+    if(name.size() > kInlineName) {
+        heap_buffer.resize(name.size() + kPad);
+        buffer = heap_buffer.data();
+    }
+    if(fold) {
+        fold_copy(buffer, name.data(), name.size());
+    } else {
+        memcpy(buffer, name.data(), name.size());
+    }
+    memset(buffer + name.size(), 0, kPad);
+    return buffer;
+}
+
+std::string folded(std::string text) {
+    fold_copy(&text[0], text.data(), text.size());
+    return text;
+}
+
+// Longest literal that every match of a regex must contain. Conservative:
+// only runs outside groups count, and alternation disables it entirely.
+std::string regex_literal(const std::string& re) {
+    if(re.find('|') != std::string::npos) {
+        return std::string();
+    }
+    std::string best;
+    std::string run;
+    int depth = 0;
+    auto flush = [&]() {
+        if(run.size() > best.size()) {
+            best = run;
+        }
+        run.clear();
+    };
+    for(size_t i = 0; i < re.size(); ++i) {
+        char c = re[i];
+        if(c == '\\' && i + 1 < re.size()) {
+            char escaped = re[++i];
+            if(!std::ispunct(static_cast<unsigned char>(escaped))) {
+                flush();        // \d, \w, \b ... are classes or assertions
+                continue;
+            }
+            c = escaped;
+        } else if(c == '[') {
+            flush();
+            size_t j = i + 1;
+            if(j < re.size() && re[j] == '^') {
+                ++j;
+            }
+            if(j < re.size() && re[j] == ']') {
+                ++j;
+            }
+            while(j < re.size() && re[j] != ']') {
+                j += re[j] == '\\' ? 2 : 1;
+            }
+            i = j;
+            continue;
+        } else if(c == '(' || c == ')') {
+            depth += c == '(' ? 1 : -1;
+            flush();
+            continue;
+        } else if(c == '.' || c == '^' || c == '$' || c == '+') {
+            flush();
+            continue;
+        } else if(c == '*' || c == '?' || c == '{') {
+            // The previous atom is optional.
+            if(!run.empty()) {
+                run.pop_back();
+            }
+            flush();
+            if(c == '{') {
+                while(i < re.size() && re[i] != '}') {
+                    ++i;
+                }
+            }
+            continue;
+        }
+        if(depth == 0) {
+            run += c;
+        } else {
+            flush();
+        }
+    }
+    flush();
+    return best;
+}
+
+}
+
+bool NameMatcher::compile(Pattern& pattern, std::string& error) const {
+    const std::string& source = pattern.source;
+    pattern.text.clear();
+    pattern.prefilter.clear();
+    pattern.glob.clear();
+    pattern.sets.clear();
+    pattern.regex.reset();
+
+    switch(pattern.kind) {
+        case Kind::Substring:
+        case Kind::Prefix:
+        case Kind::Suffix:
+        case Kind::Exact:
+            pattern.text = fold ? folded(source) : source;
+            pattern.prefilter = pattern.text;
+            break;
+        case Kind::Glob: {
+            std::string run;
+            auto flush = [&]() {
+                if(run.size() > pattern.prefilter.size()) {
+                    pattern.prefilter = run;
+                }
+                run.clear();
+            };
+            for(size_t i = 0; i < source.size(); ++i) {
+                char c = source[i];
+                if(c == '*') {
+                    flush();
+                    if(pattern.glob.empty() || pattern.glob.back().type != GlobToken::Star) {
+                        pattern.glob.push_back({GlobToken::Star, 0, 0});
+                    }
+                    continue;
+                }
+                if(c == '?') {
+                    flush();
+                    pattern.glob.push_back({GlobToken::Any, 0, 0});
+                    continue;
+                }
+                size_t close = source.find(']', i + 2);
+                if(c == '[' && close != std::string::npos) {
+                    flush();
+                    std::array<uint64_t, 4> set{};
+                    size_t j = i + 1;
+                    bool negate = source[j] == '!' || source[j] == '^';
+                    if(negate) {
+                        ++j;
+                        close = source.find(']', j + 1);
+                        if(close == std::string::npos) {
+                            error = "unterminated [ in " + source;
+                            return false;
+                        }
+                    }
+                    for(; j < close; ++j) {
+                        unsigned char lo = source[j];
+                        unsigned char hi = lo;
+                        if(j + 2 < close && source[j + 1] == '-') {
+                            hi = source[j + 2];
+                            j += 2;
+                        }
+                        for(unsigned v = lo; v <= hi; ++v) {
+                            unsigned char member = fold ? fold_char(char(v)) : char(v);
+                            set[member >> 6] |= uint64_t(1) << (member & 63);
+                        }
+                    }
+                    if(negate) {
+                        for(auto& word : set) {
+                            word = ~word;
+                        }
+                    }
+                    pattern.glob.push_back({GlobToken::Class, 0, uint32_t(pattern.sets.size())});
+                    pattern.sets.push_back(set);
+                    i = close;
+                    continue;
+                }
+                if(c == '\\' && i + 1 < source.size()) {
+                    c = source[++i];
+                }
+                c = fold ? fold_char(c) : c;
+                pattern.glob.push_back({GlobToken::Literal, c, 0});
+                run += c;
+            }
+            flush();
+            break;
+        }
+        case Kind::Regex:
+            try {
+                auto flags = std::regex::ECMAScript | std::regex::optimize;
+                if(fold) {
+                    flags |= std::regex::icase;
+                }
+                pattern.regex = std::make_shared<std::regex>(source, flags);
+            } catch(const std::regex_error& ex) {
+                error = "bad regex " + source + ": " + ex.what();
+                return false;
+            }
+            pattern.prefilter = regex_literal(source);
+            if(fold) {
+                pattern.prefilter = folded(pattern.prefilter);
+            }
+            break;
+    }
+    return true;
+}
+
+bool NameMatcher::add(const std::string& pattern, Kind kind, bool exclude, std::string& error) {
+    Pattern compiled;
+    compiled.kind = kind;
+    compiled.source = pattern;
+    if(!compile(compiled, error)) {
+        return false;
+    }
+    (exclude ? excludes : includes).push_back(std::move(compiled));
+    return true;
+}
+
+void NameMatcher::set_ignore_case(bool ignore) {
+    if(fold == ignore) {
+        return;
+    }
+    fold = ignore;
+    std::string error;
+    for(auto* list : {&includes, &excludes}) {
+        for(auto& pattern : *list) {
+            compile(pattern, error);
+        }
+    }
+}
+
+bool NameMatcher::parse(const std::string& query, std::string& error) {
+    std::vector<std::string> words;
+    std::string word;
+    bool in_word = false;
+    for(size_t i = 0; i < query.size(); ++i) {
+        char c = query[i];
+        if(c == '\\' && i + 1 < query.size() && query[i + 1] == ' ') {
+            word += ' ';
+            in_word = true;
+            ++i;
+        } else if(c == ' ' || c == '\t') {
+            if(in_word) {
+                words.push_back(word);
+            }
+            word.clear();
+            in_word = false;
+        } else {
+            word += c;
+            in_word = true;
+        }
+    }
+    if(in_word) {
+        words.push_back(word);
+    }
+
+    // -i applies to the whole query, wherever it appears.
+    if(std::find(words.begin(), words.end(), "-i") != words.end()) {
+        fold = true;
+    }
+    for(const auto& w : words) {
+        if(w == "-i") {
+            continue;
+        }
+        std::string text = w;
+        bool exclude = text.size() > 1 && text[0] == '!';
+        if(exclude) {
+            text.erase(0, 1);
+        }
+
+        Kind kind = Kind::Substring;
+        if(text.size() >= 2 && text.front() == '/' && text.back() == '/') {
+            kind = Kind::Regex;
+            text = text.substr(1, text.size() - 2);
+        } else if(text.find_first_of("*?[") != std::string::npos) {
+            kind = Kind::Glob;
+        } else {
+            bool anchored_start = text.size() > 1 && text.front() == '^';
+            bool anchored_end = text.size() > 1 && text.back() == '$';
+            if(anchored_start) {
+                text.erase(0, 1);
+            }
+            if(anchored_end) {
+                text.pop_back();
+            }
+            kind = anchored_start ? (anchored_end ? Kind::Exact : Kind::Prefix)
+                                  : (anchored_end ? Kind::Suffix : Kind::Substring);
+        }
+        if(!add(text, kind, exclude, error)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NameMatcher::match_glob(const Pattern& pattern, const char* name, size_t len) {
+    // Iterative wildcard match: on a mismatch, retry from the last star with
+    // one more character consumed. No recursion and no allocation.
+    const std::vector<GlobToken>& tokens = pattern.glob;
+    size_t n = 0;
+    size_t p = 0;
+    size_t star = SIZE_MAX;
+    size_t mark = 0;
+    while(n < len) {
+        if(p < tokens.size()) {
+            const GlobToken& token = tokens[p];
+            unsigned char c = name[n];
+            bool ok = false;
+            switch(token.type) {
+                case GlobToken::Literal: ok = token.c == name[n]; break;
+                case GlobToken::Any: ok = true; break;
+                case GlobToken::Class: ok = (pattern.sets[token.set_index][c >> 6] >> (c & 63)) & 1; break;
+                case GlobToken::Star:
+                    star = p++;
+                    mark = n;
+                    continue;
+            }
+            if(ok) {
+                ++p;
+                ++n;
+                continue;
+            }
+        }
+        if(star == SIZE_MAX) {
+            return false;
+        }
+        p = star + 1;
+        n = ++mark;
+    }
+    while(p < tokens.size() && tokens[p].type == GlobToken::Star) {
+        ++p;
+    }
+    return p == tokens.size();
+}
+
+bool NameMatcher::match_one(const Pattern& pattern, const char* name, size_t len) {
+    const std::string& text = pattern.text;
+    switch(pattern.kind) {
+        case Kind::Substring:
+            return contains_literal(name, len, text);
+        case Kind::Prefix:
+            return len >= text.size() && memcmp(name, text.data(), text.size()) == 0;
+        case Kind::Suffix:
+            return len >= text.size() && memcmp(name + len - text.size(), text.data(), text.size()) == 0;
+        case Kind::Exact:
+            return len == text.size() && memcmp(name, text.data(), len) == 0;
+        case Kind::Glob:
+            return contains_literal(name, len, pattern.prefilter) && match_glob(pattern, name, len);
+        case Kind::Regex:
+            return contains_literal(name, len, pattern.prefilter) && std::regex_search(name, name + len, *pattern.regex);
+    }
+    return false;
+}
+
+bool NameMatcher::matches(std::string_view name) const {
+    if(empty()) {
+        return true;
+    }
+    char inline_buffer[kInlineName + kPad];
+    std::vector<char> heap_buffer;
+    const char* buffer = padded_copy(name, fold, inline_buffer, heap_buffer);
+
+    for(const auto& pattern : excludes) {
+        if(match_one(pattern, buffer, name.size())) {
+            return false;
+        }
+    }
+    if(includes.empty()) {
+        return true;
+    }
+    for(const auto& pattern : includes) {
+        if(match_one(pattern, buffer, name.size())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool NameMatcher::excluded(std::string_view name) const {
+    if(excludes.empty()) {
+        return false;
+    }
+    char inline_buffer[kInlineName + kPad];
+    std::vector<char> heap_buffer;
+    const char* buffer = padded_copy(name, fold, inline_buffer, heap_buffer);
+    for(const auto& pattern : excludes) {
+        if(match_one(pattern, buffer, name.size())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string NameMatcher::required_literal() const {
+    if(fold || includes.size() != 1) {
+        return std::string();
+    }
+    return includes[0].prefilter;
+}
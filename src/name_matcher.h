@@ -0,0 +1,77 @@
+#ifndef NAME_MATCHER_H
+#define NAME_MATCHER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <array>
+#include <regex>
+#include <cstdint>
+#include <cstddef>
+
+// Compiled file name filter: any include pattern matches and no exclude
+// pattern does (no includes means everything is included). Each pattern is
+// compiled once; every kind carries a literal that a matching name must
+// contain, checked first with an SSE2 scan so most names are rejected
+// without touching the glob or regex engine and without allocating.
+class NameMatcher {
+public:
+    enum class Kind {
+        Substring,
+        Prefix,
+        Suffix,
+        Exact,
+        Glob,       // * ? [a-z] [!x], whole name
+        Regex       // ECMAScript, searched anywhere in the name
+    };
+
+    // Adds one pattern; returns false with error set if it does not compile.
+    bool add(const std::string& pattern, Kind kind, bool exclude, std::string& error);
+
+    // Parses the search prompt syntax. Words are separated by spaces ("\ "
+    // keeps one): "text" is a substring, "^text" / "text$" are anchored, a
+    // word with * ? or [ is a glob, "/re/" is a regex, a leading "!" makes a
+    // word an exclude, and "-i" makes the whole query ignore case.
+    bool parse(const std::string& query, std::string& error);
+
+    void set_ignore_case(bool ignore);
+    bool ignore_case() const { return fold; }
+    bool empty() const { return includes.empty() && excludes.empty(); }
+    bool has_excludes() const { return !excludes.empty(); }
+
+    bool matches(std::string_view name) const;
+    // Exclude patterns only; used to prune directories during a walk.
+    bool excluded(std::string_view name) const;
+
+    // A case-sensitive literal every match contains, or empty when there
+    // is none (several includes, ignored case); lets an index narrow first.
+    std::string required_literal() const;
+
+private:
+    struct GlobToken {
+        enum Type : uint8_t { Literal, Any, Star, Class } type;
+        char c;
+        uint32_t set_index;
+    };
+
+    struct Pattern {
+        Kind kind;
+        std::string source;
+        std::string text;           // literal kinds, folded when ignoring case
+        std::string prefilter;      // literal every match contains
+        std::vector<GlobToken> glob;
+        std::vector<std::array<uint64_t, 4>> sets;
+        std::shared_ptr<std::regex> regex;
+    };
+
+    std::vector<Pattern> includes;
+    std::vector<Pattern> excludes;
+    bool fold = false;
+
+    bool compile(Pattern& pattern, std::string& error) const;
+    static bool match_one(const Pattern& pattern, const char* name, size_t len);
+    static bool match_glob(const Pattern& pattern, const char* name, size_t len);
+};
+
+#endif
@@ -0,0 +1,341 @@
+#include "output_buffer.h"
+#include "telemetry.h"
+
+#include <iostream>
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <sys/uio.h>
+
+namespace {
+
+const char kPermTriplets[8][4] = {"---", "--x", "-w-", "-wx", "r--", "r-x", "rw-", "rwx"};
+const char kSizeUnits[3] = {'K', 'M', 'G'};
+
+void put2(char* out, int value) {
+    out[0] = char('0' + value / 10);
+    out[1] = char('0' + value % 10);
+}
+
+}
+
+bool parse_output_format(const std::string& text, OutputFormat& format) {
+    if(text == "human") {
+        format = OutputFormat::Human;
+    } else if(text == "tsv") {
+        format = OutputFormat::Tsv;
+    } else if(text == "json" || text == "jsonl") {
+        format = OutputFormat::JsonLines;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* output_format_name(OutputFormat format) {
+    switch(format) {
+        case OutputFormat::Human:
+            return "human";
+        case OutputFormat::Tsv:
+            return "tsv";
+        case OutputFormat::JsonLines:
+            return "json";
+    }
+    return "human";
+}
+
+size_t format_size(char* out, uint64_t size) {
+    char* end;
+    if(size < 1024) {
+        end = std::to_chars(out, out + 32, size).ptr;
+        *end++ = 'B';
+    } else {
+        // Tenths of the unit, rounded half to even like printf's %.1f.
+        int unit = size < (uint64_t(1) << 20) ? 0 : (size < (uint64_t(1) << 30) ? 1 : 2);
+        int shift = 10 * (unit + 1);
+        uint64_t mask = (uint64_t(1) << shift) - 1;
+        uint64_t fraction = (size & mask) * 10;
+        uint64_t tenths = (size >> shift) * 10 + (fraction >> shift);
+        uint64_t rest = fraction & mask;
+        uint64_t half = uint64_t(1) << (shift - 1);
+        if(rest > half || (rest == half && tenths % 2 == 1)) {
+            ++tenths;
+        }
+        end = std::to_chars(out, out + 28, tenths / 10).ptr;
+        *end++ = '.';
+        *end++ = char('0' + tenths % 10);
+        *end++ = kSizeUnits[unit];
+    }
+    return end - out;
+}
+
+bool parse_size(const std::string& text, uint64_t& size) {
+    char* end = nullptr;
+    errno = 0;
+    double value = std::strtod(text.c_str(), &end);
+    if(end == text.c_str() || errno != 0 || value < 0) {
+        return false;
+    }
+    int shift = 0;
+    switch(*end) {
+        case 'k': case 'K': shift = 10; ++end; break;
+        case 'm': case 'M': shift = 20; ++end; break;
+        case 'g': case 'G': shift = 30; ++end; break;
+        case 't': case 'T': shift = 40; ++end; break;
+    }
+    if(*end == 'B' || *end == 'b') {
+        ++end;
+    }
+    if(*end != '\0') {
+        return false;
+    }
+    size = static_cast<uint64_t>(value * double(uint64_t(1) << shift));
+    return true;
+}
+
+OutputBuffer::OutputBuffer(int fd, uint8_t frame_type)
+    : fd(fd), frame_type(frame_type), used_chunks(0), chunk_pos(kChunkBytes), pending_bytes(0), write_failed(false),
+      cached_minute(INT64_MIN) {
+}
+
+OutputBuffer::~OutputBuffer() {
+    flush();
+}
+
+char* OutputBuffer::reserve(size_t bytes) {
+    if(chunk_pos + bytes > kChunkBytes) {
+        if(used_chunks == chunks.size()) {
+            chunks.emplace_back(new char[kChunkBytes]);
+            chunk_lengths.push_back(0);
+        }
+        chunk_lengths[used_chunks] = 0;
+        ++used_chunks;
+        chunk_pos = 0;
+    }
+    return chunks[used_chunks - 1].get() + chunk_pos;
+}
+
+void OutputBuffer::commit(size_t bytes) {
+    chunk_pos += bytes;
+    chunk_lengths[used_chunks - 1] = chunk_pos;
+    pending_bytes += bytes;
+}
+
+void OutputBuffer::append(std::string_view text) {
+    while(!text.empty()) {
+        size_t room = kChunkBytes - std::min(chunk_pos, kChunkBytes);
+        if(room == 0) {
+            room = kChunkBytes;
+        }
+        size_t piece = std::min(text.size(), room);
+        char* out = reserve(piece);
+        memcpy(out, text.data(), piece);
+        commit(piece);
+        text.remove_prefix(piece);
+    }
+}
+
+void OutputBuffer::append(char c) {
+    *reserve(1) = c;
+    commit(1);
+}
+
+void OutputBuffer::append_uint(uint64_t value) {
+    char* out = reserve(20);
+    commit(std::to_chars(out, out + 20, value).ptr - out);
+}
+
+void OutputBuffer::append_int(int64_t value) {
+    char* out = reserve(20);
+    commit(std::to_chars(out, out + 20, value).ptr - out);
+}
+
+void OutputBuffer::append_octal(uint32_t value, int width) {
+    char digits[12];
+    char* end = std::to_chars(digits, digits + sizeof(digits), value, 8).ptr;
+    for(int pad = width - int(end - digits); pad > 0; --pad) {
+        append('0');
+    }
+    append(std::string_view(digits, end - digits));
+}
+
+void OutputBuffer::append_padded(std::string_view text, size_t width) {
+    for(size_t pad = text.size(); pad < width; ++pad) {
+        append(' ');
+    }
+    append(text);
+}
+
+void OutputBuffer::append_uint_padded(uint64_t value, size_t width) {
+    char digits[20];
+    char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+    append_padded(std::string_view(digits, end - digits), width);
+}
+
+void OutputBuffer::append_quoted(std::string_view text) {
+    append('"');
+    size_t start = 0;
+    for(size_t i = 0; i < text.size(); ++i) {
+        if(text[i] == '"' || text[i] == '\\') {
+            append(text.substr(start, i - start));
+            append('\\');
+            start = i;
+        }
+    }
+    append(text.substr(start));
+    append('"');
+}
+
+void OutputBuffer::append_json_string(std::string_view text) {
+    static const char kHex[] = "0123456789abcdef";
+    append('"');
+    size_t start = 0;
+    for(size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if(c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        append(text.substr(start, i - start));
+        start = i + 1;
+        switch(c) {
+            case '"': append("\\\""); break;
+            case '\\': append("\\\\"); break;
+            case '\n': append("\\n"); break;
+            case '\t': append("\\t"); break;
+            case '\r': append("\\r"); break;
+            default: {
+                char escape[6] = {'\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 15]};
+                append(std::string_view(escape, 6));
+            }
+        }
+    }
+    append(text.substr(start));
+    append('"');
+}
+
+void OutputBuffer::append_tsv_field(std::string_view text) {
+    size_t start = 0;
+    for(size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if(c != '\t' && c != '\n' && c != '\\') {
+            continue;
+        }
+        append(text.substr(start, i - start));
+        append(c == '\t' ? "\\t" : (c == '\n' ? "\\n" : "\\\\"));
+        start = i + 1;
+    }
+    append(text.substr(start));
+}
+
+void OutputBuffer::append_permissions(uint32_t mode) {
+    char* out = reserve(10);
+    memcpy(out, kPermTriplets[(mode >> 6) & 7], 3);
+    memcpy(out + 3, kPermTriplets[(mode >> 3) & 7], 3);
+    memcpy(out + 6, kPermTriplets[mode & 7], 3);
+    out[9] = '-';
+    commit(10);
+}
+
+void OutputBuffer::append_size(uint64_t size) {
+    char text[32];
+    append(std::string_view(text, format_size(text, size)));
+}
+
+void OutputBuffer::append_time(int64_t seconds) {
+    // Rows in one listing mostly share few distinct minutes, so the
+    // localtime_r conversion is cached per minute.
+    int64_t minute = seconds >= 0 ? seconds / 60 : (seconds - 59) / 60;
+    if(minute != cached_minute) {
+        std::time_t t = static_cast<std::time_t>(seconds);
+        struct tm local;
+        if(!localtime_r(&t, &local)) {
+            memset(&local, 0, sizeof(local));
+        }
+        char* out = cached_time;
+        char* year_end = std::to_chars(out, out + 5, local.tm_year + 1900).ptr;
+        if(year_end - out != 4) {
+            memcpy(out, "0000", 4);
+        }
+        out[4] = '-';
+        put2(out + 5, local.tm_mon + 1);
+        out[7] = '-';
+        put2(out + 8, local.tm_mday);
+        out[10] = ' ';
+        put2(out + 11, local.tm_hour);
+        out[13] = ':';
+        put2(out + 14, local.tm_min);
+        cached_minute = minute;
+    }
+    append(std::string_view(cached_time, 16));
+}
+
+void OutputBuffer::end_row() {
+    append('\n');
+    if(pending_bytes >= kFlushBytes) {
+        flush();
+    }
+}
+
+void OutputBuffer::flush() {
+    if(pending_bytes == 0) {
+        return;
+    }
+    std::cout.flush();
+    if(write_failed) {
+        used_chunks = 0;
+        chunk_pos = kChunkBytes;
+        pending_bytes = 0;
+        return;
+    }
+    Telemetry::add(Counter::OutputBytes, pending_bytes);
+
+    std::vector<iovec> iov;
+    iov.reserve(used_chunks + 1);
+    unsigned char header[5];
+    if(frame_type != 0) {
+        uint32_t length = static_cast<uint32_t>(pending_bytes);
+        for(int i = 0; i < 4; ++i) {
+            header[i] = static_cast<unsigned char>(length >> (8 * i));
+        }
+        header[4] = frame_type;
+        iov.push_back(iovec{header, sizeof(header)});
+    }
+    for(size_t i = 0; i < used_chunks; ++i) {
+        if(chunk_lengths[i] > 0) {
+            iov.push_back(iovec{chunks[i].get(), chunk_lengths[i]});
+        }
+    }
+
+    size_t first = 0;
+    while(first < iov.size()) {
+        int count = static_cast<int>(std::min<size_t>(iov.size() - first, IOV_MAX));
+        ssize_t written = writev(fd, &iov[first], count);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            write_failed = true;
+            if(fd == STDOUT_FILENO) {
+                std::cout.setstate(std::ios::badbit);
+            }
+            break;
+        }
+        size_t left = static_cast<size_t>(written);
+        while(first < iov.size() && left >= iov[first].iov_len) {
+            left -= iov[first].iov_len;
+            ++first;
+        }
+        if(left > 0) {
+            iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + left;
+            iov[first].iov_len -= left;
+        }
+    }
+
+    used_chunks = 0;
+    chunk_pos = kChunkBytes;
+    pending_bytes = 0;
+}
@@ -0,0 +1,88 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <unistd.h>
+
+enum class OutputFormat {
+    Human,
+    Tsv,        // one row per line, tab separated, \t \n \\ escaped
+    JsonLines   // one JSON object per line
+};
+
+bool parse_output_format(const std::string& text, OutputFormat& format);
+const char* output_format_name(OutputFormat format);
+
+// Writes a human-readable size (512B, 1.5K, 3.2M, 1.0G) into out, which
+// must hold 32 bytes, and returns its length.
+size_t format_size(char* out, uint64_t size);
+
+// Parses a size such as 4096, 512K, 1.5M or 2G (binary units).
+bool parse_size(const std::string& text, uint64_t& size);
+
+// Row renderer for listings and search results. Rows are formatted straight
+// into fixed-size chunks with std::to_chars and lookup tables, and the
+// chunks go out in one writev once enough has accumulated, instead of one
+// write(2) per line. std::cout is flushed first so prompts keep their order,
+// and a failed write to stdout sets badbit on std::cout as writing through it
+// would; output after a failed write is dropped.
+//
+// With a frame type, each flush goes out as one frame of the daemon
+// protocol (a u32 length and the type in front), so a client can tell rows
+// from other messages on the same socket.
+class OutputBuffer {
+public:
+    static const size_t kChunkBytes = 64 * 1024;
+    static const size_t kFlushBytes = 1024 * 1024;
+
+    explicit OutputBuffer(int fd = STDOUT_FILENO, uint8_t frame_type = 0);
+    ~OutputBuffer();
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void append(std::string_view text);
+    void append(char c);
+    void append_uint(uint64_t value);
+    void append_int(int64_t value);
+    void append_octal(uint32_t value, int width);
+    // Right-aligned in a field of `width`, like std::setw.
+    void append_padded(std::string_view text, size_t width);
+    void append_uint_padded(uint64_t value, size_t width);
+    // Same escaping as std::quoted.
+    void append_quoted(std::string_view text);
+    void append_json_string(std::string_view text);
+    void append_tsv_field(std::string_view text);
+    // "rwxr-xr-x-" style, matching FileExplorer::get_permissions_string.
+    void append_permissions(uint32_t mode);
+    // 512B, 1.5K, 3.2M, 1.0G
+    void append_size(uint64_t size);
+    // Local time as "%Y-%m-%d %H:%M".
+    void append_time(int64_t seconds);
+
+    // Ends a row and writes out once kFlushBytes are pending.
+    void end_row();
+    void flush();
+    size_t pending() const { return pending_bytes; }
+
+private:
+    int fd;
+    uint8_t frame_type;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    std::vector<size_t> chunk_lengths;
+    size_t used_chunks;
+    size_t chunk_pos;
+    size_t pending_bytes;
+    bool write_failed;
+    int64_t cached_minute;
+    char cached_time[16];
+
+    char* reserve(size_t bytes);
+    void commit(size_t bytes);
+};
+
+#endif
@@ -0,0 +1,255 @@
+#include "permission_engine.h"
+#include "tree_walker.h"
+#include "telemetry.h"
+
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace {
+
+const uint32_t kUserBits = S_ISUID | S_IRWXU;
+const uint32_t kGroupBits = S_ISGID | S_IRWXG;
+const uint32_t kOtherBits = S_ISVTX | S_IRWXO;
+const uint32_t kAllBits = 07777;
+
+bool is_op(char c) {
+    return c == '+' || c == '-' || c == '=';
+}
+
+// rwx of one class spread to all three, for "g=u".
+uint32_t copy_class(uint32_t mode, char from) {
+    uint32_t bits = from == 'u' ? (mode >> 6) & 7 : from == 'g' ? (mode >> 3) & 7 : mode & 7;
+    return bits * 0111;
+}
+
+}
+
+bool ModeSpec::parse(const std::string& text, std::string& error) {
+    clauses.clear();
+    source = text;
+    if(text.empty()) {
+        error = "empty mode";
+        return false;
+    }
+
+    if(text.find_first_not_of("01234567") == std::string::npos) {
+        unsigned long value = std::strtoul(text.c_str(), nullptr, 8);
+        if(text.size() > 4 || value > kAllBits) {
+            error = "invalid mode: " + text;
+            return false;
+        }
+        clauses.push_back({kAllBits, '=', static_cast<uint32_t>(value), false, 0});
+        return true;
+    }
+
+    mode_t mask = umask(0);
+    umask(mask);
+    umask_bits = mask;
+
+    size_t i = 0;
+    while(i <= text.size()) {
+        uint32_t who = 0;
+        for(; i < text.size() && std::strchr("ugoa", text[i]); ++i) {
+            who |= text[i] == 'u' ? kUserBits : text[i] == 'g' ? kGroupBits : text[i] == 'o' ? kOtherBits : kAllBits;
+        }
+        if(i >= text.size() || !is_op(text[i])) {
+            error = "invalid mode: " + text + " (e.g. 755 or u+rw,g-w,o=)";
+            clauses.clear();
+            return false;
+        }
+        // Each operator in "u+r-w" is a clause of its own.
+        while(i < text.size() && is_op(text[i])) {
+            Clause clause = {who, text[i++], 0, false, 0};
+            if(i < text.size() && std::strchr("ugo", text[i])) {
+                clause.copy_from = text[i++];
+            } else {
+                for(; i < text.size() && std::strchr("rwxXst", text[i]); ++i) {
+                    switch(text[i]) {
+                        case 'r': clause.perms |= 0444; break;
+                        case 'w': clause.perms |= 0222; break;
+                        case 'x': clause.perms |= 0111; break;
+                        case 'X': clause.conditional_exec = true; break;
+                        case 's': clause.perms |= S_ISUID | S_ISGID; break;
+                        case 't': clause.perms |= S_ISVTX; break;
+                    }
+                }
+            }
+            clauses.push_back(clause);
+        }
+        if(i < text.size() && text[i] != ',') {
+            error = "invalid mode: " + text + " (e.g. 755 or u+rw,g-w,o=)";
+            clauses.clear();
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+
+uint32_t ModeSpec::apply(uint32_t mode, bool directory) const {
+    uint32_t result = mode & kAllBits;
+    for(const auto& clause : clauses) {
+        uint32_t affected = clause.who ? clause.who : kAllBits;
+        uint32_t perms = clause.copy_from ? copy_class(result, clause.copy_from) : clause.perms;
+        if(clause.conditional_exec && (directory || (result & 0111))) {
+            perms |= 0111;
+        }
+        uint32_t value = perms & affected & (clause.who ? kAllBits : ~umask_bits);
+        switch(clause.op) {
+            case '+': result |= value; break;
+            case '-': result &= ~value; break;
+            case '=': result = (result & ~affected) | value; break;
+        }
+    }
+    return result;
+}
+
+PermissionEngine::PermissionEngine(const Options& options)
+    : options(options), privileged(geteuid() == 0), scanned(0), changed(0), unchanged(0), skipped(0),
+      error_count(0) {
+}
+
+void PermissionEngine::note_error(const std::string& path, int err) {
+    ++error_count;
+    std::lock_guard<std::mutex> lock(mutex);
+    if(first_error.empty()) {
+        first_error = path + ": " + std::strerror(err);
+    }
+}
+
+int PermissionEngine::update(int dirfd, const char* name, int stat_flags, bool& defer, uint32_t& mode) {
+    defer = false;
+    struct stat st;
+    Telemetry::add(Counter::MetadataCalls);
+    if(fstatat(dirfd, name, &st, stat_flags) != 0) {
+        return errno;
+    }
+    bool directory = S_ISDIR(st.st_mode);
+    if(S_ISLNK(st.st_mode)) {
+        ++skipped;
+        return 0;
+    }
+    const ModeSpec& spec = directory ? options.directories : options.files;
+    if(spec.empty()) {
+        ++skipped;
+        return 0;
+    }
+    ++scanned;
+    mode = spec.apply(st.st_mode, directory);
+    if(mode == (st.st_mode & kAllBits)) {
+        ++unchanged;
+        return 0;
+    }
+    // Without u+rx the walker could not read the directory afterwards.
+    if(directory && options.recursive && !privileged && (mode & (S_IRUSR | S_IXUSR)) != (S_IRUSR | S_IXUSR)) {
+        defer = true;
+        return 0;
+    }
+    // fchmodat cannot refuse symlinks on Linux; the fstatat above has just
+    // seen this name as something else.
+    Telemetry::add(Counter::ModeChanges);
+    if(fchmodat(dirfd, name, mode, 0) != 0) {
+        return errno;
+    }
+    ++changed;
+    return 0;
+}
+
+void PermissionEngine::finish(const std::string& path, int err, bool defer, uint32_t mode) {
+    if(err != 0) {
+        note_error(path, err);
+    } else if(defer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        deferred.push_back({path, mode});
+    }
+}
+
+PermissionEngine::Result PermissionEngine::apply(const std::string& path) {
+    auto start = std::chrono::steady_clock::now();
+    Result result;
+
+    // The named path itself is followed, like chmod(1).
+    bool defer = false;
+    uint32_t mode = 0;
+    int err = update(AT_FDCWD, path.c_str(), 0, defer, mode);
+    finish(path, err, defer, mode);
+
+    struct stat st;
+    if(options.recursive && stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        std::mutex progress_mutex;
+        std::condition_variable progress_cv;
+        bool running = true;
+        std::thread progress_thread;
+        if(options.progress && isatty(STDERR_FILENO)) {
+            progress_thread = std::thread([&]() {
+                std::unique_lock<std::mutex> lock(progress_mutex);
+                while(!progress_cv.wait_for(lock, std::chrono::milliseconds(250), [&]() { return !running; })) {
+                    std::cerr << "\r  Checked " << scanned << ", changed " << changed << "    " << std::flush;
+                }
+            });
+        }
+
+        TreeWalker walker(options.workers);
+        walker.set_strict(true);
+        walker.on_entry([&](const WalkEntry& entry) {
+            // d_type settles symlinks and rule-less entries without a stat;
+            // directories are still walked.
+            if(entry.type == DT_LNK || (entry.is_directory() ? options.directories : options.files).empty()) {
+                ++skipped;
+                return true;
+            }
+            bool entry_defer = false;
+            uint32_t entry_mode = 0;
+            int err = update(entry.dirfd, entry.name, AT_SYMLINK_NOFOLLOW, entry_defer, entry_mode);
+            if(err != 0 || entry_defer) {
+                finish(entry.path(), err, entry_defer, entry_mode);
+            }
+            return true;
+        });
+        walker.on_error([&](const std::string& dir_path, int err) {
+            note_error(dir_path, err);
+        });
+        walker.walk(path);
+
+        if(progress_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                running = false;
+            }
+            progress_cv.notify_all();
+            progress_thread.join();
+            std::cerr << "\r" << std::string(60, ' ') << "\r" << std::flush;
+        }
+    }
+
+    // Deepest first, so a parent is still open to us while its children change.
+    std::sort(deferred.begin(), deferred.end(), [](const Deferred& a, const Deferred& b) {
+        return a.path.size() > b.path.size();
+    });
+    for(const auto& entry : deferred) {
+        Telemetry::add(Counter::ModeChanges);
+        if(fchmodat(AT_FDCWD, entry.path.c_str(), entry.mode, 0) == 0) {
+            ++changed;
+        } else {
+            note_error(entry.path, errno);
+        }
+    }
+    deferred.clear();
+
+    result.scanned = scanned;
+    result.changed = changed;
+    result.unchanged = unchanged;
+    result.skipped = skipped;
+    result.errors = error_count;
+    result.first_error = first_error;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
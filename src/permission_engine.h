@@ -0,0 +1,90 @@
+#ifndef PERMISSION_ENGINE_H
+#define PERMISSION_ENGINE_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+
+// A chmod mode: octal ("755") or symbolic clauses separated by commas
+// ("u+rw,g-w,o=", "a+X", "g=u"). As with chmod(1), a clause without u, g,
+// o or a applies to everyone but leaves the bits in the umask alone.
+class ModeSpec {
+public:
+    bool parse(const std::string& text, std::string& error);
+    bool empty() const { return clauses.empty(); }
+    const std::string& text() const { return source; }
+
+    // The permission bits (07777) mode has once the spec is applied.
+    uint32_t apply(uint32_t mode, bool directory) const;
+
+private:
+    struct Clause {
+        uint32_t who;           // affected bits; 0 means "a" minus the umask
+        char op;                // '+', '-' or '='
+        uint32_t perms;
+        bool conditional_exec;  // X: execute for directories and files that have some
+        char copy_from;         // 'u', 'g' or 'o' for "g=u"; 0 otherwise
+    };
+
+    std::vector<Clause> clauses;
+    std::string source;
+    uint32_t umask_bits = 0;
+};
+
+// Parallel recursive chmod. Each entry is checked with one fstatat relative
+// to its directory fd and changed with fchmodat only when the mode differs,
+// so re-running on a tree that is already right writes nothing. Symlinks
+// below the root are skipped, never followed, and the walk is strict like
+// DeleteEngine's. Directories whose new mode would lock the walk out are
+// changed after everything below them.
+class PermissionEngine {
+public:
+    struct Options {
+        ModeSpec files;         // everything that is not a directory; empty leaves them alone
+        ModeSpec directories;
+        bool recursive = false;
+        bool progress = true;   // live counts on stderr
+        unsigned workers = 0;
+    };
+
+    struct Result {
+        uint64_t scanned = 0;       // entries whose mode was checked
+        uint64_t changed = 0;
+        uint64_t unchanged = 0;
+        uint64_t skipped = 0;       // symlinks, and entries no rule applies to
+        uint64_t errors = 0;
+        double seconds = 0;
+        std::string first_error;
+    };
+
+    explicit PermissionEngine(const Options& options);
+
+    Result apply(const std::string& path);
+
+private:
+    struct Deferred {
+        std::string path;
+        uint32_t mode;
+    };
+
+    Options options;
+    bool privileged;
+    std::atomic<uint64_t> scanned;
+    std::atomic<uint64_t> changed;
+    std::atomic<uint64_t> unchanged;
+    std::atomic<uint64_t> skipped;
+    std::atomic<uint64_t> error_count;
+    std::mutex mutex;           // guards first_error and deferred
+    std::string first_error;
+    std::vector<Deferred> deferred;
+
+    // Checks and changes name in dirfd; returns 0 or an errno. A directory
+    // change that has to wait for its children sets defer and mode instead.
+    int update(int dirfd, const char* name, int stat_flags, bool& defer, uint32_t& mode);
+    void finish(const std::string& path, int err, bool defer, uint32_t mode);
+    void note_error(const std::string& path, int err);
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "prefetcher.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+namespace {
+
+// From linux/ioprio.h, which is not always installed.
+const int kIoprioWhoProcess = 1;
+const int kIoprioClassIdle = 3;
+const int kIoprioClassShift = 13;
+
+void lower_thread_priority() {
+    pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+    // Linux applies both to the one thread named by its id.
+    setpriority(PRIO_PROCESS, tid, 19);
+#ifdef SYS_ioprio_set
+    syscall(SYS_ioprio_set, kIoprioWhoProcess, tid, kIoprioClassIdle << kIoprioClassShift);
+#endif
+}
+
+std::string join_path(const std::string& dir, std::string_view name) {
+    std::string path = dir;
+    if(path.empty() || path.back() != '/') {
+        path += '/';
+    }
+    path.append(name);
+    return path;
+}
+
+}
+
+Prefetcher::Prefetcher(DirCache& cache) : cache(cache), generation(0), stopping(false) {
+    worker = std::thread(&Prefetcher::run, this);
+}
+
+Prefetcher::~Prefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        ++generation;
+    }
+    has_work.notify_one();
+    worker.join();
+}
+
+void Prefetcher::retarget(const std::string& dir, const std::vector<std::string>& recent) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++generation;
+        queue.clear();
+        queue.push_back(dir);
+        expand = dir;
+        size_t slash = dir.find_last_of('/');
+        if(slash != std::string::npos && dir.size() > 1) {
+            queue.push_back(slash == 0 ? "/" : dir.substr(0, slash));
+        }
+        for(const auto& path : recent) {
+            if(path != dir) {
+                queue.push_back(path);
+            }
+        }
+    }
+    has_work.notify_one();
+}
+
+void Prefetcher::cancel() {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++generation;
+    queue.clear();
+    expand.clear();
+}
+
+void Prefetcher::advise_file(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if(fd < 0) {
+        return;
+    }
+    struct stat st;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && static_cast<uint64_t>(st.st_size) <= kMaxAdviseBytes) {
+        // Queues the reads and returns; the pages arrive in the background.
+        posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+    }
+    close(fd);
+}
+
+void Prefetcher::run() {
+    lower_thread_priority();
+    std::unique_lock<std::mutex> lock(mutex);
+    while(true) {
+        has_work.wait(lock, [&]() { return stopping || !queue.empty(); });
+        if(stopping) {
+            return;
+        }
+        std::string dir = std::move(queue.front());
+        queue.pop_front();
+        uint64_t gen = generation.load();
+        lock.unlock();
+        warm(dir, gen);
+        lock.lock();
+    }
+}
+
+void Prefetcher::warm(const std::string& dir, uint64_t gen) {
+    std::shared_ptr<const DirCache::Snapshot> snapshot = cache.get(dir);
+    if(!snapshot) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if(generation.load() != gen || dir != expand) {
+        return;
+    }
+    expand.clear();
+    // Subdirectories go ahead of the parent and recent paths; a move into
+    // one of them is the most likely next step.
+    std::vector<std::string> subdirs;
+    const DirListing& listing = snapshot->listing;
+    for(const auto& record : listing.records) {
+        if(!record.is_dir() || (record.have_meta() && record.size > kMaxDirBytes)) {
+            continue;
+        }
+        subdirs.push_back(join_path(dir, listing.name(record)));
+        if(subdirs.size() == kMaxSubdirs) {
+            break;
+        }
+    }
+    for(auto path = subdirs.rbegin(); path != subdirs.rend(); ++path) {
+        queue.push_front(std::move(*path));
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef PREFETCHER_H
+#define PREFETCHER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include "dir_cache.h"
+
+// Warms the places the user is likely to go next on one background thread
+// at idle CPU and I/O priority: the current directory, its subdirectories,
+// its parent and recently visited directories, in that order. Each is read
+// through the DirCache, so its entries and metadata are ready (and its
+// inodes are in the kernel's caches) by the time it is listed.
+//
+// Every retarget bumps a generation counter; work queued for an older
+// target is dropped before the next directory is read.
+class Prefetcher {
+public:
+    // Subdirectories beyond this many, or whose directory file is larger
+    // than kMaxDirBytes (tens of thousands of entries), are not prefetched.
+    static const size_t kMaxSubdirs = 64;
+    static const uint64_t kMaxDirBytes = 1024 * 1024;
+    // Files up to this size are read ahead in full by advise_file.
+    static const uint64_t kMaxAdviseBytes = 4 * 1024 * 1024;
+
+    explicit Prefetcher(DirCache& cache);
+    ~Prefetcher();
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+
+    // Replaces all pending work with dir and its neighbours.
+    void retarget(const std::string& dir, const std::vector<std::string>& recent);
+    // Drops pending work without queueing anything new, before an operation
+    // that would compete with it for the disk.
+    void cancel();
+    // Starts kernel readahead of a small file that is about to be viewed.
+    static void advise_file(const std::string& path);
+
+private:
+    DirCache& cache;
+    std::mutex mutex;
+    std::condition_variable has_work;
+    std::deque<std::string> queue;
+    std::string expand;         // directory whose subdirectories follow it
+    std::atomic<uint64_t> generation;
+    bool stopping;
+    std::thread worker;
+
+    void run();
+    void warm(const std::string& dir, uint64_t gen);
+};
+
+#endif
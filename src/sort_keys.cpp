@@ -0,0 +1,277 @@
+#include "sort_keys.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const uint64_t kFileBit = uint64_t(1) << 63;
+const uint64_t kValueMask = kFileBit - 1;
+const size_t kRadixThreshold = 2048;
+// Set in more_key when the extension goes on past the 14 bytes keyed.
+const uint64_t kLongExtension = uint64_t(1) << 56;
+
+struct PackedKey {
+    uint64_t key;       // type bit + sort field
+    uint64_t more_key;  // extension sort: extension bytes 7-13, kLongExtension
+    uint64_t name_key;  // name bytes that break ties in key
+    uint32_t index;
+};
+
+// Up to 7 bytes of text from offset, big-endian, so unsigned key order
+// matches memcmp order of the bytes. Names never contain NUL, so zero
+// padding sorts a shorter prefix first.
+uint64_t prefix_bytes(std::string_view text, size_t offset = 0) {
+    uint64_t value = 0;
+    for(size_t i = offset; i < offset + 7; ++i) {
+        value <<= 8;
+        if(i < text.size()) {
+            value |= uint8_t(text[i]);
+        }
+    }
+    return value;
+}
+
+uint64_t value_bits(const DirListing& listing, const ListRecord& record, SortField field) {
+    switch(field) {
+        case SortField::Name:
+            return prefix_bytes(listing.name(record));
+        case SortField::Extension:
+            return prefix_bytes(file_extension(listing.name(record)));
+        case SortField::Size:
+            return std::min<uint64_t>(record.size, kValueMask);
+        case SortField::Mtime:
+            // Bias into the 63 value bits; any real timestamp fits.
+            return uint64_t(std::clamp<int64_t>(record.mtime, -(int64_t(1) << 62), (int64_t(1) << 62) - 1) +
+                            (int64_t(1) << 62));
+        case SortField::Natural:
+            break;
+    }
+    return 0;
+}
+
+// Stable LSD radix sort on 11-bit digits (six passes) of one key member.
+// Passes whose digit is the same for every key are skipped, so narrow keys
+// such as sizes cost only a few passes.
+void radix_sort(std::vector<PackedKey>& keys, std::vector<PackedKey>& scratch, uint64_t PackedKey::*member) {
+    const int kDigitBits = 11;
+    const int kPasses = (64 + kDigitBits - 1) / kDigitBits;
+    const size_t kRadix = size_t(1) << kDigitBits;
+    std::vector<size_t> counts(kPasses * kRadix, 0);
+    for(const PackedKey& k : keys) {
+        uint64_t value = k.*member;
+        for(int pass = 0; pass < kPasses; ++pass) {
+            ++counts[pass * kRadix + ((value >> (pass * kDigitBits)) & (kRadix - 1))];
+        }
+    }
+
+    for(int pass = 0; pass < kPasses; ++pass) {
+        size_t* count = &counts[pass * kRadix];
+        int shift = pass * kDigitBits;
+        if(count[((keys[0].*member) >> shift) & (kRadix - 1)] == keys.size()) {
+            continue;
+        }
+        size_t offset = 0;
+        for(size_t digit = 0; digit < kRadix; ++digit) {
+            size_t c = count[digit];
+            count[digit] = offset;
+            offset += c;
+        }
+        for(const PackedKey& k : keys) {
+            scratch[count[((k.*member) >> shift) & (kRadix - 1)]++] = k;
+        }
+        keys.swap(scratch);
+    }
+}
+
+}
+
+std::string_view file_extension(std::string_view name) {
+    size_t dot = name.rfind('.');
+    if(dot == std::string_view::npos || dot == 0) {
+        return std::string_view();
+    }
+    return name.substr(dot + 1);
+}
+
+int natural_compare(std::string_view a, std::string_view b) {
+    size_t i = 0;
+    size_t j = 0;
+    while(i < a.size() && j < b.size()) {
+        bool a_digit = a[i] >= '0' && a[i] <= '9';
+        bool b_digit = b[j] >= '0' && b[j] <= '9';
+        if(a_digit && b_digit) {
+            size_t a_start = i;
+            size_t b_start = j;
+            while(a_start < a.size() && a[a_start] == '0') {
+                ++a_start;
+            }
+            while(b_start < b.size() && b[b_start] == '0') {
+                ++b_start;
+            }
+            size_t a_end = a_start;
+            size_t b_end = b_start;
+            while(a_end < a.size() && a[a_end] >= '0' && a[a_end] <= '9') {
+                ++a_end;
+            }
+            while(b_end < b.size() && b[b_end] >= '0' && b[b_end] <= '9') {
+                ++b_end;
+            }
+            size_t a_len = a_end - a_start;
+            size_t b_len = b_end - b_start;
+            if(a_len != b_len) {
+                return a_len < b_len ? -1 : 1;
+            }
+            int cmp = a.substr(a_start, a_len).compare(b.substr(b_start, b_len));
+            if(cmp != 0) {
+                return cmp;
+            }
+            i = a_end;
+            j = b_end;
+            continue;
+        }
+        if(a[i] != b[j]) {
+            return uint8_t(a[i]) < uint8_t(b[j]) ? -1 : 1;
+        }
+        ++i;
+        ++j;
+    }
+    if(i < a.size()) {
+        return 1;
+    }
+    if(j < b.size()) {
+        return -1;
+    }
+    // Equal by value ("a01" and "a1"): fall back to bytes for a total order.
+    return a.compare(b);
+}
+
+bool RecordOrder::operator()(const ListRecord& a, const ListRecord& b) const {
+    if(a.is_dir() != b.is_dir()) {
+        return a.is_dir() > b.is_dir();
+    }
+
+    std::string_view a_name = listing.name(a);
+    std::string_view b_name = listing.name(b);
+    int cmp = 0;
+    switch(spec.field) {
+        case SortField::Name:
+            cmp = a_name.compare(b_name);
+            return spec.descending ? cmp > 0 : cmp < 0;
+        case SortField::Natural:
+            cmp = natural_compare(a_name, b_name);
+            return spec.descending ? cmp > 0 : cmp < 0;
+        case SortField::Size:
+            cmp = a.size < b.size ? -1 : (a.size > b.size ? 1 : 0);
+            break;
+        case SortField::Mtime:
+            cmp = a.mtime < b.mtime ? -1 : (a.mtime > b.mtime ? 1 : 0);
+            break;
+        case SortField::Extension:
+            cmp = file_extension(a_name).compare(file_extension(b_name));
+            break;
+    }
+    if(cmp != 0) {
+        return spec.descending ? cmp > 0 : cmp < 0;
+    }
+    return a_name < b_name;
+}
+
+void sort_listing(DirListing& listing, const SortSpec& spec) {
+    std::vector<ListRecord>& records = listing.records;
+    RecordOrder order(listing, spec);
+    // Natural order has no fixed-width key, so it is a plain comparison sort.
+    if(records.size() < kRadixThreshold || spec.field == SortField::Natural) {
+        std::sort(records.begin(), records.end(), order);
+        return;
+    }
+
+    // The name key holds the next name bytes for a name sort and the first
+    // ones otherwise; an extension sort also keys on the next 7 extension
+    // bytes. Sorting by the name key first and then stably by the others
+    // leaves only entries equal in all of them for the comparator, except
+    // that extensions longer than the key go to it whatever their names.
+    std::vector<PackedKey> keys(records.size());
+    for(uint32_t i = 0; i < records.size(); ++i) {
+        std::string_view name = listing.name(records[i]);
+        uint64_t value = value_bits(listing, records[i], spec.field) & kValueMask;
+        uint64_t name_key = prefix_bytes(name, spec.field == SortField::Name ? 7 : 0);
+        uint64_t more_key = 0;
+        if(spec.field == SortField::Extension) {
+            std::string_view extension = file_extension(name);
+            more_key = prefix_bytes(extension, 7) | (extension.size() > 14 ? kLongExtension : 0);
+        }
+        if(spec.descending) {
+            value = ~value & kValueMask;
+            more_key = ~more_key;
+            if(spec.field == SortField::Name) {
+                name_key = ~name_key;
+            }
+        }
+        keys[i].key = (records[i].is_dir() ? 0 : kFileBit) | value;
+        keys[i].more_key = more_key;
+        keys[i].name_key = name_key;
+        keys[i].index = i;
+    }
+    std::vector<PackedKey> scratch(keys.size());
+    radix_sort(keys, scratch, &PackedKey::name_key);
+    if(spec.field == SortField::Extension) {
+        radix_sort(keys, scratch, &PackedKey::more_key);
+    }
+    radix_sort(keys, scratch, &PackedKey::key);
+
+    auto tie_less = [&](const PackedKey& a, const PackedKey& b) {
+        return order(records[a.index], records[b.index]);
+    };
+    for(size_t run = 0; run < keys.size(); ) {
+        const bool long_extension = ((keys[run].more_key & kLongExtension) != 0) != spec.descending;
+        size_t end = run + 1;
+        while(end < keys.size() && keys[end].key == keys[run].key && keys[end].more_key == keys[run].more_key &&
+              (long_extension || keys[end].name_key == keys[run].name_key)) {
+            ++end;
+        }
+        if(end - run > 1) {
+            std::sort(keys.begin() + run, keys.begin() + end, tie_less);
+        }
+        run = end;
+    }
+
+    std::vector<ListRecord> sorted(records.size());
+    for(size_t i = 0; i < keys.size(); ++i) {
+        sorted[i] = records[keys[i].index];
+    }
+    records.swap(sorted);
+}
+
+bool parse_sort_field(const std::string& text, SortField& field) {
+    if(text == "name") {
+        field = SortField::Name;
+    } else if(text == "natural" || text == "version") {
+        field = SortField::Natural;
+    } else if(text == "size") {
+        field = SortField::Size;
+    } else if(text == "mtime" || text == "time") {
+        field = SortField::Mtime;
+    } else if(text == "ext" || text == "extension") {
+        field = SortField::Extension;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* sort_field_name(SortField field) {
+    switch(field) {
+        case SortField::Name:
+            return "name";
+        case SortField::Natural:
+            return "natural";
+        case SortField::Size:
+            return "size";
+        case SortField::Mtime:
+            return "mtime";
+        case SortField::Extension:
+            return "ext";
+    }
+    return "name";
+}
@@ -0,0 +1,35 @@
+#ifndef SORT_KEYS_H
+#define SORT_KEYS_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include "dir_listing.h"
+
+// Full ordering of listing records: directories first, then the sort field,
+// then name. Used directly for small inputs and the bounded top-k heap, and
+// to settle ties left by the packed keys.
+class RecordOrder {
+public:
+    RecordOrder(const DirListing& listing, const SortSpec& spec) : listing(listing), spec(spec) {}
+    bool operator()(const ListRecord& a, const ListRecord& b) const;
+
+private:
+    const DirListing& listing;
+    SortSpec spec;
+};
+
+// Sorts listing.records. Keys are extracted once into a packed array of
+// 64-bit values (type bit, then name prefix bytes, size, mtime or extension
+// prefix); large listings are LSD radix sorted on them and only runs of equal
+// keys fall back to comparing records.
+void sort_listing(DirListing& listing, const SortSpec& spec);
+
+int natural_compare(std::string_view a, std::string_view b);
+std::string_view file_extension(std::string_view name);
+
+bool parse_sort_field(const std::string& text, SortField& field);
+const char* sort_field_name(SortField field);
+
+#endif
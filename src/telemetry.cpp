@@ -0,0 +1,313 @@
+#include "telemetry.h"
+#include "output_buffer.h"
+
+#include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+std::atomic<bool> Telemetry::active(false);
+std::atomic<bool> Telemetry::trace_on(false);
+std::atomic<bool> Telemetry::echo(false);
+
+namespace {
+
+// Trace events beyond this are dropped rather than growing without bound.
+const uint64_t kMaxTraceEvents = 4 * 1024 * 1024;
+
+const char* const kCounterNames[] = {"entries", "dir_reads", "metadata_calls", "mode_changes", "name_lookups",
+                                     "bytes_read", "bytes_copied", "output_bytes", "cache_hits", "cache_misses"};
+static_assert(sizeof(kCounterNames) / sizeof(kCounterNames[0]) == Telemetry::kCounters, "one name per counter");
+
+struct TraceEvent {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+    uint32_t tid;
+};
+
+struct ThreadBlock {
+    std::atomic<uint64_t> values[Telemetry::kCounters];
+    uint32_t tid;
+    std::mutex trace_mutex;     // the owner appends, write_trace reads
+    std::vector<TraceEvent> events;
+
+    ThreadBlock() : tid(static_cast<uint32_t>(syscall(SYS_gettid))) {
+        for(auto& value : values) {
+            value.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<ThreadBlock*> live;
+    Telemetry::Values retired = {};
+    std::vector<TraceEvent> retired_events;
+    std::vector<Telemetry::OpStats> ops;
+    std::chrono::steady_clock::time_point trace_start;
+    std::atomic<uint64_t> trace_events{0};
+};
+
+// Never destroyed: threads may still exit after static destructors run.
+Registry& registry() {
+    static Registry* instance = new Registry;
+    return *instance;
+}
+
+// Owns this thread's block and folds it into the retired totals on exit.
+struct LocalBlock {
+    ThreadBlock* block;
+
+    LocalBlock() : block(new ThreadBlock) {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.live.push_back(block);
+    }
+    ~LocalBlock() {
+        Registry& reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        for(size_t i = 0; i < Telemetry::kCounters; ++i) {
+            reg.retired[i] += block->values[i].load(std::memory_order_relaxed);
+        }
+        reg.retired_events.insert(reg.retired_events.end(), block->events.begin(), block->events.end());
+        reg.live.erase(std::find(reg.live.begin(), reg.live.end(), block));
+        delete block;
+    }
+};
+
+ThreadBlock& local_block() {
+    thread_local LocalBlock local;
+    return *local.block;
+}
+
+void print_value(std::ostream& out, Counter counter, uint64_t value) {
+    if(counter == Counter::BytesRead || counter == Counter::BytesCopied || counter == Counter::OutputBytes) {
+        char text[32];
+        out << std::string(text, format_size(text, value));
+    } else {
+        out << value;
+    }
+}
+
+}
+
+void Telemetry::add_local(Counter counter, uint64_t n) {
+    // Only this thread writes its block, so no read-modify-write is needed.
+    std::atomic<uint64_t>& value = local_block().values[static_cast<size_t>(counter)];
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+Telemetry::Values Telemetry::totals() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    Values result = reg.retired;
+    for(const ThreadBlock* block : reg.live) {
+        for(size_t i = 0; i < kCounters; ++i) {
+            result[i] += block->values[i].load(std::memory_order_relaxed);
+        }
+    }
+    return result;
+}
+
+std::vector<Telemetry::OpStats> Telemetry::operations() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    return reg.ops;
+}
+
+void Telemetry::record(const char* name, double wall_seconds, double cpu_seconds, const Values& values) {
+    if(echo.load(std::memory_order_relaxed)) {
+        OpStats run;
+        run.name = name;
+        run.count = 1;
+        run.wall_seconds = wall_seconds;
+        run.cpu_seconds = cpu_seconds;
+        run.values = values;
+        std::cerr << "[stats] ";
+        print_op(std::cerr, run);
+    }
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    auto op = std::find_if(reg.ops.begin(), reg.ops.end(), [&](const OpStats& stats) { return stats.name == name; });
+    if(op == reg.ops.end()) {
+        reg.ops.push_back(OpStats());
+        op = reg.ops.end() - 1;
+        op->name = name;
+    }
+    ++op->count;
+    op->wall_seconds += wall_seconds;
+    op->cpu_seconds += cpu_seconds;
+    for(size_t i = 0; i < kCounters; ++i) {
+        op->values[i] += values[i];
+    }
+}
+
+void Telemetry::reset() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.retired = Values();
+    // A thread adding right now may put back a count it read before this.
+    for(ThreadBlock* block : reg.live) {
+        for(auto& value : block->values) {
+            value.store(0, std::memory_order_relaxed);
+        }
+    }
+    reg.ops.clear();
+}
+
+const char* Telemetry::counter_name(Counter counter) {
+    return kCounterNames[static_cast<size_t>(counter)];
+}
+
+double Telemetry::cpu_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void Telemetry::print_op(std::ostream& out, const OpStats& op) {
+    out << op.name << ": " << std::fixed << std::setprecision(3) << op.wall_seconds << "s wall, "
+        << op.cpu_seconds << "s cpu";
+    out.unsetf(std::ios::floatfield);
+    for(size_t i = 0; i < kCounters; ++i) {
+        if(op.values[i] != 0) {
+            out << ", " << kCounterNames[i] << " ";
+            print_value(out, static_cast<Counter>(i), op.values[i]);
+        }
+    }
+    out << std::endl;
+}
+
+void Telemetry::print_summary(std::ostream& out) {
+    std::vector<OpStats> ops = operations();
+    if(ops.empty()) {
+        out << "No operations recorded." << std::endl;
+        return;
+    }
+    out << std::left << std::setw(16) << "Operation" << std::right << std::setw(6) << "Runs"
+        << std::setw(10) << "Wall" << std::setw(10) << "CPU" << "  Counters" << std::endl;
+    for(const auto& op : ops) {
+        out << std::left << std::setw(16) << op.name << std::right << std::setw(6) << op.count
+            << std::fixed << std::setprecision(3) << std::setw(9) << op.wall_seconds << "s"
+            << std::setw(9) << op.cpu_seconds << "s ";
+        out.unsetf(std::ios::floatfield);
+        for(size_t i = 0; i < kCounters; ++i) {
+            if(op.values[i] != 0) {
+                out << " " << kCounterNames[i] << "=";
+                print_value(out, static_cast<Counter>(i), op.values[i]);
+            }
+        }
+        out << std::endl;
+    }
+}
+
+void Telemetry::write_json(std::ostream& out) {
+    auto write_values = [&](const Values& values) {
+        for(size_t i = 0; i < kCounters; ++i) {
+            out << (i ? ", " : "") << "\"" << kCounterNames[i] << "\": " << values[i];
+        }
+    };
+    std::vector<OpStats> ops = operations();
+    out << "{\"operations\": [";
+    for(size_t i = 0; i < ops.size(); ++i) {
+        const OpStats& op = ops[i];
+        out << (i ? ", " : "") << "{\"name\": \"" << op.name << "\", \"count\": " << op.count
+            << std::fixed << std::setprecision(6) << ", \"wall_seconds\": " << op.wall_seconds
+            << ", \"cpu_seconds\": " << op.cpu_seconds << ", ";
+        out.unsetf(std::ios::floatfield);
+        write_values(op.values);
+        out << "}";
+    }
+    out << "], \"totals\": {";
+    write_values(totals());
+    out << "}}" << std::endl;
+}
+
+void Telemetry::start_trace() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.retired_events.clear();
+    for(ThreadBlock* block : reg.live) {
+        std::lock_guard<std::mutex> block_lock(block->trace_mutex);
+        block->events.clear();
+    }
+    reg.trace_events = 0;
+    reg.trace_start = std::chrono::steady_clock::now();
+    trace_on.store(true, std::memory_order_relaxed);
+}
+
+uint64_t Telemetry::trace_micros() {
+    auto elapsed = std::chrono::steady_clock::now() - registry().trace_start;
+    // +1 so that 0 can mean "not started" in TraceSpan.
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() + 1;
+}
+
+void Telemetry::add_span(const char* name, uint64_t start_us, uint64_t end_us) {
+    if(registry().trace_events.fetch_add(1, std::memory_order_relaxed) >= kMaxTraceEvents) {
+        return;
+    }
+    ThreadBlock& block = local_block();
+    std::lock_guard<std::mutex> lock(block.trace_mutex);
+    block.events.push_back({name, start_us, end_us, block.tid});
+}
+
+bool Telemetry::write_trace(const std::string& path, std::string& error) {
+    trace_on.store(false, std::memory_order_relaxed);
+    std::ofstream out(path);
+    if(!out) {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    bool first = true;
+    auto write_event = [&](const TraceEvent& event) {
+        out << (first ? "\n" : ",\n") << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"ts\": " << event.start
+            << ", \"dur\": " << (event.end - event.start) << ", \"pid\": " << getpid() << ", \"tid\": " << event.tid << "}";
+        first = false;
+    };
+    out << "{\"traceEvents\": [";
+    for(const auto& event : reg.retired_events) {
+        write_event(event);
+    }
+    for(ThreadBlock* block : reg.live) {
+        std::lock_guard<std::mutex> block_lock(block->trace_mutex);
+        for(const auto& event : block->events) {
+            write_event(event);
+        }
+    }
+    out << "\n], \"displayTimeUnit\": \"ms\"}" << std::endl;
+    if(!out) {
+        error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+OpScope::OpScope(const char* name)
+    : name(name), active(Telemetry::enabled()), cpu_start(0), span(name) {
+    if(active) {
+        start_values = Telemetry::totals();
+        cpu_start = Telemetry::cpu_seconds();
+        start = std::chrono::steady_clock::now();
+    }
+}
+
+OpScope::~OpScope() {
+    if(!active) {
+        return;
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu = Telemetry::cpu_seconds() - cpu_start;
+    Telemetry::Values values = Telemetry::totals();
+    for(size_t i = 0; i < Telemetry::kCounters; ++i) {
+        values[i] -= start_values[i];
+    }
+    Telemetry::record(name, wall, cpu, values);
+}
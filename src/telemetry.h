@@ -0,0 +1,119 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <string>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iosfwd>
+#include <cstdint>
+
+// What an operation cost. Counters are per thread: each thread adds to its
+// own block with a plain load and store, and a block is folded into the
+// retired totals when its thread exits, so adding never contends. When
+// telemetry is off, add() is one relaxed load and a branch.
+enum class Counter : uint8_t {
+    Entries,        // directory entries returned by getdents
+    DirReads,       // getdents calls
+    MetadataCalls,  // statx / fstatat
+    ModeChanges,    // fchmodat
+    NameLookups,    // uid/gid lookups that went to NSS
+    BytesRead,      // file contents read by searches
+    BytesCopied,
+    OutputBytes,    // rows written by the output buffer
+    CacheHits,      // directory snapshot cache
+    CacheMisses,
+    Count
+};
+
+class Telemetry {
+public:
+    static const size_t kCounters = static_cast<size_t>(Counter::Count);
+    using Values = std::array<uint64_t, kCounters>;
+
+    // Totals for one operation name over every time it ran.
+    struct OpStats {
+        std::string name;
+        uint64_t count = 0;
+        double wall_seconds = 0;
+        double cpu_seconds = 0;     // whole process, so worker threads count
+        Values values = {};
+    };
+
+    static void enable(bool on) { active.store(on, std::memory_order_relaxed); }
+    static bool enabled() { return active.load(std::memory_order_relaxed); }
+    // Prints each operation's line to stderr as it finishes.
+    static void set_echo(bool on) { echo.store(on, std::memory_order_relaxed); }
+
+    static void add(Counter counter, uint64_t n = 1) {
+        if(enabled()) {
+            add_local(counter, n);
+        }
+    }
+
+    static Values totals();
+    static std::vector<OpStats> operations();
+    static void record(const char* name, double wall_seconds, double cpu_seconds, const Values& values);
+    static void reset();
+    static const char* counter_name(Counter counter);
+    static double cpu_seconds();
+
+    // Tables for people and one JSON object for monitoring.
+    static void print_summary(std::ostream& out);
+    static void print_op(std::ostream& out, const OpStats& op);
+    static void write_json(std::ostream& out);
+
+    // Trace mode records spans as Chrome trace events ("X" phase, one track
+    // per thread); the file loads in chrome://tracing or Perfetto.
+    static void start_trace();
+    static bool tracing() { return trace_on.load(std::memory_order_relaxed); }
+    static bool write_trace(const std::string& path, std::string& error);
+    static uint64_t trace_micros();
+    static void add_span(const char* name, uint64_t start_us, uint64_t end_us);
+
+private:
+    static std::atomic<bool> active;
+    static std::atomic<bool> trace_on;
+    static std::atomic<bool> echo;
+
+    static void add_local(Counter counter, uint64_t n);
+};
+
+// A span on this thread's trace track; does nothing unless tracing.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) : name(name), start(Telemetry::tracing() ? Telemetry::trace_micros() : 0) {}
+    ~TraceSpan() {
+        if(start != 0 && Telemetry::tracing()) {
+            Telemetry::add_span(name, start, Telemetry::trace_micros());
+        }
+    }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    uint64_t start;
+};
+
+// One user-level operation: wall and CPU time plus how much every counter
+// moved, recorded under name when the scope ends. Counters moved by other
+// threads in the meantime (the prefetcher) are included.
+class OpScope {
+public:
+    explicit OpScope(const char* name);
+    ~OpScope();
+    OpScope(const OpScope&) = delete;
+    OpScope& operator=(const OpScope&) = delete;
+
+private:
+    const char* name;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+    double cpu_start;
+    Telemetry::Values start_values;
+    TraceSpan span;
+};
+
+#endif
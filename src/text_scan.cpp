@@ -0,0 +1,139 @@
+#include "text_scan.h"
+
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+bool is_letter(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+char fold_char(char c) {
+    return (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
+}
+
+bool equal_folded(const char* text, const char* lower, size_t len) {
+    for(size_t i = 0; i < len; ++i) {
+        if(fold_char(text[i]) != lower[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+bool contains_literal(const char* haystack, size_t len, std::string_view needle) {
+    size_t k = needle.size();
+    if(k == 0) {
+        return true;
+    }
+    if(k > len) {
+        return false;
+    }
+    if(k == 1) {
+        return memchr(haystack, needle[0], len) != nullptr;
+    }
+#ifdef __SSE2__
+    // Compare 16 candidate positions at once on the needle's first and last
+    // bytes; only positions where both agree are verified with memcmp.
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+    for(size_t i = 0; i + k <= len; i += 16) {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i + k - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+        while(mask != 0) {
+            size_t pos = i + __builtin_ctz(mask);
+            if(pos + k > len) {
+                return false;
+            }
+            if(memcmp(haystack + pos + 1, needle.data() + 1, k - 2) == 0) {
+                return true;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return false;
+#else
+    return std::string_view(haystack, len).find(needle) != std::string_view::npos;
+#endif
+}
+
+const char* find_literal(const char* haystack, size_t len, std::string_view needle, bool ignore_case) {
+    size_t k = needle.size();
+    if(k == 0) {
+        return haystack;
+    }
+    if(k > len) {
+        return nullptr;
+    }
+    if(!ignore_case && k == 1) {
+        return static_cast<const char*>(memchr(haystack, needle[0], len));
+    }
+    auto verify = [&](size_t pos) {
+        if(k <= 2) {
+            return true;    // first and last byte already compared
+        }
+        return ignore_case ? equal_folded(haystack + pos + 1, needle.data() + 1, k - 2)
+                           : memcmp(haystack + pos + 1, needle.data() + 1, k - 2) == 0;
+    };
+
+    size_t i = 0;
+#ifdef __SSE2__
+    // Same first/last-byte filter as contains_literal, but the loop stops
+    // while both loads are still inside the buffer; the tail is scalar. When
+    // the needle byte is a letter the haystack is compared with its 0x20 bit
+    // set, which folds exactly the upper-case letters onto it.
+    const char first_fold = (ignore_case && is_letter(needle[0])) ? 0x20 : 0;
+    const char last_fold = (ignore_case && is_letter(needle[k - 1])) ? 0x20 : 0;
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+    const __m128i first_or = _mm_set1_epi8(first_fold);
+    const __m128i last_or = _mm_set1_epi8(last_fold);
+    for(; i + k + 15 <= len; i += 16) {
+        __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i));
+        __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i + k - 1));
+        head = _mm_or_si128(head, first_or);
+        tail = _mm_or_si128(tail, last_or);
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+        while(mask != 0) {
+            size_t pos = i + __builtin_ctz(mask);
+            if(verify(pos)) {
+                return haystack + pos;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for(; i + k <= len; ++i) {
+        char c = ignore_case ? fold_char(haystack[i]) : haystack[i];
+        if(c != needle[0]) {
+            continue;
+        }
+        char e = ignore_case ? fold_char(haystack[i + k - 1]) : haystack[i + k - 1];
+        if(e == needle[k - 1] && verify(i)) {
+            return haystack + i;
+        }
+    }
+    return nullptr;
+}
+
+uint64_t count_newlines(const char* data, size_t len) {
+    uint64_t count = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for(; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+    }
+#endif
+    for(; i < len; ++i) {
+        count += data[i] == '\n';
+    }
+    return count;
+}
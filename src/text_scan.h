@@ -0,0 +1,23 @@
+#ifndef TEXT_SCAN_H
+#define TEXT_SCAN_H
+
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+// SSE2 byte-scanning kernels shared by name matching and content search.
+// Builds without SSE2 fall back to the standard library.
+
+// True if needle occurs in haystack. The haystack must stay readable for
+// 16 bytes past its end; NameMatcher matches inside a padded copy.
+bool contains_literal(const char* haystack, size_t len, std::string_view needle);
+
+// First occurrence of needle in haystack, or nullptr. Never reads past
+// haystack + len, so it is safe on mmap'd files. With ignore_case, ASCII
+// letters match either case and needle must already be lower case.
+const char* find_literal(const char* haystack, size_t len, std::string_view needle, bool ignore_case = false);
+
+// Number of '\n' bytes in [data, data + len).
+uint64_t count_newlines(const char* data, size_t len);
+
+#endif
@@ -0,0 +1,212 @@
+#include "top_files.h"
+#include "tree_walker.h"
+#include "file_metadata.h"
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <cstdlib>
+
+namespace {
+
+// Orders a heap so that its front is the worst item kept.
+bool better(const TopFiles::Item& a, const TopFiles::Item& b) {
+    return a.score != b.score ? a.score > b.score : a.path < b.path;
+}
+
+bool has_inode(const std::vector<TopFiles::Item>& items, uint64_t dev, uint64_t ino) {
+    for(const auto& item : items) {
+        if(item.ino == ino && item.dev == dev) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+TopFiles::TopFiles(const Options& options) : options(options) {
+    for(auto& extension : this->options.extensions) {
+        for(auto& c : extension) {
+            c = (c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c;
+        }
+    }
+}
+
+bool TopFiles::wanted_name(std::string_view name) const {
+    if(options.extensions.empty()) {
+        return true;
+    }
+    size_t dot = name.rfind('.');
+    if(dot == std::string_view::npos || dot == 0) {
+        return false;
+    }
+    std::string_view extension = name.substr(dot + 1);
+    for(const auto& wanted : options.extensions) {
+        if(wanted.size() == extension.size() &&
+           std::equal(wanted.begin(), wanted.end(), extension.begin(), [](char w, char c) {
+               return w == ((c >= 'A' && c <= 'Z') ? char(c + ('a' - 'A')) : c);
+           })) {
+            return true;
+        }
+    }
+    return false;
+}
+
+TopFiles::Result TopFiles::run(const std::string& root) {
+    auto start = std::chrono::steady_clock::now();
+    Result result;
+    const size_t k = options.count;
+    const int64_t now = std::time(nullptr);
+
+    struct Local {
+        std::vector<Item> heap;
+        uint64_t files = 0;
+        uint64_t matched = 0;
+        uint64_t errors = 0;
+    };
+    TreeWalker walker(options.threads);
+    std::vector<Local> locals(walker.thread_count());
+
+    walker.on_entry([&](const WalkEntry& entry) {
+        if(entry.type != DT_REG) {
+            return true;
+        }
+        Local& local = locals[entry.worker];
+        ++local.files;
+        if(!wanted_name(std::string_view(entry.name, entry.name_len))) {
+            return true;
+        }
+        FileMeta meta;
+        if(!fetch_metadata(entry.dirfd, entry.name, meta, false)) {
+            ++local.errors;
+            return true;
+        }
+        int64_t age = now - meta.mtime;
+        if(!meta.is_regular() || (options.older_than > 0 && age < options.older_than) ||
+           (options.newer_than > 0 && age > options.newer_than)) {
+            return true;
+        }
+        ++local.matched;
+
+        int64_t score = 0;
+        switch(options.key) {
+            case Key::Size: score = static_cast<int64_t>(meta.size); break;
+            case Key::Blocks: score = static_cast<int64_t>(meta.blocks * 512); break;
+            case Key::Mtime: score = -meta.mtime; break;
+            case Key::Atime: score = -meta.atime; break;
+        }
+        if(options.reverse) {
+            score = -score;
+        }
+        // Ties with the worst kept item lose, so most entries stop here.
+        std::vector<Item>& heap = local.heap;
+        if(heap.size() >= k && (k == 0 || score <= heap.front().score)) {
+            return true;
+        }
+        // Another link to a file already kept would only repeat it.
+        if(meta.nlink > 1 && has_inode(heap, meta.dev, meta.ino)) {
+            return true;
+        }
+        if(heap.size() >= k) {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.pop_back();
+        }
+        heap.push_back({entry.path(), meta.size, meta.blocks * 512, meta.mtime, meta.atime, meta.dev, meta.ino,
+                        score});
+        std::push_heap(heap.begin(), heap.end(), better);
+        return true;
+    });
+    walker.walk(root);
+
+    std::vector<Item> merged;
+    merged.reserve(k * locals.size());
+    for(auto& local : locals) {
+        result.files += local.files;
+        result.matched += local.matched;
+        result.errors += local.errors;
+        std::move(local.heap.begin(), local.heap.end(), std::back_inserter(merged));
+    }
+    std::sort(merged.begin(), merged.end(), better);
+    for(auto& item : merged) {
+        if(result.items.size() >= k) {
+            break;
+        }
+        // Links to one inode found by different workers.
+        if(!has_inode(result.items, item.dev, item.ino)) {
+            result.items.push_back(std::move(item));
+        }
+    }
+    result.errors += walker.errors();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+bool TopFiles::parse_key(const std::string& text, Key& key) {
+    if(text == "size") {
+        key = Key::Size;
+    } else if(text == "blocks") {
+        key = Key::Blocks;
+    } else if(text == "mtime") {
+        key = Key::Mtime;
+    } else if(text == "atime") {
+        key = Key::Atime;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* TopFiles::key_name(Key key) {
+    switch(key) {
+        case Key::Size: return "size";
+        case Key::Blocks: return "blocks";
+        case Key::Mtime: return "mtime";
+        case Key::Atime: return "atime";
+    }
+    return "";
+}
+
+bool TopFiles::parse_age(const std::string& text, int64_t& seconds) {
+    if(text.empty()) {
+        return false;
+    }
+    char* end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    if(end == text.c_str() || value < 0) {
+        return false;
+    }
+    std::string unit(end);
+    double scale;
+    if(unit.empty() || unit == "d") {
+        scale = 86400;
+    } else if(unit == "w") {
+        scale = 7 * 86400;
+    } else if(unit == "h") {
+        scale = 3600;
+    } else if(unit == "m") {
+        scale = 60;
+    } else if(unit == "s") {
+        scale = 1;
+    } else {
+        return false;
+    }
+    seconds = static_cast<int64_t>(value * scale);
+    return true;
+}
+
+std::vector<std::string> TopFiles::parse_extensions(const std::string& text) {
+    std::vector<std::string> extensions;
+    std::string current;
+    for(char c : text + " ") {
+        if(c == ' ' || c == ',' || c == '\t') {
+            if(!current.empty()) {
+                extensions.push_back(current);
+            }
+            current.clear();
+        } else if(c != '.' || !current.empty()) {
+            current += c;
+        }
+    }
+    return extensions;
+}
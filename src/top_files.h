@@ -0,0 +1,69 @@
+#ifndef TOP_FILES_H
+#define TOP_FILES_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// The K largest (or oldest) regular files under a root, in one parallel
+// metadata pass. Each walker thread keeps a bounded heap of its best K and
+// the heaps are merged at the end, so memory is O(K x threads) however many
+// files the tree holds. An entry that cannot beat the worst kept one costs
+// no allocation, and the extension filter runs on the name before the stat.
+class TopFiles {
+public:
+    enum class Key {
+        Size,       // largest first
+        Blocks,     // most allocated bytes first
+        Mtime,      // least recently modified first
+        Atime       // least recently accessed first
+    };
+
+    struct Options {
+        Key key = Key::Size;
+        size_t count = 20;
+        bool reverse = false;               // smallest / newest first instead
+        std::vector<std::string> extensions;    // without the dot; empty for all
+        int64_t older_than = 0;             // seconds since mtime; 0 for no limit
+        int64_t newer_than = 0;
+        unsigned threads = 0;
+    };
+
+    struct Item {
+        std::string path;
+        uint64_t size;
+        uint64_t allocated;     // st_blocks * 512
+        int64_t mtime;
+        int64_t atime;
+        uint64_t dev;
+        uint64_t ino;
+        int64_t score;          // higher ranks first
+    };
+
+    struct Result {
+        std::vector<Item> items;    // best first
+        uint64_t files = 0;         // regular files looked at
+        uint64_t matched = 0;       // passed the filters
+        uint64_t errors = 0;
+        double seconds = 0;
+    };
+
+    explicit TopFiles(const Options& options);
+
+    Result run(const std::string& root);
+
+    static bool parse_key(const std::string& text, Key& key);
+    static const char* key_name(Key key);
+    // "30d", "12h", "2w", "90m", "45s"; a bare number is days.
+    static bool parse_age(const std::string& text, int64_t& seconds);
+    // "log,tmp" or ".log .tmp"
+    static std::vector<std::string> parse_extensions(const std::string& text);
+
+private:
+    Options options;
+
+    bool wanted_name(std::string_view name) const;
+};
+
+#endif
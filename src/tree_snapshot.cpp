@@ -0,0 +1,445 @@
+#include "tree_snapshot.h"
+#include "tree_walker.h"
+#include "telemetry.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+
+const char kMagic[8] = {'F', 'E', 'X', 'S', 'N', 'P', '1', '\0'};
+const uint32_t kVersion = 2;
+
+uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+struct Record {
+    std::string path;       // relative to the root
+    uint64_t size;
+    int64_t mtime;
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t mode;
+    unsigned char type;
+};
+
+std::string_view parent_of(std::string_view path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string_view::npos ? std::string_view() : path.substr(0, slash);
+}
+
+std::string_view name_of(std::string_view path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+struct FileId {
+    uint64_t dev;
+    uint64_t ino;
+    bool operator==(const FileId& other) const { return dev == other.dev && ino == other.ino; }
+};
+
+struct FileIdHash {
+    size_t operator()(const FileId& id) const { return id.ino * 0x9e3779b97f4a7c15ull ^ id.dev; }
+};
+
+}
+
+struct TreeSnapshot::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t taken_at;
+    uint64_t root_len;
+    uint64_t count;
+    uint64_t name_bytes;
+    uint64_t off_root;
+    uint64_t off_sizes;
+    uint64_t off_mtimes;
+    uint64_t off_devs;
+    uint64_t off_inodes;
+    uint64_t off_name_offsets;
+    uint64_t off_modes;
+    uint64_t off_prefixes;
+    uint64_t off_types;
+    uint64_t off_blob;
+    uint64_t file_size;
+};
+
+TreeSnapshot::TreeSnapshot()
+    : map_base(nullptr), map_size(0), image(nullptr), image_size(0), header(nullptr), sizes(nullptr),
+      mtimes(nullptr), devs(nullptr), inodes(nullptr), name_offsets(nullptr), modes(nullptr), prefixes(nullptr),
+      types(nullptr), name_blob(nullptr) {
+}
+
+TreeSnapshot::~TreeSnapshot() {
+    release();
+}
+
+void TreeSnapshot::release() {
+    if(map_base) {
+        munmap(map_base, map_size);
+    }
+    map_base = nullptr;
+    map_size = 0;
+    std::vector<char>().swap(owned);
+    image = nullptr;
+    image_size = 0;
+    header = nullptr;
+}
+
+std::string TreeSnapshot::root() const {
+    return header ? std::string(image + header->off_root, header->root_len) : std::string();
+}
+
+std::time_t TreeSnapshot::taken_at() const {
+    return header ? header->taken_at : 0;
+}
+
+uint64_t TreeSnapshot::size() const {
+    return header ? header->count : 0;
+}
+
+bool TreeSnapshot::capture(const std::string& root_path, std::string& error, uint64_t* errors) {
+    release();
+    std::string base = root_path;
+    while(base.size() > 1 && base.back() == '/') {
+        base.pop_back();
+    }
+    struct stat root_st;
+    if(stat(base.c_str(), &root_st) != 0) {
+        error = "cannot read " + base + ": " + strerror(errno);
+        return false;
+    }
+    if(!S_ISDIR(root_st.st_mode)) {
+        error = base + " is not a directory";
+        return false;
+    }
+    const size_t skip = base == "/" ? 1 : base.size() + 1;
+
+    TreeWalker walker;
+    std::vector<std::vector<Record>> listed(walker.thread_count());
+    std::atomic<uint64_t> stat_errors(0);
+    walker.on_entry([&](const WalkEntry& entry) {
+        struct stat st;
+        Telemetry::add(Counter::MetadataCalls);
+        if(fstatat(entry.dirfd, entry.name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            ++stat_errors;
+            return entry.is_directory();
+        }
+        std::string path = entry.path();
+        path.erase(0, skip);
+        listed[entry.worker].push_back({std::move(path), static_cast<uint64_t>(st.st_size),
+                                        int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec,
+                                        st.st_dev, st.st_ino, static_cast<uint32_t>(st.st_mode & 07777), entry.type});
+        return true;
+    });
+    walker.walk(base);
+    if(errors) {
+        *errors = walker.errors() + stat_errors;
+    }
+
+    std::vector<Record> records;
+    for(auto& part : listed) {
+        std::move(part.begin(), part.end(), std::back_inserter(records));
+        std::vector<Record>().swap(part);
+    }
+    std::sort(records.begin(), records.end(), [](const Record& a, const Record& b) { return a.path < b.path; });
+
+    // Front coding: each name keeps only what differs from the one before.
+    std::vector<uint16_t> out_prefixes(records.size());
+    std::vector<uint32_t> out_offsets(records.size() + 1);
+    std::string blob;
+    for(size_t i = 0; i < records.size(); ++i) {
+        const std::string& path = records[i].path;
+        size_t shared = 0;
+        if(i > 0) {
+            const std::string& previous = records[i - 1].path;
+            size_t limit = std::min<size_t>({previous.size(), path.size(), UINT16_MAX});
+            while(shared < limit && previous[shared] == path[shared]) {
+                ++shared;
+            }
+        }
+        out_prefixes[i] = static_cast<uint16_t>(shared);
+        out_offsets[i] = static_cast<uint32_t>(blob.size());
+        blob.append(path, shared, std::string::npos);
+        if(blob.size() > UINT32_MAX) {
+            error = "tree too large for a snapshot";
+            return false;
+        }
+    }
+    out_offsets[records.size()] = static_cast<uint32_t>(blob.size());
+
+    const uint64_t count = records.size();
+    Header out{};
+    memcpy(out.magic, kMagic, sizeof(kMagic));
+    out.version = kVersion;
+    out.taken_at = std::time(nullptr);
+    out.root_len = base.size();
+    out.count = count;
+    out.name_bytes = blob.size();
+    out.off_root = sizeof(Header);
+    out.off_sizes = align8(out.off_root + out.root_len);
+    out.off_mtimes = out.off_sizes + count * sizeof(uint64_t);
+    out.off_devs = out.off_mtimes + count * sizeof(int64_t);
+    out.off_inodes = out.off_devs + count * sizeof(uint64_t);
+    out.off_name_offsets = out.off_inodes + count * sizeof(uint64_t);
+    out.off_modes = out.off_name_offsets + (count + 1) * sizeof(uint32_t);
+    out.off_prefixes = out.off_modes + count * sizeof(uint32_t);
+    out.off_types = out.off_prefixes + count * sizeof(uint16_t);
+    out.off_blob = out.off_types + count;
+    out.file_size = out.off_blob + blob.size();
+
+    owned.assign(out.file_size, 0);
+    char* data = owned.data();
+    memcpy(data, &out, sizeof(out));
+    memcpy(data + out.off_root, base.data(), base.size());
+    for(uint64_t i = 0; i < count; ++i) {
+        const Record& record = records[i];
+        memcpy(data + out.off_sizes + i * sizeof(uint64_t), &record.size, sizeof(uint64_t));
+        memcpy(data + out.off_mtimes + i * sizeof(int64_t), &record.mtime, sizeof(int64_t));
+        memcpy(data + out.off_devs + i * sizeof(uint64_t), &record.dev, sizeof(uint64_t));
+        memcpy(data + out.off_inodes + i * sizeof(uint64_t), &record.ino, sizeof(uint64_t));
+        memcpy(data + out.off_modes + i * sizeof(uint32_t), &record.mode, sizeof(uint32_t));
+        data[out.off_types + i] = static_cast<char>(record.type);
+    }
+    memcpy(data + out.off_name_offsets, out_offsets.data(), out_offsets.size() * sizeof(uint32_t));
+    memcpy(data + out.off_prefixes, out_prefixes.data(), out_prefixes.size() * sizeof(uint16_t));
+    memcpy(data + out.off_blob, blob.data(), blob.size());
+
+    if(!attach(owned.data(), owned.size(), error)) {
+        std::vector<char>().swap(owned);
+        return false;
+    }
+    return true;
+}
+
+bool TreeSnapshot::save(const std::string& file, std::string& error) const {
+    if(!image) {
+        error = "no snapshot to save";
+        return false;
+    }
+    std::string temp = file + ".tmp";
+    {
+        std::ofstream stream(temp, std::ios::binary | std::ios::trunc);
+        if(!stream) {
+            error = "cannot write " + temp + ": " + strerror(errno);
+            return false;
+        }
+        stream.write(image, image_size);
+        if(!stream.flush()) {
+            error = "failed writing " + temp;
+            unlink(temp.c_str());
+            return false;
+        }
+    }
+    if(rename(temp.c_str(), file.c_str()) != 0) {
+        error = "cannot replace " + file + ": " + strerror(errno);
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool TreeSnapshot::load(const std::string& file, std::string& error) {
+    release();
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        error = "cannot open " + file + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+        close(fd);
+        error = file + " is not a tree snapshot";
+        return false;
+    }
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        error = "cannot map " + file + ": " + strerror(errno);
+        return false;
+    }
+    if(!attach(static_cast<const char*>(base), st.st_size, error)) {
+        munmap(base, st.st_size);
+        error = file + " " + error;
+        return false;
+    }
+    map_base = base;
+    map_size = st.st_size;
+    return true;
+}
+
+bool TreeSnapshot::attach(const char* data, size_t size, std::string& error) {
+    const Header* h = reinterpret_cast<const Header*>(data);
+    const uint64_t n = h->count;
+    bool valid = memcmp(h->magic, kMagic, sizeof(kMagic)) == 0 && h->version == kVersion &&
+        h->file_size == size && n < size &&
+        h->off_root + h->root_len <= size &&
+        h->off_sizes % 8 == 0 &&
+        h->off_mtimes == h->off_sizes + n * sizeof(uint64_t) &&
+        h->off_devs == h->off_mtimes + n * sizeof(int64_t) &&
+        h->off_inodes == h->off_devs + n * sizeof(uint64_t) &&
+        h->off_name_offsets == h->off_inodes + n * sizeof(uint64_t) &&
+        h->off_modes == h->off_name_offsets + (n + 1) * sizeof(uint32_t) &&
+        h->off_prefixes == h->off_modes + n * sizeof(uint32_t) &&
+        h->off_types == h->off_prefixes + n * sizeof(uint16_t) &&
+        h->off_blob == h->off_types + n &&
+        h->off_blob + h->name_bytes <= size;
+    if(!valid) {
+        error = "is corrupt or from another version";
+        return false;
+    }
+    image = data;
+    image_size = size;
+    header = h;
+    sizes = reinterpret_cast<const uint64_t*>(data + h->off_sizes);
+    mtimes = reinterpret_cast<const int64_t*>(data + h->off_mtimes);
+    devs = reinterpret_cast<const uint64_t*>(data + h->off_devs);
+    inodes = reinterpret_cast<const uint64_t*>(data + h->off_inodes);
+    name_offsets = reinterpret_cast<const uint32_t*>(data + h->off_name_offsets);
+    modes = reinterpret_cast<const uint32_t*>(data + h->off_modes);
+    prefixes = reinterpret_cast<const uint16_t*>(data + h->off_prefixes);
+    types = reinterpret_cast<const unsigned char*>(data + h->off_types);
+    name_blob = data + h->off_blob;
+    return true;
+}
+
+bool TreeSnapshot::Cursor::next() {
+    if(next_index >= snapshot.size()) {
+        return false;
+    }
+    uint64_t i = next_index++;
+    // Offsets are not validated at load, so a damaged file yields wrong
+    // names rather than reads outside the mapping.
+    uint64_t limit = snapshot.header->name_bytes;
+    uint64_t end = std::min<uint64_t>(snapshot.name_offsets[i + 1], limit);
+    uint64_t start = std::min<uint64_t>(snapshot.name_offsets[i], end);
+    current.resize(std::min<size_t>(snapshot.prefixes[i], current.size()));
+    current.append(snapshot.name_blob + start, end - start);
+    return true;
+}
+
+void TreeSnapshot::diff(const TreeSnapshot& before, const TreeSnapshot& after, std::vector<Change>& changes) {
+    auto compare = [&](uint64_t i, uint64_t j) {
+        uint32_t what = 0;
+        if(before.type(i) != after.type(j)) {
+            return uint32_t(Change::Type);
+        }
+        if(before.type(i) != DT_DIR) {
+            if(before.file_size(i) != after.file_size(j)) {
+                what |= Change::Size;
+            }
+            if(before.mtime_ns(i) != after.mtime_ns(j)) {
+                what |= Change::Mtime;
+            }
+        }
+        if(before.mode(i) != after.mode(j)) {
+            what |= Change::Mode;
+        }
+        return what;
+    };
+
+    struct Side {
+        std::string path;
+        uint64_t index;
+        bool matched;
+    };
+    std::vector<Side> removed;
+    std::vector<Side> added;
+    std::vector<Change> modified;
+
+    Cursor a(before);
+    Cursor b(after);
+    bool has_a = a.next();
+    bool has_b = b.next();
+    while(has_a || has_b) {
+        int order = !has_a ? 1 : !has_b ? -1 : a.path().compare(b.path());
+        if(order == 0) {
+            uint32_t what = compare(a.index(), b.index());
+            if(before.device(a.index()) != after.device(b.index()) ||
+               before.inode(a.index()) != after.inode(b.index())) {
+                what |= Change::Replaced;
+            }
+            if(what) {
+                modified.push_back({Change::Modified, a.path(), std::string(), what});
+            }
+            has_a = a.next();
+            has_b = b.next();
+        } else if(order < 0) {
+            removed.push_back({a.path(), a.index(), false});
+            has_a = a.next();
+        } else {
+            added.push_back({b.path(), b.index(), false});
+            has_b = b.next();
+        }
+    }
+
+    // Moves: the same file left one path and appeared at another. A freed
+    // inode is soon reused, so a pair whose size or mtime differs is taken
+    // for a removal and an addition rather than a move.
+    std::unordered_map<FileId, size_t, FileIdHash> by_inode;
+    by_inode.reserve(removed.size());
+    for(size_t k = 0; k < removed.size(); ++k) {
+        by_inode.emplace(FileId{before.device(removed[k].index), before.inode(removed[k].index)}, k);
+    }
+    std::vector<Change> moved;
+    std::unordered_map<std::string_view, std::string_view> moved_dirs;
+    for(auto& entry : added) {
+        auto found = by_inode.find(FileId{after.device(entry.index), after.inode(entry.index)});
+        if(found == by_inode.end()) {
+            continue;
+        }
+        Side& origin = removed[found->second];
+        if(origin.matched || before.type(origin.index) != after.type(entry.index)) {
+            continue;
+        }
+        uint32_t what = compare(origin.index, entry.index);
+        if(what & (Change::Size | Change::Mtime)) {
+            continue;
+        }
+        origin.matched = true;
+        entry.matched = true;
+        // Added is in path order, so a moved parent has been seen already.
+        std::string_view from = origin.path;
+        std::string_view to = entry.path;
+        auto parent = moved_dirs.find(parent_of(from));
+        bool carried = parent != moved_dirs.end() && parent->second == parent_of(to) && name_of(from) == name_of(to);
+        if(after.type(entry.index) == DT_DIR) {
+            moved_dirs.emplace(from, to);
+        }
+        if(!carried || what) {
+            moved.push_back({Change::Moved, entry.path, origin.path, what});
+        }
+    }
+
+    changes.clear();
+    changes.reserve(modified.size() + removed.size() + added.size());
+    for(auto& change : modified) {
+        changes.push_back(std::move(change));
+    }
+    for(const auto& entry : removed) {
+        if(!entry.matched) {
+            changes.push_back({Change::Removed, entry.path, std::string(), 0});
+        }
+    }
+    for(const auto& entry : added) {
+        if(!entry.matched) {
+            changes.push_back({Change::Added, entry.path, std::string(), 0});
+        }
+    }
+    for(auto& change : moved) {
+        changes.push_back(std::move(change));
+    }
+    std::stable_sort(changes.begin(), changes.end(), [](const Change& x, const Change& y) {
+        return x.path < y.path;
+    });
+}
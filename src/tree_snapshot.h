@@ -0,0 +1,97 @@
+#ifndef TREE_SNAPSHOT_H
+#define TREE_SNAPSHOT_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+
+// A point-in-time record of every entry under a root, for diffing. Entries
+// are sorted by path relative to the root; each path is stored as the
+// length it shares with the previous one plus the remaining bytes, and
+// type, size, mtime, mode, device and inode are fixed-width columns. The same image
+// is held in memory after capture() and read straight through mmap after
+// load(), so loading costs no parsing.
+class TreeSnapshot {
+public:
+    TreeSnapshot();
+    ~TreeSnapshot();
+    TreeSnapshot(const TreeSnapshot&) = delete;
+    TreeSnapshot& operator=(const TreeSnapshot&) = delete;
+
+    // Walks root in parallel. Unreadable directories are counted in errors
+    // and left out, as if empty.
+    bool capture(const std::string& root, std::string& error, uint64_t* errors = nullptr);
+    bool save(const std::string& file, std::string& error) const;
+    bool load(const std::string& file, std::string& error);
+
+    bool loaded() const { return image != nullptr; }
+    std::string root() const;
+    std::time_t taken_at() const;
+    uint64_t size() const;
+    uint64_t bytes() const { return image_size; }
+
+    // Column access by entry index.
+    unsigned char type(uint64_t i) const { return types[i]; }      // DT_* value
+    uint64_t file_size(uint64_t i) const { return sizes[i]; }
+    int64_t mtime_ns(uint64_t i) const { return mtimes[i]; }
+    uint32_t mode(uint64_t i) const { return modes[i]; }
+    uint64_t device(uint64_t i) const { return devs[i]; }
+    uint64_t inode(uint64_t i) const { return inodes[i]; }
+
+    // Visits entries in order, rebuilding each path from the shared prefix.
+    class Cursor {
+    public:
+        explicit Cursor(const TreeSnapshot& snapshot) : snapshot(snapshot), next_index(0) {}
+        bool next();
+        uint64_t index() const { return next_index - 1; }
+        const std::string& path() const { return current; }
+
+    private:
+        const TreeSnapshot& snapshot;
+        uint64_t next_index;
+        std::string current;
+    };
+
+    struct Change {
+        enum Kind { Added, Removed, Modified, Moved };
+        enum What : uint32_t { Type = 1, Size = 2, Mtime = 4, Mode = 8, Replaced = 16 };
+        Kind kind;
+        std::string path;
+        std::string from;       // moves only
+        uint32_t what;          // Modified and Moved: which columns differ
+    };
+
+    // Merge-joins the two sorted entry lists. An entry removed from one path
+    // and added at another with the same device, inode and type, and for
+    // files the same size and mtime, is a move; entries below a moved
+    // directory that moved with it are not listed again.
+    // Directory size and mtime changes are not reported; they only echo the
+    // changes below them. Changes come out in path order.
+    static void diff(const TreeSnapshot& before, const TreeSnapshot& after, std::vector<Change>& changes);
+
+private:
+    struct Header;
+
+    std::vector<char> owned;    // image built by capture()
+    void* map_base;
+    size_t map_size;
+    const char* image;
+    size_t image_size;
+    const Header* header;
+    const uint64_t* sizes;
+    const int64_t* mtimes;
+    const uint64_t* devs;
+    const uint64_t* inodes;
+    const uint32_t* name_offsets;
+    const uint32_t* modes;
+    const uint16_t* prefixes;
+    const unsigned char* types;
+    const char* name_blob;
+
+    void release();
+    bool attach(const char* data, size_t size, std::string& error);
+};
+
+#endif
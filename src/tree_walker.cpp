@@ -0,0 +1,273 @@
+#include "tree_walker.h"
+#include "telemetry.h"
+
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+namespace {
+
+// Layout of the records returned by getdents64.
+struct RawDirent {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+std::string join_path(const std::string& dir, const char* name, size_t name_len) {
+    std::string result;
+    result.reserve(dir.size() + 1 + name_len);
+    result = dir;
+    if(result.empty() || result.back() != '/') {
+        result += '/';
+    }
+    result.append(name, name_len);
+    return result;
+}
+
+}
+
+DirReader::DirReader(int dirfd, std::vector<char>* buffer)
+    : dirfd(dirfd), buffer(buffer), pos(0), end(0), last_error(0), returned(0) {
+    if(!this->buffer) {
+        own_buffer.resize(kBatchBytes);
+        this->buffer = &own_buffer;
+    }
+}
+
+DirReader::~DirReader() {
+    Telemetry::add(Counter::Entries, returned);
+    if(dirfd >= 0) {
+        close(dirfd);
+    }
+}
+
+int DirReader::open_dir(const char* path, bool follow) {
+    return open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | (follow ? 0 : O_NOFOLLOW));
+}
+
+int DirReader::open_dir_at(int parent_fd, const char* name) {
+    return openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+}
+
+bool DirReader::refill() {
+    // Entries are counted per batch, not per call to next().
+    Telemetry::add(Counter::Entries, returned);
+    Telemetry::add(Counter::DirReads);
+    returned = 0;
+    long n = syscall(SYS_getdents64, dirfd, buffer->data(), buffer->size());
+    if(n < 0) {
+        last_error = errno;
+        return false;
+    }
+    pos = 0;
+    end = static_cast<size_t>(n);
+    return n > 0;
+}
+
+bool DirReader::next(Entry& entry) {
+    while(true) {
+        if(pos >= end && !refill()) {
+            return false;
+        }
+
+        const RawDirent* raw = reinterpret_cast<const RawDirent*>(buffer->data() + pos);
+        pos += raw->d_reclen;
+
+        const char* name = raw->d_name;
+        if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        ++returned;
+        entry.name = name;
+        entry.name_len = strlen(name);
+        entry.ino = raw->d_ino;
+        entry.type = raw->d_type;
+        if(entry.type == DT_UNKNOWN) {
+            Telemetry::add(Counter::MetadataCalls);
+            struct stat st;
+            if(fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+                entry.type = IFTODT(st.st_mode);
+            }
+        }
+        return true;
+    }
+}
+
+std::string WalkEntry::path() const {
+    return join_path(*dir_path, name, name_len);
+}
+
+TreeWalker::TreeWalker(unsigned threads)
+    : threads(threads ? threads : default_threads()), strict(false), root_dev(0), outstanding(0), stopped(false),
+      dir_count(0), entry_count(0), error_count(0) {
+}
+
+unsigned TreeWalker::default_threads() {
+    unsigned hw = std::thread::hardware_concurrency();
+    return hw ? hw : 1;
+}
+
+void TreeWalker::walk(const std::string& root) {
+    stopped = false;
+    dir_count = 0;
+    entry_count = 0;
+    error_count = 0;
+    queues.reset(new WorkQueue[threads]);
+
+    DirJob* root_job = new DirJob{root, nullptr, {1}, 0, false};
+    outstanding = 1;
+    queues[0].jobs.push_back(root_job);
+
+    std::vector<std::thread> workers;
+    for(unsigned i = 1; i < threads; ++i) {
+        workers.emplace_back(&TreeWalker::worker_loop, this, i);
+    }
+    worker_loop(0);
+    for(auto& worker : workers) {
+        worker.join();
+    }
+    queues.reset();
+}
+
+void TreeWalker::worker_loop(unsigned worker) {
+    std::vector<char> buffer(DirReader::kBatchBytes);
+
+    while(true) {
+        DirJob* job = take_job(worker);
+        if(job) {
+            process(worker, job, buffer);
+            if(outstanding.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(idle_mutex);
+                idle_cv.notify_all();
+            }
+            continue;
+        }
+
+        if(outstanding.load() == 0) {
+            break;
+        }
+
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        idle_cv.wait_for(lock, std::chrono::milliseconds(1));
+    }
+}
+
+TreeWalker::DirJob* TreeWalker::take_job(unsigned worker) {
+    {
+        WorkQueue& own = queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.jobs.empty()) {
+            DirJob* job = own.jobs.back();
+            own.jobs.pop_back();
+            return job;
+        }
+    }
+
+    for(unsigned i = 1; i < threads; ++i) {
+        WorkQueue& victim = queues[(worker + i) % threads];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.jobs.empty()) {
+            DirJob* job = victim.jobs.front();
+            victim.jobs.pop_front();
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void TreeWalker::push_job(unsigned worker, DirJob* job) {
+    {
+        WorkQueue& own = queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.jobs.push_back(job);
+    }
+    if(threads > 1) {
+        idle_cv.notify_one();
+    }
+}
+
+void TreeWalker::process(unsigned worker, DirJob* job, std::vector<char>& buffer) {
+    TraceSpan span("walk_dir");
+    if(stopped) {
+        release(worker, job);
+        return;
+    }
+
+    // The root may be a symlink to a directory; everything below it is
+    // opened with O_NOFOLLOW so the walk never leaves the tree.
+    int fd = DirReader::open_dir(job->path.c_str(), job->parent == nullptr);
+    if(fd < 0) {
+        int err = errno;
+        ++error_count;
+        if(error_callback) {
+            error_callback(job->path, err);
+        }
+        release(worker, job);
+        return;
+    }
+
+    DirReader reader(fd, &buffer);
+    if(strict) {
+        struct stat st;
+        bool changed = fstat(fd, &st) != 0;
+        if(!changed && !job->parent) {
+            root_dev = st.st_dev;
+        } else if(!changed) {
+            changed = st.st_ino != job->ino || st.st_dev != root_dev;
+        }
+        if(changed) {
+            ++error_count;
+            if(error_callback) {
+                error_callback(job->path, EXDEV);
+            }
+            release(worker, job);
+            return;
+        }
+    }
+    ++dir_count;
+    job->entered = true;
+
+    DirReader::Entry entry;
+    uint64_t seen = 0;
+    while(!stopped && reader.next(entry)) {
+        ++seen;
+        WalkEntry walk_entry{&job->path, entry.name, entry.name_len, entry.type, entry.ino, fd, worker};
+        bool descend = entry_callback ? entry_callback(walk_entry) : true;
+
+        if(entry.type == DT_DIR && descend) {
+            DirJob* child = new DirJob{join_path(job->path, entry.name, entry.name_len), job, {1}, entry.ino, false};
+            job->pending.fetch_add(1);
+            outstanding.fetch_add(1);
+            push_job(worker, child);
+        }
+    }
+    entry_count += seen;
+
+    if(reader.error()) {
+        ++error_count;
+        if(error_callback) {
+            error_callback(job->path, reader.error());
+        }
+    }
+
+    release(worker, job);
+}
+
+void TreeWalker::release(unsigned worker, DirJob* job) {
+    while(job && job->pending.fetch_sub(1) == 1) {
+        if(leave_callback && job->entered && !stopped) {
+            leave_callback(job->path, worker);
+        }
+        DirJob* parent = job->parent;
+        delete job;
+        job = parent;
+    }
+}
@@ -0,0 +1,142 @@
+#ifndef TREE_WALKER_H
+#define TREE_WALKER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <condition_variable>
+#include <cstdint>
+#include <dirent.h>
+
+// Reads a directory in large getdents64 batches. The file type comes from
+// d_type; DT_UNKNOWN is resolved with a single fstatat relative to the dirfd.
+class DirReader {
+public:
+    struct Entry {
+        const char* name;
+        size_t name_len;
+        unsigned char type;
+        uint64_t ino;
+    };
+
+    static const size_t kBatchBytes = 256 * 1024;
+
+    // Takes ownership of dirfd. If buffer is null the reader allocates its own.
+    explicit DirReader(int dirfd, std::vector<char>* buffer = nullptr);
+    ~DirReader();
+    DirReader(const DirReader&) = delete;
+    DirReader& operator=(const DirReader&) = delete;
+
+    // Opens a directory; unless follow is set, a symlink in the last
+    // component is refused.
+    static int open_dir(const char* path, bool follow = false);
+    static int open_dir_at(int parent_fd, const char* name);
+
+    bool next(Entry& entry);
+    // True once every entry of the last getdents64 batch has been returned.
+    bool batch_done() const { return pos >= end; }
+    int fd() const { return dirfd; }
+    int error() const { return last_error; }
+
+private:
+    int dirfd;
+    std::vector<char> own_buffer;
+    std::vector<char>* buffer;
+    size_t pos;
+    size_t end;
+    int last_error;
+    uint64_t returned;      // entries not yet added to telemetry
+
+    bool refill();
+};
+
+// One directory entry handed to TreeWalker callbacks. dir_path and name are
+// only valid for the duration of the callback.
+struct WalkEntry {
+    const std::string* dir_path;
+    const char* name;
+    size_t name_len;
+    unsigned char type;
+    uint64_t ino;
+    int dirfd;
+    unsigned worker;
+
+    bool is_directory() const { return type == DT_DIR; }
+    std::string path() const;
+};
+
+// Parallel tree walker. Directory jobs live on per-worker deques; a worker
+// pops its own jobs LIFO and steals from the front of the others when idle.
+// Callbacks run concurrently on the worker threads.
+class TreeWalker {
+public:
+    // Return false for a directory entry to skip descending into it.
+    using EntryCallback = std::function<bool(const WalkEntry&)>;
+    // Called once a directory and everything below it has been walked. Not
+    // called for directories that could not be opened.
+    using LeaveCallback = std::function<void(const std::string& dir_path, unsigned worker)>;
+    using ErrorCallback = std::function<void(const std::string& path, int err)>;
+
+    explicit TreeWalker(unsigned threads = 0);
+
+    void on_entry(EntryCallback callback) { entry_callback = std::move(callback); }
+    void on_leave(LeaveCallback callback) { leave_callback = std::move(callback); }
+    void on_error(ErrorCallback callback) { error_callback = std::move(callback); }
+    // Refuse to enter a directory whose inode or device differs from what its
+    // parent listed, i.e. one swapped for a symlink mid-walk or a mount point.
+    void set_strict(bool strict) { this->strict = strict; }
+
+    // Walks everything below root. The root itself is not reported.
+    void walk(const std::string& root);
+    void stop() { stopped = true; }
+
+    unsigned thread_count() const { return threads; }
+    uint64_t directories() const { return dir_count; }
+    uint64_t entries() const { return entry_count; }
+    uint64_t errors() const { return error_count; }
+
+    static unsigned default_threads();
+
+private:
+    struct DirJob {
+        std::string path;
+        DirJob* parent;
+        std::atomic<uint32_t> pending;
+        uint64_t ino;
+        bool entered;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<DirJob*> jobs;
+    };
+
+    unsigned threads;
+    EntryCallback entry_callback;
+    LeaveCallback leave_callback;
+    ErrorCallback error_callback;
+    bool strict;
+    uint64_t root_dev;
+
+    std::unique_ptr<WorkQueue[]> queues;
+    std::atomic<uint64_t> outstanding;
+    std::atomic<bool> stopped;
+    std::atomic<uint64_t> dir_count;
+    std::atomic<uint64_t> entry_count;
+    std::atomic<uint64_t> error_count;
+    std::mutex idle_mutex;
+    std::condition_variable idle_cv;
+
+    void worker_loop(unsigned worker);
+    DirJob* take_job(unsigned worker);
+    void push_job(unsigned worker, DirJob* job);
+    void process(unsigned worker, DirJob* job, std::vector<char>& buffer);
+    void release(unsigned worker, DirJob* job);
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "visit_history.h"
+#include "name_index.h"
+
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <unistd.h>
+
+VisitHistory::VisitHistory(const std::string& file) : file(file) {
+}
+
+std::string VisitHistory::default_file() {
+    return NameIndex::cache_dir() + "/history";
+}
+
+void VisitHistory::load() {
+    entries.clear();
+    std::ifstream in(file);
+    std::string line;
+    while(std::getline(in, line)) {
+        size_t first = line.find('\t');
+        size_t second = first == std::string::npos ? first : line.find('\t', first + 1);
+        if(second == std::string::npos || second + 1 >= line.size()) {
+            continue;
+        }
+        Visit visit;
+        visit.count = static_cast<uint32_t>(std::strtoul(line.c_str(), nullptr, 10));
+        visit.last = std::strtoll(line.c_str() + first + 1, nullptr, 10);
+        if(visit.count > 0) {
+            entries[line.substr(second + 1)] = visit;
+        }
+    }
+}
+
+double VisitHistory::frecency(const Visit& visit, int64_t now) {
+    int64_t age = now - visit.last;
+    double weight = age < 3600 ? 4 : age < 86400 ? 2 : age < 7 * 86400 ? 0.5 : 0.25;
+    return visit.count * weight;
+}
+
+std::vector<std::string> VisitHistory::ranked(int64_t now) const {
+    std::vector<std::pair<double, const std::string*>> order;
+    order.reserve(entries.size());
+    for(const auto& entry : entries) {
+        order.emplace_back(frecency(entry.second, now), &entry.first);
+    }
+    std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) {
+        return a.first != b.first ? a.first > b.first : *a.second < *b.second;
+    });
+    std::vector<std::string> paths;
+    paths.reserve(order.size());
+    for(const auto& item : order) {
+        paths.push_back(*item.second);
+    }
+    return paths;
+}
+
+bool VisitHistory::record(const std::string& path, int64_t now) {
+    Visit& visit = entries[path];
+    ++visit.count;
+    visit.last = now;
+    if(entries.size() > kMaxEntries) {
+        std::vector<std::string> keep = ranked(now);
+        for(size_t i = kMaxEntries; i < keep.size(); ++i) {
+            entries.erase(keep[i]);
+        }
+    }
+    return save();
+}
+
+bool VisitHistory::save() {
+    size_t slash = file.rfind('/');
+    if(slash != std::string::npos && slash > 0) {
+        std::string dir = file.substr(0, slash);
+        for(size_t p = 1; p <= dir.size(); ++p) {
+            if(p == dir.size() || dir[p] == '/') {
+                mkdir(dir.substr(0, p).c_str(), 0755);
+            }
+        }
+    }
+    // Written aside and renamed, so two explorers never leave a torn file.
+    std::string temp = file + "." + std::to_string(getpid()) + ".tmp";
+    {
+        std::ofstream out(temp, std::ios::trunc);
+        for(const auto& entry : entries) {
+            if(entry.first.find('\n') == std::string::npos) {
+                out << entry.second.count << '\t' << entry.second.last << '\t' << entry.first << '\n';
+            }
+        }
+        if(!out) {
+            std::remove(temp.c_str());
+            return false;
+        }
+    }
+    return std::rename(temp.c_str(), file.c_str()) == 0;
+}
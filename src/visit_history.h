@@ -0,0 +1,44 @@
+#ifndef VISIT_HISTORY_H
+#define VISIT_HISTORY_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+// Directories entered from the menu, with how often and when last, so fuzzy
+// jumps can rank by frecency. Kept as a small text file in the cache
+// directory ("count<TAB>last<TAB>path" per line) and rewritten on each visit.
+class VisitHistory {
+public:
+    struct Visit {
+        uint32_t count = 0;
+        int64_t last = 0;       // seconds since the epoch
+    };
+
+    static const size_t kMaxEntries = 1000;     // the least frecent go first
+
+    explicit VisitHistory(const std::string& file = default_file());
+
+    static std::string default_file();
+
+    void load();
+    // Counts a visit and saves; false if the file could not be written.
+    bool record(const std::string& path, int64_t now);
+
+    // Visits weighted by how recent the last one was: x4 within the hour,
+    // x2 within the day, x0.5 within the week and x0.25 after that.
+    static double frecency(const Visit& visit, int64_t now);
+
+    const std::unordered_map<std::string, Visit>& visits() const { return entries; }
+    // Paths best first.
+    std::vector<std::string> ranked(int64_t now) const;
+
+private:
+    std::string file;
+    std::unordered_map<std::string, Visit> entries;
+
+    bool save();
+};
+
+#endif